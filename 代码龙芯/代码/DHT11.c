@@ -1,117 +1,287 @@
 #include <ioCC2530.h>
 #include "OnBoard.h"
+#include "OSAL_PwrMgr.h"
+#include "hal_mcu.h"
+#include "dht11.h"
+
+/*
+ * DHT11 单总线驱动，数据线 P0_7。
+ *
+ * 不再忙等：起始信号的20ms低电平和读数超时都用定时器1通道0比较中断计时，
+ * 应答和40位数据用定时器1通道3(备用位置2，正好是P0_7)捕获下降沿。
+ * 相邻下降沿的间隔就是一位的长度：50us低 + 26~28us高为0，+ 70us高为1。
+ * 中断里按沿解码，整帧结束后用 osal_set_event 通知应用任务，
+ * 读一次CPU只被占用约42次很短的中断。
+ *
+ * 结果放在一个 DHT11_Reading_t 里，应用用 DHT11_Read 取一份拷贝。
+ *
+ * 定时器1只给本驱动用，32MHz/32 自由计数，1us一拍，读完就停。
+ * PM2下定时器1不走，低功耗终端(POWER_SAVING)读数期间向电源管理要求保持唤醒，
+ * 读完再放开，其余时间照常睡。
+ */
 
 typedef unsigned char uchar;
-typedef unsigned int  uint;
 
 #define DATA_PIN P0_7
 #define DATA_PIN_INPUT  (P0DIR &= ~0x80)
 #define DATA_PIN_OUTPUT (P0DIR |= 0x80)
+#define DATA_PIN_GPIO   (P0SEL &= ~0x80)
+#define DATA_PIN_PERIPH (P0SEL |= 0x80)
+
+//定时器1：32分频，自由计数
+#define DHT11_T1CTL_RUN         0x09
+
+//时序，单位us
+#define DHT11_START_US          20000   //起始信号低电平 >18ms
+#define DHT11_READ_US           8000    //整帧约4.3ms，超时就是没应答或丢了沿
+#define DHT11_RESPONSE_MIN_US   120     //应答 80us低 + 80us高
+#define DHT11_RESPONSE_MAX_US   200
+#define DHT11_BIT_MIN_US        60
+#define DHT11_BIT_ONE_US        100     //0约77us，1约120us
+#define DHT11_BIT_MAX_US        160
+
+//应答的两个下降沿 + 每位一个
+#define DHT11_EDGES             42
 
+//T1CCnCTL
+#define T1CCTL_IM               0x40
+#define T1CCTL_COMPARE          0x04
+#define T1CCTL_CAP_FALLING      0x02
 
+//T1STAT
+#define T1STAT_CH0IF            0x01
+#define T1STAT_CH3IF            0x08
+#define T1STAT_OVFIF            0x20
 
-void Delay_us(void);
-void Delay_10us(void);
-void Delay_ms(uint Time);
-void COM(void);
-void DHT11(void);
+#define TIMIF_T1OVFIM           0x40
+#define IEN1_T1IE               0x02
+#define PERCFG_T1CFG            0x40
 
-//温湿度定义
-uchar ucharFLAG,uchartemp;
-uchar shidu,wendu;
-uchar ucharT_data_H,ucharT_data_L,ucharRH_data_H,ucharRH_data_L,ucharcheckdata;
-uchar ucharT_data_H_temp,ucharT_data_L_temp,ucharRH_data_H_temp,ucharRH_data_L_temp,ucharcheckdata_temp;
-uchar ucharcomdata;
+//驱动状态
+#define DHT11_IDLE              0
+#define DHT11_START             1
+#define DHT11_READ              2
 
-//延时函数
-void Delay_us(void) //1 us延时
+//最近一次读数，只在中断里写
+static DHT11_Reading_t dht11Reading;
+static uchar dht11Status;
+static uint32 dht11StartTime;
+
+static uchar dht11State;
+static uchar dht11TaskId;
+static uint16 dht11Event;
+static uchar dht11Edges;
+static uint16 dht11LastEdge;
+static uchar dht11Data[5];
+
+//通道0在 at 时刻比较中断
+static void DHT11_CompareAt(uint16 at)
 {
-    MicroWait(1);   
+    T1CC0L = LO_UINT16(at);
+    T1CC0H = HI_UINT16(at);
+    T1CC0CTL = T1CCTL_IM | T1CCTL_COMPARE;
 }
 
-void Delay_10us(void) //10 us延时
+static uint16 DHT11_Now(void)
 {
-   MicroWait(10);
+    uint16 now = T1CNTL;   //先读低字节，高字节被锁存
+
+    return now | ((uint16)T1CNTH << 8);
 }
 
-void Delay_ms(uint Time)//n ms延时
+//停定时器，数据线回到输出高，通知应用
+static void DHT11_Finish(uchar status)
 {
-  unsigned char i;
-  while(Time--)
-  {
-    for(i=0;i<100;i++)
-     Delay_10us();
-  }
+    T1CC3CTL = 0;
+    T1CC0CTL = 0;
+    T1CTL = 0;
+    IEN1 &= ~IEN1_T1IE;
+
+    DATA_PIN_GPIO;
+    DATA_PIN = 1;
+    DATA_PIN_OUTPUT; //输出
+
+    if (status == DHT11_OK)
+    {
+        uchar sum = dht11Data[0] + dht11Data[1] + dht11Data[2] + dht11Data[3];
+
+        if (sum == dht11Data[4])
+        {
+            //湿度整数.小数，温度整数.小数，温度小数的最高位是负号
+            dht11Reading.humidity = dht11Data[0] * 10 + dht11Data[1] % 10;
+            dht11Reading.temperature = dht11Data[2] * 10 + (dht11Data[3] & 0x0F) % 10;
+            if (dht11Data[3] & 0x80)
+            {
+                dht11Reading.temperature = -dht11Reading.temperature;
+            }
+        }
+        else
+        {
+            status = DHT11_ERR_CHECKSUM;
+        }
+    }
+
+    //失败时温湿度不动，由 valid 标出
+    dht11Reading.time = dht11StartTime;
+    dht11Reading.seq++;
+    dht11Reading.valid = (status == DHT11_OK);
+    dht11Status = status;
+    dht11State = DHT11_IDLE;
+    osal_pwrmgr_task_state(dht11TaskId, PWRMGR_CONSERVE);
+    osal_set_event(dht11TaskId, dht11Event);
 }
 
-//温湿度传感
-void COM(void)    // 温湿写入
-{     
-    uchar i;         
-    for(i=0;i<8;i++)    
+//通道0比较：起始信号结束，或者读数超时
+static void DHT11_Timeout(void)
+{
+    if (dht11State == DHT11_START)
     {
-        ucharFLAG=2; 
-        while((!DATA_PIN)&&ucharFLAG++);
-        Delay_10us();
-        Delay_10us();
-        Delay_10us();
-        uchartemp=0;
-        if(DATA_PIN)uchartemp=1;
-        ucharFLAG=2;
-        while((DATA_PIN)&&ucharFLAG++);   
-        if(ucharFLAG==1)break;    
-        ucharcomdata<<=1;
-        ucharcomdata|=uchartemp; 
-    }    
+        //释放总线，上拉拉高后等DHT11应答
+        DATA_PIN_INPUT; //输入
+        DATA_PIN_PERIPH;
+        dht11Edges = 0;
+        dht11State = DHT11_READ;
+        T1CC3CTL = T1CCTL_IM | T1CCTL_CAP_FALLING;
+        DHT11_CompareAt(DHT11_Now() + DHT11_READ_US);
+    }
+    else if (dht11State == DHT11_READ)
+    {
+        DHT11_Finish(dht11Edges == 0 ? DHT11_ERR_NO_RESPONSE : DHT11_ERR_TIMING);
+    }
 }
 
-void DHT11(void)   //温湿传感启动
+//通道3捕获到下降沿，edge 是捕获时刻
+static void DHT11_Edge(uint16 edge)
 {
-    DATA_PIN=0;
-    Delay_ms(19);  //>18MS
-    DATA_PIN=1; 
-    DATA_PIN_INPUT; //输入
-    Delay_10us();
-    Delay_10us();                        
-    Delay_10us();
-    Delay_10us();  
-    if(!DATA_PIN) 
+    uint16 width = edge - dht11LastEdge;
+    uchar bit;
+
+    dht11LastEdge = edge;
+    if (dht11State != DHT11_READ)
+    {
+        return;
+    }
+
+    //第一个沿是应答开始，第二个沿前是 80us低 + 80us高
+    if (dht11Edges < 2)
     {
-        ucharFLAG=2; 
-        while((!DATA_PIN)&&ucharFLAG++);
-        ucharFLAG=2;
-        while((DATA_PIN)&&ucharFLAG++); 
-        COM();
-        ucharRH_data_H_temp=ucharcomdata;
-        COM();
-        ucharRH_data_L_temp=ucharcomdata;
-        COM();
-        ucharT_data_H_temp=ucharcomdata;
-        COM();
-        ucharT_data_L_temp=ucharcomdata;
-        COM();
-        ucharcheckdata_temp=ucharcomdata;
-        DATA_PIN=1; 
-        uchartemp=(ucharT_data_H_temp+ucharT_data_L_temp+ucharRH_data_H_temp+ucharRH_data_L_temp);
-        if(uchartemp==ucharcheckdata_temp)
+        if (dht11Edges == 1 && (width < DHT11_RESPONSE_MIN_US || width > DHT11_RESPONSE_MAX_US))
         {
-            ucharRH_data_H=ucharRH_data_H_temp;
-            ucharRH_data_L=ucharRH_data_L_temp;
-            ucharT_data_H=ucharT_data_H_temp;
-            ucharT_data_L=ucharT_data_L_temp;
-            ucharcheckdata=ucharcheckdata_temp;
+            DHT11_Finish(DHT11_ERR_TIMING);
+            return;
         }
+        dht11Edges++;
+        return;
+    }
+
+    if (width < DHT11_BIT_MIN_US || width > DHT11_BIT_MAX_US)
+    {
+        DHT11_Finish(DHT11_ERR_TIMING);
+        return;
+    }
+
+    //高位先出
+    bit = dht11Edges - 2;
+    dht11Data[bit >> 3] <<= 1;
+    if (width > DHT11_BIT_ONE_US)
+    {
+        dht11Data[bit >> 3] |= 1;
+    }
+
+    if (++dht11Edges == DHT11_EDGES)
+    {
+        DHT11_Finish(DHT11_OK);
+    }
+}
+
+HAL_ISR_FUNCTION(DHT11_Timer1Isr, T1_VECTOR)
+{
+    uchar stat = T1STAT;
+
+    //标志位写0清除，写1无效
+    if (stat & T1STAT_CH3IF)
+    {
+        uint16 edge;
+
+        T1STAT = ~T1STAT_CH3IF;
+        edge = T1CC3L;
+        edge |= (uint16)T1CC3H << 8;
+        DHT11_Edge(edge);
+    }
+
+    if (stat & T1STAT_CH0IF)
+    {
+        T1STAT = ~T1STAT_CH0IF;
+        DHT11_Timeout();
+    }
 
-        wendu=ucharT_data_H;
-        shidu=ucharRH_data_H;
-    } 
-    else //没用成功读取，返回0
+    if (stat & T1STAT_OVFIF)
     {
-        shidu=0;
-        wendu=0;
-        
-    } 
-    
+        T1STAT = ~T1STAT_OVFIF;
+    }
+}
+
+//task_id 的 done_event 在每次读完后置位，结果用 DHT11_Read 取
+void DHT11_Init(uint8 task_id, uint16 done_event)
+{
+    dht11TaskId = task_id;
+    dht11Event = done_event;
+    dht11State = DHT11_IDLE;
+    dht11Status = DHT11_ERR_NO_RESPONSE;
+    dht11Reading.valid = FALSE;
+
+    PERCFG |= PERCFG_T1CFG;  //定时器1备用位置2，通道3在P0_7
+    TIMIF &= ~TIMIF_T1OVFIM; //不要溢出中断
+
+    DATA_PIN_GPIO;
+    DATA_PIN = 1;
     DATA_PIN_OUTPUT; //输出
 }
 
+//温湿传感启动，上一次还没读完返回FALSE
+uint8 DHT11_Start(void)
+{
+    halIntState_t intState;
+
+    if (dht11State != DHT11_IDLE)
+    {
+        return FALSE;
+    }
+
+    //读完之前不能进PM2
+    osal_pwrmgr_task_state(dht11TaskId, PWRMGR_HOLD);
+
+    HAL_ENTER_CRITICAL_SECTION(intState);
+
+    dht11State = DHT11_START;
+    dht11StartTime = osal_GetSystemClock();
+    DATA_PIN_GPIO;
+    DATA_PIN_OUTPUT;
+    DATA_PIN = 0;    //起始信号
+
+    T1CTL = 0;
+    T1CNTL = 0;      //写任意值计数清零
+    T1STAT = 0;
+    dht11LastEdge = 0;
+    T1CTL = DHT11_T1CTL_RUN;
+    DHT11_CompareAt(DHT11_START_US);
+    IEN1 |= IEN1_T1IE;
+
+    HAL_EXIT_CRITICAL_SECTION(intState);
+
+    return TRUE;
+}
+
+//拷贝最近一次读数，返回它的状态。读数由中断更新，拷贝时关中断
+uint8 DHT11_Read(DHT11_Reading_t *reading)
+{
+    halIntState_t intState;
+    uint8 status;
+
+    HAL_ENTER_CRITICAL_SECTION(intState);
+    *reading = dht11Reading;
+    status = dht11Status;
+    HAL_EXIT_CRITICAL_SECTION(intState);
+
+    return status;
+}
@@ -19,7 +19,9 @@
 #endif
 #include "hal_led.h"
 #include "hal_uart.h"
+#include "aps_groups.h"
 #include "dht11.h"
+#include "uplink.h"
 
 
 /*********************************************************************
@@ -38,6 +40,15 @@
   #define SAMPLE_APP_BAUD  HAL_UART_BR_115200
 #endif
 
+// 协调器和网关之间跑 230400，要和网关的 SERIAL_BRIDGE_BAUD 一致。
+// HAL 最高只有115200一档，按 SAMPLE_APP_BAUD 打开后再改波特率寄存器(32MHz)
+#if !defined( SAMPLE_APP_UART_230400 )
+#define SAMPLE_APP_UART_230400  TRUE
+#endif
+
+#define SAMPLE_APP_U0BAUD_230400  216
+#define SAMPLE_APP_U0GCR_230400   12
+
 // When the Rx buf space is less than this threshold, invoke the Rx callback.
 #if !defined( SAMPLE_APP_THRESH )
 #define SAMPLE_APP_THRESH  64
@@ -47,20 +58,25 @@
 #define SAMPLE_APP_RX_SZ  128
 #endif
 
+// HAL 的DMA发送缓冲，协调器自己的两块发送缓冲也各这么大，都要放得下一整帧
 #if !defined( SAMPLE_APP_TX_SZ )
 #define SAMPLE_APP_TX_SZ  128
 #endif
 
+#if SAMPLE_APP_TX_SZ < UPLINK_FRAME_MAX || SAMPLE_APP_TX_SZ > 255
+  #error "SAMPLE_APP_TX_SZ must hold one uplink frame and fit a uint8 length"
+#endif
+
+// HAL 发送缓冲满时，隔多少毫秒再交。230400下128字节约5.6ms发完
+#if !defined( SAMPLE_APP_TX_RETRY )
+#define SAMPLE_APP_TX_RETRY  2
+#endif
+
 // Millisecs of idle time after a byte is received before invoking Rx callback.
 #if !defined( SAMPLE_APP_IDLE )
 #define SAMPLE_APP_IDLE  6
 #endif
 
-// Loopback Rx bytes to Tx for throughput testing.
-#if !defined( SAMPLE_APP_LOOPBACK )
-#define SAMPLE_APP_LOOPBACK  FALSE
-#endif
-
 // This is the max byte count per OTA message.
 #if !defined( SAMPLE_APP_TX_MAX )
 #define SAMPLE_APP_TX_MAX  80
@@ -68,6 +84,219 @@
 
 #define SAMPLE_APP_RSP_CNT  4
 
+// 终端id，多个终端时每个终端编译不同的值
+#if !defined( SAMPLE_APP_NODE_ID )
+#define SAMPLE_APP_NODE_ID  1
+#endif
+
+// 协调器节点表槽位数，必须是2的幂，每个槽20字节，32槽共640字节
+#if !defined( SAMPLE_APP_NODE_SLOTS )
+#define SAMPLE_APP_NODE_SLOTS  32
+#endif
+
+// 最多登记的节点数，留出空槽保证开放寻址的探测长度
+#define SAMPLE_APP_NODE_MAX  (SAMPLE_APP_NODE_SLOTS - SAMPLE_APP_NODE_SLOTS / 4)
+
+// 汇总帧的周期，毫秒
+#if !defined( SAMPLEAPP_NODE_SUMMARY_TIMEOUT )
+#define SAMPLEAPP_NODE_SUMMARY_TIMEOUT  60000
+#endif
+
+// 汇总分帧发送的间隔，毫秒，避免一次性占满串口把实时读数堵在后面
+#if !defined( SAMPLEAPP_NODE_SUMMARY_GAP )
+#define SAMPLEAPP_NODE_SUMMARY_GAP  20
+#endif
+
+#if !defined( SAMPLEAPP_NODE_SUMMARY_EVT )
+#define SAMPLEAPP_NODE_SUMMARY_EVT  0x0002
+#endif
+
+// 节点汇总帧功能码，每条记录 SAMPLE_APP_SUMMARY_REC 字节:
+// id, 短地址(低,高), 温度, 湿度, 本周期样本数, 本周期缺的报文数,
+// 本周期没上串口的最新一条读数采样到现在的时间(100ms，16位小端，0xFFFF是没有)。
+// 温度带符号(补码)，零下的照样报。最值和均值网关按收到的读数自己统计，
+// 不再发；以前的 0x02 帧每条记录还带这8字节
+#if !defined( FUN_CODE_NODE_SUMMARY )
+#define FUN_CODE_NODE_SUMMARY  0x05
+#endif
+
+#define SAMPLE_APP_SUMMARY_REC  9
+#define SAMPLE_APP_SUMMARY_NONE 0xFFFF
+
+// 节点表里还没收到过读数，温湿度都不会是这个值
+#define SAMPLE_APP_NO_READING   ((int16)0x8000)
+
+// 置1时串口仍用旧的 len,校验,fc,内容,$,@ 帧，每帧一条读数
+#if !defined( SAMPLE_APP_UPLINK_LEGACY )
+#define SAMPLE_APP_UPLINK_LEGACY  FALSE
+#endif
+
+// 读数在协调器上最多攒多久再打成一帧，毫秒
+#if !defined( SAMPLE_APP_UPLINK_HOLD )
+#define SAMPLE_APP_UPLINK_HOLD  50
+#endif
+
+#if !defined( SAMPLEAPP_UPLINK_FLUSH_EVT )
+#define SAMPLEAPP_UPLINK_FLUSH_EVT  0x0004
+#endif
+
+// DHT11 读完，由驱动的定时器中断置位
+#if !defined( SAMPLEAPP_DHT11_DONE_EVT )
+#define SAMPLEAPP_DHT11_DONE_EVT    0x0008
+#endif
+
+// 终端读数报文：id，报文序号，后面一条或几条读数，每条 seq, flags, 温度(0.1℃),
+// 湿度(0.1%RH), 采样到发送的时间(100ms)，16位都是小端。
+// 没有报文序号的老终端发 id 加读数，更老的只发 id, 温度, 湿度 三个字节的整数，
+// 三种长度按条长取余区分得开
+#define SAMPLE_APP_RECORD_LEN       8
+#define SAMPLE_APP_MSG_HEAD         2
+#define SAMPLE_APP_READING_LEN      (1 + SAMPLE_APP_RECORD_LEN)
+#define SAMPLE_APP_READING_OLD_LEN  3
+#define SAMPLE_APP_READING_INVALID  0x01
+// flags 的高7位是终端这次上电的随机编号(1..127)，协调器看到编号变了就知道
+// 终端重启过，报文序号从0重新数。老终端这几位是0，不算
+#define SAMPLE_APP_READING_EPOCH_SHIFT  1
+#define SAMPLE_APP_READING_EPOCH_MAX    0x7F
+
+#if !defined( SAMPLEAPP_RETX_EVT )
+#define SAMPLEAPP_RETX_EVT          0x0010
+#endif
+
+// 协调器串口发送缓冲等 HAL 腾出地方
+#if !defined( SAMPLEAPP_UART_TX_EVT )
+#define SAMPLEAPP_UART_TX_EVT       0x0020
+#endif
+
+// 读数报文要求APS确认。协议栈自己重试后仍失败的，终端隔 SAMPLE_APP_RETX_DELAY
+// 毫秒再发，每失败一次间隔加倍，最多再发 SAMPLE_APP_RETX_MAX 次。
+// 等确认的报文最多 SAMPLE_APP_RETX_QUEUE 个，满了挤掉最老的
+#if !defined( SAMPLE_APP_RETX_QUEUE )
+#define SAMPLE_APP_RETX_QUEUE       4
+#endif
+
+#if !defined( SAMPLE_APP_RETX_MAX )
+#define SAMPLE_APP_RETX_MAX         3
+#endif
+
+#if !defined( SAMPLE_APP_RETX_DELAY )
+#define SAMPLE_APP_RETX_DELAY       2000
+#endif
+
+// 协调器按终端记最近16个报文序号，重复的丢掉，跳过的记为缺失
+#define SAMPLE_APP_SEQ_WINDOW       16
+
+// 低功耗终端(POWER_SAVING)在PM2里攒读数，醒来凑够 SAMPLE_APP_BATCH 条
+// 或最早一条等了 SAMPLE_APP_BATCH_HOLD 毫秒(默认和心跳一样长)才开一次射频，
+// 一个报文全发出去。越过死区或有效性变了的读数不等，连同攒着的马上发，
+// 告警最多晚一个采样周期；只攒心跳读数，它们最多晚 SAMPLE_APP_BATCH_HOLD
+// 加一个采样周期。常电终端每条读数马上发
+#if !defined( SAMPLE_APP_BATCH )
+  #if defined( POWER_SAVING )
+    #define SAMPLE_APP_BATCH        4
+  #else
+    #define SAMPLE_APP_BATCH        1
+  #endif
+#endif
+
+#if !defined( SAMPLE_APP_BATCH_HOLD )
+#define SAMPLE_APP_BATCH_HOLD       300000
+#endif
+
+#define SAMPLE_APP_MSG_MAX  (SAMPLE_APP_MSG_HEAD + SAMPLE_APP_BATCH * SAMPLE_APP_RECORD_LEN)
+
+#if SAMPLE_APP_BATCH < 1 || SAMPLE_APP_MSG_MAX > SAMPLE_APP_TX_MAX
+  #error "SAMPLE_APP_BATCH does not fit in one message"
+#endif
+
+// 终端的LCD和串口提示，低功耗终端默认不开，省得醒着等LCD和串口
+#if !defined( SAMPLE_APP_DEBUG )
+  #if defined( POWER_SAVING )
+    #define SAMPLE_APP_DEBUG        FALSE
+  #else
+    #define SAMPLE_APP_DEBUG        TRUE
+  #endif
+#endif
+
+// 终端上报策略：读数和上次上报的相差到死区才发，没变化时采样周期指数退避，
+// 但最长 SAMPLE_APP_HEARTBEAT 秒一定发一次。死区按项算，某项死区为0就是
+// 这项一有变化就发，跟着批走，不马上发；两项都没变照样退避到心跳
+#define SAMPLE_APP_REPORT_NONE      0
+#define SAMPLE_APP_REPORT_HEARTBEAT 1   // 可以攒着
+#define SAMPLE_APP_REPORT_CHANGE    2   // 变了，马上发
+
+#if !defined( SAMPLE_APP_DEADBAND_T )
+#define SAMPLE_APP_DEADBAND_T   5       // 0.1℃
+#endif
+
+#if !defined( SAMPLE_APP_DEADBAND_H )
+#define SAMPLE_APP_DEADBAND_H   20      // 0.1%RH
+#endif
+
+#if !defined( SAMPLE_APP_HEARTBEAT )
+#define SAMPLE_APP_HEARTBEAT    300     // 秒
+#endif
+
+// 采样周期最多退避到基本周期的 2^N 倍
+#if !defined( SAMPLE_APP_BACKOFF_MAX )
+#define SAMPLE_APP_BACKOFF_MAX  3
+#endif
+
+// 网关下发的命令，串口帧和无线报文用同一个功能码，与网关 serial_bridge.h 一致
+// 数据都以目标开头(16位小端)：0为全部终端，广播；最高位置1是组号，组播；
+// 其余是终端id，协调器在节点表里查到就点播，查不到也广播
+#define SAMPLE_APP_TARGET_GROUP 0x8000
+
+#if !defined( FUN_CODE_SET_INTERVAL )
+#define FUN_CODE_SET_INTERVAL   0x10    // 采样周期，秒(16位小端)
+#endif
+
+#if !defined( FUN_CODE_SET_REPORT )
+#define FUN_CODE_SET_REPORT     0x11    // 温度死区、湿度死区(0.1单位，0xFF不改)，心跳秒(16位小端，0不改)
+#endif
+
+// 一条命令改哪几项由掩码决定，后面按位序只跟掩码里有的字段:
+// 采样周期秒(16位小端)，温度死区，湿度死区(0.1单位)，心跳秒(16位小端)
+#if !defined( FUN_CODE_NODE_CONFIG )
+#define FUN_CODE_NODE_CONFIG    0x12
+#endif
+
+// 协调器自己处理的命令：立刻发一轮节点汇总，没有数据
+#if !defined( FUN_CODE_QUERY_NODES )
+#define FUN_CODE_QUERY_NODES    0x13
+#endif
+
+// 链路检测：数据原样回一个同功能码的帧，网关用来算往返时间
+#if !defined( FUN_CODE_PING )
+#define FUN_CODE_PING           0x14
+#endif
+
+#define SAMPLE_APP_CONFIG_INTERVAL    0x01
+#define SAMPLE_APP_CONFIG_DEADBAND_T  0x02
+#define SAMPLE_APP_CONFIG_DEADBAND_H  0x04
+#define SAMPLE_APP_CONFIG_HEARTBEAT   0x08
+
+// 终端默认加入的组
+#if !defined( SAMPLE_APP_GROUP )
+#define SAMPLE_APP_GROUP        SAMPLEAPP_FLASH_GROUP
+#endif
+
+// 下行串口帧：长度，校验和，功能码，数据，'$'，'@'，和上行的老格式一样
+#define SAMPLE_APP_DOWN_HEAD    3
+#define SAMPLE_APP_CMD_MAX      9       // 命令数据最长，一条全量 NODE_CONFIG
+
+// 串口接收环，2的幂，不超过128。HAL 直接读进环里，帧在环里原地解析
+#if !defined( SAMPLE_APP_RX_RING )
+#define SAMPLE_APP_RX_RING      128
+#endif
+
+#define SAMPLE_APP_RX_MASK      (SAMPLE_APP_RX_RING - 1)
+
+#if (SAMPLE_APP_RX_RING & SAMPLE_APP_RX_MASK) || SAMPLE_APP_RX_RING > 128 || \
+    SAMPLE_APP_RX_RING < SAMPLE_APP_DOWN_HEAD + SAMPLE_APP_CMD_MAX + 2
+  #error "SAMPLE_APP_RX_RING must be a power of two that holds a command frame, at most 128"
+#endif
+
 // This list should be filled with Application specific Cluster IDs.
 const cId_t SampleApp_ClusterList[SAMPLE_MAX_CLUSTERS] =
 {
@@ -100,11 +329,58 @@ endPointDesc_t SampleApp_epDesc =
  * TYPEDEFS
  */
 
+#ifdef ZDO_COORDINATOR
+// 协调器上每个终端的温湿度统计
+typedef struct
+{
+  uint16 shortAddr;               // 0xFFFF 表示空槽
+  uint8  id;
+  uint8  count;                   // 本汇总周期的样本数，封顶 255
+  int16  t;                       // 最新温度，0.1℃，SAMPLE_APP_NO_READING 表示还没有
+  int16  h;                       // 最新湿度，0.1%RH
+  uint16 rxMask;                  // 收到过的报文序号，位i是 rxSeq-i，0表示还没有
+  uint8  rxSeq;                   // 收到的最大报文序号
+  uint8  rxEpoch;                 // 终端上电编号，0表示老终端不带
+  uint8  missed;                  // 本汇总周期缺的报文数，封顶 255
+  uint8  held;                    // 本汇总周期有读数没变化、没上串口
+  uint32 heldTime;                // 其中最新一条的采样时间
+  uint16 seen;                    // 最近收到报文的时间，秒(1024ms)，回绕，只比新旧
+} SampleApp_Node_t;
+
+// 网关命令的处理函数，data 至少 minLen 字节
+typedef struct
+{
+  uint8 fc;
+  uint8 minLen;
+  void  (*handler)( uint8 fc, uint8 *data, uint8 len );
+} SampleApp_UartCmd_t;
+#endif
+
+#ifndef ZDO_COORDINATOR
+// 终端上等APS确认或等重发的读数报文
+#define SAMPLE_APP_RETX_FREE    0
+#define SAMPLE_APP_RETX_WAIT    1       // 发出去了，等 AF_DATA_CONFIRM_CMD
+#define SAMPLE_APP_RETX_DUE     2       // 没确认，等 due 到了再发
+
+typedef struct
+{
+  uint8  state;
+  uint8  transID;                 // 最近一次发送的AF事务号，确认按它对上
+  uint8  tries;                   // 已经发了几次
+  uint8  len;
+  uint8  count;                   // 报文里的读数条数
+  uint32 due;
+  uint32 times[SAMPLE_APP_BATCH]; // 各条的采样时间，每次发送按它重算 age
+  uint8  msg[SAMPLE_APP_MSG_MAX];
+} SampleApp_Retx_t;
+#endif
+
 /*********************************************************************
  * GLOBAL VARIABLES
  */
 devStates_t SampleApp_NwkState;   
 uint8 SampleApp_TaskID;           // Task ID for internal task/event processing.
+uint8 SampleApp_NodeId = SAMPLE_APP_NODE_ID;  // 终端id，随温湿度一起上报
 
 /*********************************************************************
  * EXTERNAL VARIABLES
@@ -124,24 +400,129 @@ afAddrType_t SampleApp_Periodic_DstAddr; //广播
 afAddrType_t SampleApp_Flash_DstAddr;    //组播
 afAddrType_t SampleApp_P2P_DstAddr;      //点播
 
+#ifndef ZDO_COORDINATOR
+aps_Group_t SampleApp_Group;
+#endif
 
 static afAddrType_t SampleApp_TxAddr;
 static uint8 SampleApp_TxSeq;
-static uint8 SampleApp_TxBuf[SAMPLE_APP_TX_MAX+1];
-static uint8 SampleApp_TxLen;
+static uint8 SampleApp_Epoch;           // 这次上电的编号，第一次发报文时取
 
 static afAddrType_t SampleApp_RxAddr;
 static uint8 SampleApp_RxSeq;
 static uint8 SampleApp_RspBuf[SAMPLE_APP_RSP_CNT];
 
+#ifndef ZDO_COORDINATOR
+// 上报策略，网关可以按终端修改
+static uint32 SampleApp_Interval = SAMPLEAPP_SEND_PERIODIC_MSG_TIMEOUT;  // 基本采样周期，毫秒
+static uint8  SampleApp_DeadbandT = SAMPLE_APP_DEADBAND_T;
+static uint8  SampleApp_DeadbandH = SAMPLE_APP_DEADBAND_H;
+static uint16 SampleApp_Heartbeat = SAMPLE_APP_HEARTBEAT;
+static uint8  SampleApp_Backoff;                  // 当前退避级数
+static uint8  SampleApp_Reported;                 // 至少上报过一次
+static DHT11_Reading_t SampleApp_LastReport;      // 上次上报的读数
+static DHT11_Reading_t SampleApp_Batch[SAMPLE_APP_BATCH];   // 等着一起发的读数
+static uint8  SampleApp_BatchLen;
+
+static SampleApp_Retx_t SampleApp_Retx[SAMPLE_APP_RETX_QUEUE];
+
+uint16 SampleApp_ReportsSent;
+uint16 SampleApp_ReportsSuppressed;   // 在死区内没有发的读数
+uint16 SampleApp_Heartbeats;          // 没变化、因为心跳到期而发的读数
+
+uint16 SampleApp_TxAcked;             // 收到确认的报文
+uint16 SampleApp_TxRetries;           // 重发次数
+uint16 SampleApp_TxLost;              // 重发用完仍没确认，放弃的报文
+uint16 SampleApp_TxDropped;           // 队列满被挤掉的报文
+#endif
+
+#ifdef ZDO_COORDINATOR
+static SampleApp_Node_t SampleApp_Nodes[SAMPLE_APP_NODE_SLOTS];
+static uint16 SampleApp_NodeCount;
+static uint16 SampleApp_SummaryPos;   // 汇总发送到的槽位
+
+// LCD只在汇总定时器里刷新，收包时只记下最近一条，不在每个读数上 sprintf 和同步写屏
+static uplink_reading_t SampleApp_LcdReading;
+static uint8 SampleApp_LcdDirty;
+
+uint16 SampleApp_NodeTableFull;     // 表满后直接转发的读数
+uint16 SampleApp_Suppressed;        // 未变化而没有上串口的读数
+uint16 SampleApp_RxDuplicates;      // 重发造成的重复报文，丢掉
+uint16 SampleApp_RxMissing;         // 序号跳过的报文
+uint16 SampleApp_RxRecovered;       // 跳过后又晚到的报文
+uint16 SampleApp_CmdFailures;       // 网关命令协议栈没收下、没发出去的次数
+
+// 串口发送两块缓冲轮流用：一块整块交给 HAL，由DMA发出去，另一块接着在末尾
+// 直接拼帧。HAL 收下后那块就空了，下次两块对调。写串口从不等待
+static uint8 SampleApp_TxBuf[2][SAMPLE_APP_TX_SZ];
+static uint8 SampleApp_TxLen[2];
+static uint8 SampleApp_TxFill;      // 正在拼帧的一块
+static uint8 SampleApp_TxWaiting;   // 已经定了 SAMPLEAPP_UART_TX_EVT
+
+uint16 SampleApp_TxOverruns;        // 两块都满，丢掉的帧
+uint16 SampleApp_TxBusy;            // HAL 发送缓冲满，晚些再交的次数
+uint16 SampleApp_TxPeak;            // 两块里同时积压的最多字节数
+
+// 串口接收环，和发送缓冲分开，收发互不影响。下标一直往上加，用时取模
+static uint8 SampleApp_RxRing[SAMPLE_APP_RX_RING];
+static uint8 SampleApp_RxHead;      // 第一个没解析的字节
+static uint8 SampleApp_RxTail;      // 下一个收进来的字节
+static uint8 SampleApp_RxCmd[SAMPLE_APP_CMD_MAX];   // 数据绕过环尾时拼在这里
+
+uint16 SampleApp_RxFrames;          // 收到的网关命令
+uint16 SampleApp_RxSkipped;         // 找帧头时丢掉的字节
+uint16 SampleApp_RxUnknown;         // 不认识或太短的命令
+
+#if !SAMPLE_APP_UPLINK_LEGACY
+static uint8 SampleApp_UplinkBuf[UPLINK_FRAME_MAX];
+static uplink_encoder_t SampleApp_Uplink;   // 正在攒的读数帧
+static uint32 SampleApp_UplinkFirst;        // 帧里第一条读数放进来的时间
+#endif
+#endif
+
 /*********************************************************************
  * LOCAL FUNCTIONS
  */
 
 static void SampleApp_ProcessMSGCmd( afIncomingMSGPacket_t *pkt );
 void SampleApp_CallBack(uint8 port, uint8 event); 
-static void SampleApp_Send_P2P_Message( void );
+#ifdef ZDO_COORDINATOR
 static void packDataAndSend(uint8 fc, uint8* data, uint8 len);
+static uint8 *SampleApp_TxReserve( uint8 size );
+static void SampleApp_TxCommit( uint8 size );
+static void SampleApp_TxKick( void );
+#endif
+uint8 CheckSum(uint8 *pdata, uint8 len);
+#ifndef ZDO_COORDINATOR
+static void SampleApp_Send_P2P_Message( const DHT11_Reading_t *readings, uint8 count );
+static uint8 SampleApp_ReportDue( const DHT11_Reading_t *reading );
+static uint32 SampleApp_NextSample( void );
+static void SampleApp_Queue( const DHT11_Reading_t *reading, uint8 due );
+static void SampleApp_Transmit( SampleApp_Retx_t *entry );
+static void SampleApp_DataConfirm( uint8 transID, uint8 status );
+static void SampleApp_Retransmit( void );
+static void SampleApp_ProcessCommand( uint8 fc, uint8 *data, uint8 len );
+#endif
+#ifdef ZDO_COORDINATOR
+static SampleApp_Node_t *SampleApp_NodeLookup( uint16 shortAddr, uint8 id );
+static uint8 SampleApp_Whole( int16 tenths );
+static int8 SampleApp_WholeSigned( int16 tenths );
+static uint8 SampleApp_NodeUpdate( SampleApp_Node_t *node, const uplink_reading_t *reading );
+static uint8 SampleApp_NodeSeq( SampleApp_Node_t *node, uint8 seq, uint8 epoch );
+static void SampleApp_ProcessReading( SampleApp_Node_t *node, const uplink_reading_t *reading );
+static uint8 SampleApp_SendNodeSummary( void );
+static void SampleApp_ShowNodes( void );
+static void SampleApp_ForwardReading( const uplink_reading_t *reading );
+static uint8 SampleApp_RxFill( void );
+static void SampleApp_ProcessUart( void );
+static void SampleApp_DispatchCommand( uint8 fc, uint8 *data, uint8 len );
+static void SampleApp_ForwardCommand( uint8 fc, uint8 *data, uint8 len );
+static void SampleApp_QueryNodes( uint8 fc, uint8 *data, uint8 len );
+static void SampleApp_Ping( uint8 fc, uint8 *data, uint8 len );
+#if !SAMPLE_APP_UPLINK_LEGACY
+static void SampleApp_FlushUplink( void );
+#endif
+#endif
 
 
 /*********************************************************************
@@ -171,6 +552,24 @@ void SampleApp_Init( uint8 task_id )
 
   P0SEL &= ~0x80;                 //设置P07为普通IO口
   P0DIR |= 0x80;                 //P07定义为输出口  
+
+  //网关命令从串口进来，收到就回调 SampleApp_CallBack
+  uartConfig.configured           = TRUE;
+  uartConfig.baudRate             = SAMPLE_APP_BAUD;
+  uartConfig.flowControl          = FALSE;
+  uartConfig.flowControlThreshold = SAMPLE_APP_THRESH;
+  uartConfig.idleTimeout          = SAMPLE_APP_IDLE;
+  uartConfig.rx.maxBufSize        = SAMPLE_APP_RX_SZ;
+  uartConfig.tx.maxBufSize        = SAMPLE_APP_TX_SZ;
+  uartConfig.intEnable            = TRUE;
+  uartConfig.callBackFunc         = SampleApp_CallBack;
+  HalUARTOpen( SAMPLE_APP_PORT, &uartConfig );
+#if SAMPLE_APP_UART_230400
+  U0BAUD = SAMPLE_APP_U0BAUD_230400;
+  U0GCR = (U0GCR & ~0x1F) | SAMPLE_APP_U0GCR_230400;
+#endif
+#else
+  DHT11_Init( task_id, SAMPLEAPP_DHT11_DONE_EVT );
 #endif
 
   SampleApp_Periodic_DstAddr.addrMode = (afAddrMode_t)AddrBroadcast;//广播
@@ -181,12 +580,25 @@ void SampleApp_Init( uint8 task_id )
   SampleApp_Flash_DstAddr.addrMode = (afAddrMode_t)afAddrGroup;//组播
   SampleApp_Flash_DstAddr.endPoint = SAMPLEAPP_ENDPOINT;
   SampleApp_Flash_DstAddr.addr.shortAddr = SAMPLEAPP_FLASH_GROUP;
+
+#ifndef ZDO_COORDINATOR
+  // 加入组，网关按组下发的命令靠它收
+  SampleApp_Group.ID = SAMPLE_APP_GROUP;
+  osal_memcpy( SampleApp_Group.name, "Group 1", 7 );
+  aps_AddGroup( SAMPLEAPP_ENDPOINT, &SampleApp_Group );
+#endif
   
   SampleApp_P2P_DstAddr.addrMode = (afAddrMode_t)Addr16Bit; //点播 
   SampleApp_P2P_DstAddr.endPoint = SAMPLEAPP_ENDPOINT; 
   SampleApp_P2P_DstAddr.addr.shortAddr = 0x0000;            //发给协调器
 
-  
+#ifdef ZDO_COORDINATOR
+  osal_memset(SampleApp_Nodes, 0xFF, sizeof(SampleApp_Nodes));
+  SampleApp_NodeCount = 0;
+#if !SAMPLE_APP_UPLINK_LEGACY
+  uplink_encoder_begin(&SampleApp_Uplink, SampleApp_UplinkBuf);
+#endif
+#endif
 }
 
 /*********************************************************************
@@ -214,6 +626,13 @@ UINT16 SampleApp_ProcessEvent( uint8 task_id, UINT16 events )
       case AF_INCOMING_MSG_CMD:
         SampleApp_ProcessMSGCmd( MSGpkt );
         break;
+
+#ifndef ZDO_COORDINATOR
+      //读数报文的APS确认
+      case AF_DATA_CONFIRM_CMD:
+        SampleApp_DataConfirm( ((afDataConfirm_t *)MSGpkt)->transID, MSGpkt->hdr.status );
+        break;
+#endif
         
       case ZDO_STATE_CHANGE:
         SampleApp_NwkState = (devStates_t)(MSGpkt->hdr.status);
@@ -226,6 +645,15 @@ UINT16 SampleApp_ProcessEvent( uint8 task_id, UINT16 events )
                               SAMPLEAPP_SEND_PERIODIC_MSG_EVT,
                               SAMPLEAPP_SEND_PERIODIC_MSG_TIMEOUT );
         }
+#ifdef ZDO_COORDINATOR
+        else if ( SampleApp_NwkState == DEV_ZB_COORD )
+        {
+            //网络建立后，周期性把节点表汇总发给网关
+            osal_start_timerEx( SampleApp_TaskID,
+                              SAMPLEAPP_NODE_SUMMARY_EVT,
+                              SAMPLEAPP_NODE_SUMMARY_TIMEOUT );
+        }
+#endif
         else
         {
           // Device is no longer in the network
@@ -243,19 +671,77 @@ UINT16 SampleApp_ProcessEvent( uint8 task_id, UINT16 events )
   }
 
   //定时器时间到
+#ifndef ZDO_COORDINATOR
   if ( events & SAMPLEAPP_SEND_PERIODIC_MSG_EVT )
   {
-    // DHT11采集
-    SampleApp_Send_P2P_Message();
+    // DHT11采集，读完在 SAMPLEAPP_DHT11_DONE_EVT 决定发不发
+    DHT11_Start();
 
-    // Setup to send message again in normal period (+ a little jitter)
+    // 读数万一没回来也要接着采，读完后会按退避重新定时
     osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_SEND_PERIODIC_MSG_EVT,
-        (SAMPLEAPP_SEND_PERIODIC_MSG_TIMEOUT + (osal_rand() & 0x00FF)) );
+                        SampleApp_NextSample() );
 
     // return unprocessed events
     return (events ^ SAMPLEAPP_SEND_PERIODIC_MSG_EVT);
   }
 
+  //温湿度读完
+  if ( events & SAMPLEAPP_DHT11_DONE_EVT )
+  {
+    DHT11_Reading_t reading;
+
+    DHT11_Read(&reading);
+    SampleApp_Queue( &reading, SampleApp_ReportDue(&reading) );
+
+    osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_SEND_PERIODIC_MSG_EVT,
+                        SampleApp_NextSample() );
+
+    return (events ^ SAMPLEAPP_DHT11_DONE_EVT);
+  }
+
+  //没确认的报文重发
+  if ( events & SAMPLEAPP_RETX_EVT )
+  {
+    SampleApp_Retransmit();
+
+    return (events ^ SAMPLEAPP_RETX_EVT);
+  }
+#endif
+
+#ifdef ZDO_COORDINATOR
+  //汇总定时器
+  if ( events & SAMPLEAPP_NODE_SUMMARY_EVT )
+  {
+    SampleApp_ShowNodes();
+
+    //表没走完就隔一会儿发下一帧，走完了等下一个周期
+    osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_NODE_SUMMARY_EVT,
+                        SampleApp_SendNodeSummary() ? SAMPLEAPP_NODE_SUMMARY_GAP
+                                                    : SAMPLEAPP_NODE_SUMMARY_TIMEOUT );
+
+    return (events ^ SAMPLEAPP_NODE_SUMMARY_EVT);
+  }
+
+#if !SAMPLE_APP_UPLINK_LEGACY
+  //攒读数的时间到，不满也发出去
+  if ( events & SAMPLEAPP_UPLINK_FLUSH_EVT )
+  {
+    SampleApp_FlushUplink();
+
+    return (events ^ SAMPLEAPP_UPLINK_FLUSH_EVT);
+  }
+#endif
+
+  //HAL 发送缓冲该腾出地方了
+  if ( events & SAMPLEAPP_UART_TX_EVT )
+  {
+    SampleApp_TxWaiting = FALSE;
+    SampleApp_TxKick();
+
+    return (events ^ SAMPLEAPP_UART_TX_EVT);
+  }
+#endif
+
 
   return ( 0 );  // Discard unknown events.
 }
@@ -274,53 +760,74 @@ UINT16 SampleApp_ProcessEvent( uint8 task_id, UINT16 events )
  */
 void SampleApp_ProcessMSGCmd( afIncomingMSGPacket_t *pkt )
 {
-  uint8 buff[20]={0};
-
   switch ( pkt->clusterId )
   {
   // 接收终端上传的温度数据
   case SAMPLEAPP_P2P_CLUSTERID: 
 #ifdef ZDO_COORDINATOR
     {
-        uint8 id=pkt->cmd.Data[0];//终端id
-        uint8 t=pkt->cmd.Data[1]; //终端温度
-        uint8 h=pkt->cmd.Data[2]; //终端湿度 
+        uint8 *data = pkt->cmd.Data;
+        uint8 len = pkt->cmd.DataLength;
+        uplink_reading_t reading;
+        SampleApp_Node_t *node;
+        uint8 i;
 
-        if(id==1)
+        if (len < SAMPLE_APP_READING_OLD_LEN)
         {
-          sprintf(buff, "%d T&H:%d %d", id, t, h);
-          HalLcdWriteString(buff, HAL_LCD_LINE_2); //LCD显示
+          break;
         }
-        else if(id==2)
+
+        reading.node_id = data[0]; //终端id
+        node = SampleApp_NodeLookup(pkt->srcAddr.addr.shortAddr, data[0]);
+
+        if (len % SAMPLE_APP_RECORD_LEN == SAMPLE_APP_MSG_HEAD)
         {
-          sprintf(buff, "%d T&H:%d %d", id, t, h);
-          HalLcdWriteString(buff, HAL_LCD_LINE_3); //LCD显示
+          //带报文序号，重发来的重复报文整个丢掉
+          if (node != NULL
+              && !SampleApp_NodeSeq(node, data[1], data[SAMPLE_APP_MSG_HEAD + 1] >> SAMPLE_APP_READING_EPOCH_SHIFT))
+          {
+            SampleApp_RxDuplicates++;
+            break;
+          }
+          i = SAMPLE_APP_MSG_HEAD;
         }
-        else if(id==3)
+        else if (len % SAMPLE_APP_RECORD_LEN == 1 && len >= SAMPLE_APP_READING_LEN)
         {
-          sprintf(buff, "%d T&H:%d %d", id, t, h);
-          HalLcdWriteString(buff, HAL_LCD_LINE_4); //LCD显示
+          i = 1;
+        }
+        else
+        {
+          reading.seq = 0;
+          reading.flags = UPLINK_FLAG_NO_SEQ;
+          reading.temperature = data[1] * 10;
+          reading.humidity = data[2] * 10;
+          reading.age = 0;
+          SampleApp_ProcessReading(node, &reading);
+          break;
         }
 
-        
-        HalUARTWrite(0, buff, osal_strlen(buff));           //串口输出提示信息
-        HalUARTWrite(0, "\r\n",2);
-#else        
-        //打包无线发送的数据        
-        buff[0]=id;//终端id
-        buff[1]=t; //终端温度
-        buff[2]=h; //终端湿度
-
-        //打包数据用于发送到wifi网关，或者串口
-        packDataAndSend(FUN_CODE_UPDATA_DATA, buff, 3);
-      
-#endif
+        //低功耗终端一个报文里可能有好几条
+        for ( ; i + SAMPLE_APP_RECORD_LEN <= len; i += SAMPLE_APP_RECORD_LEN)
+        {
+          reading.seq = data[i];
+          reading.flags = (data[i+1] & SAMPLE_APP_READING_INVALID) ? UPLINK_FLAG_INVALID : 0;
+          reading.temperature = (int16)BUILD_UINT16(data[i+2], data[i+3]);
+          reading.humidity = (int16)BUILD_UINT16(data[i+4], data[i+5]);
+          reading.age = BUILD_UINT16(data[i+6], data[i+7]);
+          SampleApp_ProcessReading(node, &reading);
+        }
     }
 #endif
     break;
 
+  // 协调器转来的网关命令：功能码，数据
   case SAMPLEAPP_PERIODIC_CLUSTERID:
-
+#ifndef ZDO_COORDINATOR
+    if (pkt->cmd.DataLength >= 1)
+    {
+      SampleApp_ProcessCommand(pkt->cmd.Data[0], pkt->cmd.Data + 1, pkt->cmd.DataLength - 1);
+    }
+#endif
     break;
 
     default:
@@ -332,7 +839,9 @@ void SampleApp_ProcessMSGCmd( afIncomingMSGPacket_t *pkt )
 /*********************************************************************
  * @fn      SampleApp_CallBack
  *
- * @brief   Send data OTA.
+ * @brief   Collect gateway commands from the UART. Everything the HAL
+ *          has buffered is read into the receive ring and parsed, a
+ *          ring's worth at a time.
  *
  * @param   port - UART port.
  * @param   event - the UART port event flag.
@@ -343,109 +852,1308 @@ void SampleApp_CallBack(uint8 port, uint8 event)
 {
   (void)port;
 
-  if ((event & (HAL_UART_RX_FULL | HAL_UART_RX_ABOUT_FULL | HAL_UART_RX_TIMEOUT)) &&
-#if SAMPLE_APP_LOOPBACK
-      (SampleApp_TxLen < SAMPLE_APP_TX_MAX))
+  if (event & (HAL_UART_RX_FULL | HAL_UART_RX_ABOUT_FULL | HAL_UART_RX_TIMEOUT))
+  {
+#ifdef ZDO_COORDINATOR
+    while (SampleApp_RxFill() > 0)
+    {
+      SampleApp_ProcessUart();
+    }
 #else
-      !SampleApp_TxLen)
+    uint8 buf[16];
+
+    while (HalUARTRead(SAMPLE_APP_PORT, buf, sizeof(buf)) > 0);    // 终端的串口只用来打印
 #endif
-  {
-    SampleApp_TxLen += HalUARTRead(SAMPLE_APP_PORT, SampleApp_TxBuf+SampleApp_TxLen+1,
-                                                      SAMPLE_APP_TX_MAX-SampleApp_TxLen);
   }
 }
 
+#ifndef ZDO_COORDINATOR
 /*********************************************************************
  * @fn      SampleApp_Send_P2P_Message
  *
- * @brief   point to point.
+ * @brief   point to point. 把攒下的读数一个报文发给协调器，报文留在
+ *          重发队列里直到确认
  *
- * @param   none
+ * @param   readings - DHT11 读数，按采样先后
+ * @param   count - 条数，1..SAMPLE_APP_BATCH
  *
  * @return  none
  */
-void SampleApp_Send_P2P_Message( void )
+static void SampleApp_Send_P2P_Message( const DHT11_Reading_t *readings, uint8 count )
 {
-  uint8 str[5]={0};
-  uint8 strTemp[20]={0};
+  SampleApp_Retx_t *entry = NULL;
+  uint8 *str;
   int len=0;
+  uint8 i;
 
-  DHT11();             //获取温湿度
-
-  str[0] = 1;//增加一个ID，如果是多个终端就增加这个值
-  str[1] = wendu;//温度
-  str[2] = shidu;//湿度
-  len=3;
-
-  sprintf(strTemp, "T&H:%d %d", str[1],str[2]);
-  HalLcdWriteString(strTemp, HAL_LCD_LINE_3); //LCD显示
+  // 入网后随机数才靠得住
+  if ( SampleApp_Epoch == 0 )
+  {
+    SampleApp_Epoch = (uint8)(osal_rand() % SAMPLE_APP_READING_EPOCH_MAX) + 1;
+  }
 
-  HalUARTWrite(0, strTemp, osal_strlen(strTemp));           //串口输出提示信息
-  HalUARTWrite(0, "\r\n",2);
+  //空位，没有就挤掉最早的一个
+  for (i = 0; i < SAMPLE_APP_RETX_QUEUE; i++)
+  {
+    SampleApp_Retx_t *e = &SampleApp_Retx[i];
 
-  //无线发送到协调器
-  if ( AF_DataRequest( &SampleApp_P2P_DstAddr, &SampleApp_epDesc,
-                       SAMPLEAPP_P2P_CLUSTERID,
-                       len,
-                       str,
-                       &SampleApp_MsgID,
-                       AF_DISCV_ROUTE,
-                       AF_DEFAULT_RADIUS ) == afStatus_SUCCESS )
+    if (e->state == SAMPLE_APP_RETX_FREE)
+    {
+      entry = e;
+      break;
+    }
+    if (entry == NULL || (int8)(e->msg[1] - entry->msg[1]) < 0)
+    {
+      entry = e;
+    }
+  }
+  if (entry->state != SAMPLE_APP_RETX_FREE)
   {
+    SampleApp_TxDropped++;
   }
-  else
+
+  str = entry->msg;
+  str[len++] = SampleApp_NodeId;//终端id
+  str[len++] = SampleApp_TxSeq++;
+  for (i = 0; i < count; i++)
   {
-    // Error occurred in request to send.
+    const DHT11_Reading_t *reading = &readings[i];
+
+    entry->times[i] = reading->time;
+    str[len++] = reading->seq;
+    str[len++] = (reading->valid ? 0 : SAMPLE_APP_READING_INVALID)
+                 | (uint8)(SampleApp_Epoch << SAMPLE_APP_READING_EPOCH_SHIFT);
+    str[len++] = LO_UINT16(reading->temperature);//温度
+    str[len++] = HI_UINT16(reading->temperature);
+    str[len++] = LO_UINT16(reading->humidity);//湿度
+    str[len++] = HI_UINT16(reading->humidity);
+    len += 2;                   // age，发送时填
   }
-}
 
-uint8 CheckSum(uint8 *pdata, uint8 len)
-{
-	uint8 i;
-	uint8 check_sum=0;
+#if SAMPLE_APP_DEBUG
+  {
+    const DHT11_Reading_t *reading = &readings[count - 1];
+    uint8 strTemp[20]={0};
+    uint16 t;
+    uint8 n;
+
+    t = (reading->temperature < 0) ? -reading->temperature : reading->temperature;
+    n = sprintf(strTemp, "T&H:%s%d.%d %d%s", (reading->temperature < 0) ? "-" : "", t / 10, t % 10,
+                reading->humidity / 10, reading->valid ? "" : "?");
+    HalLcdWriteString(strTemp, HAL_LCD_LINE_3); //LCD显示
+
+    strTemp[n++] = '\r';
+    strTemp[n++] = '\n';
+    HalUARTWrite(0, strTemp, n);           //串口输出提示信息
+  }
+#endif
 
-	for(i=0; i<len; i++)
-	{
-		check_sum += pdata[i];
-	}
-	return check_sum;
+  entry->len = len;
+  entry->count = count;
+  entry->tries = 0;
+  SampleApp_Transmit(entry);
 }
 
-//数据打包发送
-/**
-*fc:功能码
-*data:上传的数据
-*len:数据长度
-格式:len,校验,fc,内容,$,@,
-*/
-void packDataAndSend(uint8 fc, uint8* data, uint8 len)
+/*********************************************************************
+ * @fn      SampleApp_Transmit
+ *
+ * @brief   Send a queued message to the coordinator with an APS ack
+ *          request; the stack answers with AF_DATA_CONFIRM_CMD. The
+ *          ages are filled in from the sample times on every send, the
+ *          stack's own APS retries reuse them as they are.
+ *
+ * @param   entry - retransmit queue entry
+ *
+ * @return  none
+ */
+static void SampleApp_Transmit( SampleApp_Retx_t *entry )
 {
-    osal_memset(SampleApp_TxBuf, 0, SAMPLE_APP_TX_MAX+1);
+  uint32 now = osal_GetSystemClock();
+  uint8 *age = entry->msg + SAMPLE_APP_MSG_HEAD + SAMPLE_APP_RECORD_LEN - 2;
+  uint32 units;
+  uint8 i;
 
+  for ( i = 0; i < entry->count; i++, age += SAMPLE_APP_RECORD_LEN )
+  {
+    units = (now - entry->times[i]) / UPLINK_AGE_UNIT_MS;
+    if ( units > UPLINK_AGE_MAX )
+    {
+      units = UPLINK_AGE_MAX;
+    }
+    age[0] = LO_UINT16(units);
+    age[1] = HI_UINT16(units);
+  }
 
-    //数据包长度
-    SampleApp_TxBuf[0]=3+len;
+  entry->transID = SampleApp_MsgID;
+  entry->tries++;
+  entry->state = SAMPLE_APP_RETX_WAIT;
 
-    //功能码
-    SampleApp_TxBuf[2]=fc;
+  //无线发送到协调器
+  if ( AF_DataRequest( &SampleApp_P2P_DstAddr, &SampleApp_epDesc,
+                       SAMPLEAPP_P2P_CLUSTERID,
+                       entry->len,
+                       entry->msg,
+                       &SampleApp_MsgID,
+                       AF_DISCV_ROUTE | AF_ACK_REQUEST,
+                       AF_DEFAULT_RADIUS ) != afStatus_SUCCESS )
+  {
+    // 没发出去，不会有确认，当作失败
+    SampleApp_DataConfirm( entry->transID, afStatus_FAILED );
+  }
+}
 
-    //发送的数据
-    if(len>0)
+/*********************************************************************
+ * @fn      SampleApp_DataConfirm
+ *
+ * @brief   Settle a queued message on its APS confirm. Acked messages
+ *          leave the queue; failed ones are retried with a doubling
+ *          delay until SAMPLE_APP_RETX_MAX retries were spent.
+ *
+ * @param   transID - AF transaction id of the send
+ * @param   status - ZSuccess or the failure status
+ *
+ * @return  none
+ */
+static void SampleApp_DataConfirm( uint8 transID, uint8 status )
+{
+  SampleApp_Retx_t *entry = NULL;
+  uint8 i;
+
+  for ( i = 0; i < SAMPLE_APP_RETX_QUEUE; i++ )
+  {
+    if ( SampleApp_Retx[i].state == SAMPLE_APP_RETX_WAIT && SampleApp_Retx[i].transID == transID )
     {
-        osal_memcpy(SampleApp_TxBuf+3, data, len);
+      entry = &SampleApp_Retx[i];
+      break;
     }
+  }
+  if ( entry == NULL )
+  {
+    return;
+  }
 
-    //校验和,从fc开始，
-    SampleApp_TxBuf[1]=CheckSum(SampleApp_TxBuf+2, len+1);
-
-    //数据结尾
-    SampleApp_TxBuf[3+len]='$';
-    SampleApp_TxBuf[4+len]='@';
+  if ( status == ZSuccess )
+  {
+    SampleApp_TxAcked++;
+    entry->state = SAMPLE_APP_RETX_FREE;
+    return;
+  }
 
-    //发送长度
-    SampleApp_TxLen=5+len;
+  if ( entry->tries > SAMPLE_APP_RETX_MAX )
+  {
+    SampleApp_TxLost++;
+    entry->state = SAMPLE_APP_RETX_FREE;
+    return;
+  }
 
-    //接着发数据包
-    HalUARTWrite(0,SampleApp_TxBuf, SampleApp_TxLen);
+  // 链路不好时别马上重发，一次比一次等得久
+  entry->state = SAMPLE_APP_RETX_DUE;
+  entry->due = osal_GetSystemClock() + ((uint32)SAMPLE_APP_RETX_DELAY << (entry->tries - 1))
+               + (osal_rand() & 0x00FF);
+  SampleApp_Retransmit();
 }
 
+/*********************************************************************
+ * @fn      SampleApp_Retransmit
+ *
+ * @brief   Resend the queued messages whose delay ran out and arm
+ *          SAMPLEAPP_RETX_EVT for the next one.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void SampleApp_Retransmit( void )
+{
+  uint32 now = osal_GetSystemClock();
+  uint32 next = 0;
+  uint8 i;
+
+  for ( i = 0; i < SAMPLE_APP_RETX_QUEUE; i++ )
+  {
+    SampleApp_Retx_t *entry = &SampleApp_Retx[i];
+
+    if ( entry->state != SAMPLE_APP_RETX_DUE )
+    {
+      continue;
+    }
+    if ( (int32)(entry->due - now) <= 0 )
+    {
+      SampleApp_TxRetries++;
+      SampleApp_Transmit( entry );
+    }
+    else if ( next == 0 || entry->due - now < next )
+    {
+      next = entry->due - now;
+    }
+  }
+
+  if ( next != 0 )
+  {
+    osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_RETX_EVT, next );
+  }
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ReportDue
+ *
+ * @brief   Decide whether a reading goes out. It does at once when it
+ *          left a non-zero dead-band around the last reported one or its
+ *          validity changed, and may be batched when the heartbeat is due
+ *          or a metric whose dead-band is zero changed at all; otherwise
+ *          it is counted as suppressed and the sample period backs off.
+ *
+ * @param   reading - the new reading
+ *
+ * @return  SAMPLE_APP_REPORT_NONE, _HEARTBEAT or _CHANGE
+ */
+static uint8 SampleApp_ReportDue( const DHT11_Reading_t *reading )
+{
+  int16 dT = reading->temperature - SampleApp_LastReport.temperature;
+  int16 dH = (int16)(reading->humidity - SampleApp_LastReport.humidity);
+  uint8 due = SAMPLE_APP_REPORT_HEARTBEAT;
+
+  if ( dT < 0 ) dT = -dT;
+  if ( dH < 0 ) dH = -dH;
+
+  if ( !SampleApp_Reported || reading->valid != SampleApp_LastReport.valid
+       || ( SampleApp_DeadbandT != 0 && dT >= SampleApp_DeadbandT )
+       || ( SampleApp_DeadbandH != 0 && dH >= SampleApp_DeadbandH ) )
+  {
+    // 变了，回到基本周期
+    SampleApp_Backoff = 0;
+    due = SAMPLE_APP_REPORT_CHANGE;
+  }
+  else if ( ( SampleApp_DeadbandT == 0 && dT > 0 )
+            || ( SampleApp_DeadbandH == 0 && dH > 0 ) )
+  {
+    // 死区为0的那项变了，发，但跟着批走
+    SampleApp_Backoff = 0;
+  }
+  else if ( reading->time - SampleApp_LastReport.time < (uint32)SampleApp_Heartbeat * 1000 )
+  {
+    if ( SampleApp_Backoff < SAMPLE_APP_BACKOFF_MAX )
+    {
+      SampleApp_Backoff++;
+    }
+    SampleApp_ReportsSuppressed++;
+    return SAMPLE_APP_REPORT_NONE;
+  }
+  else
+  {
+    SampleApp_Heartbeats++;
+  }
+
+  SampleApp_LastReport = *reading;
+  SampleApp_Reported = TRUE;
+  SampleApp_ReportsSent++;
+  return due;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_NextSample
+ *
+ * @brief   Time to the next sample: the base period doubled once per
+ *          suppressed reading up to SAMPLE_APP_BACKOFF_MAX, but never
+ *          past the heartbeat, plus a little jitter.
+ *
+ * @param   none
+ *
+ * @return  timeout in ms
+ */
+static uint32 SampleApp_NextSample( void )
+{
+  uint32 next = SampleApp_Interval << SampleApp_Backoff;
+
+  if ( SampleApp_Reported )
+  {
+    uint32 since = osal_GetSystemClock() - SampleApp_LastReport.time;
+    uint32 heartbeat = (uint32)SampleApp_Heartbeat * 1000;
+    uint32 left = (since < heartbeat) ? heartbeat - since : 0;
+
+    if ( next > left )
+    {
+      next = (left > SampleApp_Interval) ? left : SampleApp_Interval;
+    }
+  }
+
+  return next + (osal_rand() & 0x00FF);
+}
+
+/*********************************************************************
+ * @fn      SampleApp_Queue
+ *
+ * @brief   Hold a reading until the batch is full or its oldest reading
+ *          has waited SAMPLE_APP_BATCH_HOLD ms, then send the batch in
+ *          one message. A changed reading sends the batch at once, so
+ *          only heartbeats wait. The hold is only checked when the node
+ *          wakes for a sample, so it is stretched by at most one period.
+ *          With a batch of 1 every reading goes out at once.
+ *
+ * @param   reading - the new reading
+ * @param   due - what SampleApp_ReportDue made of it, NONE only checks the hold
+ *
+ * @return  none
+ */
+static void SampleApp_Queue( const DHT11_Reading_t *reading, uint8 due )
+{
+  if ( due != SAMPLE_APP_REPORT_NONE )
+  {
+    SampleApp_Batch[SampleApp_BatchLen++] = *reading;
+  }
+
+  if ( SampleApp_BatchLen == 0 )
+  {
+    return;
+  }
+  if ( due != SAMPLE_APP_REPORT_CHANGE && SampleApp_BatchLen < SAMPLE_APP_BATCH
+       && osal_GetSystemClock() - SampleApp_Batch[0].time < SAMPLE_APP_BATCH_HOLD )
+  {
+    return;
+  }
+
+  SampleApp_Send_P2P_Message( SampleApp_Batch, SampleApp_BatchLen );
+  SampleApp_BatchLen = 0;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ProcessCommand
+ *
+ * @brief   Apply a gateway command forwarded by the coordinator, if it
+ *          is addressed to this node, its group or all nodes.
+ *
+ * @param   fc - function code
+ * @param   data - target (16 bit le) followed by the parameters
+ * @param   len - data length
+ *
+ * @return  none
+ */
+static void SampleApp_ProcessCommand( uint8 fc, uint8 *data, uint8 len )
+{
+  uint16 target;
+  uint16 v;
+  uint8 mask;
+  uint8 i;
+
+  if ( len < 2 )
+  {
+    return;
+  }
+
+  target = BUILD_UINT16( data[0], data[1] );
+  if ( target != 0 && target != SampleApp_NodeId
+       && target != (SAMPLE_APP_TARGET_GROUP | SampleApp_Group.ID) )
+  {
+    return;
+  }
+
+  switch ( fc )
+  {
+  case FUN_CODE_NODE_CONFIG:
+    if ( len < 3 )
+    {
+      return;
+    }
+    mask = data[2];
+    i = 3;
+    if ( mask & SAMPLE_APP_CONFIG_INTERVAL )
+    {
+      if ( i + 2 > len ) return;
+      v = BUILD_UINT16( data[i], data[i+1] );
+      i += 2;
+      if ( v != 0 )
+      {
+        SampleApp_Interval = (uint32)v * 1000;
+      }
+    }
+    if ( mask & SAMPLE_APP_CONFIG_DEADBAND_T )
+    {
+      if ( i + 1 > len ) return;
+      SampleApp_DeadbandT = data[i++];
+    }
+    if ( mask & SAMPLE_APP_CONFIG_DEADBAND_H )
+    {
+      if ( i + 1 > len ) return;
+      SampleApp_DeadbandH = data[i++];
+    }
+    if ( mask & SAMPLE_APP_CONFIG_HEARTBEAT )
+    {
+      if ( i + 2 > len ) return;
+      v = BUILD_UINT16( data[i], data[i+1] );
+      if ( v != 0 )
+      {
+        SampleApp_Heartbeat = v;
+      }
+    }
+    break;
+
+  case FUN_CODE_SET_INTERVAL:
+    v = (len >= 4) ? BUILD_UINT16( data[2], data[3] ) : 0;
+    if ( v == 0 )
+    {
+      return;
+    }
+    SampleApp_Interval = (uint32)v * 1000;
+    break;
+
+  case FUN_CODE_SET_REPORT:
+    if ( len < 6 )
+    {
+      return;
+    }
+    if ( data[2] != 0xFF )
+    {
+      SampleApp_DeadbandT = data[2];
+    }
+    if ( data[3] != 0xFF )
+    {
+      SampleApp_DeadbandH = data[3];
+    }
+    v = BUILD_UINT16( data[4], data[5] );
+    if ( v != 0 )
+    {
+      SampleApp_Heartbeat = v;
+    }
+    break;
+
+  default:
+    return;
+  }
+
+  // 新策略马上生效
+  SampleApp_Backoff = 0;
+  osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_SEND_PERIODIC_MSG_EVT,
+                      SampleApp_NextSample() );
+}
+#endif
+
+#ifdef ZDO_COORDINATOR
+/*********************************************************************
+ * @fn      SampleApp_NodeLookup
+ *
+ * @brief   Find the table slot of a node, claiming an empty one for a
+ *          node heard for the first time, and mark it heard now. Linear
+ *          probing from a hash of short address and id.
+ *
+ * @param   shortAddr - network address of the sender
+ * @param   id - node id carried in the reading
+ *
+ * @return  the slot, NULL when the table is full
+ */
+static SampleApp_Node_t *SampleApp_NodeLookup( uint16 shortAddr, uint8 id )
+{
+  uint16 pos = (uint16)((shortAddr * 31u) ^ id);
+  uint16 now = (uint16)(osal_GetSystemClock() >> 10);
+  uint16 i;
+
+  for ( i = 0; i < SAMPLE_APP_NODE_SLOTS; i++ )
+  {
+    SampleApp_Node_t *node = &SampleApp_Nodes[(pos + i) & (SAMPLE_APP_NODE_SLOTS - 1)];
+
+    if ( node->shortAddr == shortAddr && node->id == id )
+    {
+      node->seen = now;
+      return node;
+    }
+
+    if ( node->shortAddr == 0xFFFF )
+    {
+      if ( SampleApp_NodeCount >= SAMPLE_APP_NODE_MAX )
+      {
+        return NULL;
+      }
+
+      node->shortAddr = shortAddr;
+      node->id = id;
+      node->count = 0;
+      node->t = node->h = SAMPLE_APP_NO_READING;
+      node->rxMask = 0;
+      node->rxEpoch = 0;
+      node->missed = 0;
+      node->held = FALSE;
+      node->seen = now;
+      SampleApp_NodeCount++;
+      return node;
+    }
+  }
+
+  return NULL;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_Whole
+ *
+ * @brief   Round tenths to a whole degree or percent for the 8 bit
+ *          summary and legacy records.
+ *
+ * @param   tenths - value in 0.1 units
+ *
+ * @return  rounded value, clamped to 0..255
+ */
+static uint8 SampleApp_Whole( int16 tenths )
+{
+  if ( tenths <= 0 )
+  {
+    return 0;
+  }
+  if ( tenths >= 2550 )
+  {
+    return 0xFF;
+  }
+  return (uint8)((tenths + 5) / 10);
+}
+
+/*********************************************************************
+ * @fn      SampleApp_WholeSigned
+ *
+ * @brief   Round tenths to a whole degree for the signed temperature
+ *          of the summary records, halves away from zero.
+ *
+ * @param   tenths - value in 0.1 units
+ *
+ * @return  rounded value, clamped to -128..127
+ */
+static int8 SampleApp_WholeSigned( int16 tenths )
+{
+  if ( tenths <= -1280 )
+  {
+    return -128;
+  }
+  if ( tenths >= 1270 )
+  {
+    return 127;
+  }
+  return (int8)((tenths + ((tenths < 0) ? -5 : 5)) / 10);
+}
+
+/*********************************************************************
+ * @fn      SampleApp_NodeUpdate
+ *
+ * @brief   Fold one reading into the node's latest value and the
+ *          window's count. Failed sensor reads are not folded in.
+ *
+ * @param   node - table slot
+ * @param   reading - the node's reading, in tenths
+ *
+ * @return  TRUE if the latest value changed, the node is new or the
+ *          read failed
+ */
+static uint8 SampleApp_NodeUpdate( SampleApp_Node_t *node, const uplink_reading_t *reading )
+{
+  uint8 changed = (node->t != reading->temperature) || (node->h != reading->humidity);
+
+  //读失败的照样转给网关，由网关计数丢弃
+  if ( reading->flags & UPLINK_FLAG_INVALID )
+  {
+    return TRUE;
+  }
+
+  if ( node->count < 0xFF )
+  {
+    node->count++;
+  }
+
+  node->t = reading->temperature;
+  node->h = reading->humidity;
+
+  return changed;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_NodeSeq
+ *
+ * @brief   Check a message sequence number against the last
+ *          SAMPLE_APP_SEQ_WINDOW seen from the node. Numbers skipped
+ *          are counted as missing until a retransmission fills them in.
+ *          A new power-up epoch, or for nodes without one a number far
+ *          behind the window, means the node restarted counting at 0.
+ *
+ * @param   node - the sender's slot
+ * @param   seq - message sequence number
+ * @param   epoch - the node's power-up epoch, 0 if it sends none
+ *
+ * @return  FALSE if the message was already received
+ */
+static uint8 SampleApp_NodeSeq( SampleApp_Node_t *node, uint8 seq, uint8 epoch )
+{
+  int8 d = (int8)(seq - node->rxSeq);
+  uint16 bit;
+
+  if ( node->rxMask == 0 || d <= -SAMPLE_APP_SEQ_WINDOW
+       || ( epoch != 0 && epoch != node->rxEpoch ) )
+  {
+    node->rxEpoch = epoch;
+    node->rxSeq = seq;
+    node->rxMask = 1;
+    return TRUE;
+  }
+
+  if ( d > 0 )
+  {
+    SampleApp_RxMissing += d - 1;
+    node->missed = (node->missed + d - 1 > 0xFF) ? 0xFF : node->missed + d - 1;
+    node->rxMask = (d < SAMPLE_APP_SEQ_WINDOW) ? (uint16)(node->rxMask << d) | 1 : 1;
+    node->rxSeq = seq;
+    return TRUE;
+  }
+
+  bit = (uint16)1 << -d;
+  if ( node->rxMask & bit )
+  {
+    return FALSE;
+  }
+
+  //晚到的重发补上了缺口
+  node->rxMask |= bit;
+  SampleApp_RxRecovered++;
+  if ( node->missed > 0 )
+  {
+    node->missed--;
+  }
+  return TRUE;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ProcessReading
+ *
+ * @brief   Book one reading from a node into the node table and pass it
+ *          on to the gateway unless it did not change.
+ *
+ * @param   node - the sender's slot, NULL when the table is full
+ * @param   reading - the node's reading, in tenths
+ *
+ * @return  none
+ */
+static void SampleApp_ProcessReading( SampleApp_Node_t *node, const uplink_reading_t *reading )
+{
+  SampleApp_LcdReading = *reading;
+  SampleApp_LcdDirty = TRUE;
+
+  if (node != NULL && !SampleApp_NodeUpdate(node, reading))
+  {
+    //读数没变，留给周期汇总
+    SampleApp_Suppressed++;
+    node->held = TRUE;
+    node->heldTime = osal_GetSystemClock() - (uint32)reading->age * UPLINK_AGE_UNIT_MS;
+    return;
+  }
+  if (node != NULL)
+  {
+    //网关有了更新的，之前没转的不用补了
+    node->held = FALSE;
+  }
+  if (node == NULL)
+  {
+    SampleApp_NodeTableFull++;
+  }
+
+  //新节点或读数变化才上串口，网关按帧解析
+  SampleApp_ForwardReading(reading);
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ShowNodes
+ *
+ * @brief   Show the last reading received and the node count on the
+ *          LCD, when a reading came in since the last time.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void SampleApp_ShowNodes( void )
+{
+  uint8 buff[20]={0};
+
+  if ( !SampleApp_LcdDirty )
+  {
+    return;
+  }
+  SampleApp_LcdDirty = FALSE;
+
+  sprintf(buff, "%d T&H:%d %d", SampleApp_LcdReading.node_id,
+          SampleApp_WholeSigned(SampleApp_LcdReading.temperature), SampleApp_Whole(SampleApp_LcdReading.humidity));
+  HalLcdWriteString(buff, HAL_LCD_LINE_2); //LCD显示最近一次上报
+
+  sprintf(buff, "Nodes:%d", SampleApp_NodeCount);
+  HalLcdWriteString(buff, HAL_LCD_LINE_3);
+}
+
+/*********************************************************************
+ * @fn      SampleApp_SendNodeSummary
+ *
+ * @brief   Send the next frame of the node table summary, as many
+ *          records as fit, and start a new statistics window for them.
+ *          Nodes that were silent for the window are sent with a count
+ *          of 0, the age of the newest reading held back is only set
+ *          when the gateway has not seen it. While frames are still waiting for the UART the summary
+ *          holds back, so readings are not dropped behind it.
+ *
+ * @param   none
+ *
+ * @return  TRUE if part of the table is still to be sent
+ */
+static uint8 SampleApp_SendNodeSummary( void )
+{
+  uint8 rec[SAMPLE_APP_TX_MAX];
+  uint8 len = 0;
+  uint32 now = osal_GetSystemClock();
+  uint32 age;
+
+  if ( SampleApp_TxLen[0] + SampleApp_TxLen[1] > 0 )
+  {
+    return TRUE;
+  }
+
+  for ( ; SampleApp_SummaryPos < SAMPLE_APP_NODE_SLOTS; SampleApp_SummaryPos++ )
+  {
+    SampleApp_Node_t *node = &SampleApp_Nodes[SampleApp_SummaryPos];
+    uint8 *p = rec + len;
+
+    if ( node->shortAddr == 0xFFFF )
+    {
+      continue;
+    }
+
+    if ( len + SAMPLE_APP_SUMMARY_REC > SAMPLE_APP_TX_MAX )
+    {
+      break;
+    }
+
+    p[0]  = node->id;
+    p[1]  = LO_UINT16( node->shortAddr );
+    p[2]  = HI_UINT16( node->shortAddr );
+    p[3]  = (uint8)SampleApp_WholeSigned( node->t );
+    p[4]  = SampleApp_Whole( node->h );
+    p[5]  = node->count;
+    p[6]  = node->missed;
+    age = SAMPLE_APP_SUMMARY_NONE;
+    if ( node->held )
+    {
+      age = (now - node->heldTime) / UPLINK_AGE_UNIT_MS;
+      if ( age > UPLINK_AGE_MAX )
+      {
+        age = UPLINK_AGE_MAX;
+      }
+    }
+    p[7]  = LO_UINT16( age );
+    p[8]  = HI_UINT16( age );
+    len += SAMPLE_APP_SUMMARY_REC;
+
+    // 新窗口从零开始数
+    node->count = 0;
+    node->missed = 0;
+    node->held = FALSE;
+  }
+
+  if ( len > 0 )
+  {
+    packDataAndSend(FUN_CODE_NODE_SUMMARY, rec, len);
+  }
+
+  if ( SampleApp_SummaryPos < SAMPLE_APP_NODE_SLOTS )
+  {
+    return TRUE;
+  }
+
+  SampleApp_SummaryPos = 0;
+  return FALSE;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ForwardReading
+ *
+ * @brief   Queue a reading for the gateway. Readings are packed into one
+ *          uplink frame until it is full or SAMPLE_APP_UPLINK_HOLD ms
+ *          have passed since the first of them. The time left until
+ *          then is added to the reading's age, a frame that fills up
+ *          early leaves less than SAMPLE_APP_UPLINK_HOLD over.
+ *
+ * @param   reading - the node's reading, in tenths
+ *
+ * @return  none
+ */
+static void SampleApp_ForwardReading( const uplink_reading_t *reading )
+{
+#if SAMPLE_APP_UPLINK_LEGACY
+  uint8 buff[3];
+
+  buff[0]=(uint8)reading->node_id;//终端id
+  buff[1]=SampleApp_Whole(reading->temperature); //终端温度
+  buff[2]=SampleApp_Whole(reading->humidity); //终端湿度
+
+  //打包数据用于发送到龙芯网关
+  packDataAndSend(FUN_CODE_UPDATA_DATA, buff, 3);
+#else
+  uplink_reading_t held = *reading;
+  uint32 now = osal_GetSystemClock();
+  uint32 age;
+
+  if ( SampleApp_Uplink.count > 0
+       && SampleApp_Uplink.len + UPLINK_READING_MAX > UPLINK_PAYLOAD_MAX )
+  {
+    //帧满了，先发出去再放进新帧
+    SampleApp_FlushUplink();
+  }
+  if ( SampleApp_Uplink.count == 0 )
+  {
+    SampleApp_UplinkFirst = now;
+  }
+
+  //在协调器这里还要等到帧发出去，定时器晚了就不等了
+  age = SampleApp_UplinkFirst + SAMPLE_APP_UPLINK_HOLD - now;
+  if ( (int32)age < 0 )
+  {
+    age = 0;
+  }
+  age = held.age + (age + UPLINK_AGE_UNIT_MS / 2) / UPLINK_AGE_UNIT_MS;
+  held.age = (age > UPLINK_AGE_MAX) ? UPLINK_AGE_MAX : (uint16)age;
+  uplink_encoder_add(&SampleApp_Uplink, &held);
+
+  if ( SampleApp_Uplink.count == 1 )
+  {
+    osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_UPLINK_FLUSH_EVT,
+                        SAMPLE_APP_UPLINK_HOLD );
+  }
+#endif
+}
+
+#if !SAMPLE_APP_UPLINK_LEGACY
+/*********************************************************************
+ * @fn      SampleApp_FlushUplink
+ *
+ * @brief   Send the readings frame under construction, if any.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void SampleApp_FlushUplink( void )
+{
+  uint16 len = uplink_encoder_finish(&SampleApp_Uplink);
+  uint8 *frame;
+
+  if ( len > 0 && (frame = SampleApp_TxReserve(len)) != NULL )
+  {
+    osal_memcpy(frame, SampleApp_UplinkBuf, len);
+    SampleApp_TxCommit(len);
+  }
+
+  osal_stop_timerEx( SampleApp_TaskID, SAMPLEAPP_UPLINK_FLUSH_EVT );
+  uplink_encoder_begin(&SampleApp_Uplink, SampleApp_UplinkBuf);
+}
+#endif
+
+/*********************************************************************
+ * @fn      SampleApp_RxFill
+ *
+ * @brief   Read what the HAL has buffered straight into the free part of
+ *          the receive ring, in two pieces when it wraps.
+ *
+ * @param   none
+ *
+ * @return  bytes read, 0 when the HAL is empty or the ring is full
+ */
+static uint8 SampleApp_RxFill( void )
+{
+  uint8 total = 0;
+  uint8 room, n;
+
+  do
+  {
+    room = SAMPLE_APP_RX_RING - (uint8)(SampleApp_RxTail - SampleApp_RxHead);
+    if ( room > SAMPLE_APP_RX_RING - (SampleApp_RxTail & SAMPLE_APP_RX_MASK) )
+    {
+      room = SAMPLE_APP_RX_RING - (SampleApp_RxTail & SAMPLE_APP_RX_MASK);
+    }
+    if ( room == 0 )
+    {
+      break;
+    }
+
+    n = HalUARTRead( SAMPLE_APP_PORT, SampleApp_RxRing + (SampleApp_RxTail & SAMPLE_APP_RX_MASK), room );
+    SampleApp_RxTail += n;
+    total += n;
+  } while ( n == room );
+
+  return total;
+}
+
+// 接收环里 SampleApp_RxHead 之后第 i 个字节
+#define SAMPLE_APP_RX_AT( i )  SampleApp_RxRing[(uint8)(SampleApp_RxHead + (i)) & SAMPLE_APP_RX_MASK]
+
+/*********************************************************************
+ * @fn      SampleApp_ProcessUart
+ *
+ * @brief   Take every complete gateway command out of the receive ring.
+ *          Frames are checked where they lie; the command data is handed
+ *          over in place unless it wraps around the end of the ring.
+ *          Bytes that do not start a valid frame are dropped one at a
+ *          time until the stream is back in sync.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void SampleApp_ProcessUart( void )
+{
+  uint8 avail, len, sum, pos, i;
+  uint8 *data;
+
+  while ( (avail = (uint8)(SampleApp_RxTail - SampleApp_RxHead)) >= SAMPLE_APP_DOWN_HEAD + 2 )
+  {
+    len = SAMPLE_APP_RX_AT( 0 );
+    if ( len < SAMPLE_APP_DOWN_HEAD || len > SAMPLE_APP_DOWN_HEAD + SAMPLE_APP_CMD_MAX )
+    {
+      SampleApp_RxHead++;
+      SampleApp_RxSkipped++;
+      continue;
+    }
+    if ( avail < len + 2 )
+    {
+      break;
+    }
+
+    sum = 0;
+    for ( i = 2; i < len; i++ )
+    {
+      sum += SAMPLE_APP_RX_AT( i );
+    }
+    if ( SAMPLE_APP_RX_AT( len ) != '$' || SAMPLE_APP_RX_AT( len + 1 ) != '@' || sum != SAMPLE_APP_RX_AT( 1 ) )
+    {
+      SampleApp_RxHead++;
+      SampleApp_RxSkipped++;
+      continue;
+    }
+
+    pos = (uint8)(SampleApp_RxHead + SAMPLE_APP_DOWN_HEAD) & SAMPLE_APP_RX_MASK;
+    if ( pos + (len - SAMPLE_APP_DOWN_HEAD) <= SAMPLE_APP_RX_RING )
+    {
+      data = SampleApp_RxRing + pos;
+    }
+    else
+    {
+      for ( i = 0; i < len - SAMPLE_APP_DOWN_HEAD; i++ )
+      {
+        SampleApp_RxCmd[i] = SAMPLE_APP_RX_AT( SAMPLE_APP_DOWN_HEAD + i );
+      }
+      data = SampleApp_RxCmd;
+    }
+
+    SampleApp_RxFrames++;
+    SampleApp_DispatchCommand( SAMPLE_APP_RX_AT( 2 ), data, len - SAMPLE_APP_DOWN_HEAD );
+    SampleApp_RxHead += len + 2;
+  }
+}
+
+// 网关命令，按功能码查
+static const SampleApp_UartCmd_t SampleApp_UartCmds[] =
+{
+  { FUN_CODE_SET_INTERVAL, 4, SampleApp_ForwardCommand },
+  { FUN_CODE_SET_REPORT,   6, SampleApp_ForwardCommand },
+  { FUN_CODE_NODE_CONFIG,  3, SampleApp_ForwardCommand },
+  { FUN_CODE_QUERY_NODES,  0, SampleApp_QueryNodes },
+  { FUN_CODE_PING,         0, SampleApp_Ping },
+};
+
+/*********************************************************************
+ * @fn      SampleApp_DispatchCommand
+ *
+ * @brief   Run the handler of one gateway command.
+ *
+ * @param   fc - function code
+ * @param   data - command data, valid until the handler returns
+ * @param   len - data length
+ *
+ * @return  none
+ */
+static void SampleApp_DispatchCommand( uint8 fc, uint8 *data, uint8 len )
+{
+  uint8 i;
+
+  for ( i = 0; i < sizeof(SampleApp_UartCmds) / sizeof(SampleApp_UartCmds[0]); i++ )
+  {
+    if ( SampleApp_UartCmds[i].fc == fc )
+    {
+      if ( len < SampleApp_UartCmds[i].minLen )
+      {
+        break;
+      }
+      SampleApp_UartCmds[i].handler( fc, data, len );
+      return;
+    }
+  }
+
+  SampleApp_RxUnknown++;
+}
+
+/*********************************************************************
+ * @fn      SampleApp_QueryNodes
+ *
+ * @brief   Start a node table summary now instead of at the end of the
+ *          period, so a gateway that just came up gets every node at
+ *          once. The statistics window of the summary ends early. A
+ *          summary already being sent is left to finish.
+ *
+ * @param   fc - FUN_CODE_QUERY_NODES
+ * @param   data - unused
+ * @param   len - unused
+ *
+ * @return  none
+ */
+static void SampleApp_QueryNodes( uint8 fc, uint8 *data, uint8 len )
+{
+  (void)fc;
+  (void)data;
+  (void)len;
+
+  if ( SampleApp_SummaryPos == 0 )
+  {
+    osal_stop_timerEx( SampleApp_TaskID, SAMPLEAPP_NODE_SUMMARY_EVT );
+    osal_set_event( SampleApp_TaskID, SAMPLEAPP_NODE_SUMMARY_EVT );
+  }
+}
+
+/*********************************************************************
+ * @fn      SampleApp_Ping
+ *
+ * @brief   Answer a ping with the same data.
+ *
+ * @param   fc - FUN_CODE_PING
+ * @param   data - whatever the gateway put in, usually a timestamp
+ * @param   len - data length
+ *
+ * @return  none
+ */
+static void SampleApp_Ping( uint8 fc, uint8 *data, uint8 len )
+{
+  packDataAndSend( fc, data, len );
+}
+
+/*********************************************************************
+ * @fn      SampleApp_ForwardCommand
+ *
+ * @brief   Send a node command from the gateway over the air in one
+ *          message: broadcast for all nodes, group-cast for a group and
+ *          unicast for a node in the table. A node that is not in the
+ *          table gets a broadcast; nodes check the target themselves.
+ *          A node that rejoined under a new short address has a slot
+ *          for each, the one heard last wins. Group-casts only reach
+ *          nodes with the receiver on, sleepy nodes do not hear them.
+ *
+ * @param   fc - function code
+ * @param   data - target (16 bit le) followed by the parameters
+ * @param   len - data length
+ *
+ * @return  none
+ */
+static void SampleApp_ForwardCommand( uint8 fc, uint8 *data, uint8 len )
+{
+  uint8 buf[1 + SAMPLE_APP_CMD_MAX];
+  afAddrType_t addr = SampleApp_Periodic_DstAddr;
+  SampleApp_Node_t *node = NULL;
+  uint16 now = (uint16)(osal_GetSystemClock() >> 10);
+  uint16 target;
+  uint16 i;
+
+  target = BUILD_UINT16( data[0], data[1] );
+  if ( target & SAMPLE_APP_TARGET_GROUP )
+  {
+    addr = SampleApp_Flash_DstAddr;
+    addr.addr.shortAddr = target & ~SAMPLE_APP_TARGET_GROUP;
+  }
+  else if ( target != 0 )
+  {
+    for ( i = 0; i < SAMPLE_APP_NODE_SLOTS; i++ )
+    {
+      SampleApp_Node_t *slot = &SampleApp_Nodes[i];
+
+      if ( slot->shortAddr != 0xFFFF && slot->id == target
+           && ( node == NULL || (uint16)(now - slot->seen) < (uint16)(now - node->seen) ) )
+      {
+        node = slot;
+      }
+    }
+    if ( node != NULL )
+    {
+      addr.addrMode = (afAddrMode_t)Addr16Bit;
+      addr.endPoint = SAMPLEAPP_ENDPOINT;
+      addr.addr.shortAddr = node->shortAddr;
+    }
+  }
+
+  buf[0] = fc;
+  osal_memcpy( buf + 1, data, len );
+
+  if ( AF_DataRequest( &addr, &SampleApp_epDesc,
+                       SAMPLEAPP_PERIODIC_CLUSTERID,
+                       len + 1,
+                       buf,
+                       &SampleApp_MsgID,
+                       AF_DISCV_ROUTE,
+                       AF_DEFAULT_RADIUS ) != afStatus_SUCCESS )
+  {
+    SampleApp_CmdFailures++;
+  }
+}
+#endif
+
+uint8 CheckSum(uint8 *pdata, uint8 len)
+{
+	uint8 i;
+	uint8 check_sum=0;
+
+	for(i=0; i<len; i++)
+	{
+		check_sum += pdata[i];
+	}
+	return check_sum;
+}
+
+#ifdef ZDO_COORDINATOR
+//数据打包发送，帧直接拼在串口发送缓冲里
+/**
+*fc:功能码
+*data:上传的数据
+*len:数据长度
+格式:sync,版本,fc,len,内容,crc16 见 uplink.h
+SAMPLE_APP_UPLINK_LEGACY 时为 len,校验,fc,内容,$,@,
+*/
+void packDataAndSend(uint8 fc, uint8* data, uint8 len)
+{
+    uint8 *frame;
+
+#if !SAMPLE_APP_UPLINK_LEGACY
+    frame=SampleApp_TxReserve(UPLINK_HEAD_SIZE+len+UPLINK_CRC_SIZE);
+    if(frame==NULL)
+    {
+        return;
+    }
+    if(len>0)
+    {
+        osal_memcpy(frame+UPLINK_HEAD_SIZE, data, len);
+    }
+    SampleApp_TxCommit(uplink_frame_pack(frame, fc, len));
+#else
+    frame=SampleApp_TxReserve(5+len);
+    if(frame==NULL)
+    {
+        return;
+    }
+
+    //数据包长度
+    frame[0]=3+len;
+
+    //功能码
+    frame[2]=fc;
+
+    //发送的数据
+    if(len>0)
+    {
+        osal_memcpy(frame+3, data, len);
+    }
+
+    //校验和,从fc开始，
+    frame[1]=CheckSum(frame+2, len+1);
+
+    //数据结尾
+    frame[3+len]='$';
+    frame[4+len]='@';
+
+    SampleApp_TxCommit(5+len);
+#endif
+}
+
+/*********************************************************************
+ * @fn      SampleApp_TxReserve
+ *
+ * @brief   Find room for a frame at the end of the transmit buffer being
+ *          filled. If it is full the other buffer is handed to the HAL
+ *          first, when the HAL has taken the previous one.
+ *
+ * @param   size - frame size in bytes
+ *
+ * @return  where to build the frame, NULL if both buffers are full and
+ *          the frame has to be dropped
+ */
+static uint8 *SampleApp_TxReserve( uint8 size )
+{
+  if ( SampleApp_TxLen[SampleApp_TxFill] + size > SAMPLE_APP_TX_SZ )
+  {
+    SampleApp_TxKick();
+  }
+
+  if ( SampleApp_TxLen[SampleApp_TxFill] + size > SAMPLE_APP_TX_SZ )
+  {
+    SampleApp_TxOverruns++;
+    return NULL;
+  }
+
+  return SampleApp_TxBuf[SampleApp_TxFill] + SampleApp_TxLen[SampleApp_TxFill];
+}
+
+/*********************************************************************
+ * @fn      SampleApp_TxCommit
+ *
+ * @brief   Append the frame built at SampleApp_TxReserve and start
+ *          sending it if the UART is free.
+ *
+ * @param   size - frame size in bytes, at most the reserved size
+ *
+ * @return  none
+ */
+static void SampleApp_TxCommit( uint8 size )
+{
+  uint16 queued;
+
+  SampleApp_TxLen[SampleApp_TxFill] += size;
+
+  queued = SampleApp_TxLen[0] + SampleApp_TxLen[1];
+  if ( queued > SampleApp_TxPeak )
+  {
+    SampleApp_TxPeak = queued;
+  }
+
+  SampleApp_TxKick();
+}
+
+/*********************************************************************
+ * @fn      SampleApp_TxKick
+ *
+ * @brief   Hand whatever is queued to the HAL. The DMA driver takes a
+ *          write whole or not at all; when it has no room the buffer
+ *          stays queued and is tried again after SAMPLE_APP_TX_RETRY ms
+ *          while frames keep going into the other one.
+ *
+ * @param   none
+ *
+ * @return  none
+ */
+static void SampleApp_TxKick( void )
+{
+  uint8 busy = SampleApp_TxFill ^ 1;
+
+  while ( SampleApp_TxLen[busy] > 0 || SampleApp_TxLen[SampleApp_TxFill] > 0 )
+  {
+    if ( SampleApp_TxLen[busy] == 0 )
+    {
+      //交出拼好的一块，换另一块接着拼
+      busy = SampleApp_TxFill;
+      SampleApp_TxFill ^= 1;
+    }
+
+    if ( HalUARTWrite( SAMPLE_APP_PORT, SampleApp_TxBuf[busy], SampleApp_TxLen[busy] ) == 0 )
+    {
+      SampleApp_TxBusy++;
+      if ( !SampleApp_TxWaiting )
+      {
+        SampleApp_TxWaiting = TRUE;
+        osal_start_timerEx( SampleApp_TaskID, SAMPLEAPP_UART_TX_EVT, SAMPLE_APP_TX_RETRY );
+      }
+      return;
+    }
+    SampleApp_TxLen[busy] = 0;
+  }
+}
+#endif
+
@@ -0,0 +1,29 @@
+/*
+ * DHT11 温湿度传感器，数据线 P0_7，中断驱动，见 DHT11.c
+ */
+#ifndef DHT11_H
+#define DHT11_H
+
+#include "hal_types.h"
+
+//DHT11_Read 的返回值
+#define DHT11_OK                0
+#define DHT11_ERR_NO_RESPONSE   1   //没有应答
+#define DHT11_ERR_TIMING        2   //沿的间隔不对，可能丢了沿
+#define DHT11_ERR_CHECKSUM      3   //校验错
+
+//一次读数。读失败时 valid 为 FALSE，温湿度保持上一次的正确值
+typedef struct
+{
+    uint32 time;            //采样时刻，osal_GetSystemClock() 毫秒
+    int16  temperature;     //0.1℃
+    uint16 humidity;        //0.1%RH
+    uint8  seq;             //每读一次加一，失败也加
+    uint8  valid;
+} DHT11_Reading_t;
+
+void  DHT11_Init(uint8 task_id, uint16 done_event);
+uint8 DHT11_Start(void);
+uint8 DHT11_Read(DHT11_Reading_t *reading);
+
+#endif /* DHT11_H */
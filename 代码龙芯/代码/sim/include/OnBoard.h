@@ -0,0 +1,2 @@
+/* OnBoard.h for the host simulator, see zstack_sim.h */
+#include "zstack_sim.h"
@@ -0,0 +1,38 @@
+/*
+ * Host stand-in for the SampleApp.h of the Z-Stack project, which is not part
+ * of this tree. Values follow the stock SampleApp; the period can be
+ * overridden on the compiler command line like on the target.
+ */
+#ifndef SAMPLEAPP_H
+#define SAMPLEAPP_H
+
+#include "zstack_sim.h"
+
+#define SAMPLEAPP_ENDPOINT                20
+
+#define SAMPLEAPP_PROFID                  0x0F08
+#define SAMPLEAPP_DEVICEID                0x0001
+#define SAMPLEAPP_DEVICE_VERSION          0
+#define SAMPLEAPP_FLAGS                   0
+
+#define SAMPLE_MAX_CLUSTERS               2
+#define SAMPLEAPP_PERIODIC_CLUSTERID      1
+#define SAMPLEAPP_P2P_CLUSTERID           3
+
+#define SAMPLEAPP_SEND_PERIODIC_MSG_EVT   0x0001
+
+#if !defined( SAMPLEAPP_SEND_PERIODIC_MSG_TIMEOUT )
+#define SAMPLEAPP_SEND_PERIODIC_MSG_TIMEOUT  5000
+#endif
+
+#define SAMPLEAPP_FLASH_GROUP             0x0001
+
+// 串口帧功能码，与网关 serial_bridge.h 一致
+#define FUN_CODE_UPDATA_DATA              0x01
+
+extern uint8 SampleApp_TaskID;
+
+extern void SampleApp_Init( uint8 task_id );
+extern UINT16 SampleApp_ProcessEvent( uint8 task_id, UINT16 events );
+
+#endif /* SAMPLEAPP_H */
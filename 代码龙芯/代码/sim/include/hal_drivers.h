@@ -0,0 +1,2 @@
+/* hal_drivers.h for the host simulator, see zstack_sim.h */
+#include "zstack_sim.h"
@@ -0,0 +1,2 @@
+/* hal_types.h for the host simulator, see zstack_sim.h */
+#include "zstack_sim.h"
@@ -0,0 +1,273 @@
+/*
+ * Host stand-ins for the Z-Stack OSAL, AF and HAL declarations cc2530.c uses.
+ * Only what the application touches is declared; the implementations live in
+ * sim_osal.c and act on whichever virtual device the simulator is running.
+ */
+#ifndef ZSTACK_SIM_H
+#define ZSTACK_SIM_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* hal_types.h */
+typedef int8_t    int8;
+typedef uint8_t   uint8;
+typedef int16_t   int16;
+typedef uint16_t  uint16;
+typedef int32_t   int32;
+typedef uint32_t  uint32;
+typedef uint16_t  UINT16;
+typedef uint8_t   byte;
+typedef uint8_t   halIntState_t;
+
+#ifndef TRUE
+#define TRUE  1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#ifndef NULL
+#define NULL  ((void *)0)
+#endif
+
+/* hal_defs.h */
+#define BUILD_UINT16(loByte, hiByte)  ((uint16)(((loByte) & 0x00FF) + (((hiByte) & 0x00FF) << 8)))
+#define HI_UINT16(a)                  (((a) >> 8) & 0xFF)
+#define LO_UINT16(a)                  ((a) & 0xFF)
+
+/* ioCC2530.h: the registers the application pokes at */
+extern uint8 P0SEL;
+extern uint8 P0DIR;
+extern uint8 P0_7;
+extern uint8 U0BAUD;
+extern uint8 U0GCR;
+
+/* OSAL */
+#define SYS_EVENT_MSG               0x8000
+#define AF_INCOMING_MSG_CMD         0x1A
+#define AF_DATA_CONFIRM_CMD         0xFD
+#define KEY_CHANGE                  0xC0
+#define ZDO_STATE_CHANGE            0xD1
+
+typedef struct
+{
+  uint8  event;
+  uint8  status;
+} osal_event_hdr_t;
+
+uint8  *osal_msg_receive( uint8 task_id );
+uint8   osal_msg_deallocate( uint8 *msg_ptr );
+uint8   osal_start_timerEx( uint8 task_id, uint16 event_id, uint32 timeout_value );
+uint8   osal_stop_timerEx( uint8 task_id, uint16 event_id );
+uint8   osal_set_event( uint8 task_id, uint16 event_flag );
+uint16  osal_rand( void );
+uint32  osal_GetSystemClock( void );
+int     osal_strlen( char *pString );
+void   *osal_memset( void *dest, uint8 value, int len );
+void   *osal_memcpy( void *dst, const void *src, unsigned int len );
+void   *osal_mem_alloc( uint16 size );
+void    osal_mem_free( void *ptr );
+
+/* ZDApp / NWK */
+typedef enum
+{
+  DEV_HOLD,
+  DEV_INIT,
+  DEV_NWK_DISC,
+  DEV_NWK_JOINING,
+  DEV_NWK_SEC_REJOIN_CURR_CHANNEL,
+  DEV_END_DEVICE_UNAUTH,
+  DEV_END_DEVICE,
+  DEV_ROUTER,
+  DEV_COORD_STARTING,
+  DEV_ZB_COORD,
+  DEV_NWK_ORPHAN,
+  DEV_NWK_KA,
+  DEV_NWK_BACKOFF,
+  DEV_NWK_SEC_REJOIN_ALL_CHANNEL,
+  DEV_NWK_TC_REJOIN_CURR_CHANNEL,
+  DEV_NWK_TC_REJOIN_ALL_CHANNEL
+} devStates_t;
+
+uint16  NLME_GetShortAddr( void );
+
+/* AF */
+typedef uint16 cId_t;
+
+typedef enum
+{
+  afAddrNotPresent = 0,
+  afAddrGroup      = 1,
+  Addr16Bit        = 2,
+  Addr64Bit        = 3,
+  AddrBroadcast    = 15
+} afAddrMode_t;
+
+typedef struct
+{
+  union
+  {
+    uint16 shortAddr;
+    uint8  extAddr[8];
+  } addr;
+  afAddrMode_t addrMode;
+  uint8 endPoint;
+  uint16 panId;
+} afAddrType_t;
+
+typedef struct
+{
+  uint8  EndPoint;
+  uint16 AppProfId;
+  uint16 AppDeviceId;
+  uint8  AppDevVer:4;
+  uint8  Reserved:4;
+  uint8  AppNumInClusters;
+  cId_t *pAppInClusterList;
+  uint8  AppNumOutClusters;
+  cId_t *pAppOutClusterList;
+} SimpleDescriptionFormat_t;
+
+typedef enum
+{
+  noLatencyReqs,
+  fastBeacons,
+  slowBeacons
+} afNetworkLatencyReq_t;
+
+typedef struct
+{
+  uint8 endPoint;
+  uint8 *task_id;
+  SimpleDescriptionFormat_t *simpleDesc;
+  afNetworkLatencyReq_t latencyReq;
+} endPointDesc_t;
+
+typedef struct
+{
+  uint8  TransSeqNumber;
+  uint16 DataLength;
+  uint8  *Data;
+} afMSGCommandFormat_t;
+
+typedef struct
+{
+  osal_event_hdr_t hdr;
+  uint16 groupId;
+  uint16 clusterId;
+  afAddrType_t srcAddr;
+  uint16 macDestAddr;
+  uint8 endPoint;
+  uint8 wasBroadcast;
+  uint8 LinkQuality;
+  uint8 correlation;
+  int8  rssi;
+  uint8 SecurityUse;
+  uint32 timestamp;
+  uint8 nwkSeqNum;
+  afMSGCommandFormat_t cmd;
+} afIncomingMSGPacket_t;
+
+typedef uint8 afStatus_t;
+
+#define afStatus_SUCCESS            0x00
+#define afStatus_FAILED             0x01
+#define afStatus_MEM_FAIL           0x10
+#define afStatus_NO_ROUTE           0xCD
+
+/* ZStatus_t values an AF_DATA_CONFIRM_CMD carries in hdr.status */
+#define ZSuccess                    0x00
+#define ZApsNoAck                   0xB7
+
+#define AF_ACK_REQUEST              0x10
+#define AF_DISCV_ROUTE              0x20
+#define AF_EN_SECURITY              0x40
+#define AF_SKIP_ROUTING             0x80
+#define AF_DEFAULT_RADIUS           0x0F
+
+typedef struct
+{
+  osal_event_hdr_t hdr;
+  endPointDesc_t *ep;
+  uint8 transID;
+} afDataConfirm_t;
+
+afStatus_t afRegister( endPointDesc_t *epDesc );
+
+/* APS groups */
+#define APS_GROUP_NAME_LEN          16
+
+typedef struct
+{
+  uint16 ID;
+  uint8  name[APS_GROUP_NAME_LEN];
+} aps_Group_t;
+
+uint8 aps_AddGroup( uint8 endpoint, aps_Group_t *group );
+afStatus_t AF_DataRequest( afAddrType_t *dstAddr, endPointDesc_t *srcEP, uint16 cID, uint16 len, uint8 *buf,
+                           uint8 *transID, uint8 options, uint8 radius );
+
+/* OnBoard / keys */
+uint8   RegisterForKeys( uint8 task_id );
+void    MicroWait( uint16 us );
+
+/* MT / HAL UART */
+#define HAL_UART_BR_9600            0x00
+#define HAL_UART_BR_19200           0x01
+#define HAL_UART_BR_38400           0x02
+#define HAL_UART_BR_57600           0x03
+#define HAL_UART_BR_115200          0x04
+
+#define HAL_UART_RX_FULL            0x01
+#define HAL_UART_RX_ABOUT_FULL      0x02
+#define HAL_UART_RX_TIMEOUT         0x04
+#define HAL_UART_TX_FULL            0x08
+#define HAL_UART_TX_EMPTY           0x10
+
+typedef void (*halUARTCBack_t)( uint8 port, uint8 event );
+
+typedef struct
+{
+  uint16 bufferHead;
+  uint16 bufferTail;
+  uint16 maxBufSize;
+  uint8 *pBuffer;
+} halUARTBufControl_t;
+
+typedef struct
+{
+  uint8                 configured;
+  uint8                 baudRate;
+  uint8                 flowControl;
+  uint16                flowControlThreshold;
+  uint8                 idleTimeout;
+  halUARTBufControl_t   rx;
+  halUARTBufControl_t   tx;
+  uint8                 intEnable;
+  uint32                rxChRvdTime;
+  halUARTCBack_t        callBackFunc;
+} halUARTCfg_t;
+
+void    MT_UartInit( void );
+void    MT_UartRegisterTaskID( uint8 taskID );
+uint8   HalUARTOpen( uint8 port, halUARTCfg_t *config );
+uint16  HalUARTRead( uint8 port, uint8 *buf, uint16 len );
+uint16  HalUARTWrite( uint8 port, uint8 *buf, uint16 len );
+
+/* HAL LCD / LED */
+#define HAL_LCD_LINE_1              0x01
+#define HAL_LCD_LINE_2              0x02
+#define HAL_LCD_LINE_3              0x03
+#define HAL_LCD_LINE_4              0x04
+
+#define HAL_LED_1                   0x01
+#define HAL_LED_2                   0x02
+#define HAL_LED_MODE_OFF            0x00
+#define HAL_LED_MODE_ON             0x01
+#define HAL_LED_MODE_TOGGLE         0x08
+
+void    HalLcdWriteString( char *str, uint8 option );
+uint8   HalLedSet( uint8 led, uint8 mode );
+
+#endif /* ZSTACK_SIM_H */
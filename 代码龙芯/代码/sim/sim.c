@@ -0,0 +1,960 @@
+/*
+ * Host simulator of the CC2530 SampleApp network.
+ *
+ * cc2530.c is built twice as a shared object, once with ZDO_COORDINATOR and
+ * once as an end device, and both are loaded with dlopen. The coordinator
+ * image runs as a single device whose uart is a pty, so the gateway can be
+ * pointed at the slave side exactly like at /dev/ttyS1. The end device image
+ * is shared by all virtual nodes: its writable segment holds the whole
+ * application state, so switching nodes is saving and restoring that segment.
+ *
+ * Time is virtual. OSAL timers and radio deliveries are entries in one heap
+ * ordered by due time; with -s the clock is paced against the wall clock,
+ * with -s 0 it runs as fast as the host allows.
+ *
+ *   ./zsim -n 2000 -l /tmp/zsim-tty &
+ *   ../阿里云/quickstart /tmp/zsim-tty
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <link.h>
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/stat.h>
+
+#include "sim.h"
+#include "SampleApp.h"
+#include "uplink.h"
+
+#define SIM_NODES_DEFAULT           100
+#define SIM_JOIN_SPREAD_DEFAULT     5000
+#define SIM_AIR_MS_DEFAULT          8
+#define SIM_AIR_JITTER_DEFAULT      4
+#define SIM_UART_BAUD_FIRMWARE      (-1)
+#define SIM_DURATION_DEFAULT        60
+#define SIM_STATS_DEFAULT           10
+
+#define SIM_COORD_IMAGE             "sim_coord.so"
+#define SIM_NODE_IMAGE              "sim_node.so"
+
+/* task ids are only echoed back by the images, each image has a single task */
+#define SIM_TASK_ID                 0
+
+typedef enum {
+    SIM_ENTRY_TIMER,
+    SIM_ENTRY_MSG,
+    SIM_ENTRY_EVENT
+} sim_entry_kind_t;
+
+typedef struct _sim_entry {
+    uint64_t        due_ms;
+    uint64_t        seq;            /* keeps entries due at the same time in fifo order */
+    sim_device_t   *dev;
+    sim_msg_t      *msg;
+    uint16          event;
+    uint16          gen;
+    uint8           kind;
+} sim_entry_t;
+
+typedef struct _sim_heap {
+    sim_entry_t    *entries;
+    int             count;
+    int             size;
+    uint64_t        seq;
+} sim_heap_t;
+
+sim_t sim;
+
+static sim_heap_t sim_heap;
+static volatile sig_atomic_t sim_stop;
+
+uint32_t sim_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static uint64_t sim_wall_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int sim_entry_before(const sim_entry_t *a, const sim_entry_t *b)
+{
+    return a->due_ms < b->due_ms || (a->due_ms == b->due_ms && a->seq < b->seq);
+}
+
+static void sim_heap_push(sim_entry_t *entry)
+{
+    sim_heap_t *heap = &sim_heap;
+    int i;
+
+    if (heap->count == heap->size) {
+        heap->size = heap->size ? heap->size * 2 : 1024;
+        heap->entries = realloc(heap->entries, heap->size * sizeof(sim_entry_t));
+        if (heap->entries == NULL) {
+            fprintf(stderr, "zsim: out of memory\n");
+            exit(1);
+        }
+    }
+
+    entry->seq = heap->seq++;
+    for (i = heap->count++; i > 0; ) {
+        int parent = (i - 1) / 2;
+
+        if (!sim_entry_before(entry, &heap->entries[parent])) {
+            break;
+        }
+        heap->entries[i] = heap->entries[parent];
+        i = parent;
+    }
+    heap->entries[i] = *entry;
+}
+
+static int sim_heap_pop(sim_entry_t *entry)
+{
+    sim_heap_t *heap = &sim_heap;
+    sim_entry_t last;
+    int i = 0;
+
+    if (heap->count == 0) {
+        return -1;
+    }
+
+    *entry = heap->entries[0];
+    last = heap->entries[--heap->count];
+    while (1) {
+        int child = 2 * i + 1;
+
+        if (child >= heap->count) {
+            break;
+        }
+        if (child + 1 < heap->count && sim_entry_before(&heap->entries[child + 1], &heap->entries[child])) {
+            child++;
+        }
+        if (!sim_entry_before(&heap->entries[child], &last)) {
+            break;
+        }
+        heap->entries[i] = heap->entries[child];
+        i = child;
+    }
+    heap->entries[i] = last;
+    return 0;
+}
+
+static int sim_event_bit(uint16 event)
+{
+    return __builtin_ctz(event);
+}
+
+void sim_timer_start(sim_device_t *dev, uint16 event, uint32 timeout_ms)
+{
+    sim_entry_t entry;
+    int bit;
+
+    if (event == 0) {
+        return;
+    }
+    if (sim.config.timer_jitter_ms > 0) {
+        timeout_ms += sim_rand(&dev->rng) % sim.config.timer_jitter_ms;
+    }
+
+    /* restarting a running timer invalidates its queued expiry, like osal does */
+    for (bit = 0; bit < SIM_EVENT_BITS; bit++) {
+        if (event & (1 << bit)) {
+            memset(&entry, 0, sizeof(entry));
+            entry.kind = SIM_ENTRY_TIMER;
+            entry.dev = dev;
+            entry.event = 1 << bit;
+            entry.gen = ++dev->timer_gen[bit];
+            entry.due_ms = sim.now_ms + timeout_ms;
+            sim_heap_push(&entry);
+        }
+    }
+}
+
+void sim_timer_stop(sim_device_t *dev, uint16 event)
+{
+    int bit;
+
+    for (bit = 0; bit < SIM_EVENT_BITS; bit++) {
+        if (event & (1 << bit)) {
+            dev->timer_gen[bit]++;
+        }
+    }
+}
+
+void sim_set_event(sim_device_t *dev, uint16 event, uint32 delay_ms)
+{
+    sim_entry_t entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = SIM_ENTRY_EVENT;
+    entry.dev = dev;
+    entry.event = event;
+    entry.due_ms = sim.now_ms + delay_ms;
+    sim_heap_push(&entry);
+}
+
+sim_msg_t *sim_msg_alloc(size_t size)
+{
+    sim_msg_t *msg = malloc(sizeof(sim_msg_t) + size);
+
+    if (msg == NULL) {
+        fprintf(stderr, "zsim: out of memory\n");
+        exit(1);
+    }
+    msg->next = NULL;
+    msg->origin_ms = 0;
+    return msg;
+}
+
+void sim_send_msg(sim_device_t *dev, sim_msg_t *msg, uint32 delay_ms)
+{
+    sim_entry_t entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.kind = SIM_ENTRY_MSG;
+    entry.dev = dev;
+    entry.msg = msg;
+    entry.due_ms = sim.now_ms + delay_ms;
+    sim_heap_push(&entry);
+}
+
+static void sim_latency_record(uint64_t latency)
+{
+    sim_stats_t *stats = &sim.stats;
+
+    stats->latency_count++;
+    stats->latency_sum += latency;
+    if (latency > stats->latency_max) {
+        stats->latency_max = latency;
+    }
+    stats->latency[(latency < SIM_LATENCY_BUCKETS) ? latency : SIM_LATENCY_BUCKETS]++;
+}
+
+static uint64_t sim_latency_percentile(double p)
+{
+    uint64_t want = (uint64_t)(sim.stats.latency_count * p);
+    uint64_t seen = 0;
+    int i;
+
+    if (sim.stats.latency_count == 0) {
+        return 0;
+    }
+    for (i = 0; i <= SIM_LATENCY_BUCKETS; i++) {
+        seen += sim.stats.latency[i];
+        if (seen > want) {
+            return i;
+        }
+    }
+    return SIM_LATENCY_BUCKETS;
+}
+
+static void sim_uart_rx_poll(void)
+{
+    int n;
+
+    if (sim.rx_len >= (int)sizeof(sim.rx_buf)) {
+        return;
+    }
+
+    n = read(sim.uart_fd, sim.rx_buf + sim.rx_len, sizeof(sim.rx_buf) - sim.rx_len);
+    if (n <= 0) {
+        return;
+    }
+    sim.stats.uart_rx_bytes += n;
+
+    /* with no uart callback registered the firmware never reads, the bytes fall on the floor */
+    if (sim.rx_callback != NULL) {
+        sim.rx_len += n;
+    }
+}
+
+/* the coordinator got a reading sampled at origin_ms, it reaches the uart with the next readings frame */
+void sim_reading_taken(uint64_t origin_ms)
+{
+    if (sim.pending_count == sim.pending_size) {
+        int size = sim.pending_size ? sim.pending_size * 2 : 1024;
+        uint64_t *pending = malloc(size * sizeof(uint64_t));
+        int i;
+
+        if (pending == NULL) {
+            fprintf(stderr, "zsim: out of memory\n");
+            exit(1);
+        }
+        for (i = 0; i < sim.pending_count; i++) {
+            pending[i] = sim.pending[(sim.pending_head + i) % sim.pending_size];
+        }
+        free(sim.pending);
+        sim.pending = pending;
+        sim.pending_size = size;
+        sim.pending_head = 0;
+    }
+
+    sim.pending[(sim.pending_head + sim.pending_count++) % sim.pending_size] = origin_ms;
+    sim.pending_inflight = 1;
+    sim.suppressed_mark = (sim.coord_suppressed != NULL) ? *sim.coord_suppressed : 0;
+    sim.duplicates_mark = (sim.coord_duplicates != NULL) ? *sim.coord_duplicates : 0;
+}
+
+/* done with the message, a reading the coordinator chose not to forward or a
+ * duplicate it dropped leaves the fifo */
+void sim_reading_done(void)
+{
+    int dropped = (sim.coord_suppressed != NULL && *sim.coord_suppressed != sim.suppressed_mark) ||
+                  (sim.coord_duplicates != NULL && *sim.coord_duplicates != sim.duplicates_mark);
+
+    if (sim.pending_inflight && dropped && sim.pending_count > 0) {
+        sim.pending_count--;
+    }
+    sim.pending_inflight = 0;
+}
+
+static int sim_uart_carries_readings(const uint8 *buf, int len)
+{
+    if (len >= UPLINK_HEAD_SIZE && buf[0] == UPLINK_SYNC) {
+        return buf[2] == UPLINK_FC_SAMPLES || buf[2] == UPLINK_FC_READINGS;
+    }
+    return len >= 3 && buf[2] == FUN_CODE_UPDATA_DATA;
+}
+
+/* the configured pacing, or what the firmware left in U0BAUD/U0GCR */
+static uint32_t sim_uart_baud(void)
+{
+    if (sim.config.uart_baud != SIM_UART_BAUD_FIRMWARE) {
+        return sim.config.uart_baud;
+    }
+
+    /* (256 + BAUD_M) * 2^BAUD_E / 2^28 * 32 MHz */
+    return (uint32_t)((((uint64_t)(256 + U0BAUD) << (U0GCR & 0x1F)) * 32000000) >> 28);
+}
+
+/* bytes the coordinator uart has not sent yet */
+int sim_uart_queued(void)
+{
+    uint32_t baud = sim_uart_baud();
+
+    if (baud == 0 || sim.uart_free_ms <= sim.now_ms) {
+        return 0;
+    }
+    return (int)((sim.uart_free_ms - sim.now_ms) * baud / 10000);
+}
+
+void sim_uart_write(const uint8 *buf, int len)
+{
+    uint32_t baud = sim_uart_baud();
+    int sent = 0;
+
+    sim.stats.uart_frames++;
+    sim.stats.uart_bytes += len;
+
+    /* at the configured baud the frame leaves the chip once the uart has drained */
+    if (baud > 0) {
+        uint64_t start = (sim.uart_free_ms > sim.now_ms) ? sim.uart_free_ms : sim.now_ms;
+
+        sim.uart_free_ms = start + ((uint64_t)len * 10 * 1000 + baud - 1) / baud;
+    } else {
+        sim.uart_free_ms = sim.now_ms;
+    }
+    if (sim_uart_carries_readings(buf, len)) {
+        while (sim.pending_count > 0) {
+            sim_latency_record(sim.uart_free_ms - sim.pending[sim.pending_head]);
+            sim.pending_head = (sim.pending_head + 1) % sim.pending_size;
+            sim.pending_count--;
+        }
+    }
+
+    /* a slow reader stalls the whole network, which is what a full uart would do */
+    while (sent < len && !sim_stop) {
+        struct pollfd pfd;
+        ssize_t n = write(sim.uart_fd, buf + sent, len - sent);
+
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            /* nobody has the pty open, the bytes are lost on the wire */
+            if (errno == EIO) {
+                sim.stats.uart_dropped += len - sent;
+                return;
+            }
+            perror("zsim: uart write");
+            sim_stop = 1;
+            return;
+        }
+
+        sim.stats.uart_stalls++;
+        pfd.fd = sim.uart_fd;
+        pfd.events = POLLOUT | POLLIN;
+        poll(&pfd, 1, 100);
+        if (pfd.revents & POLLIN) {
+            sim_uart_rx_poll();
+        }
+        if (pfd.revents & POLLHUP) {
+            sim.stats.uart_dropped += len - sent;
+            return;
+        }
+    }
+}
+
+/* put dev's state into its image's writable segment */
+static void sim_device_switch(sim_device_t *dev)
+{
+    sim_image_t *image = dev->image;
+
+    if (image->loaded != dev) {
+        if (image->loaded != NULL && image->loaded->state != NULL) {
+            memcpy(image->loaded->state, image->data, image->data_len);
+        }
+        if (dev->state != NULL) {
+            memcpy(image->data, dev->state, image->data_len);
+        }
+        image->loaded = dev;
+    }
+    sim.current = dev;
+}
+
+/* one pass of the osal scheduler over a single task */
+static void sim_device_run(sim_device_t *dev, uint16 events)
+{
+    sim_device_switch(dev);
+    if (dev != &sim.devices[0]) {
+        sim.stats.node_wakes++;
+        sim.stats.node_active_us += SIM_WAKE_US;
+    }
+
+    dev->events |= events;
+    while (dev->events != 0) {
+        uint16 pending = dev->events;
+
+        dev->events = 0;
+        dev->events |= dev->image->process(SIM_TASK_ID, pending);
+        sim.stats.events++;
+    }
+
+    sim.current = NULL;
+}
+
+static void sim_entry_run(sim_entry_t *entry)
+{
+    sim_device_t *dev = entry->dev;
+
+    switch (entry->kind) {
+        case SIM_ENTRY_TIMER:
+            if (dev->timer_gen[sim_event_bit(entry->event)] != entry->gen) {
+                return;
+            }
+            sim_device_run(dev, entry->event);
+            break;
+        case SIM_ENTRY_MSG:
+            if (dev->msg_tail != NULL) {
+                dev->msg_tail->next = entry->msg;
+            } else {
+                dev->msg_head = entry->msg;
+            }
+            dev->msg_tail = entry->msg;
+            sim_device_run(dev, SYS_EVENT_MSG);
+            break;
+        case SIM_ENTRY_EVENT:
+            /* the driver's globals are shared, fill them right before the task reads them */
+            if (dev->dht11_busy && (entry->event & dev->dht11_event)) {
+                sim_dht11_complete(dev);
+            }
+            sim_device_run(dev, entry->event);
+            break;
+        default:
+            break;
+    }
+}
+
+/* tell the task the network came up, the way ZDApp does */
+static void sim_device_join(sim_device_t *dev, devStates_t state, uint32 delay_ms)
+{
+    sim_msg_t *msg = sim_msg_alloc(sizeof(osal_event_hdr_t));
+    osal_event_hdr_t *hdr = (osal_event_hdr_t *)msg->payload;
+
+    hdr->event = ZDO_STATE_CHANGE;
+    hdr->status = (uint8)state;
+    sim_send_msg(dev, msg, delay_ms);
+}
+
+static int sim_segment_cb(struct dl_phdr_info *info, size_t size, void *arg)
+{
+    sim_image_t *image = arg;
+    struct link_map *map;
+    int i;
+
+    (void)size;
+    if (dlinfo(image->handle, RTLD_DI_LINKMAP, &map) < 0 || info->dlpi_addr != map->l_addr) {
+        return 0;
+    }
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_W)) {
+            image->data = (uint8 *)(info->dlpi_addr + ph->p_vaddr);
+            image->data_len = ph->p_memsz;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int sim_image_load(sim_image_t *image, const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    image->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (image->handle == NULL) {
+        fprintf(stderr, "zsim: %s\n", dlerror());
+        return -1;
+    }
+
+    image->path = name;
+    image->init = (void (*)(uint8))dlsym(image->handle, "SampleApp_Init");
+    image->process = (UINT16 (*)(uint8, UINT16))dlsym(image->handle, "SampleApp_ProcessEvent");
+    image->node_id = (uint8 *)dlsym(image->handle, "SampleApp_NodeId");
+    if (image->init == NULL || image->process == NULL || image->node_id == NULL) {
+        fprintf(stderr, "zsim: %s does not export the SampleApp entry points\n", path);
+        return -1;
+    }
+
+    dl_iterate_phdr(sim_segment_cb, image);
+    if (image->data == NULL) {
+        fprintf(stderr, "zsim: no writable segment in %s\n", path);
+        return -1;
+    }
+
+    image->pristine = malloc(image->data_len);
+    if (image->pristine == NULL) {
+        return -1;
+    }
+    memcpy(image->pristine, image->data, image->data_len);
+    return 0;
+}
+
+/* boot a device: fresh image state, node id, SampleApp_Init, then save it */
+static void sim_device_boot(sim_device_t *dev, sim_image_t *image, int index, int shared)
+{
+    dev->image = image;
+    dev->short_addr = index;
+    dev->rng = sim.config.seed * 2654435761u + index * 40503u + 1;
+    dev->temperature = 180 + sim_rand(&dev->rng) % 100;
+    dev->humidity = 400 + sim_rand(&dev->rng) % 300;
+
+    if (shared) {
+        dev->state = malloc(image->data_len);
+        if (dev->state == NULL) {
+            fprintf(stderr, "zsim: out of memory\n");
+            exit(1);
+        }
+    }
+
+    /* the segment is reloaded from the pristine copy, nobody owns it until init ran */
+    if (image->loaded != NULL && image->loaded->state != NULL) {
+        memcpy(image->loaded->state, image->data, image->data_len);
+    }
+    memcpy(image->data, image->pristine, image->data_len);
+    image->loaded = dev;
+
+    /* ids are one byte on the air, large networks wrap and are told apart by short address */
+    dev->node_id = (index > 0) ? (uint8)((index - 1) % 255 + 1) : 0;
+    if (index > 0) {
+        *image->node_id = dev->node_id;
+    }
+
+    sim.current = dev;
+    image->init(SIM_TASK_ID);
+    sim.current = NULL;
+}
+
+static int sim_uart_open(const char *output, const char *link_path)
+{
+    struct termios tio;
+    int fd;
+
+    if (output != NULL) {
+        struct stat st;
+
+        /* a serial port or fifo is used both ways, a plain file only records */
+        if (stat(output, &st) == 0 && !S_ISREG(st.st_mode)) {
+            fd = open(output, O_RDWR | O_NOCTTY | O_NONBLOCK);
+        } else {
+            fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644);
+        }
+        if (fd < 0) {
+            perror(output);
+            return -1;
+        }
+        sim.uart_fd = fd;
+        return 0;
+    }
+
+    fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+        perror("zsim: pty");
+        return -1;
+    }
+
+    /* raw on both sides, the gateway sets its own termios on the slave */
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    if (link_path != NULL) {
+        unlink(link_path);
+        if (symlink(ptsname(fd), link_path) < 0) {
+            perror(link_path);
+            return -1;
+        }
+    }
+
+    fprintf(stderr, "zsim: coordinator uart on %s\n", ptsname(fd));
+    sim.uart_fd = fd;
+    return 0;
+}
+
+/* wait for the gateway to open the slave side, the master hangs up until then */
+static void sim_uart_wait_reader(void)
+{
+    while (!sim_stop) {
+        struct pollfd pfd;
+
+        pfd.fd = sim.uart_fd;
+        pfd.events = POLLOUT;
+        if (poll(&pfd, 1, 200) > 0 && !(pfd.revents & POLLHUP)) {
+            return;
+        }
+    }
+}
+
+/* sleep until the virtual clock may advance to due_ms, 0 if uart input cut the wait short */
+static int sim_pace(uint64_t due_ms, uint64_t wall_start)
+{
+    while (!sim_stop) {
+        struct pollfd pfd;
+        uint64_t wall = sim_wall_ms();
+        uint64_t target = wall_start + (uint64_t)(due_ms / sim.config.speed);
+        int timeout;
+
+        if (wall >= target) {
+            return 1;
+        }
+
+        timeout = (int)(target - wall);
+        pfd.fd = sim.uart_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+            sim_uart_rx_poll();
+        }
+        if (sim.rx_len > 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/* hand gateway bytes to the coordinator the way the uart driver would */
+static void sim_uart_rx_dispatch(void)
+{
+    if (sim.rx_len == 0 || sim.rx_callback == NULL) {
+        return;
+    }
+
+    sim_device_switch(&sim.devices[0]);
+    sim.rx_callback(0, HAL_UART_RX_TIMEOUT);
+    sim.current = NULL;
+}
+
+/* sum a uint16 counter of an image over every device running it, the live
+ * segment holds the loaded device's copy and the others sit in their saved state */
+static uint64_t sim_counter(sim_image_t *image, const char *symbol)
+{
+    uint8 *addr = (uint8 *)dlsym(image->handle, symbol);
+    uint64_t sum = 0;
+    size_t offset;
+    int i;
+
+    if (addr == NULL || addr < image->data || addr + sizeof(uint16) > image->data + image->data_len) {
+        return 0;
+    }
+
+    offset = addr - image->data;
+    for (i = 0; i < sim.device_count; i++) {
+        sim_device_t *dev = &sim.devices[i];
+        uint16 value;
+
+        if (dev->image != image) {
+            continue;
+        }
+        if (image->loaded == dev || dev->state == NULL) {
+            memcpy(&value, addr, sizeof(value));
+        } else {
+            memcpy(&value, dev->state + offset, sizeof(value));
+        }
+        sum += value;
+    }
+    return sum;
+}
+
+static void sim_stats_print(const char *tag, uint64_t wall_ms)
+{
+    sim_stats_t *s = &sim.stats;
+    double virt_s = sim.now_ms / 1000.0;
+    double wall_s = wall_ms / 1000.0;
+    double node_s = virt_s * (sim.device_count - 1);
+
+    fprintf(stderr,
+            "zsim %s: t=%.0fs wall=%.1fs nodes=%d events=%llu (%.0f/s wall) samples=%llu af tx=%llu lost=%llu "
+            "unroutable=%llu suppressed=%llu heartbeats=%llu node msgs/h=%.1f wakes/h=%.1f duty=%.3f%% "
+            "aps acked=%llu failed=%llu retries=%llu node acked=%llu retx=%llu gave up=%llu dropped=%llu "
+            "coord dup=%llu missing=%llu recovered=%llu uart baud=%u frames=%llu (%.1f/s) bytes=%llu full=%llu "
+            "overruns=%llu peak=%llu stalls=%llu dropped=%llu rx=%llu "
+            "latency avg=%.1fms p50=%llums p99=%llums max=%llums\n",
+            tag, virt_s, wall_s, sim.device_count - 1,
+            (unsigned long long)s->events, wall_s > 0 ? s->events / wall_s : 0.0,
+            (unsigned long long)s->samples, (unsigned long long)s->af_tx, (unsigned long long)s->af_lost,
+            (unsigned long long)s->af_unroutable, (unsigned long long)sim_counter(&sim.node, "SampleApp_ReportsSuppressed"),
+            (unsigned long long)sim_counter(&sim.node, "SampleApp_Heartbeats"),
+            node_s > 0 ? s->node_af_tx * 3600.0 / node_s : 0.0, node_s > 0 ? s->node_wakes * 3600.0 / node_s : 0.0,
+            node_s > 0 ? s->node_active_us / (node_s * 1e4) : 0.0,
+            (unsigned long long)s->aps_acked, (unsigned long long)s->aps_failed, (unsigned long long)s->aps_retries,
+            (unsigned long long)sim_counter(&sim.node, "SampleApp_TxAcked"),
+            (unsigned long long)sim_counter(&sim.node, "SampleApp_TxRetries"),
+            (unsigned long long)sim_counter(&sim.node, "SampleApp_TxLost"),
+            (unsigned long long)sim_counter(&sim.node, "SampleApp_TxDropped"),
+            (unsigned long long)sim_counter(&sim.coord, "SampleApp_RxDuplicates"),
+            (unsigned long long)sim_counter(&sim.coord, "SampleApp_RxMissing"),
+            (unsigned long long)sim_counter(&sim.coord, "SampleApp_RxRecovered"),
+            sim_uart_baud(), (unsigned long long)s->uart_frames, virt_s > 0 ? s->uart_frames / virt_s : 0.0,
+            (unsigned long long)s->uart_bytes, (unsigned long long)s->uart_tx_full,
+            (unsigned long long)sim_counter(&sim.coord, "SampleApp_TxOverruns"),
+            (unsigned long long)sim_counter(&sim.coord, "SampleApp_TxPeak"), (unsigned long long)s->uart_stalls,
+            (unsigned long long)s->uart_dropped, (unsigned long long)s->uart_rx_bytes,
+            s->latency_count ? (double)s->latency_sum / s->latency_count : 0.0,
+            (unsigned long long)sim_latency_percentile(0.50), (unsigned long long)sim_latency_percentile(0.99),
+            (unsigned long long)s->latency_max);
+}
+
+static void sim_signal(int sig)
+{
+    (void)sig;
+    sim_stop = 1;
+}
+
+static void sim_usage(void)
+{
+    fprintf(stderr,
+            "usage: zsim [options]\n"
+            "  -n nodes      virtual end devices (%d)\n"
+            "  -j ms         join spread, nodes come up uniformly within it (%d)\n"
+            "  -J ms         random jitter added to every osal timer (0)\n"
+            "  -a ms         radio latency (%d)\n"
+            "  -A ms         radio latency jitter (%d)\n"
+            "  -x permille   radio loss (0)\n"
+            "  -b baud       coordinator uart pacing, 0 for none (the firmware's baud registers)\n"
+            "  -s speed      virtual ms per wall ms, 0 runs flat out (1)\n"
+            "  -d seconds    virtual run time, 0 for no limit (%d)\n"
+            "  -i seconds    stats interval, 0 for only the summary (%d)\n"
+            "  -r seed       random seed (1)\n"
+            "  -o path       write the coordinator uart to path instead of a pty\n"
+            "  -l path       symlink the pty slave to path\n"
+            "  -w            wait for the gateway to open the pty before starting\n"
+            "  -L dir        directory holding %s and %s\n",
+            SIM_NODES_DEFAULT, SIM_JOIN_SPREAD_DEFAULT, SIM_AIR_MS_DEFAULT, SIM_AIR_JITTER_DEFAULT,
+            SIM_DURATION_DEFAULT, SIM_STATS_DEFAULT, SIM_COORD_IMAGE, SIM_NODE_IMAGE);
+}
+
+int main(int argc, char *argv[])
+{
+    sim_config_t *config = &sim.config;
+    const char *output = NULL, *link_path = NULL;
+    char image_dir[PATH_MAX];
+    uint64_t wall_start, next_stats;
+    int wait_reader = 0;
+    int opt, i;
+
+    config->nodes = SIM_NODES_DEFAULT;
+    config->join_spread_ms = SIM_JOIN_SPREAD_DEFAULT;
+    config->air_ms = SIM_AIR_MS_DEFAULT;
+    config->air_jitter_ms = SIM_AIR_JITTER_DEFAULT;
+    config->uart_baud = SIM_UART_BAUD_FIRMWARE;
+    config->speed = 1;
+    config->duration_s = SIM_DURATION_DEFAULT;
+    config->stats_s = SIM_STATS_DEFAULT;
+    config->seed = 1;
+
+    snprintf(image_dir, sizeof(image_dir), "%s", argv[0]);
+    if (strrchr(image_dir, '/') != NULL) {
+        *strrchr(image_dir, '/') = '\0';
+    } else {
+        strcpy(image_dir, ".");
+    }
+
+    while ((opt = getopt(argc, argv, "n:j:J:a:A:x:b:s:d:i:r:o:l:wL:h")) != -1) {
+        switch (opt) {
+            case 'n':
+                config->nodes = atoi(optarg);
+                break;
+            case 'j':
+                config->join_spread_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'J':
+                config->timer_jitter_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                config->air_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'A':
+                config->air_jitter_ms = strtoul(optarg, NULL, 0);
+                break;
+            case 'x':
+                config->loss_permille = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                config->uart_baud = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                config->speed = atof(optarg);
+                break;
+            case 'd':
+                config->duration_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'i':
+                config->stats_s = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                config->seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'l':
+                link_path = optarg;
+                break;
+            case 'w':
+                wait_reader = 1;
+                break;
+            case 'L':
+                snprintf(image_dir, sizeof(image_dir), "%s", optarg);
+                break;
+            default:
+                sim_usage();
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    /* short addresses are device indices and 0xFFF8 and up are broadcast */
+    if (config->nodes < 1 || config->nodes >= 0xFFF8 || config->speed < 0) {
+        sim_usage();
+        return 1;
+    }
+
+    signal(SIGINT, sim_signal);
+    signal(SIGTERM, sim_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (sim_image_load(&sim.coord, image_dir, SIM_COORD_IMAGE) < 0 ||
+        sim_image_load(&sim.node, image_dir, SIM_NODE_IMAGE) < 0) {
+        return 1;
+    }
+    if (sim_uart_open(output, link_path) < 0) {
+        return 1;
+    }
+
+    sim.device_count = config->nodes + 1;
+    sim.devices = calloc(sim.device_count, sizeof(sim_device_t));
+    if (sim.devices == NULL) {
+        fprintf(stderr, "zsim: out of memory\n");
+        return 1;
+    }
+
+    sim_device_boot(&sim.devices[0], &sim.coord, 0, 0);
+    sim.coord_suppressed = (uint16 *)dlsym(sim.coord.handle, "SampleApp_Suppressed");
+    sim.coord_duplicates = (uint16 *)dlsym(sim.coord.handle, "SampleApp_RxDuplicates");
+    for (i = 1; i < sim.device_count; i++) {
+        sim_device_boot(&sim.devices[i], &sim.node, i, 1);
+    }
+
+    fprintf(stderr, "zsim: %d nodes, %zu bytes of state per node\n", config->nodes, sim.node.data_len);
+
+    if (wait_reader && output == NULL) {
+        sim_uart_wait_reader();
+    }
+
+    /* the coordinator forms the network first, end devices join over the spread */
+    sim_device_join(&sim.devices[0], DEV_ZB_COORD, 0);
+    for (i = 1; i < sim.device_count; i++) {
+        uint32 delay = config->join_spread_ms ? sim_rand(&sim.devices[i].rng) % config->join_spread_ms : 0;
+
+        sim_device_join(&sim.devices[i], DEV_END_DEVICE, delay);
+    }
+
+    wall_start = sim_wall_ms();
+    next_stats = config->stats_s * 1000;
+
+    while (!sim_stop) {
+        sim_entry_t entry;
+
+        if (sim_heap.count == 0) {
+            break;
+        }
+        if (config->duration_s > 0 && sim_heap.entries[0].due_ms > (uint64_t)config->duration_s * 1000) {
+            sim.now_ms = (uint64_t)config->duration_s * 1000;
+            break;
+        }
+
+        if (config->speed > 0 && !sim_pace(sim_heap.entries[0].due_ms, wall_start)) {
+            sim_uart_rx_dispatch();
+            continue;
+        }
+        if (config->speed == 0) {
+            sim_uart_rx_poll();
+        }
+        sim_uart_rx_dispatch();
+
+        if (sim_heap_pop(&entry) < 0) {
+            break;
+        }
+        if (entry.due_ms > sim.now_ms) {
+            sim.now_ms = entry.due_ms;
+        }
+        sim_entry_run(&entry);
+
+        if (config->stats_s > 0 && sim.now_ms >= next_stats) {
+            sim_stats_print("stats", sim_wall_ms() - wall_start);
+            next_stats += config->stats_s * 1000;
+        }
+    }
+
+    sim_stats_print("summary", sim_wall_ms() - wall_start);
+
+    if (link_path != NULL) {
+        unlink(link_path);
+    }
+    close(sim.uart_fd);
+    return 0;
+}
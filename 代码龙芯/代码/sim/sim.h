@@ -0,0 +1,157 @@
+/*
+ * Host simulator of the CC2530 SampleApp network: shared state between the
+ * scheduler in sim.c and the Z-Stack stand-ins in sim_osal.c.
+ */
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "zstack_sim.h"
+
+/* the event bits OSAL hands to a task, one timer slot per bit */
+#define SIM_EVENT_BITS          16
+
+/* sample to coordinator uart latency histogram, 1 ms buckets */
+#define SIM_LATENCY_BUCKETS     10000
+
+/* end device active time model, everything else is spent in PM2. A wake is
+ * the 32 MHz crystal start and one pass of the OSAL loop; a transmission is
+ * CSMA, the frame with MAC/NWK/APS headers at 250 kbit/s and the MAC ack. */
+#define SIM_WAKE_US             1000
+#define SIM_TX_BASE_US          2500
+#define SIM_TX_HEADER_BYTES     31
+#define SIM_TX_BYTE_US          32
+#define SIM_LCD_WRITE_US        2000
+#define SIM_UART_BYTE_US        87
+
+/* APS retries of an acked unicast (APSC_MAX_FRAME_RETRIES) and how long the
+ * sender waits for the ack before each of them */
+#define SIM_APS_RETRIES         3
+#define SIM_APS_ACK_WAIT_MS     50
+
+typedef struct _sim_device sim_device_t;
+
+/* one build of cc2530.c loaded with dlopen, shared by all devices of that role */
+typedef struct _sim_image {
+    const char     *path;
+    void           *handle;
+    void (*init)(uint8 task_id);
+    UINT16 (*process)(uint8 task_id, UINT16 events);
+    uint8          *node_id;        /* SampleApp_NodeId inside the image */
+    uint8          *data;           /* writable segment, the whole application state */
+    size_t          data_len;
+    uint8          *pristine;       /* segment as loaded, before any SampleApp_Init */
+    sim_device_t   *loaded;         /* device whose state is currently in the segment */
+} sim_image_t;
+
+/* osal message with simulator bookkeeping in front of it */
+typedef struct _sim_msg {
+    struct _sim_msg    *next;
+    uint64_t            origin_ms;  /* when the reading it carries was sampled */
+    uint64_t            payload[];  /* the osal message handed to the task */
+} sim_msg_t;
+
+typedef struct _sim_stats {
+    uint64_t    events;
+    uint64_t    af_tx;
+    uint64_t    af_tx_bytes;
+    uint64_t    af_delivered;
+    uint64_t    af_lost;
+    uint64_t    af_unroutable;
+    uint64_t    aps_acked;          /* acked unicasts */
+    uint64_t    aps_failed;         /* acked unicasts that ran out of retries */
+    uint64_t    aps_retries;
+    uint64_t    samples;
+    uint64_t    uart_frames;        /* coordinator writes */
+    uint64_t    uart_bytes;
+    uint64_t    uart_stalls;        /* writes that had to wait for the reader */
+    uint64_t    uart_dropped;       /* bytes written while no reader had the pty open */
+    uint64_t    uart_tx_full;       /* HalUARTWrite calls refused, the driver buffer was full */
+    uint64_t    node_uart_bytes;    /* end device debug output, discarded */
+    uint64_t    node_af_tx;         /* transmissions by end devices */
+    uint64_t    node_wakes;
+    uint64_t    node_active_us;     /* summed over all end devices */
+    uint64_t    lcd_writes;
+    uint64_t    uart_rx_bytes;
+    uint64_t    latency_count;
+    uint64_t    latency_sum;
+    uint64_t    latency_max;
+    uint32_t    latency[SIM_LATENCY_BUCKETS + 1];
+} sim_stats_t;
+
+struct _sim_device {
+    sim_image_t    *image;
+    uint8          *state;          /* saved segment, NULL when the image has only this device */
+    uint16          short_addr;
+    uint8           node_id;
+    uint16          events;         /* pending osal events */
+    uint16          timer_gen[SIM_EVENT_BITS];
+    sim_msg_t      *msg_head;
+    sim_msg_t      *msg_tail;
+    uint32_t        rng;
+    int             temperature;    /* synthetic sensor, tenths */
+    int             humidity;
+    uint64_t        sample_ms;
+    uint16          dht11_event;    /* DHT11_Init's done event, 0 before init */
+    uint8           dht11_busy;     /* a read is in flight */
+    uint8           dht11_seq;
+    uint16          group;          /* aps_AddGroup membership, 0 for none */
+};
+
+typedef struct _sim_config {
+    int         nodes;
+    uint32_t    join_spread_ms;     /* end devices join uniformly within this window */
+    uint32_t    timer_jitter_ms;    /* added to every osal timer */
+    uint32_t    air_ms;             /* radio latency per message */
+    uint32_t    air_jitter_ms;
+    uint32_t    loss_permille;
+    int32_t     uart_baud;          /* coordinator uart pacing, 0 to disable, -1 for the firmware's */
+    double      speed;              /* virtual ms per wall ms, 0 runs flat out */
+    uint32_t    duration_s;
+    uint32_t    stats_s;
+    uint32_t    seed;
+} sim_config_t;
+
+typedef struct _sim {
+    sim_config_t    config;
+    sim_image_t     coord;
+    sim_image_t     node;
+    sim_device_t   *devices;        /* [0] is the coordinator, short address == index */
+    int             device_count;
+    sim_device_t   *current;        /* device whose code is running */
+    uint64_t        now_ms;         /* virtual clock */
+    uint64_t        uart_free_ms;   /* when the coordinator uart drains at the configured baud */
+    uint16          uart_tx_size;   /* driver tx buffer given to HalUARTOpen, 0 before */
+    uint64_t       *pending;        /* sample times of readings the coordinator holds back, fifo */
+    int             pending_head;
+    int             pending_count;
+    int             pending_size;
+    int             pending_inflight;   /* the message being processed pushed one */
+    uint16         *coord_suppressed;   /* SampleApp_Suppressed in the coordinator image */
+    uint16          suppressed_mark;
+    uint16         *coord_duplicates;   /* SampleApp_RxDuplicates */
+    uint16          duplicates_mark;
+    int             uart_fd;
+    uint8           rx_buf[256];    /* gateway to coordinator bytes not yet read by HalUARTRead */
+    int             rx_len;
+    halUARTCBack_t  rx_callback;
+    sim_stats_t     stats;
+} sim_t;
+
+extern sim_t sim;
+
+uint32_t sim_rand(uint32_t *state);
+void sim_timer_start(sim_device_t *dev, uint16 event, uint32 timeout_ms);
+void sim_timer_stop(sim_device_t *dev, uint16 event);
+void sim_set_event(sim_device_t *dev, uint16 event, uint32 delay_ms);
+void sim_send_msg(sim_device_t *dev, sim_msg_t *msg, uint32 delay_ms);
+sim_msg_t *sim_msg_alloc(size_t size);
+void sim_uart_write(const uint8 *buf, int len);
+int sim_uart_queued(void);
+void sim_reading_taken(uint64_t origin_ms);
+void sim_reading_done(void);
+void sim_dht11_complete(sim_device_t *dev);
+
+#endif /* _SIM_H_ */
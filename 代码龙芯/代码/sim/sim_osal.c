@@ -0,0 +1,455 @@
+/*
+ * Z-Stack stand-ins: OSAL, AF, HAL and the DHT11 driver as seen by cc2530.c.
+ * Every call acts on sim.current, the virtual device whose code is running.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "dht11.h"
+
+/* registers the images link against */
+uint8 P0SEL;
+uint8 P0DIR;
+uint8 U0BAUD;
+uint8 U0GCR;
+uint8 P0_7;
+
+/* OSAL */
+uint8 *osal_msg_receive(uint8 task_id)
+{
+    sim_device_t *dev = sim.current;
+    sim_msg_t *msg = dev->msg_head;
+
+    (void)task_id;
+    if (msg == NULL) {
+        return NULL;
+    }
+
+    dev->msg_head = msg->next;
+    if (dev->msg_head == NULL) {
+        dev->msg_tail = NULL;
+    }
+
+    if (dev == &sim.devices[0] && msg->origin_ms != 0) {
+        sim_reading_taken(msg->origin_ms);
+    }
+    return (uint8 *)msg->payload;
+}
+
+uint8 osal_msg_deallocate(uint8 *msg_ptr)
+{
+    if (msg_ptr != NULL) {
+        free((uint8 *)msg_ptr - offsetof(sim_msg_t, payload));
+    }
+    sim_reading_done();
+    return 0;
+}
+
+uint8 osal_start_timerEx(uint8 task_id, uint16 event_id, uint32 timeout_value)
+{
+    (void)task_id;
+    sim_timer_start(sim.current, event_id, timeout_value);
+    return 0;
+}
+
+uint8 osal_stop_timerEx(uint8 task_id, uint16 event_id)
+{
+    (void)task_id;
+    sim_timer_stop(sim.current, event_id);
+    return 0;
+}
+
+uint8 osal_set_event(uint8 task_id, uint16 event_flag)
+{
+    (void)task_id;
+    sim_set_event(sim.current, event_flag, 0);
+    return 0;
+}
+
+uint16 osal_rand(void)
+{
+    return (uint16)sim_rand(&sim.current->rng);
+}
+
+uint32 osal_GetSystemClock(void)
+{
+    return (uint32)sim.now_ms;
+}
+
+int osal_strlen(char *pString)
+{
+    return (int)strlen(pString);
+}
+
+void *osal_memset(void *dest, uint8 value, int len)
+{
+    return memset(dest, value, len);
+}
+
+void *osal_memcpy(void *dst, const void *src, unsigned int len)
+{
+    /* the target returns the byte past the copy */
+    memcpy(dst, src, len);
+    return (uint8 *)dst + len;
+}
+
+void *osal_mem_alloc(uint16 size)
+{
+    return malloc(size);
+}
+
+void osal_mem_free(void *ptr)
+{
+    free(ptr);
+}
+
+/* ZDApp / NWK */
+uint16 NLME_GetShortAddr(void)
+{
+    return sim.current->short_addr;
+}
+
+/* AF */
+afStatus_t afRegister(endPointDesc_t *epDesc)
+{
+    (void)epDesc;
+    return afStatus_SUCCESS;
+}
+
+/* one group per device is all SampleApp uses */
+uint8 aps_AddGroup(uint8 endpoint, aps_Group_t *group)
+{
+    (void)endpoint;
+    sim.current->group = group->ID;
+    return ZSuccess;
+}
+
+/* one frame over the air, end devices pay for it in active time */
+static int sim_af_frame_lost(sim_device_t *src, uint16 len)
+{
+    if (src != &sim.devices[0]) {
+        sim.stats.node_active_us += SIM_TX_BASE_US + (SIM_TX_HEADER_BYTES + len) * SIM_TX_BYTE_US;
+    }
+    if (sim.config.loss_permille > 0 && sim_rand(&src->rng) % 1000 < sim.config.loss_permille) {
+        sim.stats.af_lost++;
+        return 1;
+    }
+    return 0;
+}
+
+static uint32 sim_af_delay(sim_device_t *src)
+{
+    uint32 delay = sim.config.air_ms;
+
+    if (sim.config.air_jitter_ms > 0) {
+        delay += sim_rand(&src->rng) % sim.config.air_jitter_ms;
+    }
+    return delay;
+}
+
+static void sim_af_deliver(sim_device_t *dst, afAddrType_t *dstAddr, endPointDesc_t *srcEP, uint16 cID,
+                           uint16 len, uint8 *buf, uint8 seq, uint32 delay)
+{
+    sim_device_t *src = sim.current;
+    sim_msg_t *msg;
+    afIncomingMSGPacket_t *pkt;
+
+    msg = sim_msg_alloc(sizeof(afIncomingMSGPacket_t) + len);
+    pkt = (afIncomingMSGPacket_t *)msg->payload;
+    memset(pkt, 0, sizeof(afIncomingMSGPacket_t));
+
+    pkt->hdr.event = AF_INCOMING_MSG_CMD;
+    pkt->groupId = (dstAddr->addrMode == afAddrGroup) ? dstAddr->addr.shortAddr : 0;
+    pkt->clusterId = cID;
+    pkt->srcAddr.addrMode = Addr16Bit;
+    pkt->srcAddr.addr.shortAddr = src->short_addr;
+    pkt->srcAddr.endPoint = srcEP->endPoint;
+    pkt->macDestAddr = dst->short_addr;
+    pkt->endPoint = dstAddr->endPoint;
+    pkt->wasBroadcast = (dstAddr->addrMode == AddrBroadcast);
+    pkt->LinkQuality = 160 + sim_rand(&src->rng) % 96;
+    pkt->rssi = -40 - (int8)(sim_rand(&src->rng) % 50);
+    pkt->timestamp = (uint32)sim.now_ms;
+    pkt->cmd.TransSeqNumber = seq;
+    pkt->cmd.DataLength = len;
+    pkt->cmd.Data = (uint8 *)(pkt + 1);
+    memcpy(pkt->cmd.Data, buf, len);
+
+    /* readings keep their sample time so the coordinator side can measure latency */
+    msg->origin_ms = (src->sample_ms != 0) ? src->sample_ms : sim.now_ms;
+
+    sim_send_msg(dst, msg, delay);
+    sim.stats.af_delivered++;
+}
+
+/* unicast with AF_ACK_REQUEST: the APS layer retries a lost frame or ack
+ * SIM_APS_RETRIES times, the receiver drops the copies of a frame it already
+ * has, and the sender gets AF_DATA_CONFIRM_CMD with the outcome */
+static void sim_af_acked(sim_device_t *dst, afAddrType_t *dstAddr, endPointDesc_t *srcEP, uint16 cID,
+                         uint16 len, uint8 *buf, uint8 seq)
+{
+    sim_device_t *src = sim.current;
+    afDataConfirm_t *cnf;
+    sim_msg_t *msg;
+    uint32 elapsed = 0;
+    uint8 status = ZApsNoAck;
+    int delivered = 0;
+    int tries;
+
+    for (tries = 0; tries <= SIM_APS_RETRIES; tries++) {
+        uint32 delay = sim_af_delay(src);
+        uint32 wait = (2 * delay > SIM_APS_ACK_WAIT_MS) ? 2 * delay : SIM_APS_ACK_WAIT_MS;
+
+        if (tries > 0) {
+            sim.stats.aps_retries++;
+        }
+        if (sim_af_frame_lost(src, len)) {
+            elapsed += wait;
+            continue;
+        }
+        if (!delivered) {
+            sim_af_deliver(dst, dstAddr, srcEP, cID, len, buf, seq, elapsed + delay);
+            delivered = 1;
+        }
+        if (sim_af_frame_lost(dst, 0)) {
+            elapsed += wait;
+            continue;
+        }
+        elapsed += 2 * delay;
+        status = ZSuccess;
+        break;
+    }
+
+    if (status == ZSuccess) {
+        sim.stats.aps_acked++;
+    } else {
+        sim.stats.aps_failed++;
+    }
+
+    msg = sim_msg_alloc(sizeof(afDataConfirm_t));
+    cnf = (afDataConfirm_t *)msg->payload;
+    cnf->hdr.event = AF_DATA_CONFIRM_CMD;
+    cnf->hdr.status = status;
+    cnf->ep = srcEP;
+    cnf->transID = seq;
+    sim_send_msg(src, msg, elapsed);
+}
+
+afStatus_t AF_DataRequest(afAddrType_t *dstAddr, endPointDesc_t *srcEP, uint16 cID, uint16 len, uint8 *buf,
+                          uint8 *transID, uint8 options, uint8 radius)
+{
+    sim_device_t *src = sim.current;
+    uint8 seq = *transID;
+    int i;
+
+    (void)radius;
+
+    /* like the stack, the transaction id advances on every request */
+    (*transID)++;
+    sim.stats.af_tx++;
+    sim.stats.af_tx_bytes += len;
+    if (src != &sim.devices[0]) {
+        sim.stats.node_af_tx++;
+    }
+
+    switch (dstAddr->addrMode) {
+        case Addr16Bit:
+            if (dstAddr->addr.shortAddr >= sim.device_count) {
+                sim.stats.af_unroutable++;
+                return afStatus_SUCCESS;
+            }
+            if (options & AF_ACK_REQUEST) {
+                sim_af_acked(&sim.devices[dstAddr->addr.shortAddr], dstAddr, srcEP, cID, len, buf, seq);
+            } else if (!sim_af_frame_lost(src, len)) {
+                sim_af_deliver(&sim.devices[dstAddr->addr.shortAddr], dstAddr, srcEP, cID, len, buf, seq,
+                               sim_af_delay(src));
+            }
+            break;
+        case AddrBroadcast:
+        case afAddrGroup:
+            /* one frame on the air, each device hears it or not */
+            for (i = 0; i < sim.device_count; i++) {
+                if (&sim.devices[i] == src) {
+                    continue;
+                }
+                if (dstAddr->addrMode == afAddrGroup && sim.devices[i].group != dstAddr->addr.shortAddr) {
+                    continue;
+                }
+#ifdef SIM_NODES_SLEEPY
+                /* group-casts go to the receivers that are always on, parents keep none for sleepy children */
+                if (dstAddr->addrMode == afAddrGroup && i != 0) {
+                    continue;
+                }
+#endif
+                if (!sim_af_frame_lost(src, len)) {
+                    sim_af_deliver(&sim.devices[i], dstAddr, srcEP, cID, len, buf, seq, sim_af_delay(src));
+                }
+            }
+            break;
+        default:
+            sim.stats.af_unroutable++;
+            break;
+    }
+
+    return afStatus_SUCCESS;
+}
+
+/* OnBoard */
+uint8 RegisterForKeys(uint8 task_id)
+{
+    (void)task_id;
+    return 0;
+}
+
+void MicroWait(uint16 us)
+{
+    (void)us;
+}
+
+/* MT / HAL UART */
+void MT_UartInit(void)
+{
+}
+
+void MT_UartRegisterTaskID(uint8 taskID)
+{
+    (void)taskID;
+}
+
+uint8 HalUARTOpen(uint8 port, halUARTCfg_t *config)
+{
+    /* BAUD_M and BAUD_E at 32 MHz, as the HAL sets them */
+    static const uint8 baud_m[] = { 59, 59, 59, 216, 216 };
+    static const uint8 baud_e[] = { 8, 9, 10, 10, 11 };
+
+    (void)port;
+
+    /* only the coordinator's uart is wired to the pty */
+    if (sim.current == &sim.devices[0]) {
+        sim.rx_callback = config->callBackFunc;
+        sim.uart_tx_size = config->tx.maxBufSize;
+        if (config->baudRate <= HAL_UART_BR_115200) {
+            U0BAUD = baud_m[config->baudRate];
+            U0GCR = (U0GCR & ~0x1F) | baud_e[config->baudRate];
+        }
+    }
+    return 0;
+}
+
+uint16 HalUARTRead(uint8 port, uint8 *buf, uint16 len)
+{
+    (void)port;
+
+    if (sim.current != &sim.devices[0]) {
+        return 0;
+    }
+
+    if (len > sim.rx_len) {
+        len = sim.rx_len;
+    }
+    memcpy(buf, sim.rx_buf, len);
+    memmove(sim.rx_buf, sim.rx_buf + len, sim.rx_len - len);
+    sim.rx_len -= len;
+    return len;
+}
+
+uint16 HalUARTWrite(uint8 port, uint8 *buf, uint16 len)
+{
+    (void)port;
+
+    if (sim.current != &sim.devices[0]) {
+        sim.stats.node_uart_bytes += len;
+        sim.stats.node_active_us += len * SIM_UART_BYTE_US;
+        return len;
+    }
+
+    /* the dma driver takes a write whole or not at all */
+    if (sim.uart_tx_size > 0 && sim_uart_queued() + len > sim.uart_tx_size) {
+        sim.stats.uart_tx_full++;
+        return 0;
+    }
+
+    sim_uart_write(buf, len);
+    return len;
+}
+
+/* HAL LCD / LED */
+void HalLcdWriteString(char *str, uint8 option)
+{
+    (void)str;
+    (void)option;
+    sim.stats.lcd_writes++;
+    if (sim.current != &sim.devices[0]) {
+        sim.stats.node_active_us += SIM_LCD_WRITE_US;
+    }
+}
+
+uint8 HalLedSet(uint8 led, uint8 mode)
+{
+    (void)led;
+    (void)mode;
+    return 0;
+}
+
+/* DHT11: start signal plus the 40 bit frame, the driver's done event fires after this */
+#define SIM_DHT11_READ_MS   25
+
+void DHT11_Init(uint8 task_id, uint16 done_event)
+{
+    (void)task_id;
+    sim.current->dht11_event = done_event;
+    sim.current->dht11_busy = 0;
+}
+
+uint8 DHT11_Start(void)
+{
+    sim_device_t *dev = sim.current;
+
+    if (dev->dht11_busy || dev->dht11_event == 0) {
+        return FALSE;
+    }
+    dev->dht11_busy = 1;
+    sim_set_event(dev, dev->dht11_event, SIM_DHT11_READ_MS);
+
+    /* the driver holds the power manager while timer 1 runs */
+    sim.stats.node_active_us += SIM_DHT11_READ_MS * 1000;
+    return TRUE;
+}
+
+/* a slow random walk per device. Temperature moves a tenth at most per sample,
+ * humidity a few tenths but the sensor only reports whole percent. */
+void sim_dht11_complete(sim_device_t *dev)
+{
+    dev->dht11_busy = 0;
+    dev->temperature += (int)(sim_rand(&dev->rng) % 3) - 1;
+    dev->humidity += (int)(sim_rand(&dev->rng) % 7) - 3;
+
+    if (dev->temperature < 0) {
+        dev->temperature = 0;
+    } else if (dev->temperature > 500) {
+        dev->temperature = 500;
+    }
+    if (dev->humidity < 200) {
+        dev->humidity = 200;
+    } else if (dev->humidity > 950) {
+        dev->humidity = 950;
+    }
+
+    dev->dht11_seq++;
+    dev->sample_ms = sim.now_ms;
+    sim.stats.samples++;
+}
+
+uint8 DHT11_Read(DHT11_Reading_t *reading)
+{
+    sim_device_t *dev = sim.current;
+
+    reading->time = (uint32)dev->sample_ms;
+    reading->temperature = (int16)dev->temperature;
+    reading->humidity = (uint16)(dev->humidity / 10 * 10);
+    reading->seq = dev->dht11_seq;
+    reading->valid = TRUE;
+    return DHT11_OK;
+}
@@ -0,0 +1,212 @@
+/*
+ * Compact uplink frame codec
+ */
+#include "uplink.h"
+
+uint16_t uplink_crc16(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+
+    /* table free CRC-16/CCITT, cheap enough for the 8051 and fast on the gateway */
+    while (len-- > 0) {
+        uint8_t x = (uint8_t)(crc >> 8) ^ *data++;
+
+        x ^= x >> 4;
+        crc = (crc << 8) ^ ((uint16_t)x << 12) ^ ((uint16_t)x << 5) ^ x;
+    }
+
+    return crc;
+}
+
+uint16_t uplink_frame_pack(uint8_t *buf, uint8_t fc, uint8_t len)
+{
+    uint16_t crc;
+
+    buf[0] = UPLINK_SYNC;
+    buf[1] = UPLINK_VERSION;
+    buf[2] = fc;
+    buf[3] = len;
+
+    crc = uplink_crc16(buf + 1, UPLINK_HEAD_SIZE - 1 + len);
+    buf[UPLINK_HEAD_SIZE + len] = (uint8_t)(crc >> 8);
+    buf[UPLINK_HEAD_SIZE + len + 1] = (uint8_t)crc;
+
+    return UPLINK_HEAD_SIZE + len + UPLINK_CRC_SIZE;
+}
+
+static uint8_t uplink_put_varint(uint8_t *p, uint16_t v)
+{
+    uint8_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return n;
+}
+
+static uint16_t uplink_zigzag(int16_t v)
+{
+    return (uint16_t)(((uint16_t)v << 1) ^ (uint16_t)(v >> 15));
+}
+
+static int16_t uplink_unzigzag(uint16_t v)
+{
+    return (int16_t)((v >> 1) ^ (uint16_t)-(int16_t)(v & 1));
+}
+
+void uplink_encoder_begin(uplink_encoder_t *enc, uint8_t *buf)
+{
+    enc->buf = buf;
+    enc->len = 1;           /* count goes first */
+    enc->count = 0;
+    enc->prev.node_id = 0;
+    enc->prev.temperature = 0;
+    enc->prev.humidity = 0;
+}
+
+static uint16_t uplink_age_flags(const uplink_reading_t *reading)
+{
+    uint16_t age = (reading->age > UPLINK_AGE_MAX) ? UPLINK_AGE_MAX : reading->age;
+
+    return (uint16_t)(age << 1) | ((reading->flags & UPLINK_FLAG_INVALID) ? 1 : 0);
+}
+
+int8_t uplink_encoder_add(uplink_encoder_t *enc, const uplink_reading_t *reading)
+{
+    uint8_t *p = enc->buf + UPLINK_HEAD_SIZE + enc->len;
+    uint8_t n;
+
+    if (enc->len + UPLINK_READING_MAX > UPLINK_PAYLOAD_MAX || enc->count == 0xFF) {
+        return -1;
+    }
+
+    n = uplink_put_varint(p, uplink_zigzag((int16_t)(reading->node_id - enc->prev.node_id)));
+    p[n++] = reading->seq;
+    n += uplink_put_varint(p + n, uplink_zigzag((int16_t)(reading->temperature - enc->prev.temperature)));
+    n += uplink_put_varint(p + n, uplink_zigzag((int16_t)(reading->humidity - enc->prev.humidity)));
+    n += uplink_put_varint(p + n, uplink_age_flags(reading));
+
+    enc->len += n;
+    enc->count++;
+    enc->prev = *reading;
+
+    return 0;
+}
+
+uint16_t uplink_encoder_finish(uplink_encoder_t *enc)
+{
+    if (enc->count == 0) {
+        return 0;
+    }
+
+    enc->buf[UPLINK_HEAD_SIZE] = enc->count;
+    return uplink_frame_pack(enc->buf, UPLINK_FC_SAMPLES, enc->len);
+}
+
+int16_t uplink_frame_parse(const uint8_t *buf, uint16_t avail, uplink_frame_t *frame)
+{
+    uint16_t size, crc;
+
+    if (avail < 1) {
+        return 0;
+    }
+    if (buf[0] != UPLINK_SYNC) {
+        return UPLINK_ERR_FRAMING;
+    }
+    if (avail < UPLINK_HEAD_SIZE) {
+        return 0;
+    }
+    if (buf[1] != UPLINK_VERSION || buf[3] > UPLINK_PAYLOAD_MAX) {
+        return UPLINK_ERR_FRAMING;
+    }
+
+    size = UPLINK_HEAD_SIZE + buf[3] + UPLINK_CRC_SIZE;
+    if (avail < size) {
+        return 0;
+    }
+
+    crc = uplink_crc16(buf + 1, UPLINK_HEAD_SIZE - 1 + buf[3]);
+    if (buf[size - 2] != (uint8_t)(crc >> 8) || buf[size - 1] != (uint8_t)crc) {
+        return UPLINK_ERR_CRC;
+    }
+
+    frame->version = buf[1];
+    frame->fc = buf[2];
+    frame->len = buf[3];
+    frame->payload = buf + UPLINK_HEAD_SIZE;
+
+    return (int16_t)size;
+}
+
+/* varint at *p, 16 bits at most */
+static int8_t uplink_get_varint(const uint8_t **p, const uint8_t *end, uint16_t *v)
+{
+    uint8_t shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 16) {
+        uint8_t b = *(*p)++;
+
+        *v |= (uint16_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return 0;
+        }
+        shift += 7;
+    }
+
+    return -1;
+}
+
+int16_t uplink_decode_readings(uint8_t fc, const uint8_t *payload, uint8_t len, uplink_reading_t *readings,
+                               uint8_t max)
+{
+    const uint8_t *p = payload + 1;
+    const uint8_t *end = payload + len;
+    uplink_reading_t prev = { 0, 0, 0, 0, 0, 0 };
+    uint8_t count, i;
+
+    if (len < 1 || (fc != UPLINK_FC_SAMPLES && fc != UPLINK_FC_READINGS)) {
+        return -1;
+    }
+    count = payload[0];
+    if (count > max) {
+        return -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        uint16_t id, t, h, age = 0;
+
+        if (uplink_get_varint(&p, end, &id) < 0) {
+            return -1;
+        }
+        if (fc == UPLINK_FC_SAMPLES) {
+            if (p >= end) {
+                return -1;
+            }
+            prev.seq = *p++;
+        }
+        if (uplink_get_varint(&p, end, &t) < 0 || uplink_get_varint(&p, end, &h) < 0 ||
+            (fc == UPLINK_FC_SAMPLES && uplink_get_varint(&p, end, &age) < 0)) {
+            return -1;
+        }
+
+        prev.node_id += (uint16_t)uplink_unzigzag(id);
+        prev.temperature += uplink_unzigzag(t);
+        prev.humidity += uplink_unzigzag(h);
+        readings[i] = prev;
+
+        if (fc == UPLINK_FC_SAMPLES) {
+            readings[i].age = age >> 1;
+            readings[i].flags = (age & 1) ? UPLINK_FLAG_INVALID : 0;
+        } else {
+            readings[i].temperature *= 10;
+            readings[i].humidity *= 10;
+            readings[i].flags = UPLINK_FLAG_NO_SEQ;
+        }
+    }
+
+    return (p == end) ? count : -1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Compact uplink frame, shared by the coordinator (cc2530.c) and the
+ * gateway (阿里云/serial_bridge.c).
+ *
+ * frame:   sync, version, fc, len, payload[len], crc16 (big endian)
+ *          crc is CRC-16/CCITT-FALSE over version..payload
+ *
+ * UPLINK_FC_SAMPLES payload: count, then per reading the zigzag varint
+ * delta of node id, the sequence number byte, the zigzag varint deltas of
+ * temperature and humidity in tenths, and a varint of age << 1 | invalid.
+ * Deltas are against the previous reading in the same frame (the first one
+ * against zero). Neighbouring nodes read alike, so a reading is usually
+ * five bytes.
+ *
+ * UPLINK_FC_READINGS is the older form: whole degrees and percent, no
+ * sequence number, flags or age. Gateways still decode it.
+ *
+ * The sync byte is above the largest length byte of the legacy
+ * len/checksum/fc/data/'$'/'@' frame, so a reader can accept both.
+ */
+#ifndef _UPLINK_H_
+#define _UPLINK_H_
+
+#include <stdint.h>
+
+#define UPLINK_SYNC                 0xC5
+#define UPLINK_VERSION              1
+
+#define UPLINK_HEAD_SIZE            4
+#define UPLINK_CRC_SIZE             2
+
+/* fits the coordinator's uart tx buffer with room to spare */
+#define UPLINK_PAYLOAD_MAX          80
+#define UPLINK_FRAME_MAX            (UPLINK_HEAD_SIZE + UPLINK_PAYLOAD_MAX + UPLINK_CRC_SIZE)
+
+/* function codes only carried by uplink frames, the legacy ones keep their values */
+#define UPLINK_FC_READINGS          0x03
+#define UPLINK_FC_SAMPLES           0x04
+
+/* worst case of one reading: four 16 bit varints and the sequence number */
+#define UPLINK_READING_MAX          13
+
+/* uplink_reading_t flags */
+#define UPLINK_FLAG_INVALID         0x01    /* the sensor read failed, values are the last good ones */
+#define UPLINK_FLAG_NO_SEQ          0x02    /* decoded from UPLINK_FC_READINGS, seq and age are 0 */
+
+/* age is carried in these units and saturates */
+#define UPLINK_AGE_UNIT_MS          100
+#define UPLINK_AGE_MAX              0x7FFF
+
+#define UPLINK_ERR_FRAMING          (-1)
+#define UPLINK_ERR_CRC              (-2)
+
+typedef struct _uplink_reading {
+    uint16_t    node_id;
+    int16_t     temperature;    /* 0.1 C */
+    int16_t     humidity;       /* 0.1 %RH */
+    uint16_t    age;            /* UPLINK_AGE_UNIT_MS since the node took the sample */
+    uint8_t     seq;            /* per node, wraps */
+    uint8_t     flags;
+} uplink_reading_t;
+
+typedef struct _uplink_encoder {
+    uint8_t            *buf;            /* UPLINK_FRAME_MAX bytes */
+    uint8_t             len;            /* payload bytes so far */
+    uint8_t             count;
+    uplink_reading_t    prev;
+} uplink_encoder_t;
+
+typedef struct _uplink_frame {
+    uint8_t             version;
+    uint8_t             fc;
+    uint8_t             len;
+    const uint8_t      *payload;
+} uplink_frame_t;
+
+uint16_t uplink_crc16(const uint8_t *data, uint16_t len);
+
+/* wrap len bytes already at buf + UPLINK_HEAD_SIZE, returns the frame size */
+uint16_t uplink_frame_pack(uint8_t *buf, uint8_t fc, uint8_t len);
+
+/* readings frame under construction in buf */
+void     uplink_encoder_begin(uplink_encoder_t *enc, uint8_t *buf);
+/* 0 if the reading was added, -1 if the frame is full */
+int8_t   uplink_encoder_add(uplink_encoder_t *enc, const uplink_reading_t *reading);
+/* frame size, 0 if no reading was added */
+uint16_t uplink_encoder_finish(uplink_encoder_t *enc);
+
+/* frame size if buf starts with a complete valid frame, 0 if more bytes are
+ * needed, UPLINK_ERR_FRAMING or UPLINK_ERR_CRC if it does not start a frame */
+int16_t  uplink_frame_parse(const uint8_t *buf, uint16_t avail, uplink_frame_t *frame);
+
+/* readings of a UPLINK_FC_SAMPLES or UPLINK_FC_READINGS payload, count or -1 if
+ * malformed; both come out in tenths */
+int16_t  uplink_decode_readings(uint8_t fc, const uint8_t *payload, uint8_t len, uplink_reading_t *readings,
+                                uint8_t max);
+
+#endif /* _UPLINK_H_ */
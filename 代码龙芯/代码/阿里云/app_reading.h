@@ -0,0 +1,21 @@
+/*
+ * Reading reported by a ZigBee end device and forwarded by the coordinator
+ */
+#ifndef _APP_READING_H_
+#define _APP_READING_H_
+
+#include <stdint.h>
+
+/* app_reading_t flags */
+#define APP_READING_HELD    0x01        /* the node held it back and sent it later, not its current value */
+
+typedef struct _app_reading {
+    uint16_t    node_id;
+    int16_t     temperature;    /* 0.1 C */
+    int16_t     humidity;       /* 0.1 %RH */
+    uint8_t     link;           /* coordinator link of the node's PAN, 0 with a single coordinator */
+    uint8_t     flags;
+    uint64_t    timestamp_ms;   /* wall clock ms since the epoch when the node took the sample */
+} app_reading_t;
+
+#endif /* _APP_READING_H_ */
@@ -0,0 +1,876 @@
+/*
+ * Asynchronous binary log
+ */
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bin_log.h"
+
+/* a site past BIN_LOG_SITES, its records are written through */
+#define BIN_LOG_SITE_NONE               0xffff
+
+/* file entries, each a kind byte and its fields */
+#define BIN_LOG_ENTRY_FORMAT            'F'     /* id u16, line u32, func u16 + bytes, fmt u16 + bytes */
+#define BIN_LOG_ENTRY_RECORD            'R'     /* id u16, len u16, ns u64, arguments */
+#define BIN_LOG_ENTRY_DROPPED           'D'     /* ns u64, records u64 */
+
+typedef struct _bin_log_slot {
+    uint32_t        seq;                /* position it is free for, that plus one once written */
+    uint16_t        id;
+    uint16_t        len;
+    uint64_t        ns;                 /* wall clock */
+    uint8_t         args[BIN_LOG_ARGS_MAX];
+} bin_log_slot_t;
+
+/* one conversion of a format */
+typedef struct _bin_log_spec {
+    char            text[32];           /* for snprintf, integers take long long */
+    char            conv;
+    uint8_t         stars;              /* '*' width and precision */
+    uint8_t         type;               /* bin_log_arg_t of the value, 0 for %% */
+} bin_log_spec_t;
+
+/* the index is the id, 0 is none */
+static const bin_log_site_t *bin_log_sites[BIN_LOG_SITES];
+static uint16_t bin_log_site_count = 1;
+static pthread_mutex_t bin_log_site_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t bin_log_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(BIN_LOG_CLOCK, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static bin_log_slot_t *bin_log_slot(const bin_log_t *log, uint32_t pos)
+{
+    return (bin_log_slot_t *)(log->slots + (size_t)(pos & (BIN_LOG_SLOTS - 1)) * BIN_LOG_SLOT_SIZE);
+}
+
+static int bin_log_spec_put(bin_log_spec_t *spec, int *len, char c)
+{
+    if (*len >= (int)sizeof(spec->text) - 3) {
+        return -1;
+    }
+    spec->text[(*len)++] = c;
+    return 0;
+}
+
+/* the conversion at *p, just past its '%'. Advances *p, -1 if it can't be captured */
+static int bin_log_spec(const char **p, bin_log_spec_t *spec)
+{
+    const char *s = *p;
+    int len = 0, length = 0, star_precision = 0, precision = 0, integer = 0;
+
+    spec->text[len++] = '%';
+    spec->stars = 0;
+    while (*s != '\0' && strchr("-+ #0", *s) != NULL) {
+        if (bin_log_spec_put(spec, &len, *s++) < 0) {
+            return -1;
+        }
+    }
+    if (*s == '*') {
+        spec->stars++;
+        bin_log_spec_put(spec, &len, *s++);
+    }
+    while (*s >= '0' && *s <= '9') {
+        if (bin_log_spec_put(spec, &len, *s++) < 0) {
+            return -1;
+        }
+    }
+    if (*s == '.') {
+        bin_log_spec_put(spec, &len, *s++);
+        if (*s == '*') {
+            spec->stars++;
+            star_precision = 1;
+            bin_log_spec_put(spec, &len, *s++);
+        }
+        while (*s >= '0' && *s <= '9') {
+            precision = 1;
+            if (bin_log_spec_put(spec, &len, *s++) < 0) {
+                return -1;
+            }
+        }
+    }
+    if (*s == 'l') {
+        length = (s[1] == 'l') ? 2 : 1;
+        s += length;
+    } else if (*s == 'z') {
+        length = 3;
+        s++;
+    } else if (*s == 'h' || *s == 'j' || *s == 't' || *s == 'L' || *s == 'q') {
+        return -1;
+    }
+
+    spec->conv = *s;
+    switch (*s) {
+        case '%':
+            spec->type = 0;
+            break;
+        case 'd':
+        case 'i':
+            if (length == 3) {
+                return -1;
+            }
+            spec->type = (length == 0) ? BIN_LOG_ARG_INT : (length == 1) ? BIN_LOG_ARG_LONG : BIN_LOG_ARG_LLONG;
+            integer = 1;
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec->type = (length == 0) ? BIN_LOG_ARG_UINT : (length == 1) ? BIN_LOG_ARG_ULONG :
+                         (length == 2) ? BIN_LOG_ARG_ULLONG : BIN_LOG_ARG_SIZE;
+            integer = 1;
+            break;
+        case 'c':
+            if (length != 0) {
+                return -1;
+            }
+            spec->type = BIN_LOG_ARG_INT;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (length > 1) {
+                return -1;
+            }
+            spec->type = BIN_LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            /* a literal precision may cut a string that isn't terminated, copying it would overrun */
+            if (length != 0 || precision) {
+                return -1;
+            }
+            spec->type = star_precision ? BIN_LOG_ARG_STRN : BIN_LOG_ARG_STR;
+            break;
+        case 'p':
+            spec->type = BIN_LOG_ARG_PTR;
+            break;
+        default:
+            return -1;
+    }
+    s++;
+
+    if (integer) {
+        spec->text[len++] = 'l';
+        spec->text[len++] = 'l';
+    }
+    spec->text[len++] = spec->conv;
+    spec->text[len] = '\0';
+    *p = s;
+
+    return 0;
+}
+
+/* the argument types of a site, or raw if any conversion can't be captured */
+static void bin_log_parse(bin_log_site_t *site)
+{
+    const char *p = site->fmt;
+    bin_log_spec_t spec;
+    int i, n = 0, reserve = 0;
+
+    while ((p = strchr(p, '%')) != NULL) {
+        p++;
+        if (bin_log_spec(&p, &spec) < 0 || n + spec.stars + 1 > BIN_LOG_SITE_ARGS) {
+            site->raw = 1;
+            break;
+        }
+        for (i = 0; i < spec.stars; i++) {
+            site->types[n++] = BIN_LOG_ARG_INT;
+        }
+        if (spec.type != 0) {
+            site->types[n++] = spec.type;
+        }
+    }
+    if (site->raw) {
+        site->types[0] = BIN_LOG_ARG_STR;
+        n = 1;
+    }
+    for (i = 0; i < n; i++) {
+        reserve += (site->types[i] == BIN_LOG_ARG_STR || site->types[i] == BIN_LOG_ARG_STRN) ? 2 : 8;
+    }
+    site->nargs = n;
+    site->reserve = reserve;
+}
+
+static uint16_t bin_log_register(bin_log_site_t *site)
+{
+    uint16_t id;
+
+    pthread_mutex_lock(&bin_log_site_lock);
+    id = site->id;
+    if (id == 0) {
+        bin_log_parse(site);
+        if (bin_log_site_count < BIN_LOG_SITES) {
+            id = bin_log_site_count;
+            bin_log_sites[id] = site;
+            __atomic_store_n(&bin_log_site_count, id + 1, __ATOMIC_RELEASE);
+        } else {
+            id = BIN_LOG_SITE_NONE;
+        }
+        __atomic_store_n(&site->id, id, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&bin_log_site_lock);
+
+    return id;
+}
+
+static const char *bin_log_site_fmt(const bin_log_site_t *site)
+{
+    return site->raw ? "%s" : site->fmt;
+}
+
+/* the arguments of a record, 8 bytes each but strings, which take their length and bytes */
+static int bin_log_encode(const bin_log_site_t *site, uint8_t *args, va_list ap)
+{
+    int i, pos = 0, reserve = site->reserve;
+    int64_t precision = -1;
+
+    if (site->raw) {
+        int n = vsnprintf((char *)args + 2, BIN_LOG_ARGS_MAX - 2, site->fmt, ap);
+        uint16_t len = (n < 0) ? 0 : (n > BIN_LOG_ARGS_MAX - 3) ? BIN_LOG_ARGS_MAX - 3 : n;
+
+        memcpy(args, &len, 2);
+        return 2 + len;
+    }
+
+    for (i = 0; i < site->nargs; i++) {
+        uint64_t v = 0;
+        double d;
+
+        switch (site->types[i]) {
+            case BIN_LOG_ARG_INT:
+                precision = va_arg(ap, int);
+                v = (uint64_t)precision;
+                break;
+            case BIN_LOG_ARG_UINT:
+                v = va_arg(ap, unsigned int);
+                break;
+            case BIN_LOG_ARG_LONG:
+                v = (uint64_t)(int64_t)va_arg(ap, long);
+                break;
+            case BIN_LOG_ARG_ULONG:
+                v = va_arg(ap, unsigned long);
+                break;
+            case BIN_LOG_ARG_LLONG:
+                v = (uint64_t)va_arg(ap, long long);
+                break;
+            case BIN_LOG_ARG_ULLONG:
+                v = va_arg(ap, unsigned long long);
+                break;
+            case BIN_LOG_ARG_SIZE:
+                v = va_arg(ap, size_t);
+                break;
+            case BIN_LOG_ARG_DOUBLE:
+                d = va_arg(ap, double);
+                memcpy(&v, &d, 8);
+                break;
+            case BIN_LOG_ARG_PTR:
+                v = (uintptr_t)va_arg(ap, void *);
+                break;
+            default: {
+                const char *s = va_arg(ap, const char *);
+                size_t room;
+                uint16_t len;
+
+                /* what the arguments after this one leave */
+                reserve -= 2;
+                room = BIN_LOG_ARGS_MAX - pos - 2 - reserve;
+                if (site->types[i] == BIN_LOG_ARG_STRN && precision >= 0 && (size_t)precision < room) {
+                    room = (size_t)precision;
+                }
+                if (s == NULL) {
+                    s = "(null)";
+                }
+                len = strnlen(s, room);
+                memcpy(args + pos, &len, 2);
+                memcpy(args + pos + 2, s, len);
+                pos += 2 + len;
+                continue;
+            }
+        }
+        memcpy(args + pos, &v, 8);
+        pos += 8;
+        reserve -= 8;
+    }
+
+    return pos;
+}
+
+static int bin_log_clamp(int n, int size)
+{
+    return (n < 0) ? 0 : (n >= size) ? size - 1 : n;
+}
+
+#define BIN_LOG_PRINT(out, size, spec, star, value) \
+    (((spec)->stars == 0) ? snprintf((out), (size), (spec)->text, value) : \
+     ((spec)->stars == 1) ? snprintf((out), (size), (spec)->text, (int)(star)[0], value) : \
+     snprintf((out), (size), (spec)->text, (int)(star)[0], (int)(star)[1], value))
+
+/* one conversion, its value taken from args at *pos */
+static int bin_log_conv(const bin_log_spec_t *spec, const int64_t *star, const uint8_t *args, int len, int *pos,
+                        char *out, int size)
+{
+    char str[BIN_LOG_ARGS_MAX + 1];
+    uint64_t v;
+    uint16_t n;
+    double d;
+
+    if (spec->type == BIN_LOG_ARG_STR || spec->type == BIN_LOG_ARG_STRN) {
+        if (*pos + 2 > len) {
+            return 0;
+        }
+        memcpy(&n, args + *pos, 2);
+        if (n > len - *pos - 2) {
+            return 0;
+        }
+        memcpy(str, args + *pos + 2, n);
+        str[n] = '\0';
+        *pos += 2 + n;
+        return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, str), size);
+    }
+
+    if (*pos + 8 > len) {
+        return 0;
+    }
+    memcpy(&v, args + *pos, 8);
+    *pos += 8;
+    switch (spec->conv) {
+        case 'c':
+            return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, (int)v), size);
+        case 'd':
+        case 'i':
+            return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, (long long)v), size);
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, (unsigned long long)v), size);
+        case 'p':
+            return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, (void *)(uintptr_t)v), size);
+        default:
+            memcpy(&d, &v, 8);
+            return bin_log_clamp(BIN_LOG_PRINT(out, size, spec, star, d), size);
+    }
+}
+
+int bin_log_format(const char *fmt, const uint8_t *args, int len, char *out, int size)
+{
+    const char *p = fmt;
+    bin_log_spec_t spec;
+    int64_t star[2];
+    int i, n = 0, pos = 0;
+
+    if (size <= 0) {
+        return 0;
+    }
+    while (*p != '\0' && n < size - 1) {
+        if (*p != '%') {
+            out[n++] = *p++;
+            continue;
+        }
+        p++;
+        if (bin_log_spec(&p, &spec) < 0) {
+            break;
+        }
+        if (spec.type == 0) {
+            out[n++] = '%';
+            continue;
+        }
+        for (i = 0; i < spec.stars; i++) {
+            star[i] = 0;
+            if (pos + 8 <= len) {
+                memcpy(&star[i], args + pos, 8);
+                pos += 8;
+            }
+        }
+        n += bin_log_conv(&spec, star, args, len, &pos, out + n, size - n);
+    }
+    out[n] = '\0';
+
+    return n;
+}
+
+static void bin_log_out(bin_log_t *log, const char *line, int len)
+{
+    if (log->out != NULL) {
+        log->out(line, len, log->ctx);
+    } else {
+        fprintf(stdout, "%.*s\n", len, line);
+    }
+}
+
+static void bin_log_emit(bin_log_t *log, const bin_log_site_t *site, const uint8_t *args, int len)
+{
+    char line[BIN_LOG_LINE_MAX];
+    int n;
+
+    n = bin_log_clamp(snprintf(line, sizeof(line), "%s|%03d :: ", site->func, site->line), sizeof(line));
+    n += bin_log_format(bin_log_site_fmt(site), args, len, line + n, sizeof(line) - n);
+    bin_log_out(log, line, n);
+}
+
+void bin_log_init(bin_log_t *log, bin_log_out_t out, void *ctx)
+{
+    memset(log, 0, sizeof(bin_log_t));
+    log->out = out;
+    log->ctx = ctx;
+}
+
+/* a free slot at the tail, NULL when the ring is full */
+static bin_log_slot_t *bin_log_claim(bin_log_t *log, uint32_t *claimed)
+{
+    uint32_t pos = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+
+    while (1) {
+        bin_log_slot_t *slot = bin_log_slot(log, pos);
+        int32_t diff = (int32_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *claimed = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&log->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void bin_log_write(bin_log_t *log, bin_log_site_t *site, ...)
+{
+    bin_log_slot_t local, *slot;
+    uint16_t id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    uint32_t pos;
+    va_list ap;
+
+    if (id == 0) {
+        id = bin_log_register(site);
+    }
+
+    if (id == BIN_LOG_SITE_NONE || !__atomic_load_n(&log->running, __ATOMIC_ACQUIRE)) {
+        va_start(ap, site);
+        local.len = bin_log_encode(site, local.args, ap);
+        va_end(ap);
+        bin_log_emit(log, site, local.args, local.len);
+        return;
+    }
+
+    slot = bin_log_claim(log, &pos);
+    if (slot == NULL) {
+        __atomic_fetch_add(&log->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    slot->id = id;
+    slot->ns = bin_log_clock_ns();
+    va_start(ap, site);
+    slot->len = bin_log_encode(site, slot->args, ap);
+    va_end(ap);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+static void bin_log_put(bin_log_t *log, const void *p, size_t n)
+{
+    if (fwrite(p, 1, n, log->fp) != n) {
+        log->stats.file_errors++;
+    }
+    log->file_size += n;
+    log->stats.bytes += n;
+}
+
+static void bin_log_file_name(const bin_log_t *log, int i, char *name, size_t size)
+{
+    if (i == 0) {
+        snprintf(name, size, "%s", log->path);
+    } else {
+        snprintf(name, size, "%s.%d", log->path, i);
+    }
+}
+
+/* path moves to path.1 and so on, the oldest falls off, a new path is started */
+static void bin_log_rotate(bin_log_t *log)
+{
+    char from[sizeof(log->path) + 16], to[sizeof(log->path) + 16];
+    int i;
+
+    if (log->fp != NULL) {
+        fclose(log->fp);
+        log->fp = NULL;
+    }
+    for (i = log->files - 1; i > 0; i--) {
+        bin_log_file_name(log, i - 1, from, sizeof(from));
+        bin_log_file_name(log, i, to, sizeof(to));
+        rename(from, to);
+    }
+
+    log->fp = fopen(log->path, "wb");
+    if (log->fp == NULL) {
+        log->stats.file_errors++;
+        return;
+    }
+    memset(log->described, 0, sizeof(log->described));
+    log->file_size = 0;
+    bin_log_put(log, BIN_LOG_MAGIC, 8);
+}
+
+static void bin_log_describe(bin_log_t *log, uint16_t id, const bin_log_site_t *site)
+{
+    const char *fmt = bin_log_site_fmt(site);
+    uint8_t kind = BIN_LOG_ENTRY_FORMAT;
+    uint32_t line = site->line;
+    uint16_t n;
+
+    bin_log_put(log, &kind, 1);
+    bin_log_put(log, &id, 2);
+    bin_log_put(log, &line, 4);
+    n = strlen(site->func);
+    bin_log_put(log, &n, 2);
+    bin_log_put(log, site->func, n);
+    n = strlen(fmt);
+    bin_log_put(log, &n, 2);
+    bin_log_put(log, fmt, n);
+    log->described[id] = 1;
+}
+
+static void bin_log_file_record(bin_log_t *log, const bin_log_slot_t *slot)
+{
+    uint8_t kind = BIN_LOG_ENTRY_RECORD;
+
+    if (!log->described[slot->id]) {
+        bin_log_describe(log, slot->id, bin_log_sites[slot->id]);
+    }
+    bin_log_put(log, &kind, 1);
+    bin_log_put(log, &slot->id, 2);
+    bin_log_put(log, &slot->len, 2);
+    bin_log_put(log, &slot->ns, 8);
+    bin_log_put(log, slot->args, slot->len);
+    if (log->file_size >= log->file_max) {
+        bin_log_rotate(log);
+        log->stats.rotations++;
+    }
+}
+
+/* tokens of a site up to ns, the first record of a site finds a full burst */
+static void bin_log_refill(bin_log_t *log, uint16_t id, uint64_t ns)
+{
+    uint64_t tokens;
+
+    if (log->refill_ns[id] == 0) {
+        tokens = BIN_LOG_BURST * 1000;
+    } else if (ns > log->refill_ns[id]) {
+        tokens = log->tokens[id] + (ns - log->refill_ns[id]) * BIN_LOG_RATE / 1000000;
+        if (tokens > BIN_LOG_BURST * 1000) {
+            tokens = BIN_LOG_BURST * 1000;
+        }
+    } else {
+        return;
+    }
+    log->tokens[id] = (uint32_t)tokens;
+    log->refill_ns[id] = ns;
+}
+
+static void bin_log_held(bin_log_t *log, uint16_t id)
+{
+    const bin_log_site_t *site = bin_log_sites[id];
+    char line[BIN_LOG_LINE_MAX];
+    int n;
+
+    n = snprintf(line, sizeof(line), "%s|%03d :: %u more like this suppressed", site->func, site->line,
+                 log->held[id]);
+    bin_log_out(log, line, bin_log_clamp(n, sizeof(line)));
+    log->held[id] = 0;
+}
+
+/* 1 if a record of the site goes to the console */
+static int bin_log_admit(bin_log_t *log, uint16_t id, uint64_t ns)
+{
+    bin_log_refill(log, id, ns);
+    if (log->tokens[id] < 1000) {
+        log->held[id]++;
+        log->stats.suppressed++;
+        return 0;
+    }
+    log->tokens[id] -= 1000;
+    if (log->held[id] > 0) {
+        bin_log_held(log, id);
+    }
+
+    return 1;
+}
+
+/* sites that went quiet while held back tell how much they were */
+static void bin_log_release(bin_log_t *log, uint64_t ns)
+{
+    uint16_t id, count = __atomic_load_n(&bin_log_site_count, __ATOMIC_ACQUIRE);
+
+    for (id = 1; id < count; id++) {
+        if (log->held[id] > 0) {
+            bin_log_refill(log, id, ns);
+            if (log->tokens[id] >= 1000) {
+                log->tokens[id] -= 1000;
+                bin_log_held(log, id);
+            }
+        }
+    }
+}
+
+/* what a full ring cost since the last report */
+static void bin_log_dropped(bin_log_t *log, uint64_t dropped, uint64_t ns)
+{
+    uint64_t lost = dropped - log->dropped_seen;
+    uint8_t kind = BIN_LOG_ENTRY_DROPPED;
+    char line[128];
+    int n;
+
+    if (log->fp != NULL) {
+        bin_log_put(log, &kind, 1);
+        bin_log_put(log, &ns, 8);
+        bin_log_put(log, &lost, 8);
+    }
+    n = snprintf(line, sizeof(line), "%s|%03d :: %llu records dropped, the log ring was full", __func__, __LINE__,
+                 (unsigned long long)lost);
+    bin_log_out(log, line, bin_log_clamp(n, sizeof(line)));
+    log->stats.dropped = dropped;
+    log->dropped_seen = dropped;
+    log->dropped_ns = ns;
+}
+
+/* records taken off the ring */
+static int bin_log_drain(bin_log_t *log)
+{
+    uint64_t dropped = __atomic_load_n(&log->dropped, __ATOMIC_RELAXED), ns;
+    int n = 0;
+
+    while (n < BIN_LOG_SLOTS) {
+        bin_log_slot_t *slot = bin_log_slot(log, log->head);
+
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != log->head + 1) {
+            break;
+        }
+        log->stats.records++;
+        if (log->fp != NULL) {
+            bin_log_file_record(log, slot);
+        }
+        if (bin_log_admit(log, slot->id, slot->ns)) {
+            bin_log_emit(log, bin_log_sites[slot->id], slot->args, slot->len);
+            log->stats.lines++;
+        }
+        __atomic_store_n(&slot->seq, log->head + BIN_LOG_SLOTS, __ATOMIC_RELEASE);
+        log->head++;
+        n++;
+    }
+
+    if (dropped != log->dropped_seen) {
+        ns = bin_log_clock_ns();
+        if (ns - log->dropped_ns >= BIN_LOG_DROP_REPORT_NS) {
+            bin_log_dropped(log, dropped, ns);
+        }
+    }
+    if (n > 0 && log->fp != NULL) {
+        fflush(log->fp);
+    }
+
+    return n;
+}
+
+static void *bin_log_thread(void *arg)
+{
+    bin_log_t *log = (bin_log_t *)arg;
+
+    while (1) {
+        /* read before draining, all records of the producers are in by then */
+        int stopping = __atomic_load_n(&log->stopping, __ATOMIC_ACQUIRE);
+
+        if (bin_log_drain(log) == 0) {
+            if (stopping) {
+                break;
+            }
+            bin_log_release(log, bin_log_clock_ns());
+            usleep(BIN_LOG_IDLE_US);
+        }
+    }
+
+    return NULL;
+}
+
+int bin_log_start(bin_log_t *log, const char *path, uint32_t file_max, int files)
+{
+    uint32_t i;
+
+    if (log->running) {
+        return -1;
+    }
+    log->slots = malloc((size_t)BIN_LOG_SLOTS * BIN_LOG_SLOT_SIZE);
+    if (log->slots == NULL) {
+        return -1;
+    }
+    for (i = 0; i < BIN_LOG_SLOTS; i++) {
+        bin_log_slot(log, i)->seq = i;
+    }
+    log->head = 0;
+    log->tail = 0;
+    log->dropped = 0;
+    log->dropped_seen = 0;
+    log->dropped_ns = 0;
+    log->stopping = 0;
+    memset(log->tokens, 0, sizeof(log->tokens));
+    memset(log->refill_ns, 0, sizeof(log->refill_ns));
+    memset(log->held, 0, sizeof(log->held));
+    log->file_max = (file_max > 0) ? file_max : BIN_LOG_FILE_MAX_DEFAULT;
+    log->files = (files > 0) ? files : BIN_LOG_FILES_DEFAULT;
+    log->path[0] = '\0';
+    log->fp = NULL;
+
+    /* every run starts a file of its own, the last one is kept as path.1 */
+    if (path != NULL && path[0] != '\0') {
+        snprintf(log->path, sizeof(log->path), "%s", path);
+        bin_log_rotate(log);
+    }
+
+    if (pthread_create(&log->thread, NULL, bin_log_thread, log) != 0) {
+        if (log->fp != NULL) {
+            fclose(log->fp);
+            log->fp = NULL;
+        }
+        free(log->slots);
+        log->slots = NULL;
+        return -1;
+    }
+    __atomic_store_n(&log->running, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void bin_log_stop(bin_log_t *log)
+{
+    uint16_t id, count;
+
+    if (!log->running) {
+        return;
+    }
+    __atomic_store_n(&log->running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&log->stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(log->thread, NULL);
+
+    if (log->dropped != log->dropped_seen) {
+        bin_log_dropped(log, log->dropped, bin_log_clock_ns());
+    }
+    count = __atomic_load_n(&bin_log_site_count, __ATOMIC_ACQUIRE);
+    for (id = 1; id < count; id++) {
+        if (log->held[id] > 0) {
+            bin_log_held(log, id);
+        }
+    }
+    if (log->fp != NULL) {
+        fclose(log->fp);
+        log->fp = NULL;
+    }
+    free(log->slots);
+    log->slots = NULL;
+}
+
+static int bin_log_read(FILE *fp, void *p, size_t n)
+{
+    return (fread(p, 1, n, fp) == n) ? 0 : -1;
+}
+
+/* a length and that many bytes, into a fresh string */
+static char *bin_log_read_str(FILE *fp)
+{
+    uint16_t n;
+    char *s;
+
+    if (bin_log_read(fp, &n, 2) < 0 || (s = malloc(n + 1)) == NULL) {
+        return NULL;
+    }
+    if (bin_log_read(fp, s, n) < 0) {
+        free(s);
+        return NULL;
+    }
+    s[n] = '\0';
+
+    return s;
+}
+
+long bin_log_decode(FILE *fp, bin_log_line_t line, void *ctx)
+{
+    typedef struct {
+        char       *func;
+        char       *fmt;
+        int         line;
+    } bin_log_def_t;
+    bin_log_def_t *defs;
+    uint8_t args[BIN_LOG_ARGS_MAX];
+    char magic[8], text[BIN_LOG_LINE_MAX];
+    long records = 0;
+    int c, i;
+
+    if (bin_log_read(fp, magic, 8) < 0 || memcmp(magic, BIN_LOG_MAGIC, 8) != 0) {
+        return -1;
+    }
+    defs = calloc(BIN_LOG_SITES, sizeof(bin_log_def_t));
+    if (defs == NULL) {
+        return -1;
+    }
+
+    while ((c = fgetc(fp)) != EOF) {
+        uint16_t id, len;
+        uint32_t site_line;
+        uint64_t ns, lost;
+
+        if (c == BIN_LOG_ENTRY_FORMAT) {
+            char *func, *fmt;
+
+            if (bin_log_read(fp, &id, 2) < 0 || id >= BIN_LOG_SITES || bin_log_read(fp, &site_line, 4) < 0) {
+                break;
+            }
+            func = bin_log_read_str(fp);
+            fmt = (func != NULL) ? bin_log_read_str(fp) : NULL;
+            if (fmt == NULL) {
+                free(func);
+                break;
+            }
+            free(defs[id].func);
+            free(defs[id].fmt);
+            defs[id].func = func;
+            defs[id].fmt = fmt;
+            defs[id].line = site_line;
+        } else if (c == BIN_LOG_ENTRY_RECORD) {
+            if (bin_log_read(fp, &id, 2) < 0 || id >= BIN_LOG_SITES || defs[id].fmt == NULL
+                || bin_log_read(fp, &len, 2) < 0 || len > BIN_LOG_ARGS_MAX
+                || bin_log_read(fp, &ns, 8) < 0 || bin_log_read(fp, args, len) < 0) {
+                break;
+            }
+            bin_log_format(defs[id].fmt, args, len, text, sizeof(text));
+            line(ns, defs[id].func, defs[id].line, text, ctx);
+            records++;
+        } else if (c == BIN_LOG_ENTRY_DROPPED) {
+            if (bin_log_read(fp, &ns, 8) < 0 || bin_log_read(fp, &lost, 8) < 0) {
+                break;
+            }
+            snprintf(text, sizeof(text), "%llu records dropped, the log ring was full", (unsigned long long)lost);
+            line(ns, "bin_log_drain", 0, text, ctx);
+        } else {
+            break;
+        }
+    }
+
+    for (i = 0; i < BIN_LOG_SITES; i++) {
+        free(defs[i].func);
+        free(defs[i].fmt);
+    }
+    free(defs);
+
+    return records;
+}
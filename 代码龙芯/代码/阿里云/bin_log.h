@@ -0,0 +1,181 @@
+/*
+ * Asynchronous binary log.
+ *
+ * A call site records the id of its printf format, a timestamp and the raw
+ * arguments into a slot of a lock-free multi producer ring; it neither
+ * formats nor writes. The site's format is parsed once, the first time it
+ * logs, into the argument types it takes. A background thread drains the
+ * ring: it appends every record as is to a binary file that is rotated by
+ * size, and formats the records into "func|line :: message" lines for the
+ * console, each site limited to a rate with a burst on top. What the rate
+ * limit held back is still in the file, bin_log_decode turns it into text.
+ *
+ * The file is self-describing: every file starts with a magic and carries
+ * each format it uses, with the function and line of its site, before the
+ * first record of that site. Numbers are in host byte order, integer
+ * arguments are widened to 64 bits so a file decodes on another word size.
+ *
+ * Producers never block. A full ring drops the record and counts it. Strings
+ * are copied and cut to what fits in a slot. Formats with conversions this
+ * doesn't capture (%hd, %Lf, %jd, a literal string precision, more than
+ * BIN_LOG_SITE_ARGS arguments) are formatted on the calling thread into one
+ * string argument instead. Before bin_log_start and after bin_log_stop every
+ * record is formatted and written out on the calling thread.
+ */
+#ifndef _BIN_LOG_H_
+#define _BIN_LOG_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+
+/* slots of the ring and the size of one, its arguments get all but 16 bytes */
+#ifndef BIN_LOG_SLOTS
+#define BIN_LOG_SLOTS                   2048
+#endif
+#define BIN_LOG_SLOT_SIZE               256
+#define BIN_LOG_ARGS_MAX                (BIN_LOG_SLOT_SIZE - 16)
+
+/* call sites of a process, and arguments of one */
+#define BIN_LOG_SITES                   512
+#define BIN_LOG_SITE_ARGS               16
+
+/* console lines of one site per second, and how many more it may burst */
+#ifndef BIN_LOG_RATE
+#define BIN_LOG_RATE                    10
+#endif
+#ifndef BIN_LOG_BURST
+#define BIN_LOG_BURST                   50
+#endif
+
+/* the file is rotated past this size, keeping path.1 .. path.<files - 1> */
+#define BIN_LOG_FILE_MAX_DEFAULT        (1024 * 1024)
+#define BIN_LOG_FILES_DEFAULT           4
+
+/* records are stamped with this clock, the coarse one is read in a few ns and ticks every few ms.
+ * The ring keeps the order of the records either way */
+#ifndef BIN_LOG_CLOCK
+#define BIN_LOG_CLOCK                   CLOCK_REALTIME_COARSE
+#endif
+
+/* records lost to a full ring are reported at most this often */
+#define BIN_LOG_DROP_REPORT_NS          1000000000ull
+
+/* how long the writer sleeps when the ring is empty */
+#define BIN_LOG_IDLE_US                 10000
+
+/* formatted line of a record, longer ones are cut */
+#define BIN_LOG_LINE_MAX                1024
+
+#define BIN_LOG_MAGIC                   "ZGWLOG1\n"
+
+/* what a conversion takes from the argument list */
+typedef enum {
+    BIN_LOG_ARG_INT = 1,                /* int, also a '*' width or precision and %c */
+    BIN_LOG_ARG_UINT,
+    BIN_LOG_ARG_LONG,
+    BIN_LOG_ARG_ULONG,
+    BIN_LOG_ARG_LLONG,
+    BIN_LOG_ARG_ULLONG,
+    BIN_LOG_ARG_SIZE,                   /* %zu, %zx */
+    BIN_LOG_ARG_DOUBLE,
+    BIN_LOG_ARG_PTR,
+    BIN_LOG_ARG_STR,
+    BIN_LOG_ARG_STRN                    /* %.*s, no longer than the int before it */
+} bin_log_arg_t;
+
+/* a call site, static and zero but for the first three until its first record */
+typedef struct _bin_log_site {
+    const char     *fmt;
+    const char     *func;
+    int             line;
+    uint16_t        id;                 /* 0 until registered, then published with a release store */
+    uint8_t         raw;                /* formatted by the caller, see above */
+    uint8_t         nargs;
+    uint16_t        reserve;            /* bytes the fixed arguments and the string lengths take */
+    uint8_t         types[BIN_LOG_SITE_ARGS];
+} bin_log_site_t;
+
+#define BIN_LOG_SITE(fmt)               { (fmt), __func__, __LINE__, 0, 0, 0, 0, { 0 } }
+
+/* takes one formatted line, without a line break */
+typedef void (*bin_log_out_t)(const char *line, int len, void *ctx);
+
+typedef struct _bin_log_stats {
+    uint64_t        records;            /* taken by the writer */
+    uint64_t        dropped;            /* lost to a full ring */
+    uint64_t        suppressed;         /* kept off the console by the rate limit */
+    uint64_t        lines;              /* written to the console */
+    uint64_t        bytes;              /* written to files */
+    uint64_t        rotations;
+    uint64_t        file_errors;
+} bin_log_stats_t;
+
+typedef struct _bin_log {
+    /* read only while running */
+    uint8_t        *slots;
+    bin_log_out_t   out;
+    void           *ctx;
+    char            path[256];
+    uint32_t        file_max;
+    int             files;
+    int             running;
+    int             stopping;
+    pthread_t       thread;
+
+    /* producers */
+    uint32_t        tail __attribute__((aligned(64)));
+    uint64_t        dropped;
+
+    /* writer */
+    uint32_t        head __attribute__((aligned(64)));
+    uint64_t        dropped_seen;
+    uint64_t        dropped_ns;                     /* last reported */
+    FILE           *fp;
+    uint32_t        file_size;
+    uint8_t         described[BIN_LOG_SITES];
+    uint32_t        tokens[BIN_LOG_SITES];          /* thousandths of a line */
+    uint64_t        refill_ns[BIN_LOG_SITES];
+    uint32_t        held[BIN_LOG_SITES];            /* suppressed since the last line of the site */
+    bin_log_stats_t stats;
+} bin_log_t;
+
+/* out gets the lines, stdout if NULL. Records are written through at once until the log is started */
+void bin_log_init(bin_log_t *log, bin_log_out_t out, void *ctx);
+
+/* starts the writer. path empty or NULL logs to the console only, file_max and files 0 take the defaults */
+int  bin_log_start(bin_log_t *log, const char *path, uint32_t file_max, int files);
+
+/* drains the ring and stops the writer, call once no other thread logs any more */
+void bin_log_stop(bin_log_t *log);
+
+/* records a message of site, the arguments as its format takes them */
+void bin_log_write(bin_log_t *log, bin_log_site_t *site, ...);
+
+/* formats the arguments of a record, the length of out, cut to size */
+int  bin_log_format(const char *fmt, const uint8_t *args, int len, char *out, int size);
+
+/* one record of a log file */
+typedef void (*bin_log_line_t)(uint64_t ns, const char *func, int line, const char *text, void *ctx);
+
+/* reads a log file to the end, a cut last record is left out. Records of the file, -1 if it isn't one */
+long bin_log_decode(FILE *fp, bin_log_line_t line, void *ctx);
+
+/* the compiler checks the arguments against the format, it is never called */
+static inline void bin_log_check(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static inline void bin_log_check(const char *fmt, ...)
+{
+    (void)fmt;
+}
+
+#define BIN_LOG(log, fmt, ...) \
+    do { \
+        static bin_log_site_t _bin_log_site = BIN_LOG_SITE(fmt); \
+        if (0) { \
+            bin_log_check(fmt, ##__VA_ARGS__); \
+        } \
+        bin_log_write((log), &_bin_log_site, ##__VA_ARGS__); \
+    } while (0)
+
+#endif /* _BIN_LOG_H_ */
@@ -0,0 +1,50 @@
+/*
+ * Offline decoder of the gateway's binary log, see bin_log.h.
+ * Prints every record of the files given, oldest first, as
+ * "<local time> func|line :: message":
+ *
+ *   bin_log_decode /tmp/zigbee_gateway.log.3 /tmp/zigbee_gateway.log.2 /tmp/zigbee_gateway.log.1 /tmp/zigbee_gateway.log
+ *
+ * Builds without the sdk: make decode
+ */
+#include <stdio.h>
+#include <time.h>
+
+#include "bin_log.h"
+
+static void decode_line(uint64_t ns, const char *func, int line, const char *text, void *ctx)
+{
+    time_t sec = (time_t)(ns / 1000000000u);
+    struct tm tm;
+    char when[32];
+
+    localtime_r(&sec, &tm);
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%03u %s|%03d :: %s\n", when, (unsigned)(ns / 1000000 % 1000), func, line, text);
+}
+
+int main(int argc, char **argv)
+{
+    int i, ret = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <log file>...\n", argv[0]);
+        return 2;
+    }
+    for (i = 1; i < argc; i++) {
+        FILE *fp = fopen(argv[i], "rb");
+
+        if (fp == NULL) {
+            perror(argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (bin_log_decode(fp, decode_line, NULL) < 0) {
+            fprintf(stderr, "%s: not a gateway log\n", argv[i]);
+            ret = 1;
+        }
+        fclose(fp);
+    }
+
+    return ret;
+}
@@ -0,0 +1,261 @@
+/*
+ * Micro benchmark: connection manager against a simulated broker outage.
+ * Simulated time, the broker is a listening socket on localhost that is
+ * closed for the outage, so the probes are real. Reports time to first
+ * publish after outages of several lengths next to the sdk's own reconnect
+ * (1 s doubling up to 60 s), how spread out the connects of a fleet that
+ * lost the broker together are, and what a probe costs. Builds without the
+ * sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "cloud_conn.h"
+
+#define BENCH_LOOP_MS           200     /* one pass of the cloud loop, the yield timeout */
+#define BENCH_CONNECT_MS        300     /* TLS and MQTT CONNECT */
+#define BENCH_SUBSCRIBE_MS      100
+#define BENCH_PUBLISH_MS        150     /* first post until its reply */
+#define BENCH_FLEET             1000
+#define BENCH_FLEET_OUTAGE_MS   60000
+#define BENCH_PROBES            200
+
+static uint64_t bench_clock;
+static int bench_listener = -1;
+static int bench_port;
+static int bench_broker_up;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_broker(int up)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int one = 1;
+
+    bench_broker_up = up;
+    if (!up) {
+        if (bench_listener >= 0) {
+            close(bench_listener);
+        }
+        bench_listener = -1;
+        return;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(bench_port);
+    bench_listener = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(bench_listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(bench_listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(bench_listener, 64) < 0) {
+        perror("bench broker");
+        exit(1);
+    }
+    getsockname(bench_listener, (struct sockaddr *)&addr, &len);
+    bench_port = ntohs(addr.sin_port);
+    fcntl(bench_listener, F_SETFL, O_NONBLOCK);
+}
+
+/* take the probes off the backlog */
+static void bench_accept(void)
+{
+    int fd;
+
+    while (bench_listener >= 0 && (fd = accept(bench_listener, NULL, NULL)) >= 0) {
+        close(fd);
+    }
+}
+
+/* a gateway of the simulation */
+typedef struct {
+    cloud_conn_t    conn;
+    uint64_t        connects;           /* sdk connects made */
+    uint64_t        connect_ms;         /* when the last one was made */
+    uint64_t        initialized_ms;     /* sdk events due, 0 if none */
+    uint64_t        published_ms;
+} bench_gw_t;
+
+static int bench_connect(void *ctx)
+{
+    bench_gw_t *gw = (bench_gw_t *)ctx;
+
+    gw->connects++;
+    gw->connect_ms = bench_clock;
+    bench_clock += BENCH_CONNECT_MS;
+    if (!bench_broker_up) {
+        return -1;
+    }
+    gw->initialized_ms = bench_clock + BENCH_SUBSCRIBE_MS;
+    gw->published_ms = bench_clock + BENCH_PUBLISH_MS;
+    return 0;
+}
+
+static void bench_close(void *ctx)
+{
+    bench_gw_t *gw = (bench_gw_t *)ctx;
+
+    gw->initialized_ms = 0;
+    gw->published_ms = 0;
+}
+
+static const cloud_conn_ops_t bench_ops = {
+    bench_connect, bench_close
+};
+
+/* one loop pass of one gateway: sdk events arrive during the yield, then the manager is polled */
+static void bench_step(bench_gw_t *gw)
+{
+    if (gw->conn.state == CLOUD_CONN_UP && !bench_broker_up) {
+        cloud_conn_disconnected(&gw->conn, bench_clock);
+        bench_close(gw);
+    }
+    if (gw->initialized_ms != 0 && gw->initialized_ms <= bench_clock) {
+        gw->initialized_ms = 0;
+        cloud_conn_initialized(&gw->conn, bench_clock);
+    }
+    if (gw->published_ms != 0 && gw->published_ms <= bench_clock) {
+        gw->published_ms = 0;
+        cloud_conn_published(&gw->conn, bench_clock);
+    }
+    cloud_conn_poll(&gw->conn, bench_clock);
+    bench_accept();
+}
+
+/* the sdk's own reconnect tries 1 s after the drop, then doubles its wait up to 60 s */
+static uint64_t bench_sdk_ttfp(uint64_t outage_ms)
+{
+    uint64_t t = 0, wait = 1000;
+
+    while (1) {
+        t += wait;
+        if (t >= outage_ms) {
+            return t + BENCH_CONNECT_MS + BENCH_PUBLISH_MS;
+        }
+        t += BENCH_CONNECT_MS;
+        wait = (wait * 2 < 60000) ? wait * 2 : 60000;
+    }
+}
+
+static int bench_flap(uint64_t outage_ms)
+{
+    static bench_gw_t gw;
+    uint64_t start, connects;
+    int ok;
+
+    memset(&gw, 0, sizeof(gw));
+    bench_broker(1);
+    cloud_conn_init(&gw.conn, "127.0.0.1", bench_port, &bench_ops, &gw, bench_clock);
+    while (!gw.conn.published) {
+        bench_step(&gw);
+        bench_clock += BENCH_LOOP_MS;
+    }
+
+    bench_broker(0);
+    start = bench_clock;
+    connects = gw.connects;
+    while (bench_clock - start < outage_ms) {
+        bench_step(&gw);
+        bench_clock += BENCH_LOOP_MS;
+    }
+    bench_broker(1);
+    while (gw.conn.stats.ttfp_count < 2 && bench_clock - start < outage_ms + 120000) {
+        bench_step(&gw);
+        bench_clock += BENCH_LOOP_MS;
+    }
+
+    /* the broker is back at most one probe interval before the manager notices */
+    ok = gw.conn.stats.ttfp_count == 2 && gw.conn.stats.drops == 1 && gw.conn.stats.takeovers == 1 &&
+         gw.conn.stats.ttfp_last_ms <= outage_ms + CLOUD_CONN_PROBE_MAX_MS + BENCH_CONNECT_MS + BENCH_PUBLISH_MS;
+    printf("flap     %3llu s outage: first publish after %5.1f s, sdk alone %5.1f s, %llu probes, %llu connects  %s\n",
+           (unsigned long long)outage_ms / 1000, gw.conn.stats.ttfp_last_ms / 1000.0,
+           bench_sdk_ttfp(outage_ms) / 1000.0,
+           (unsigned long long)gw.conn.stats.probe_failures, (unsigned long long)(gw.connects - connects),
+           ok ? "ok" : "MISMATCH");
+    bench_broker(0);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    static bench_gw_t fleet[BENCH_FLEET];
+    static int per_sec[BENCH_FLEET_OUTAGE_MS / 1000 + 120];
+    static const uint64_t outages[] = { 2000, 10000, 30000, 120000 };
+    uint64_t start, connects = 0;
+    int i, peak = 0, up = 0, probed, ok = 1;
+    double t;
+
+    bench_clock = 1000;
+    for (i = 0; i < (int)(sizeof(outages) / sizeof(outages[0])); i++) {
+        ok &= bench_flap(outages[i]);
+    }
+
+    /* a fleet without probing loses the broker at once, the sdk connect fails until it is back */
+    start = bench_clock;
+    for (i = 0; i < BENCH_FLEET; i++) {
+        cloud_conn_init(&fleet[i].conn, NULL, 0, &bench_ops, &fleet[i], bench_clock + i);
+    }
+    bench_broker_up = 0;
+    while (bench_clock - start < BENCH_FLEET_OUTAGE_MS + 120000 && up < BENCH_FLEET) {
+        uint64_t now = bench_clock;
+
+        if (bench_clock - start >= BENCH_FLEET_OUTAGE_MS) {
+            bench_broker_up = 1;
+        }
+        up = 0;
+        for (i = 0; i < BENCH_FLEET; i++) {
+            uint64_t before = fleet[i].connects;
+
+            bench_clock = now;
+            bench_step(&fleet[i]);
+            if (fleet[i].connects != before && now - start >= BENCH_FLEET_OUTAGE_MS) {
+                per_sec[(now - start) / 1000]++;
+            }
+            up += fleet[i].conn.state == CLOUD_CONN_UP;
+        }
+        bench_clock = now + BENCH_LOOP_MS;
+    }
+    for (i = 0; i < (int)(sizeof(per_sec) / sizeof(per_sec[0])); i++) {
+        peak = (per_sec[i] > peak) ? per_sec[i] : peak;
+    }
+    for (i = 0; i < BENCH_FLEET; i++) {
+        connects += fleet[i].connects;
+    }
+    ok &= up == BENCH_FLEET;
+    printf("fleet    %d gateways, %.1f connects each in a %d s outage, at most %d/s once it ended, all back in %.1f s  %s\n",
+           BENCH_FLEET, (double)connects / BENCH_FLEET, BENCH_FLEET_OUTAGE_MS / 1000, peak,
+           (bench_clock - start - BENCH_FLEET_OUTAGE_MS) / 1000.0, (up == BENCH_FLEET) ? "ok" : "MISMATCH");
+
+    /* a probe of a broker that is there and of one that isn't */
+    bench_broker(1);
+    cloud_conn_init(&fleet[0].conn, "127.0.0.1", bench_port, &bench_ops, &fleet[0], bench_clock);
+    fleet[0].connects = 0;
+    t = bench_now();
+    for (i = 0; i < BENCH_PROBES; i++) {
+        fleet[0].conn.state = CLOUD_CONN_DOWN;
+        fleet[0].conn.next_ms = 0;
+        do {
+            cloud_conn_poll(&fleet[0].conn, bench_clock);
+            bench_accept();
+        } while (fleet[0].conn.probe != CLOUD_CONN_PROBE_IDLE);
+    }
+    t = bench_now() - t;
+    bench_broker(0);
+    probed = fleet[0].connects == BENCH_PROBES && fleet[0].conn.stats.probe_failures == 0;
+    ok &= probed;
+    printf("probe    %6.1f us resolve and connect on loopback  %s\n", t * 1e6 / BENCH_PROBES,
+           probed ? "ok" : "MISMATCH");
+
+    return ok ? 0 : 1;
+}
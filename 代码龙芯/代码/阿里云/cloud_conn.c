@@ -0,0 +1,373 @@
+/*
+ * Connection manager for the gateway's cloud connection
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cloud_conn.h"
+
+static uint64_t cloud_conn_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void cloud_conn_init(cloud_conn_t *conn, const char *host, int port, const cloud_conn_ops_t *ops, void *ctx,
+                     uint64_t now_ms)
+{
+    memset(conn, 0, sizeof(cloud_conn_t));
+    conn->ops = *ops;
+    conn->ctx = ctx;
+    if (host != NULL) {
+        snprintf(conn->host, sizeof(conn->host), "%s", host);
+    }
+    snprintf(conn->port, sizeof(conn->port), "%d", port);
+    conn->state = CLOUD_CONN_DOWN;
+    conn->fd = -1;
+    conn->rng = (uint32_t)(now_ms * 2654435761u) ^ (uint32_t)getpid() ^ 0x9e3779b9u;
+    conn->down_ms = now_ms;
+    conn->next_ms = now_ms;
+}
+
+static uint32_t cloud_conn_random(cloud_conn_t *conn)
+{
+    uint32_t x = conn->rng;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    conn->rng = x;
+    return x;
+}
+
+/* exponential, capped, and anywhere between half and all of it */
+static void cloud_conn_backoff(cloud_conn_t *conn, uint64_t now_ms, uint32_t max_ms)
+{
+    uint32_t wait = CLOUD_CONN_BACKOFF_MIN_MS;
+    uint32_t i;
+
+    for (i = 0; i < conn->failures && wait < max_ms; i++) {
+        wait *= 2;
+    }
+    if (wait > max_ms) {
+        wait = max_ms;
+    }
+    conn->failures++;
+    conn->next_ms = now_ms + wait / 2 + cloud_conn_random(conn) % (wait / 2 + 1);
+}
+
+/* drop our reference to a resolve, the last one out frees it */
+static void cloud_conn_resolve_put(cloud_conn_resolve_t *req)
+{
+    if (__atomic_sub_fetch(&req->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(req);
+    }
+}
+
+static void *cloud_conn_resolver(void *arg)
+{
+    cloud_conn_resolve_t *req = (cloud_conn_resolve_t *)arg;
+    struct addrinfo hints, *res = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(req->host, req->port, &hints, &res) == 0 && res != NULL) {
+        memcpy(&req->addr, res->ai_addr, res->ai_addrlen);
+        req->addr_len = res->ai_addrlen;
+        freeaddrinfo(res);
+    }
+    __atomic_store_n(&req->done, 1, __ATOMIC_RELEASE);
+    cloud_conn_resolve_put(req);
+
+    return NULL;
+}
+
+/* a numeric host resolves without asking anyone, 0 if it was one */
+static int cloud_conn_resolve_numeric(cloud_conn_t *conn)
+{
+    struct addrinfo hints, *res = NULL;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(conn->host, conn->port, &hints, &res) != 0 || res == NULL) {
+        return -1;
+    }
+    memcpy(&conn->addr, res->ai_addr, res->ai_addrlen);
+    conn->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    return 0;
+}
+
+/* hand the host to a resolver thread, -1 if none could be started */
+static int cloud_conn_resolve_start(cloud_conn_t *conn)
+{
+    cloud_conn_resolve_t *req;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int err;
+
+    req = (cloud_conn_resolve_t *)calloc(1, sizeof(cloud_conn_resolve_t));
+    if (req == NULL) {
+        return -1;
+    }
+    memcpy(req->host, conn->host, sizeof(req->host));
+    memcpy(req->port, conn->port, sizeof(req->port));
+    req->refs = 2;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    err = pthread_create(&thread, &attr, cloud_conn_resolver, req);
+    pthread_attr_destroy(&attr);
+    if (err != 0) {
+        free(req);
+        return -1;
+    }
+    conn->resolve = req;
+
+    return 0;
+}
+
+static void cloud_conn_probe_fail(cloud_conn_t *conn, uint64_t now_ms)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->probe = CLOUD_CONN_PROBE_IDLE;
+    conn->stats.probe_failures++;
+    cloud_conn_backoff(conn, now_ms, CLOUD_CONN_PROBE_MAX_MS);
+}
+
+/* the probe reached the broker, run the sdk connect */
+static void cloud_conn_connect(cloud_conn_t *conn, uint64_t now_ms)
+{
+    uint64_t t;
+
+    /* the sdk events of the connect may come in before it returns */
+    conn->probe = CLOUD_CONN_PROBE_IDLE;
+    conn->initialized = 0;
+    conn->published = 0;
+    conn->connected_ms = UINT64_MAX;
+    t = cloud_conn_clock_ms();
+    if (conn->ops.connect(conn->ctx) < 0) {
+        conn->ops.close(conn->ctx);
+        conn->stats.connect_failures++;
+        cloud_conn_backoff(conn, now_ms + (cloud_conn_clock_ms() - t), CLOUD_CONN_BACKOFF_MAX_MS);
+        return;
+    }
+    conn->phases.connect_ms = (uint32_t)(cloud_conn_clock_ms() - t);
+    conn->stats.last = conn->phases;
+    conn->connected_ms = now_ms + conn->phases.connect_ms;
+    conn->failures = 0;
+    conn->state = CLOUD_CONN_UP;
+}
+
+/* see whether the TCP handshake is through, without waiting */
+static void cloud_conn_tcp_check(cloud_conn_t *conn, uint64_t now_ms)
+{
+    struct pollfd pfd;
+    int err = 0;
+    socklen_t len = sizeof(err);
+
+    pfd.fd = conn->fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 0) != 1) {
+        if (now_ms - conn->probe_ms >= CLOUD_CONN_PROBE_TIMEOUT_MS) {
+            cloud_conn_probe_fail(conn, now_ms);
+        }
+        return;
+    }
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        cloud_conn_probe_fail(conn, now_ms);
+        return;
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    conn->phases.tcp_ms = (uint32_t)(now_ms - conn->probe_ms);
+    cloud_conn_connect(conn, now_ms);
+}
+
+/* start a non-blocking TCP connect to the kept address */
+static void cloud_conn_tcp_start(cloud_conn_t *conn, uint64_t now_ms)
+{
+    conn->fd = socket(conn->addr.ss_family, SOCK_STREAM, 0);
+    if (conn->fd < 0) {
+        cloud_conn_probe_fail(conn, now_ms);
+        return;
+    }
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    if (connect(conn->fd, (struct sockaddr *)&conn->addr, conn->addr_len) < 0 && errno != EINPROGRESS) {
+        cloud_conn_probe_fail(conn, now_ms);
+        return;
+    }
+    conn->probe = CLOUD_CONN_PROBE_TCP;
+    conn->probe_ms = now_ms;
+    cloud_conn_tcp_check(conn, now_ms);
+}
+
+/* the resolver answered, or gave up, or took too long: carry on with the address we have */
+static void cloud_conn_resolved(cloud_conn_t *conn, uint64_t now_ms, int ok)
+{
+    conn->phases.dns_ms = (uint32_t)(now_ms - conn->probe_ms);
+    if (!ok) {
+        conn->stats.dns_failures++;
+        if (conn->addr_len == 0) {
+            cloud_conn_probe_fail(conn, now_ms);
+            return;
+        }
+    }
+    cloud_conn_tcp_start(conn, now_ms);
+}
+
+/* see whether the resolver thread is done, without waiting */
+static void cloud_conn_resolve_check(cloud_conn_t *conn, uint64_t now_ms)
+{
+    cloud_conn_resolve_t *req = conn->resolve;
+    int ok;
+
+    if (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE)) {
+        /* it keeps running, the next attempt doesn't start another one until it is done */
+        if (conn->probe == CLOUD_CONN_PROBE_DNS && now_ms - conn->probe_ms >= CLOUD_CONN_RESOLVE_TIMEOUT_MS) {
+            cloud_conn_resolved(conn, now_ms, 0);
+        }
+        return;
+    }
+
+    ok = req->addr_len > 0;
+    if (ok) {
+        memcpy(&conn->addr, &req->addr, req->addr_len);
+        conn->addr_len = req->addr_len;
+    }
+    conn->resolve = NULL;
+    cloud_conn_resolve_put(req);
+    if (conn->probe == CLOUD_CONN_PROBE_DNS) {
+        cloud_conn_resolved(conn, now_ms, ok);
+    }
+}
+
+static void cloud_conn_attempt(cloud_conn_t *conn, uint64_t now_ms)
+{
+    memset(&conn->phases, 0, sizeof(conn->phases));
+    conn->stats.attempts++;
+    if (conn->host[0] == '\0') {
+        cloud_conn_connect(conn, now_ms);
+        return;
+    }
+
+    /* collect a resolver that outlived the last attempt */
+    if (conn->resolve != NULL) {
+        cloud_conn_resolve_check(conn, now_ms);
+    }
+    conn->probe_ms = now_ms;
+    if (cloud_conn_resolve_numeric(conn) == 0) {
+        cloud_conn_tcp_start(conn, now_ms);
+    } else if (conn->resolve == NULL && cloud_conn_resolve_start(conn) == 0) {
+        conn->probe = CLOUD_CONN_PROBE_DNS;
+        cloud_conn_resolve_check(conn, now_ms);
+    } else {
+        /* the last resolve still hangs, or no thread for one */
+        cloud_conn_resolved(conn, now_ms, 0);
+    }
+}
+
+void cloud_conn_poll(cloud_conn_t *conn, uint64_t now_ms)
+{
+    if (conn->state == CLOUD_CONN_LOST && now_ms - conn->down_ms >= CLOUD_CONN_GRACE_MS) {
+        conn->ops.close(conn->ctx);
+        conn->state = CLOUD_CONN_DOWN;
+        conn->next_ms = now_ms;
+        conn->stats.takeovers++;
+    }
+    if (conn->state != CLOUD_CONN_DOWN) {
+        return;
+    }
+    if (conn->probe == CLOUD_CONN_PROBE_DNS) {
+        cloud_conn_resolve_check(conn, now_ms);
+    } else if (conn->probe == CLOUD_CONN_PROBE_TCP) {
+        cloud_conn_tcp_check(conn, now_ms);
+    } else if (now_ms >= conn->next_ms) {
+        cloud_conn_attempt(conn, now_ms);
+    }
+}
+
+void cloud_conn_connected(cloud_conn_t *conn, uint64_t now_ms)
+{
+    if (conn->state != CLOUD_CONN_LOST) {
+        return;
+    }
+    /* the sdk's own reconnect, nothing of it but the publish can be timed */
+    memset(&conn->stats.last, 0, sizeof(conn->stats.last));
+    conn->connected_ms = now_ms;
+    conn->initialized = 1;
+    conn->published = 0;
+    conn->state = CLOUD_CONN_UP;
+    conn->stats.sdk_recoveries++;
+}
+
+void cloud_conn_disconnected(cloud_conn_t *conn, uint64_t now_ms)
+{
+    if (conn->state != CLOUD_CONN_UP) {
+        return;
+    }
+    conn->state = CLOUD_CONN_LOST;
+    conn->down_ms = now_ms;
+    conn->stats.drops++;
+}
+
+void cloud_conn_initialized(cloud_conn_t *conn, uint64_t now_ms)
+{
+    if (conn->initialized) {
+        return;
+    }
+    conn->initialized = 1;
+    conn->stats.last.subscribe_ms = (now_ms > conn->connected_ms) ? (uint32_t)(now_ms - conn->connected_ms) : 0;
+}
+
+void cloud_conn_published(cloud_conn_t *conn, uint64_t now_ms)
+{
+    uint64_t ttfp;
+
+    if (conn->state != CLOUD_CONN_UP || conn->published) {
+        return;
+    }
+    conn->published = 1;
+    conn->stats.last.publish_ms = (now_ms > conn->connected_ms) ? (uint32_t)(now_ms - conn->connected_ms) : 0;
+    ttfp = now_ms - conn->down_ms;
+    conn->stats.ttfp_last_ms = ttfp;
+    conn->stats.ttfp_total_ms += ttfp;
+    conn->stats.ttfp_count++;
+    if (ttfp > conn->stats.ttfp_max_ms) {
+        conn->stats.ttfp_max_ms = ttfp;
+    }
+}
+
+void cloud_conn_close(cloud_conn_t *conn)
+{
+    if (conn->state != CLOUD_CONN_DOWN) {
+        conn->ops.close(conn->ctx);
+    }
+    conn->state = CLOUD_CONN_DOWN;
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    if (conn->resolve != NULL) {
+        cloud_conn_resolve_put(conn->resolve);
+        conn->resolve = NULL;
+    }
+    conn->probe = CLOUD_CONN_PROBE_IDLE;
+}
@@ -0,0 +1,153 @@
+/*
+ * Connection manager for the gateway's cloud connection.
+ *
+ * Every attempt first probes the broker: the host is resolved and a plain TCP
+ * connection is made and dropped. Only when that works is the full sdk
+ * connect (TLS, MQTT CONNECT, topic subscription) run, so while the network is
+ * away attempts cost a resolver query and a SYN instead of a TLS handshake
+ * that can't finish, and can be made often enough to notice the network
+ * coming back within CLOUD_CONN_PROBE_MAX_MS. The last address that resolved
+ * is kept and probed when the resolver fails.
+ *
+ * The probe never blocks the loop. A host name is resolved on a thread of its
+ * own, given CLOUD_CONN_RESOLVE_TIMEOUT_MS before the kept address is probed
+ * instead; a resolver that hangs longer is left to finish, and no other is
+ * started until it has. The TCP connect is non-blocking and checked on every
+ * poll until it is through or CLOUD_CONN_PROBE_TIMEOUT_MS is over. Only the
+ * sdk connect itself still blocks.
+ *
+ * Failed attempts back off exponentially with jitter, so gateways that lost
+ * the broker together don't come back together. After a drop the sdk gets
+ * CLOUD_CONN_GRACE_MS to reconnect by itself; after that its slower internal
+ * back-off is not waited for, the connection is torn down and the manager
+ * takes over.
+ *
+ * Each successful attempt records how long resolving, the TCP probe, the sdk
+ * connect, subscription and the first acknowledged publish took. Time to first
+ * publish is counted from the moment the connection went away, or from start
+ * for the first connection, so it covers the whole outage as the nodes saw it.
+ *
+ * The manager makes no sdk calls itself, they go through cloud_conn_ops_t.
+ * It belongs to the cloud thread, the event calls come from sdk callbacks run
+ * on it.
+ */
+#ifndef _CLOUD_CONN_H_
+#define _CLOUD_CONN_H_
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* first and longest wait between attempts that got as far as the sdk connect */
+#define CLOUD_CONN_BACKOFF_MIN_MS       500
+#define CLOUD_CONN_BACKOFF_MAX_MS       30000
+
+/* longest wait between probes while the broker can't be reached at all */
+#define CLOUD_CONN_PROBE_MAX_MS         4000
+
+/* the TCP probe gives up after this long */
+#define CLOUD_CONN_PROBE_TIMEOUT_MS     2000
+
+/* the resolver is waited for this long, then the kept address is probed */
+#define CLOUD_CONN_RESOLVE_TIMEOUT_MS   5000
+
+/* the sdk may reconnect by itself within this long after a drop */
+#ifndef CLOUD_CONN_GRACE_MS
+#define CLOUD_CONN_GRACE_MS             3000
+#endif
+
+#define CLOUD_CONN_HOST_MAX             128
+
+typedef enum {
+    CLOUD_CONN_DOWN,                    /* nothing open, attempts are made from the poll */
+    CLOUD_CONN_UP,
+    CLOUD_CONN_LOST,                    /* dropped, the sdk has its grace period */
+} cloud_conn_state_t;
+
+typedef enum {
+    CLOUD_CONN_PROBE_IDLE,
+    CLOUD_CONN_PROBE_DNS,               /* waiting for the resolver thread */
+    CLOUD_CONN_PROBE_TCP,               /* waiting for the connect to go through */
+} cloud_conn_probe_t;
+
+/* one host name to resolve, shared with the resolver thread, freed by whichever lets go of it last */
+typedef struct _cloud_conn_resolve {
+    char            host[CLOUD_CONN_HOST_MAX];
+    char            port[8];
+    struct sockaddr_storage addr;
+    socklen_t       addr_len;           /* 0 if it didn't resolve */
+    int             done;               /* set by the thread with a release store once addr is written */
+    int             refs;
+} cloud_conn_resolve_t;
+
+/* connect opens the devices and connects, blocking, 0 once CONNECT went through.
+ * close tears down whatever connect or the sdk left open */
+typedef struct _cloud_conn_ops {
+    int  (*connect)(void *ctx);
+    void (*close)(void *ctx);
+} cloud_conn_ops_t;
+
+/* one attempt, ms per phase */
+typedef struct _cloud_conn_phases {
+    uint32_t        dns_ms;
+    uint32_t        tcp_ms;
+    uint32_t        connect_ms;         /* the sdk connect: its own resolve and TCP, TLS, MQTT CONNECT */
+    uint32_t        subscribe_ms;       /* connect returned until the sdk reported the device initialized */
+    uint32_t        publish_ms;         /* connect returned until the first publish was acknowledged */
+} cloud_conn_phases_t;
+
+typedef struct _cloud_conn_stats {
+    uint64_t        attempts;
+    uint64_t        probe_failures;     /* resolver or TCP probe failed, no sdk connect made */
+    uint64_t        dns_failures;       /* of those, the resolver failed, the kept address was probed */
+    uint64_t        connect_failures;   /* probe fine, sdk connect failed */
+    uint64_t        drops;
+    uint64_t        sdk_recoveries;     /* reconnected by the sdk within the grace period */
+    uint64_t        takeovers;          /* torn down after the grace period */
+    cloud_conn_phases_t last;           /* phases of the last successful attempt */
+    uint64_t        ttfp_last_ms;       /* time to first publish, see above */
+    uint64_t        ttfp_max_ms;
+    uint64_t        ttfp_total_ms;
+    uint64_t        ttfp_count;
+} cloud_conn_stats_t;
+
+typedef struct _cloud_conn {
+    cloud_conn_ops_t ops;
+    void           *ctx;
+    char            host[CLOUD_CONN_HOST_MAX];  /* empty: no probe, attempts go straight to the sdk */
+    char            port[8];
+    uint8_t         state;              /* cloud_conn_state_t */
+    uint8_t         initialized;        /* since the last connect */
+    uint8_t         published;
+    uint32_t        failures;           /* attempts failed in a row */
+    uint32_t        rng;
+    uint64_t        down_ms;            /* start, or when the connection went away */
+    uint64_t        next_ms;            /* next attempt while down */
+    uint64_t        connected_ms;       /* the sdk connect returned */
+    struct sockaddr_storage addr;       /* last address the host resolved to */
+    socklen_t       addr_len;           /* 0 until it first resolved */
+    uint8_t         probe;              /* cloud_conn_probe_t of the attempt under way */
+    int             fd;                 /* TCP probe, -1 for none */
+    uint64_t        probe_ms;           /* the attempt started */
+    cloud_conn_phases_t phases;         /* of the attempt under way */
+    cloud_conn_resolve_t *resolve;      /* resolver thread not yet collected, NULL for none */
+    cloud_conn_stats_t stats;
+} cloud_conn_t;
+
+/* host and port of the broker to probe, NULL host for none. The first attempt is made right away */
+void cloud_conn_init(cloud_conn_t *conn, const char *host, int port, const cloud_conn_ops_t *ops, void *ctx,
+                     uint64_t now_ms);
+
+/* attempt when due, carry on with the one under way, and take over from the sdk once its grace period
+ * is over. Call from the loop */
+void cloud_conn_poll(cloud_conn_t *conn, uint64_t now_ms);
+
+/* sdk events */
+void cloud_conn_connected(cloud_conn_t *conn, uint64_t now_ms);
+void cloud_conn_disconnected(cloud_conn_t *conn, uint64_t now_ms);
+void cloud_conn_initialized(cloud_conn_t *conn, uint64_t now_ms);
+void cloud_conn_published(cloud_conn_t *conn, uint64_t now_ms);
+
+/* tear down whatever is open, at exit */
+void cloud_conn_close(cloud_conn_t *conn);
+
+#endif /* _CLOUD_CONN_H_ */
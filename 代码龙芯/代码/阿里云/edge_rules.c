@@ -0,0 +1,446 @@
+/*
+ * Edge alarm rules
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "edge_rules.h"
+#include "node_hash.h"
+
+/* largest number a rule may hold, well beyond any sensor */
+#define EDGE_RULES_NUMBER_MAX       100000
+
+typedef struct _edge_compiler {
+    const char     *p;
+    edge_rule_t    *rule;
+    int             len;
+    int             depth;
+    const char     *err;
+} edge_compiler_t;
+
+static void edge_skip_space(edge_compiler_t *c)
+{
+    while (isspace((unsigned char)*c->p)) {
+        c->p++;
+    }
+}
+
+/* consume token if it comes next */
+static int edge_accept(edge_compiler_t *c, const char *token)
+{
+    size_t n = strlen(token);
+
+    edge_skip_space(c);
+    if (strncmp(c->p, token, n) != 0) {
+        return 0;
+    }
+    /* a keyword must not run on into a longer identifier */
+    if (isalpha((unsigned char)token[0]) && (isalnum((unsigned char)c->p[n]) || c->p[n] == '_')) {
+        return 0;
+    }
+
+    c->p += n;
+    return 1;
+}
+
+static void edge_emit(edge_compiler_t *c, edge_op_t op, int32_t arg)
+{
+    if (c->err != NULL) {
+        return;
+    }
+    if (c->len == EDGE_RULES_CODE_MAX) {
+        c->err = "rule too long";
+        return;
+    }
+
+    switch (op) {
+        case EDGE_OP_CONST:
+        case EDGE_OP_TEMPERATURE:
+        case EDGE_OP_HUMIDITY:
+        case EDGE_OP_NODE:
+        case EDGE_OP_LINK:
+            c->depth++;
+            break;
+        case EDGE_OP_NEG:
+        case EDGE_OP_NOT:
+        case EDGE_OP_END:
+            break;
+        default:
+            c->depth--;
+            break;
+    }
+    if (c->depth > EDGE_RULES_STACK_MAX) {
+        c->err = "expression nested too deep";
+        return;
+    }
+
+    c->rule->code[c->len].op = op;
+    c->rule->code[c->len].arg = arg;
+    c->len++;
+}
+
+static void edge_parse_or(edge_compiler_t *c);
+
+static void edge_parse_atom(edge_compiler_t *c)
+{
+    char *end;
+    double value;
+
+    if (c->err != NULL) {
+        return;
+    }
+
+    if (edge_accept(c, "(")) {
+        edge_parse_or(c);
+        if (c->err == NULL && !edge_accept(c, ")")) {
+            c->err = "missing )";
+        }
+    } else if (edge_accept(c, "-")) {
+        edge_parse_atom(c);
+        edge_emit(c, EDGE_OP_NEG, 0);
+    } else if (edge_accept(c, "temperature")) {
+        edge_emit(c, EDGE_OP_TEMPERATURE, 0);
+    } else if (edge_accept(c, "humidity")) {
+        edge_emit(c, EDGE_OP_HUMIDITY, 0);
+    } else if (edge_accept(c, "node")) {
+        edge_emit(c, EDGE_OP_NODE, 0);
+    } else if (edge_accept(c, "link")) {
+        edge_emit(c, EDGE_OP_LINK, 0);
+    } else if (isdigit((unsigned char)*c->p) || *c->p == '.') {
+        value = strtod(c->p, &end);
+        if (end == c->p || value > EDGE_RULES_NUMBER_MAX || isalpha((unsigned char)*end)) {
+            c->err = "bad number";
+            return;
+        }
+        c->p = end;
+        edge_emit(c, EDGE_OP_CONST, (int32_t)(value * 10 + 0.5));
+    } else {
+        c->err = (*c->p == '\0') ? "expression ends early" : "unexpected input";
+    }
+}
+
+static void edge_parse_sum(edge_compiler_t *c)
+{
+    edge_parse_atom(c);
+    while (c->err == NULL) {
+        if (edge_accept(c, "+")) {
+            edge_parse_atom(c);
+            edge_emit(c, EDGE_OP_ADD, 0);
+        } else if (edge_accept(c, "-")) {
+            edge_parse_atom(c);
+            edge_emit(c, EDGE_OP_SUB, 0);
+        } else {
+            break;
+        }
+    }
+}
+
+static void edge_parse_compare(edge_compiler_t *c)
+{
+    /* two character operators first so < doesn't take the start of <= */
+    static const struct {
+        const char *token;
+        edge_op_t   op;
+    } ops[] = {
+        { "<=", EDGE_OP_LE }, { ">=", EDGE_OP_GE }, { "==", EDGE_OP_EQ }, { "!=", EDGE_OP_NE },
+        { "<", EDGE_OP_LT }, { ">", EDGE_OP_GT },
+    };
+    int i;
+
+    edge_parse_sum(c);
+    for (i = 0; c->err == NULL && i < (int)(sizeof(ops) / sizeof(ops[0])); i++) {
+        if (edge_accept(c, ops[i].token)) {
+            edge_parse_sum(c);
+            edge_emit(c, ops[i].op, 0);
+            break;
+        }
+    }
+}
+
+static void edge_parse_not(edge_compiler_t *c)
+{
+    edge_skip_space(c);
+    if (c->p[0] == '!' && c->p[1] != '=') {
+        c->p++;
+        edge_parse_not(c);
+        edge_emit(c, EDGE_OP_NOT, 0);
+        return;
+    }
+
+    edge_parse_compare(c);
+}
+
+static void edge_parse_and(edge_compiler_t *c)
+{
+    edge_parse_not(c);
+    while (c->err == NULL && edge_accept(c, "&&")) {
+        edge_parse_not(c);
+        edge_emit(c, EDGE_OP_AND, 0);
+    }
+}
+
+static void edge_parse_or(edge_compiler_t *c)
+{
+    edge_parse_and(c);
+    while (c->err == NULL && edge_accept(c, "||")) {
+        edge_parse_and(c);
+        edge_emit(c, EDGE_OP_OR, 0);
+    }
+}
+
+/* one program ending in EDGE_OP_END, leaving a single value */
+static int edge_parse_program(edge_compiler_t *c)
+{
+    int at = c->len;
+
+    c->depth = 0;
+    edge_parse_or(c);
+    edge_emit(c, EDGE_OP_END, 0);
+    return at;
+}
+
+void edge_rules_init(edge_rules_t *rules, edge_rules_handler_t handler, void *ctx)
+{
+    memset(rules, 0, sizeof(edge_rules_t));
+    rules->handler = handler;
+    rules->ctx = ctx;
+}
+
+int edge_rules_add(edge_rules_t *rules, const char *text, char *err, int err_size)
+{
+    edge_compiler_t c;
+    edge_rule_t *rule;
+    int n = 0;
+
+    if (rules->count == EDGE_RULES_MAX) {
+        snprintf(err, err_size, "more than %d rules", EDGE_RULES_MAX);
+        return -1;
+    }
+    rule = &rules->rules[rules->count];
+    memset(rule, 0, sizeof(edge_rule_t));
+
+    memset(&c, 0, sizeof(c));
+    c.p = text;
+    c.rule = rule;
+
+    edge_skip_space(&c);
+    while (isalnum((unsigned char)c.p[n]) || c.p[n] == '_' || c.p[n] == '-') {
+        n++;
+    }
+    if (n == 0 || n >= EDGE_RULES_NAME_MAX) {
+        snprintf(err, err_size, "rule needs a name of 1 to %d letters", EDGE_RULES_NAME_MAX - 1);
+        return -1;
+    }
+    memcpy(rule->name, c.p, n);
+    c.p += n;
+    if (!edge_accept(&c, ":")) {
+        snprintf(err, err_size, "missing : after the rule name");
+        return -1;
+    }
+
+    rule->set_at = edge_parse_program(&c);
+    rule->clear_at = -1;
+    if (c.err == NULL && edge_accept(&c, "clear")) {
+        rule->clear_at = edge_parse_program(&c);
+    }
+    edge_skip_space(&c);
+    if (c.err == NULL && *c.p != '\0') {
+        c.err = "unexpected input";
+    }
+
+    if (c.err != NULL) {
+        snprintf(err, err_size, "%s at column %d", c.err, (int)(c.p - text) + 1);
+        return -1;
+    }
+
+    rules->count++;
+    return 0;
+}
+
+int edge_rules_load(edge_rules_t *rules, const char *path, char *err, int err_size)
+{
+    char line[EDGE_RULES_LINE_MAX], msg[128];
+    int first = rules->count;
+    int number = 0, failed = 0;
+    FILE *fp;
+
+    fp = fopen((path != NULL) ? path : EDGE_RULES_PATH_DEFAULT, "r");
+    if (fp == NULL) {
+        snprintf(err, err_size, "can't open %s", (path != NULL) ? path : EDGE_RULES_PATH_DEFAULT);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char *p = line;
+        char *nl = strchr(line, '\n');
+
+        number++;
+        if (nl == NULL && !feof(fp)) {
+            snprintf(err, err_size, "line %d: longer than %d bytes", number, EDGE_RULES_LINE_MAX - 2);
+            failed = 1;
+            break;
+        }
+        if (nl != NULL) {
+            *nl = '\0';
+        }
+
+        while (isspace((unsigned char)*p)) {
+            p++;
+        }
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+
+        if (edge_rules_add(rules, p, msg, sizeof(msg)) < 0) {
+            snprintf(err, err_size, "line %d: %s", number, msg);
+            failed = 1;
+            break;
+        }
+    }
+
+    fclose(fp);
+    if (failed) {
+        rules->count = first;
+        return -1;
+    }
+
+    return rules->count - first;
+}
+
+/* run one program, its value as a truth value */
+static int edge_rules_run(const edge_insn_t *pc, const app_reading_t *reading)
+{
+    int32_t stack[EDGE_RULES_STACK_MAX];
+    int32_t *sp = stack;
+
+    for (;; pc++) {
+        switch (pc->op) {
+            case EDGE_OP_CONST:
+                *sp++ = pc->arg;
+                break;
+            case EDGE_OP_TEMPERATURE:
+                *sp++ = reading->temperature;
+                break;
+            case EDGE_OP_HUMIDITY:
+                *sp++ = reading->humidity;
+                break;
+            case EDGE_OP_NODE:
+                *sp++ = (int32_t)reading->node_id * 10;
+                break;
+            case EDGE_OP_LINK:
+                *sp++ = (int32_t)reading->link * 10;
+                break;
+            case EDGE_OP_NEG:
+                sp[-1] = -sp[-1];
+                break;
+            case EDGE_OP_ADD:
+                sp--;
+                sp[-1] += sp[0];
+                break;
+            case EDGE_OP_SUB:
+                sp--;
+                sp[-1] -= sp[0];
+                break;
+            case EDGE_OP_LT:
+                sp--;
+                sp[-1] = sp[-1] < sp[0];
+                break;
+            case EDGE_OP_LE:
+                sp--;
+                sp[-1] = sp[-1] <= sp[0];
+                break;
+            case EDGE_OP_GT:
+                sp--;
+                sp[-1] = sp[-1] > sp[0];
+                break;
+            case EDGE_OP_GE:
+                sp--;
+                sp[-1] = sp[-1] >= sp[0];
+                break;
+            case EDGE_OP_EQ:
+                sp--;
+                sp[-1] = sp[-1] == sp[0];
+                break;
+            case EDGE_OP_NE:
+                sp--;
+                sp[-1] = sp[-1] != sp[0];
+                break;
+            case EDGE_OP_NOT:
+                sp[-1] = !sp[-1];
+                break;
+            case EDGE_OP_AND:
+                sp--;
+                sp[-1] = sp[-1] && sp[0];
+                break;
+            case EDGE_OP_OR:
+                sp--;
+                sp[-1] = sp[-1] || sp[0];
+                break;
+            default:
+                return sp[-1] != 0;
+        }
+    }
+}
+
+static int edge_rules_match(const edge_rules_t *rules, uint32_t pos, uint8_t link, uint16_t node_id)
+{
+    const edge_rules_node_t *node = &rules->nodes[pos];
+
+    return !node->used || (node->node_id == node_id && node->link == link);
+}
+
+static edge_rules_node_t *edge_rules_node(edge_rules_t *rules, uint8_t link, uint16_t node_id)
+{
+    int slot = NODE_HASH_PROBE(EDGE_RULES_NODES, link, node_id, pos, edge_rules_match(rules, pos, link, node_id));
+    edge_rules_node_t *node = &rules->nodes[slot];
+
+    if (!node->used) {
+        if (rules->node_count >= EDGE_RULES_NODES / 4 * 3) {
+            return NULL;
+        }
+        node->used = 1;
+        node->node_id = node_id;
+        node->link = link;
+        node->active = 0;
+        rules->node_count++;
+    }
+
+    return node;
+}
+
+void edge_rules_eval(edge_rules_t *rules, const app_reading_t *reading)
+{
+    edge_rules_node_t *node;
+    int i;
+
+    if (rules->count == 0) {
+        return;
+    }
+
+    node = edge_rules_node(rules, reading->link, reading->node_id);
+    if (node == NULL) {
+        rules->stats.untracked++;
+        return;
+    }
+    rules->stats.evaluated++;
+
+    for (i = 0; i < rules->count; i++) {
+        const edge_rule_t *rule = &rules->rules[i];
+        uint32_t bit = 1u << i;
+
+        if (!(node->active & bit)) {
+            if (edge_rules_run(rule->code + rule->set_at, reading)) {
+                node->active |= bit;
+                rules->stats.raised++;
+                rules->handler(rules->ctx, rule, reading, 1);
+            }
+        } else if (rule->clear_at >= 0 ? edge_rules_run(rule->code + rule->clear_at, reading) :
+                   !edge_rules_run(rule->code + rule->set_at, reading)) {
+            node->active &= ~bit;
+            rules->stats.cleared++;
+            rules->handler(rules->ctx, rule, reading, 0);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * Edge alarm rules, evaluated on the gateway for every reading.
+ *
+ * A rule is one line of text:
+ *
+ *   name: expression [clear expression]
+ *
+ * over the operands temperature, humidity, node and link (the coordinator the
+ * node is on), decimal numbers, + - and
+ * unary -, the comparisons < <= > >= == != and ! && || with parentheses:
+ *
+ *   overheat: temperature > 35 clear temperature < 34.5
+ *   dry: humidity < 20 && node != 7
+ *
+ * A rule is raised for a node when its expression becomes true and cleared
+ * when the clear expression becomes true, or when the expression turns false
+ * again if there is none; a clear expression below the trigger keeps a value
+ * hovering at the threshold from flapping. The handler is called on these
+ * transitions only.
+ *
+ * Rules are compiled once into a flat stack bytecode. Everything is integer
+ * tenths at run time: readings already are, numbers are scaled when compiled
+ * and node ids and links are loaded times ten, so every operand compares alike.
+ * A node is known by its link and node id, the same id on two links is two nodes.
+ */
+#ifndef _EDGE_RULES_H_
+#define _EDGE_RULES_H_
+
+#include <stdint.h>
+
+#include "app_reading.h"
+
+#ifndef EDGE_RULES_PATH_DEFAULT
+#define EDGE_RULES_PATH_DEFAULT     "./rules.conf"
+#endif
+
+/* rules at once, one bit each in the per node state */
+#define EDGE_RULES_MAX              32
+
+#define EDGE_RULES_NAME_MAX         24
+#define EDGE_RULES_CODE_MAX         64
+#define EDGE_RULES_STACK_MAX        16
+#define EDGE_RULES_LINE_MAX         256
+
+/* open addressed node state table, power of two, holds nodes up to 3/4 of it */
+#define EDGE_RULES_NODES            4096
+
+typedef enum {
+    EDGE_OP_CONST,
+    EDGE_OP_TEMPERATURE,
+    EDGE_OP_HUMIDITY,
+    EDGE_OP_NODE,
+    EDGE_OP_LINK,
+    EDGE_OP_NEG,
+    EDGE_OP_ADD,
+    EDGE_OP_SUB,
+    EDGE_OP_LT,
+    EDGE_OP_LE,
+    EDGE_OP_GT,
+    EDGE_OP_GE,
+    EDGE_OP_EQ,
+    EDGE_OP_NE,
+    EDGE_OP_NOT,
+    EDGE_OP_AND,
+    EDGE_OP_OR,
+    EDGE_OP_END
+} edge_op_t;
+
+typedef struct _edge_insn {
+    int32_t         op;
+    int32_t         arg;                /* EDGE_OP_CONST only */
+} edge_insn_t;
+
+typedef struct _edge_rule {
+    char            name[EDGE_RULES_NAME_MAX];
+    int             set_at;             /* offsets of the two programs in code */
+    int             clear_at;           /* -1 without a clear expression */
+    edge_insn_t     code[EDGE_RULES_CODE_MAX];
+} edge_rule_t;
+
+typedef struct _edge_rules_node {
+    uint16_t        node_id;
+    uint8_t         link;
+    uint8_t         used;
+    uint32_t        active;             /* bit per rule raised for the node */
+} edge_rules_node_t;
+
+typedef struct _edge_rules_stats {
+    uint64_t        evaluated;          /* readings run through the rules */
+    uint64_t        raised;
+    uint64_t        cleared;
+    uint64_t        untracked;          /* node table full, readings not evaluated */
+} edge_rules_stats_t;
+
+/* a rule changed state for the node of reading, active is 1 when raised and 0 when cleared */
+typedef void (*edge_rules_handler_t)(void *ctx, const edge_rule_t *rule, const app_reading_t *reading, int active);
+
+typedef struct _edge_rules {
+    edge_rule_t         rules[EDGE_RULES_MAX];
+    int                 count;
+    edge_rules_node_t   nodes[EDGE_RULES_NODES];
+    int                 node_count;
+    edge_rules_handler_t handler;
+    void               *ctx;
+    edge_rules_stats_t  stats;
+} edge_rules_t;
+
+void edge_rules_init(edge_rules_t *rules, edge_rules_handler_t handler, void *ctx);
+
+/* compile one rule line, -1 and a message in err if it doesn't parse */
+int  edge_rules_add(edge_rules_t *rules, const char *text, char *err, int err_size);
+
+/* compile every rule of a file, blank lines and # comments are skipped.
+ * Number of rules, or -1 with "line N: message" in err; nothing is kept then */
+int  edge_rules_load(edge_rules_t *rules, const char *path, char *err, int err_size);
+
+void edge_rules_eval(edge_rules_t *rules, const app_reading_t *reading);
+
+#endif /* _EDGE_RULES_H_ */
@@ -0,0 +1,144 @@
+/*
+ * Micro benchmark: legacy one-reading frames against packed uplink frames.
+ * Reports wire bytes per reading, the readings/s the coordinator uart can carry
+ * and host decode speed through frame_decoder. Builds without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "serial_bridge.h"
+#include "uplink.h"
+
+#define BENCH_READINGS          200000
+#define BENCH_NODES             200
+#define BENCH_ROUNDS            20
+#define BENCH_UART_BAUD         SERIAL_BRIDGE_BAUD
+
+static uint8_t bench_stream[BENCH_READINGS * FRAME_SIZE_MAX];
+static uint64_t bench_decoded;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* nodes in turn, each drifting slowly like the simulator's rooms, in tenths */
+static void bench_reading(int i, uplink_reading_t *reading)
+{
+    static int16_t temperature[BENCH_NODES], humidity[BENCH_NODES];
+    int node = i % BENCH_NODES;
+
+    if (i < BENCH_NODES) {
+        temperature[node] = 180 + rand() % 100;
+        humidity[node] = (40 + rand() % 30) * 10;
+    }
+    temperature[node] += rand() % 3 - 1;
+    humidity[node] += (rand() % 3 - 1) * 10;
+
+    reading->node_id = node + 1;
+    reading->temperature = temperature[node];
+    reading->humidity = humidity[node];
+    reading->seq = (uint8_t)(i / BENCH_NODES);
+    reading->age = 0;
+    reading->flags = 0;
+}
+
+static int bench_legacy_stream(void)
+{
+    int i, len = 0;
+
+    srand(1);
+    for (i = 0; i < BENCH_READINGS; i++) {
+        uplink_reading_t reading;
+        uint8_t *p = bench_stream + len;
+
+        bench_reading(i, &reading);
+        p[0] = FRAME_HEAD_SIZE + 3;
+        p[2] = FUN_CODE_UPDATA_DATA;
+        p[3] = (uint8_t)reading.node_id;
+        p[4] = (uint8_t)(reading.temperature / 10);
+        p[5] = (uint8_t)(reading.humidity / 10);
+        p[1] = p[2] + p[3] + p[4] + p[5];
+        p[6] = FRAME_TAIL_0;
+        p[7] = FRAME_TAIL_1;
+        len += 8;
+    }
+
+    return len;
+}
+
+static int bench_uplink_stream(void)
+{
+    uplink_encoder_t enc;
+    int i, len = 0;
+
+    srand(1);
+    uplink_encoder_begin(&enc, bench_stream);
+    for (i = 0; i < BENCH_READINGS; i++) {
+        uplink_reading_t reading;
+
+        bench_reading(i, &reading);
+        if (uplink_encoder_add(&enc, &reading) < 0) {
+            len += uplink_encoder_finish(&enc);
+            uplink_encoder_begin(&enc, bench_stream + len);
+            uplink_encoder_add(&enc, &reading);
+        }
+    }
+    len += uplink_encoder_finish(&enc);
+
+    return len;
+}
+
+static void bench_handler(void *ctx, uint8_t fc, const uint8_t *data, int len)
+{
+    uplink_reading_t readings[UPLINK_PAYLOAD_MAX];
+    int count;
+
+    (void)ctx;
+    if (fc == FUN_CODE_UPDATA_DATA) {
+        bench_decoded++;
+    } else if (fc == UPLINK_FC_SAMPLES || fc == UPLINK_FC_READINGS) {
+        count = uplink_decode_readings(fc, data, len, readings, UPLINK_PAYLOAD_MAX);
+        if (count > 0) {
+            bench_decoded += count;
+        }
+    }
+}
+
+/* 1 if every reading came out of the decoder */
+static int bench_run(const char *name, int (*build)(void))
+{
+    static frame_decoder_t dec;
+    double start, elapsed;
+    int len = build();
+    int round, ok;
+
+    bench_decoded = 0;
+    start = bench_now();
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+        frame_decoder_init(&dec, bench_handler, NULL);
+        frame_decoder_feed(&dec, bench_stream, len);
+    }
+    elapsed = bench_now() - start;
+    ok = bench_decoded == (uint64_t)BENCH_READINGS * BENCH_ROUNDS;
+
+    printf("%-8s %5.2f bytes/reading  %6.0f readings/s at %d baud  %10.0f readings/s decoded  %s\n", name,
+           (double)len / BENCH_READINGS, BENCH_UART_BAUD / 10.0 / ((double)len / BENCH_READINGS), BENCH_UART_BAUD,
+           bench_decoded / elapsed, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int ok = 1;
+
+    ok &= bench_run("legacy", bench_legacy_stream);
+    ok &= bench_run("uplink", bench_uplink_stream);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+/*
+ * Micro benchmark: binary log. Measures what recording a trace costs the
+ * calling thread next to the synchronous three-printf APP_TRACE, with one
+ * and with several threads logging in bursts the writer keeps up with, how
+ * many records the writer formats and files a second when flooded, how the
+ * rate limit thins a flooding call site on the console, and decodes rotated
+ * files back into the text snprintf makes of the same arguments. Builds
+ * without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "bin_log.h"
+
+#define BENCH_BURST             1000    /* records in a row, the writer catches up in between */
+#define BENCH_BURSTS            1000
+#define BENCH_TRACES            1000000
+#define BENCH_THREADS           4
+#define BENCH_FLOOD_MS          500
+#define BENCH_ROUNDTRIP         20000
+#define BENCH_PATH              "/tmp/log_bench.log"
+#define BENCH_FILE_MAX          (256 * 1024)
+#define BENCH_FILES             3
+
+static bin_log_t bench_log;
+static FILE *bench_null;
+static uint64_t bench_lines;
+static const char bench_payload[] = "{\"temperature\":23.5,\"humidity\":41,\"light\":380,\"battery\":87,\"rssi\":-71}";
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_out(const char *line, int len, void *ctx)
+{
+    fprintf(bench_null, "%.*s\r\n", len, line);
+    fflush(bench_null);
+    bench_lines++;
+}
+
+/* what APP_TRACE did per message */
+static void bench_trace(int node_id)
+{
+    fprintf(bench_null, "%s|%03d :: ", __func__, __LINE__);
+    fprintf(bench_null, "App post reading of node %d:%d fail, spooled", 0, node_id);
+    fprintf(bench_null, "%s", "\r\n");
+    fflush(bench_null);
+}
+
+static void bench_wait(void)
+{
+    while (__atomic_load_n(&bench_log.head, __ATOMIC_RELAXED) != __atomic_load_n(&bench_log.tail, __ATOMIC_RELAXED)) {
+        usleep(100);
+    }
+}
+
+/* seconds spent recording bursts of a post failure and of a payload, the drains in between aren't counted */
+static double bench_bursts(int bursts, int burst)
+{
+    double t, spent = 0;
+    int b, i;
+
+    for (b = 0; b < bursts; b++) {
+        t = bench_now();
+        for (i = 0; i < burst; i += 2) {
+            BIN_LOG(&bench_log, "App post reading of node %d:%d fail, spooled", 0, i);
+            BIN_LOG(&bench_log, "Property post of node %d:%d, seq %llu, payload: %.*s", 0, i, (unsigned long long)b,
+                    (int)sizeof(bench_payload) - 1, bench_payload);
+        }
+        spent += bench_now() - t;
+        bench_wait();
+    }
+
+    return spent;
+}
+
+static void *bench_producer(void *arg)
+{
+    double *spent = (double *)arg;
+
+    *spent = bench_bursts(BENCH_BURSTS / 4, BENCH_BURST / BENCH_THREADS);
+    return NULL;
+}
+
+static volatile int bench_flooding;
+
+static void *bench_flooder(void *arg)
+{
+    uint64_t *n = (uint64_t *)arg;
+
+    while (bench_flooding) {
+        BIN_LOG(&bench_log, "Reading ring full, %llu readings dropped so far", (unsigned long long)*n);
+        (*n)++;
+    }
+    return NULL;
+}
+
+static void bench_start(const char *path, uint32_t file_max, int files)
+{
+    bin_log_init(&bench_log, bench_out, NULL);
+    if (bin_log_start(&bench_log, path, file_max, files) < 0) {
+        perror("bin_log_start");
+        exit(1);
+    }
+    bench_lines = 0;
+}
+
+/* what snprintf makes of the round trip record of seq */
+static int bench_expect(unsigned long long seq, char *out, int size)
+{
+    return snprintf(out, size, "node %d:%04x seq %llu %s %.*s|%-6s|%5.2f|%c|%*d|%lu%%",
+                    (int)(seq % 7) - 3, (unsigned)(seq * 2654435761u), seq, (seq & 1) ? "odd" : "even",
+                    (int)(seq % 20), bench_payload, "x", seq / 7.0, 'a' + (int)(seq % 26), (int)(seq % 9), -4,
+                    (unsigned long)seq * 3);
+}
+
+static unsigned long long bench_decoded, bench_next, bench_bad;
+
+static void bench_decoded_line(uint64_t ns, const char *func, int line, const char *text, void *ctx)
+{
+    unsigned long long seq;
+    char expect[BIN_LOG_LINE_MAX];
+    int skip = 0;
+
+    if (sscanf(text, "node %*d:%*x seq %llu%n", &seq, &skip) != 1 || skip == 0) {
+        bench_bad++;
+        return;
+    }
+    bench_expect(seq, expect, sizeof(expect));
+    if ((bench_decoded > 0 && seq != bench_next) || strcmp(text, expect) != 0) {
+        bench_bad++;
+    }
+    bench_next = seq + 1;
+    bench_decoded++;
+}
+
+int main(int argc, char **argv)
+{
+    static double spent[BENCH_THREADS];
+    static uint64_t flooded;
+    pthread_t threads[BENCH_THREADS];
+    double t, t_log, t_trace, t_threads = 0;
+    uint64_t records;
+    int i, ok, failed = 0;
+
+    bench_null = fopen("/dev/null", "w");
+    if (bench_null == NULL) {
+        return 1;
+    }
+
+    /* one thread to the console, then several to the console and the file */
+    bench_start(NULL, 0, 0);
+    t_log = bench_bursts(BENCH_BURSTS, BENCH_BURST);
+    bin_log_stop(&bench_log);
+    ok = bench_log.stats.records == (uint64_t)BENCH_BURSTS * BENCH_BURST && bench_log.stats.dropped == 0;
+    t = bench_now();
+    for (i = 0; i < BENCH_TRACES; i++) {
+        bench_trace(i);
+    }
+    t_trace = bench_now() - t;
+    printf("record   %5.1f ns a trace in bursts of %d, %6.1f ns APP_TRACE to /dev/null, %llu dropped  %s\n",
+           t_log * 1e9 / ((double)BENCH_BURSTS * BENCH_BURST), BENCH_BURST, t_trace * 1e9 / BENCH_TRACES,
+           (unsigned long long)bench_log.stats.dropped, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    bench_start(BENCH_PATH, BENCH_FILE_MAX, BENCH_FILES);
+    for (i = 0; i < BENCH_THREADS; i++) {
+        pthread_create(&threads[i], NULL, bench_producer, &spent[i]);
+    }
+    for (i = 0; i < BENCH_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        t_threads += spent[i];
+    }
+    bin_log_stop(&bench_log);
+    records = (uint64_t)(BENCH_BURSTS / 4) * BENCH_BURST;
+    ok = bench_log.stats.records + bench_log.stats.dropped == records && bench_log.stats.rotations > 0;
+    printf("threads  %d threads %5.1f ns a trace in bursts of %d with the file on, %llu rotations, %llu dropped  %s\n",
+           BENCH_THREADS, t_threads * 1e9 / records, BENCH_BURST / BENCH_THREADS,
+           (unsigned long long)bench_log.stats.rotations,
+           (unsigned long long)bench_log.stats.dropped, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* one site flooding: the writer's throughput, the rate limit */
+    bench_start(BENCH_PATH, BENCH_FILE_MAX, BENCH_FILES);
+    bench_flooding = 1;
+    pthread_create(&threads[0], NULL, bench_flooder, &flooded);
+    t = bench_now();
+    usleep(BENCH_FLOOD_MS * 1000);
+    bench_flooding = 0;
+    pthread_join(threads[0], NULL);
+    bin_log_stop(&bench_log);
+    t = bench_now() - t;
+    ok = bench_log.stats.records + bench_log.stats.dropped == flooded
+         && bench_lines <= BIN_LOG_BURST + BIN_LOG_RATE * (uint64_t)(t + 1) + 4;
+    printf("flood    writer %5.0f k records/s, %llu of %llu dropped, %llu console lines, %llu suppressed  %s\n",
+           bench_log.stats.records / t / 1000, (unsigned long long)bench_log.stats.dropped,
+           (unsigned long long)flooded, (unsigned long long)bench_lines,
+           (unsigned long long)bench_log.stats.suppressed, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* every kind of argument through rotated files and back */
+    bench_start(BENCH_PATH, BENCH_FILE_MAX / 4, BENCH_FILES);
+    for (i = 0; i < BENCH_ROUNDTRIP; i++) {
+        unsigned long long seq = i;
+
+        BIN_LOG(&bench_log, "node %d:%04x seq %llu %s %.*s|%-6s|%5.2f|%c|%*d|%lu%%",
+                (int)(seq % 7) - 3, (unsigned)(seq * 2654435761u), seq, (seq & 1) ? "odd" : "even",
+                (int)(seq % 20), bench_payload, "x", seq / 7.0, 'a' + (int)(seq % 26), (int)(seq % 9), -4,
+                (unsigned long)seq * 3);
+        if (i % BENCH_BURST == 0) {
+            bench_wait();
+        }
+    }
+    bin_log_stop(&bench_log);
+    for (i = BENCH_FILES - 1; i >= 0; i--) {
+        char name[64];
+        FILE *fp;
+
+        snprintf(name, sizeof(name), (i > 0) ? "%s.%d" : "%s", BENCH_PATH, i);
+        fp = fopen(name, "rb");
+        if (fp == NULL || bin_log_decode(fp, bench_decoded_line, NULL) < 0) {
+            bench_bad++;
+        }
+        if (fp != NULL) {
+            fclose(fp);
+            unlink(name);
+        }
+    }
+    ok = bench_bad == 0 && bench_decoded > 0 && bench_next == BENCH_ROUNDTRIP && bench_log.stats.dropped == 0;
+    printf("decode   %llu of %d records in %d rotated files, %llu bytes written, all as snprintf has them  %s\n",
+           bench_decoded, BENCH_ROUNDTRIP, BENCH_FILES, (unsigned long long)bench_log.stats.bytes,
+           ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    fclose(bench_null);
+    return failed ? 1 : 0;
+}
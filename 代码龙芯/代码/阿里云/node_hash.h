@@ -0,0 +1,37 @@
+/*
+ * Hash and linear probe of the per node tables
+ *
+ * The gateway keeps several open addressed tables keyed on a node's
+ * coordinator link and id, all a power of two in size and all probed
+ * linearly from the same hash. Tables keyed on the id alone pass link 0.
+ */
+#ifndef _NODE_HASH_H_
+#define _NODE_HASH_H_
+
+#include <stdint.h>
+
+/* multiplicative hash, the high half spreads consecutive ids over the table */
+static inline uint32_t node_hash(uint8_t link, uint16_t node_id)
+{
+    return ((((uint32_t)link << 16) | node_id) * 2654435761u) >> 16;
+}
+
+/* first position pos from the node's hash for which match, an expression of pos, holds:
+ * the node's or a free one. -1 if none of the size positions does. A macro rather than a
+ * callback so the match is inlined into the lookups on the reading path */
+#define NODE_HASH_PROBE(size, link, node_id, pos, match) \
+    __extension__({ \
+        uint32_t pos = node_hash(link, node_id); \
+        uint32_t node_hash_probes_; \
+        int node_hash_found_ = -1; \
+        for (node_hash_probes_ = 0; node_hash_probes_ < (size); node_hash_probes_++, pos++) { \
+            pos &= (size) - 1; \
+            if (match) { \
+                node_hash_found_ = (int)pos; \
+                break; \
+            } \
+        } \
+        node_hash_found_; \
+    })
+
+#endif /* _NODE_HASH_H_ */
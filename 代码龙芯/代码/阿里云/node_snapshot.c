@@ -0,0 +1,218 @@
+/*
+ * Latest reading of every node, in shared memory
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "node_snapshot.h"
+#include "node_hash.h"
+
+static uint64_t node_snapshot_clock_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void node_snapshot_name(node_snapshot_t *snap, const char *name)
+{
+    snprintf(snap->name, sizeof(snap->name), "%s", (name != NULL) ? name : NODE_SNAPSHOT_NAME_DEFAULT);
+}
+
+int node_snapshot_create(node_snapshot_t *snap, const char *name)
+{
+    node_snapshot_shm_t *shm;
+    int fd;
+
+    memset(snap, 0, sizeof(node_snapshot_t));
+    node_snapshot_name(snap, name);
+
+    /* readers still mapping the old segment keep it until they re-attach */
+    shm_unlink(snap->name);
+    fd = shm_open(snap->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(node_snapshot_shm_t)) < 0) {
+        close(fd);
+        shm_unlink(snap->name);
+        return -1;
+    }
+
+    shm = mmap(NULL, sizeof(node_snapshot_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        shm_unlink(snap->name);
+        return -1;
+    }
+
+    /* the magic goes in last, a reader attaching earlier sees an empty segment */
+    memset(shm->index, 0xff, sizeof(shm->index));
+    shm->version = NODE_SNAPSHOT_VERSION;
+    shm->capacity = NODE_SNAPSHOT_NODES;
+    __atomic_store_n(&shm->magic, NODE_SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+
+    snap->shm = shm;
+    snap->owner = 1;
+    return 0;
+}
+
+int node_snapshot_attach(node_snapshot_t *snap, const char *name)
+{
+    node_snapshot_shm_t *shm;
+    struct stat st;
+    int fd;
+
+    memset(snap, 0, sizeof(node_snapshot_t));
+    node_snapshot_name(snap, name);
+
+    fd = shm_open(snap->name, O_RDONLY, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(node_snapshot_shm_t)) {
+        close(fd);
+        return -1;
+    }
+
+    shm = mmap(NULL, sizeof(node_snapshot_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        return -1;
+    }
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != NODE_SNAPSHOT_MAGIC ||
+        shm->version != NODE_SNAPSHOT_VERSION || shm->capacity != NODE_SNAPSHOT_NODES) {
+        munmap(shm, sizeof(node_snapshot_shm_t));
+        return -1;
+    }
+
+    snap->shm = shm;
+    return 0;
+}
+
+void node_snapshot_close(node_snapshot_t *snap)
+{
+    if (snap->shm == NULL) {
+        return;
+    }
+
+    munmap(snap->shm, sizeof(node_snapshot_shm_t));
+    snap->shm = NULL;
+    if (snap->owner) {
+        shm_unlink(snap->name);
+    }
+}
+
+static int node_snapshot_match(const node_snapshot_shm_t *shm, uint32_t pos, uint8_t link, uint16_t node_id)
+{
+    int i = __atomic_load_n(&shm->index[pos], __ATOMIC_ACQUIRE);
+
+    return i < 0 || (i < NODE_SNAPSHOT_NODES && shm->slots[i].node_id == node_id && shm->slots[i].link == link);
+}
+
+/* index position holding the node or the free one it would go to, -1 if the index is full */
+static int node_snapshot_lookup(const node_snapshot_shm_t *shm, uint8_t link, uint16_t node_id)
+{
+    return NODE_HASH_PROBE(NODE_SNAPSHOT_INDEX_SIZE, link, node_id, pos, node_snapshot_match(shm, pos, link, node_id));
+}
+
+static void node_snapshot_write(node_snapshot_slot_t *slot, const app_reading_t *reading)
+{
+    uint32_t seq = slot->seq;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store_n(&slot->temperature, reading->temperature, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->humidity, reading->humidity, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->timestamp_ms, reading->timestamp_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->updates, slot->updates + 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void node_snapshot_update(node_snapshot_t *snap, const app_reading_t *reading)
+{
+    node_snapshot_shm_t *shm = snap->shm;
+    int pos = node_snapshot_lookup(shm, reading->link, reading->node_id);
+    int i = (pos < 0) ? -1 : shm->index[pos];
+
+    if (i >= 0) {
+        node_snapshot_write(&shm->slots[i], reading);
+    } else if (pos < 0 || shm->count >= NODE_SNAPSHOT_NODES) {
+        snap->untracked++;
+        return;
+    } else {
+        /* fill the slot before anyone can find it */
+        i = shm->count;
+        shm->slots[i].node_id = reading->node_id;
+        shm->slots[i].link = reading->link;
+        node_snapshot_write(&shm->slots[i], reading);
+        __atomic_store_n(&shm->index[pos], i, __ATOMIC_RELEASE);
+        __atomic_store_n(&shm->count, i + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&shm->generation, shm->generation + 1, __ATOMIC_RELEASE);
+}
+
+int node_snapshot_read(const node_snapshot_t *snap, int slot, node_snapshot_reading_t *reading)
+{
+    const node_snapshot_slot_t *s = &snap->shm->slots[slot];
+    uint32_t seq, spins = 0;
+    uint64_t deadline = 0;
+
+    do {
+        /* odd: the writer is in the slot, it is out again within a few stores unless it was
+         * preempted there, or died there and never will be */
+        while ((seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE)) & 1) {
+            if (++spins < NODE_SNAPSHOT_READ_SPINS) {
+                continue;
+            }
+            spins = 0;
+            if (deadline == 0) {
+                deadline = node_snapshot_clock_ms() + NODE_SNAPSHOT_READ_TIMEOUT_MS;
+            } else if (node_snapshot_clock_ms() >= deadline) {
+                return -1;
+            }
+            sched_yield();
+        }
+
+        reading->node_id = s->node_id;
+        reading->link = s->link;
+        reading->temperature = __atomic_load_n(&s->temperature, __ATOMIC_RELAXED);
+        reading->humidity = __atomic_load_n(&s->humidity, __ATOMIC_RELAXED);
+        reading->timestamp_ms = __atomic_load_n(&s->timestamp_ms, __ATOMIC_RELAXED);
+        reading->updates = __atomic_load_n(&s->updates, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq);
+
+    return 0;
+}
+
+int node_snapshot_get(const node_snapshot_t *snap, uint8_t link, uint16_t node_id, node_snapshot_reading_t *reading)
+{
+    int pos = node_snapshot_lookup(snap->shm, link, node_id);
+    int i = (pos < 0) ? -1 : __atomic_load_n(&snap->shm->index[pos], __ATOMIC_ACQUIRE);
+
+    if (i < 0 || i >= NODE_SNAPSHOT_NODES) {
+        return -1;
+    }
+
+    return node_snapshot_read(snap, i, reading);
+}
+
+int node_snapshot_count(const node_snapshot_t *snap)
+{
+    uint32_t count = __atomic_load_n(&snap->shm->count, __ATOMIC_ACQUIRE);
+
+    return (count > NODE_SNAPSHOT_NODES) ? NODE_SNAPSHOT_NODES : (int)count;
+}
@@ -0,0 +1,102 @@
+/*
+ * Latest reading of every node, published in POSIX shared memory.
+ *
+ * The ingestion thread is the only writer. Every node slot has its own
+ * sequence counter: the writer makes it odd, updates the slot and makes it
+ * even again, a reader copies the slot and retries when the counter was odd
+ * or moved meanwhile. Readers take no locks and never hold up the writer, so
+ * local processes may map the segment and poll it as often as they like. A
+ * slot a writer died in stays odd; readers give up on it after a bounded wait.
+ *
+ * Slots are handed out in the order nodes are first seen and never move. A
+ * node, known by its coordinator link and node id, is found through an open
+ * addressed index of slot numbers which is only ever added to; an entry is
+ * published after its slot, and count after both.
+ */
+#ifndef _NODE_SNAPSHOT_H_
+#define _NODE_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include "app_reading.h"
+
+/* shm_open name, the segment shows up as /dev/shm/zigbee_nodes */
+#ifndef NODE_SNAPSHOT_NAME_DEFAULT
+#define NODE_SNAPSHOT_NAME_DEFAULT      "/zigbee_nodes"
+#endif
+
+#define NODE_SNAPSHOT_MAGIC             0x4e534e5a      /* "ZNSN" */
+#define NODE_SNAPSHOT_VERSION           2       /* 2: coordinator link */
+
+/* nodes with a slot, later nodes are counted and not published */
+#define NODE_SNAPSHOT_NODES             1024
+
+/* power of two and at least twice the nodes */
+#define NODE_SNAPSHOT_INDEX_SIZE        2048
+
+/* a reader spins this many looks at an odd counter, then yields between looks and gives up
+ * on the slot once it stayed odd this long: the writer died in it */
+#define NODE_SNAPSHOT_READ_SPINS        1024
+#ifndef NODE_SNAPSHOT_READ_TIMEOUT_MS
+#define NODE_SNAPSHOT_READ_TIMEOUT_MS   100
+#endif
+
+/* layout shared with other processes, only ever extended at the end */
+typedef struct _node_snapshot_slot {
+    uint32_t        seq;                /* odd while the writer is in the slot */
+    uint16_t        node_id;            /* set before the slot is indexed, never changes */
+    int16_t         temperature;        /* 0.1 C */
+    int16_t         humidity;           /* 0.1 %RH */
+    uint8_t         link;               /* set with node_id */
+    uint8_t         reserved;
+    uint32_t        updates;            /* readings published for the node */
+    uint64_t        timestamp_ms;       /* wall clock ms when the node took the sample */
+} node_snapshot_slot_t;
+
+typedef struct _node_snapshot_shm {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        capacity;           /* NODE_SNAPSHOT_NODES of the writer */
+    uint32_t        count;              /* slots in use */
+    uint64_t        generation;         /* bumped on every update, a cheap "anything new" check */
+    int16_t         index[NODE_SNAPSHOT_INDEX_SIZE];    /* slot number, -1 for free */
+    node_snapshot_slot_t slots[NODE_SNAPSHOT_NODES];
+} node_snapshot_shm_t;
+
+/* consistent copy of one slot */
+typedef struct _node_snapshot_reading {
+    uint16_t        node_id;
+    uint8_t         link;
+    int16_t         temperature;
+    int16_t         humidity;
+    uint32_t        updates;
+    uint64_t        timestamp_ms;
+} node_snapshot_reading_t;
+
+typedef struct _node_snapshot {
+    node_snapshot_shm_t *shm;
+    char            name[64];
+    uint8_t         owner;              /* created the segment, unlinks it on close */
+    uint64_t        untracked;          /* writer only, readings of nodes without a slot */
+} node_snapshot_t;
+
+/* writer: create the segment, replacing one a previous run left behind. NULL name for the default */
+int  node_snapshot_create(node_snapshot_t *snap, const char *name);
+
+/* reader: map an existing segment read only */
+int  node_snapshot_attach(node_snapshot_t *snap, const char *name);
+
+void node_snapshot_close(node_snapshot_t *snap);
+
+/* writer only */
+void node_snapshot_update(node_snapshot_t *snap, const app_reading_t *reading);
+
+/* any thread or process: 0 and a consistent copy, -1 if the node has no slot or its slot can't be read */
+int  node_snapshot_get(const node_snapshot_t *snap, uint8_t link, uint16_t node_id, node_snapshot_reading_t *reading);
+
+/* slots in use, slot i of them can be read with node_snapshot_read, 0 and a consistent copy,
+ * -1 if the slot stayed mid-update for NODE_SNAPSHOT_READ_TIMEOUT_MS */
+int  node_snapshot_count(const node_snapshot_t *snap);
+int  node_snapshot_read(const node_snapshot_t *snap, int slot, node_snapshot_reading_t *reading);
+
+#endif /* _NODE_SNAPSHOT_H_ */
@@ -0,0 +1,204 @@
+/*
+ * Micro benchmark: property payload encodes per second, snprintf against the
+ * schema driven writer, and request parses per second. Checks the parser's
+ * perfect hash and its handling of unknown and nested keys, values of the
+ * wrong type, escapes and numbers too long to hold. Builds without the sdk:
+ * make bench
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "prop_encoder.h"
+#include "prop_parser.h"
+
+#define BENCH_ITERATIONS        2000000
+#define BENCH_BATCH_READINGS    16
+
+/* the formats sample.c and report_batch.c used before the schema encoder */
+#define BENCH_PROPERTY_FORMAT   "{\"Data\": \"%s\", \"Status\": %d}"
+#define BENCH_ITEM_FORMAT       "{\"NodeID\":%d,\"Temperature\":%d,\"Humidity\":%d}"
+
+#define BENCH_REQUEST           "{\"NodeID\":12,\"Interval\":30,\"TempDeadband\":0.5,\"Heartbeat\":600," \
+                                "\"Data\":\"Hello,World!\",\"Status\":1}"
+
+static char bench_payload[4096];
+static volatile int bench_sink;
+
+/* what the setters got, by id */
+typedef struct {
+    int             set[PROP_MAX];
+    prop_value_t    value[PROP_MAX];
+} bench_request_t;
+
+static prop_setter_t bench_setters[PROP_MAX];
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_snprintf_property(int i)
+{
+    return snprintf(bench_payload, sizeof(bench_payload), BENCH_PROPERTY_FORMAT, "Hello,World!", i & 1);
+}
+
+static int bench_writer_property(int i)
+{
+    prop_writer_t w;
+
+    prop_writer_init(&w, bench_payload, sizeof(bench_payload));
+    prop_begin_object(&w);
+    prop_put_DATA(&w, "Hello,World!");
+    prop_put_STATUS(&w, i & 1);
+    prop_end_object(&w);
+    return prop_writer_finish(&w);
+}
+
+static int bench_snprintf_batch(int i)
+{
+    int n, len;
+
+    len = snprintf(bench_payload, sizeof(bench_payload), "%s", "{\"Readings\":[");
+    for (n = 0; n < BENCH_BATCH_READINGS; n++) {
+        if (n > 0) {
+            bench_payload[len++] = ',';
+        }
+        len += snprintf(bench_payload + len, sizeof(bench_payload) - len, BENCH_ITEM_FORMAT, n + 1, 20 + (i & 7),
+                        55);
+    }
+    len += snprintf(bench_payload + len, sizeof(bench_payload) - len, "%s", "]}");
+    return len;
+}
+
+static int bench_writer_batch(int i)
+{
+    prop_writer_t w;
+    int n;
+
+    prop_writer_init(&w, bench_payload, sizeof(bench_payload));
+    prop_begin_object(&w);
+    prop_open_READINGS(&w);
+    for (n = 0; n < BENCH_BATCH_READINGS; n++) {
+        prop_begin_object(&w);
+        prop_put_NODE_ID(&w, n + 1);
+        prop_put_TEMPERATURE(&w, 200 + (i & 63));
+        prop_put_HUMIDITY(&w, 550);
+        prop_end_object(&w);
+    }
+    prop_end_array(&w);
+    prop_end_object(&w);
+    return prop_writer_finish(&w);
+}
+
+static void bench_run(const char *name, int (*encode)(int), int iterations)
+{
+    double start, elapsed;
+    int i;
+
+    start = bench_now();
+    for (i = 0; i < iterations; i++) {
+        bench_sink = encode(i);
+    }
+    elapsed = bench_now() - start;
+
+    printf("%-20s %10.0f encodes/s  %6.1f ns/encode  %d bytes\n", name, iterations / elapsed,
+           elapsed * 1e9 / iterations, bench_sink);
+}
+
+static int bench_set(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    bench_request_t *req = (bench_request_t *)ctx;
+
+    req->set[id]++;
+    req->value[id] = *value;
+    return 0;
+}
+
+/* parse json, 1 if the result and the counts are as expected */
+static int bench_parse(const char *json, int res, int applied, int unknown, int mismatched, bench_request_t *req)
+{
+    prop_parse_stats_t stats;
+
+    memset(req, 0, sizeof(bench_request_t));
+    return prop_parse(json, strlen(json), bench_setters, req, &stats) == res && stats.applied == applied &&
+           stats.unknown == unknown && stats.mismatched == mismatched;
+}
+
+/* the parser against requests with every kind of trouble, 1 if all came out right */
+static int bench_parser_cases(void)
+{
+    static const char *nested = "{\"Extra\":{\"a\":[1,{\"b\":\"}]\\\"\"}],\"c\":null},\"Interval\":30,"
+                                "\"Rollups\":[[[]]],\"Heartbeat\":600}";
+    static const char *deep = "{\"Extra\":[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]],\"Interval\":30}";
+    bench_request_t req;
+    char text[32];
+    int id, ok = 1;
+
+    for (id = 0; id < PROP_MAX; id++) {
+        ok = ok && prop_lookup(prop_schema[id].identifier, strlen(prop_schema[id].identifier)) == id;
+    }
+    ok = ok && prop_lookup("Dat", 3) == PROP_MAX && prop_lookup("Datum", 5) == PROP_MAX && prop_lookup("", 0) == PROP_MAX;
+
+    /* unknown keys are skipped whole, nested values and strings with brackets included,
+     * an array for a schema array has no setter type and is skipped the same way */
+    ok = ok && bench_parse(nested, 0, 2, 1, 1, &req) && req.value[PROP_INTERVAL].i == 30 &&
+         req.value[PROP_HEARTBEAT].i == 600;
+    ok = ok && bench_parse(deep, -1, 0, 0, 0, &req);
+
+    /* a string for a number and a bool for an int are skipped, 0/1 for a bool is taken */
+    ok = ok && bench_parse("{\"Interval\":\"30\",\"Heartbeat\":true,\"Status\":1,\"Data\":5}", 0, 1, 0, 3, &req) &&
+         req.value[PROP_STATUS].i == 1;
+
+    /* escapes stay in the value until it is decoded */
+    ok = ok && bench_parse("{\"Data\":\"a\\\"b\\\\c\\u0041\\n\",\"Sta\\\"tus\":1}", 0, 1, 1, 0, &req) &&
+         prop_unescape(&req.value[PROP_DATA], text, sizeof(text)) == 7 && strcmp(text, "a\"b\\cA\n") == 0 &&
+         prop_unescape(&req.value[PROP_DATA], text, 4) < 0;
+
+    /* numbers: fractions and signs, 18 digits hold, longer ones don't reach the setter */
+    ok = ok && bench_parse("{\"TempDeadband\":2.5,\"Interval\":-7,\"Time\":123456789012345678}", 0, 3, 0, 0, &req) &&
+         req.value[PROP_TEMP_DEADBAND].d == 2.5 && req.value[PROP_INTERVAL].i == -7 &&
+         req.value[PROP_TIME].i == 123456789012345678LL;
+    ok = ok && bench_parse("{\"Interval\":18446744073709551646,\"Heartbeat\":-99999999999999999999.5}", 0, 0, 0, 2,
+                           &req) && !req.set[PROP_INTERVAL] && !req.set[PROP_HEARTBEAT];
+
+    /* malformed */
+    ok = ok && bench_parse("{\"Interval\":30", -1, 1, 0, 0, &req);
+    ok = ok && bench_parse("{\"Interval\":1e3}", -1, 0, 0, 0, &req);
+    ok = ok && bench_parse("{\"Interval\":-}", -1, 0, 0, 0, &req);
+    ok = ok && bench_parse("[1]", -1, 0, 0, 0, &req);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    bench_request_t req;
+    prop_parse_stats_t stats;
+    double start, elapsed;
+    int i, ok;
+
+    bench_run("snprintf property", bench_snprintf_property, BENCH_ITERATIONS);
+    bench_run("writer property", bench_writer_property, BENCH_ITERATIONS);
+    bench_run("snprintf batch x16", bench_snprintf_batch, BENCH_ITERATIONS / 10);
+    bench_run("writer batch x16", bench_writer_batch, BENCH_ITERATIONS / 10);
+
+    for (i = 0; i < PROP_MAX; i++) {
+        bench_setters[i] = bench_set;
+    }
+    ok = prop_parser_init() == 0 && bench_parser_cases();
+
+    start = bench_now();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        bench_sink = prop_parse(BENCH_REQUEST, sizeof(BENCH_REQUEST) - 1, bench_setters, &req, &stats);
+    }
+    elapsed = bench_now() - start;
+    ok = ok && stats.applied == 6;
+    printf("%-20s %10.0f parses/s    %6.1f ns/parse   %d values  %s\n", "parser request", BENCH_ITERATIONS / elapsed,
+           elapsed * 1e9 / BENCH_ITERATIONS, stats.applied, ok ? "ok" : "MISMATCH");
+
+    return ok ? 0 : 1;
+}
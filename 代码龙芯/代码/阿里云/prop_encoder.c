@@ -0,0 +1,208 @@
+/*
+ * Schema driven property payload encoder
+ */
+#include <stddef.h>
+
+#include "prop_encoder.h"
+
+const prop_desc_t prop_schema[PROP_MAX] = {
+#define PROP_DESC(id, key, type)    { key, "\"" key "\":", sizeof("\"" key "\":") - 1, PROP_TYPE_##type },
+    APP_PROPERTY_SCHEMA(PROP_DESC)
+#undef PROP_DESC
+};
+
+/* pieces are a few bytes long, a byte loop beats a memcpy call here */
+static inline void prop_write(prop_writer_t *w, const char *data, int len)
+{
+    if (w->buf != NULL) {
+        char *dst = w->buf + w->len;
+        int i;
+
+        if (w->len + len > w->size) {
+            w->overflow = 1;
+            return;
+        }
+        for (i = 0; i < len; i++) {
+            dst[i] = data[i];
+        }
+    }
+    w->len += len;
+}
+
+static inline void prop_putc(prop_writer_t *w, char c)
+{
+    if (w->buf != NULL) {
+        if (w->len >= w->size) {
+            w->overflow = 1;
+            return;
+        }
+        w->buf[w->len] = c;
+    }
+    w->len++;
+}
+
+/* separator in front of an array element or a key */
+static inline void prop_element(prop_writer_t *w)
+{
+    if (w->keyed) {
+        w->keyed = 0;
+        return;
+    }
+    if (!w->first) {
+        prop_putc(w, ',');
+    }
+    w->first = 0;
+}
+
+void prop_writer_init(prop_writer_t *w, char *buf, int size)
+{
+    w->buf = buf;
+    w->size = size;
+    w->len = 0;
+    w->overflow = 0;
+    w->first = 1;
+    w->keyed = 0;
+}
+
+int prop_writer_finish(prop_writer_t *w)
+{
+    if (w->overflow || (w->buf != NULL && w->len >= w->size)) {
+        return -1;
+    }
+
+    if (w->buf != NULL) {
+        w->buf[w->len] = '\0';
+    }
+    return w->len;
+}
+
+void prop_begin_object(prop_writer_t *w)
+{
+    prop_element(w);
+    prop_putc(w, '{');
+    w->first = 1;
+}
+
+void prop_end_object(prop_writer_t *w)
+{
+    prop_putc(w, '}');
+    w->first = 0;
+}
+
+void prop_begin_array(prop_writer_t *w)
+{
+    prop_element(w);
+    prop_putc(w, '[');
+    w->first = 1;
+}
+
+void prop_end_array(prop_writer_t *w)
+{
+    prop_putc(w, ']');
+    w->first = 0;
+}
+
+void prop_key(prop_writer_t *w, prop_id_t id)
+{
+    prop_element(w);
+    prop_write(w, prop_schema[id].key, prop_schema[id].key_len);
+    w->keyed = 1;
+}
+
+void prop_string(prop_writer_t *w, const char *value)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = value;
+
+    prop_element(w);
+    prop_putc(w, '"');
+
+    /* copy plain runs in one go, escape only what json requires */
+    for (; *value != '\0'; value++) {
+        unsigned char c = (unsigned char)*value;
+        char esc[6];
+
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        prop_write(w, run, value - run);
+        run = value + 1;
+
+        esc[0] = '\\';
+        if (c == '"' || c == '\\') {
+            esc[1] = c;
+            prop_write(w, esc, 2);
+        } else {
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 0x0f];
+            prop_write(w, esc, 6);
+        }
+    }
+    prop_write(w, run, value - run);
+
+    prop_putc(w, '"');
+}
+
+void prop_bool(prop_writer_t *w, int value)
+{
+    /* tsl bool is posted as 0/1 */
+    prop_element(w);
+    prop_putc(w, value ? '1' : '0');
+}
+
+void prop_uint64(prop_writer_t *w, uint64_t value)
+{
+    char digits[20];
+    int n = sizeof(digits);
+
+    prop_element(w);
+    do {
+        digits[--n] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    prop_write(w, digits + n, sizeof(digits) - n);
+}
+
+void prop_int(prop_writer_t *w, int32_t value)
+{
+    char digits[11];
+    int n = sizeof(digits);
+    uint32_t v = (value < 0) ? (uint32_t)0 - (uint32_t)value : (uint32_t)value;
+
+    prop_element(w);
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (value < 0) {
+        digits[--n] = '-';
+    }
+
+    prop_write(w, digits + n, sizeof(digits) - n);
+}
+
+void prop_deci(prop_writer_t *w, int32_t tenths)
+{
+    char digits[13];
+    int n = sizeof(digits);
+    uint32_t v = (tenths < 0) ? (uint32_t)0 - (uint32_t)tenths : (uint32_t)tenths;
+
+    prop_element(w);
+    digits[--n] = '0' + v % 10;
+    digits[--n] = '.';
+    v /= 10;
+    do {
+        digits[--n] = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (tenths < 0) {
+        digits[--n] = '-';
+    }
+
+    prop_write(w, digits + n, sizeof(digits) - n);
+}
@@ -0,0 +1,120 @@
+/*
+ * Schema driven property payload encoder.
+ *
+ * Every TSL identifier the gateway posts is listed once in APP_PROPERTY_SCHEMA.
+ * The list expands into the property ids, a table of pre-quoted keys and one
+ * typed prop_put_<ID>() writer per property, so encoding is plain memcpy and
+ * integer conversion into a caller owned buffer: no format string, no heap.
+ */
+#ifndef _PROP_ENCODER_H_
+#define _PROP_ENCODER_H_
+
+#include <stdint.h>
+
+/* X(id, identifier, type), DECI is a tsl float posted with one decimal from an int of tenths */
+#define APP_PROPERTY_SCHEMA(X) \
+    X(DATA,         "Data",         STRING) \
+    X(STATUS,       "Status",       BOOL) \
+    X(READINGS,     "Readings",     ARRAY) \
+    X(NODE_ID,      "NodeID",       INT) \
+    X(LINK,         "Link",         INT) \
+    X(GROUP_ID,     "GroupID",      INT) \
+    X(TEMPERATURE,  "Temperature",  DECI) \
+    X(HUMIDITY,     "Humidity",     DECI) \
+    X(TIME,         "Time",         UINT64) \
+    X(INTERVAL,     "Interval",     INT) \
+    X(TEMP_DEADBAND, "TempDeadband", DECI) \
+    X(HUMI_DEADBAND, "HumiDeadband", DECI) \
+    X(HEARTBEAT,    "Heartbeat",    INT) \
+    X(GRANULARITY,  "Granularity",  INT) \
+    X(ROLLUPS,      "Rollups",      ARRAY) \
+    X(PERIOD,       "Period",       INT) \
+    X(TEMP_MIN,     "TempMin",      DECI) \
+    X(TEMP_MAX,     "TempMax",      DECI) \
+    X(HUMI_MIN,     "HumiMin",      DECI) \
+    X(HUMI_MAX,     "HumiMax",      DECI) \
+    X(COUNT,        "Count",        INT) \
+    X(RULE,         "Rule",         STRING) \
+    X(ACTIVE,       "Active",       BOOL)
+
+typedef enum {
+#define PROP_ENUM(id, key, type)    PROP_##id,
+    APP_PROPERTY_SCHEMA(PROP_ENUM)
+#undef PROP_ENUM
+    PROP_MAX
+} prop_id_t;
+
+typedef enum {
+    PROP_TYPE_STRING,
+    PROP_TYPE_BOOL,
+    PROP_TYPE_INT,
+    PROP_TYPE_DECI,
+    PROP_TYPE_UINT64,
+    PROP_TYPE_ARRAY
+} prop_type_t;
+
+typedef struct _prop_desc {
+    const char     *identifier;
+    const char     *key;            /* "identifier": */
+    uint8_t         key_len;
+    prop_type_t     type;
+} prop_desc_t;
+
+extern const prop_desc_t prop_schema[PROP_MAX];
+
+/*
+ * Writer over a fixed buffer. With buf NULL it only measures, which is how the
+ * report batcher sizes items against its byte budget.
+ */
+typedef struct _prop_writer {
+    char           *buf;
+    int             size;
+    int             len;
+    uint8_t         overflow;
+    uint8_t         first;          /* nothing written yet in the open object or array */
+    uint8_t         keyed;          /* a key was written, the value follows without separator */
+} prop_writer_t;
+
+void prop_writer_init(prop_writer_t *w, char *buf, int size);
+
+/* payload length, or -1 if it did not fit; nothing is ever silently truncated */
+int  prop_writer_finish(prop_writer_t *w);
+
+void prop_begin_object(prop_writer_t *w);
+void prop_end_object(prop_writer_t *w);
+void prop_begin_array(prop_writer_t *w);
+void prop_end_array(prop_writer_t *w);
+
+void prop_key(prop_writer_t *w, prop_id_t id);
+void prop_string(prop_writer_t *w, const char *value);
+void prop_bool(prop_writer_t *w, int value);
+void prop_int(prop_writer_t *w, int32_t value);
+void prop_deci(prop_writer_t *w, int32_t tenths);
+void prop_uint64(prop_writer_t *w, uint64_t value);
+
+/* typed writers generated from the schema: prop_put_<ID>(w, value) for scalars,
+ * prop_open_<ID>(w) for arrays which are closed again with prop_end_array() */
+#define PROP_SCALAR_PUT(id, ctype, writer) \
+    static inline void prop_put_##id(prop_writer_t *w, ctype value) \
+    { \
+        prop_key(w, PROP_##id); \
+        writer(w, value); \
+    }
+
+#define PROP_PUT_STRING(id)         PROP_SCALAR_PUT(id, const char *, prop_string)
+#define PROP_PUT_BOOL(id)           PROP_SCALAR_PUT(id, int, prop_bool)
+#define PROP_PUT_INT(id)            PROP_SCALAR_PUT(id, int32_t, prop_int)
+#define PROP_PUT_DECI(id)           PROP_SCALAR_PUT(id, int32_t, prop_deci)
+#define PROP_PUT_UINT64(id)         PROP_SCALAR_PUT(id, uint64_t, prop_uint64)
+#define PROP_PUT_ARRAY(id) \
+    static inline void prop_open_##id(prop_writer_t *w) \
+    { \
+        prop_key(w, PROP_##id); \
+        prop_begin_array(w); \
+    }
+
+#define PROP_PUT(id, key, type)     PROP_PUT_##type(id)
+APP_PROPERTY_SCHEMA(PROP_PUT)
+#undef PROP_PUT
+
+#endif /* _PROP_ENCODER_H_ */
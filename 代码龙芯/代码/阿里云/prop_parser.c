@@ -0,0 +1,385 @@
+/*
+ * Streaming property request parser
+ */
+#include <stddef.h>
+#include <string.h>
+
+#include "prop_parser.h"
+
+/* power of two comfortably above PROP_MAX so a collision free seed is found quickly */
+#define PROP_HASH_SIZE          64
+#define PROP_HASH_SEED_TRIES    65536
+
+/* nesting of skipped values, deeper requests are rejected */
+#define PROP_SKIP_DEPTH_MAX     16
+
+/* integer digits that always fit an int64, longer numbers are rejected as values */
+#define PROP_NUMBER_DIGITS_MAX  18
+
+static uint8_t  prop_hash_table[PROP_HASH_SIZE];
+static uint8_t  prop_identifier_len[PROP_MAX];
+static uint32_t prop_hash_seed;
+
+typedef struct _prop_scan {
+    const char     *p;
+    const char     *end;
+} prop_scan_t;
+
+static uint32_t prop_hash(const char *key, int len, uint32_t seed)
+{
+    uint32_t h = seed ^ (uint32_t)len;
+
+    h = h * 31 + (uint8_t)key[0];
+    h = h * 31 + (uint8_t)key[len >> 1];
+    h = h * 31 + (uint8_t)key[len - 1];
+    h ^= h >> 7;
+
+    return h & (PROP_HASH_SIZE - 1);
+}
+
+int prop_parser_init(void)
+{
+    uint32_t seed;
+    int id;
+
+    for (id = 0; id < PROP_MAX; id++) {
+        prop_identifier_len[id] = strlen(prop_schema[id].identifier);
+    }
+
+    /* look for a seed that gives every identifier its own slot */
+    for (seed = 0; seed < PROP_HASH_SEED_TRIES; seed++) {
+        memset(prop_hash_table, PROP_MAX, sizeof(prop_hash_table));
+
+        for (id = 0; id < PROP_MAX; id++) {
+            uint32_t slot = prop_hash(prop_schema[id].identifier, prop_identifier_len[id], seed);
+
+            if (prop_hash_table[slot] != PROP_MAX) {
+                break;
+            }
+            prop_hash_table[slot] = id;
+        }
+
+        if (id == PROP_MAX) {
+            prop_hash_seed = seed;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+prop_id_t prop_lookup(const char *key, int len)
+{
+    prop_id_t id;
+
+    if (len <= 0) {
+        return PROP_MAX;
+    }
+
+    id = (prop_id_t)prop_hash_table[prop_hash(key, len, prop_hash_seed)];
+    if (id == PROP_MAX || prop_identifier_len[id] != len || memcmp(prop_schema[id].identifier, key, len) != 0) {
+        return PROP_MAX;
+    }
+
+    return id;
+}
+
+static void prop_skip_ws(prop_scan_t *s)
+{
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\r' || *s->p == '\n')) {
+        s->p++;
+    }
+}
+
+static int prop_expect(prop_scan_t *s, char c)
+{
+    prop_skip_ws(s);
+    if (s->p >= s->end || *s->p != c) {
+        return -1;
+    }
+    s->p++;
+    return 0;
+}
+
+/* string body between the quotes, s->p is on the opening quote */
+static int prop_scan_string(prop_scan_t *s, const char **str, int *len)
+{
+    const char *start = ++s->p;
+
+    while (s->p < s->end && *s->p != '"') {
+        if (*s->p == '\\') {
+            s->p++;
+        }
+        s->p++;
+    }
+    if (s->p >= s->end) {
+        return -1;
+    }
+
+    *str = start;
+    *len = s->p - start;
+    s->p++;
+    return 0;
+}
+
+/* 0, 1 if the integer part is too long to hold and the value is no good, -1 on bad json */
+static int prop_scan_number(prop_scan_t *s, prop_value_t *value)
+{
+    const char *start = s->p;
+    int negative = 0, digits = 0;
+    double scale = 1;
+
+    value->i = 0;
+    value->d = 0;
+
+    if (s->p < s->end && *s->p == '-') {
+        negative = 1;
+        s->p++;
+    }
+    while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+        if (++digits <= PROP_NUMBER_DIGITS_MAX) {
+            value->i = value->i * 10 + (*s->p - '0');
+        }
+        s->p++;
+    }
+    value->d = (double)value->i;
+
+    if (s->p < s->end && *s->p == '.') {
+        s->p++;
+        while (s->p < s->end && *s->p >= '0' && *s->p <= '9') {
+            scale /= 10;
+            value->d += (*s->p++ - '0') * scale;
+        }
+    }
+
+    /* exponents are not used by the tsl, reject rather than misread them */
+    if (s->p == start || s->p == start + negative || (s->p < s->end && (*s->p == 'e' || *s->p == 'E'))) {
+        return -1;
+    }
+
+    if (negative) {
+        value->i = -value->i;
+        value->d = -value->d;
+    }
+    return (digits > PROP_NUMBER_DIGITS_MAX) ? 1 : 0;
+}
+
+static int prop_scan_literal(prop_scan_t *s, const char *literal, int len)
+{
+    if (s->end - s->p < len || memcmp(s->p, literal, len) != 0) {
+        return -1;
+    }
+    s->p += len;
+    return 0;
+}
+
+/* skip any value, nested objects and arrays included */
+static int prop_skip_value(prop_scan_t *s)
+{
+    int depth = 0;
+
+    do {
+        const char *str;
+        int len;
+
+        prop_skip_ws(s);
+        if (s->p >= s->end) {
+            return -1;
+        }
+
+        switch (*s->p) {
+            case '{':
+            case '[':
+                if (++depth > PROP_SKIP_DEPTH_MAX) {
+                    return -1;
+                }
+                s->p++;
+                break;
+            case '}':
+            case ']':
+                depth--;
+                s->p++;
+                break;
+            case ',':
+            case ':':
+                if (depth == 0) {
+                    return -1;
+                }
+                s->p++;
+                break;
+            case '"':
+                if (prop_scan_string(s, &str, &len) < 0) {
+                    return -1;
+                }
+                break;
+            default:
+                /* number or literal, runs until the next delimiter */
+                str = s->p;
+                while (s->p < s->end && *s->p != ',' && *s->p != '}' && *s->p != ']' && *s->p != ' ' &&
+                       *s->p != '\r' && *s->p != '\n' && *s->p != '\t') {
+                    s->p++;
+                }
+                if (s->p == str) {
+                    return -1;
+                }
+                break;
+        }
+    } while (depth > 0);
+
+    return (depth < 0) ? -1 : 0;
+}
+
+/* read a value as the schema type of id, 1 if it matched, 0 if it was skipped or out of range, -1 on bad json */
+static int prop_scan_typed(prop_scan_t *s, prop_id_t id, prop_value_t *value)
+{
+    char c;
+
+    prop_skip_ws(s);
+    if (s->p >= s->end) {
+        return -1;
+    }
+
+    memset(value, 0, sizeof(prop_value_t));
+    c = *s->p;
+
+    switch (prop_schema[id].type) {
+        case PROP_TYPE_STRING:
+            if (c == '"') {
+                return (prop_scan_string(s, &value->str, &value->str_len) < 0) ? -1 : 1;
+            }
+            break;
+        case PROP_TYPE_BOOL:
+            if (c == 't' || c == 'f') {
+                value->i = (c == 't');
+                value->d = (double)value->i;
+                return (prop_scan_literal(s, (c == 't') ? "true" : "false", (c == 't') ? 4 : 5) < 0) ? -1 : 1;
+            }
+            /* fall through, the tsl also posts bools as 0/1 */
+        case PROP_TYPE_INT:
+        case PROP_TYPE_DECI:
+        case PROP_TYPE_UINT64:
+            if (c == '-' || (c >= '0' && c <= '9')) {
+                switch (prop_scan_number(s, value)) {
+                    case 0:
+                        return 1;
+                    case 1:
+                        /* consumed, but no setter gets a number that lost its leading digits */
+                        return 0;
+                    default:
+                        return -1;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+
+    return (prop_skip_value(s) < 0) ? -1 : 0;
+}
+
+int prop_parse(const char *json, int len, const prop_setter_t setters[PROP_MAX], void *ctx,
+               prop_parse_stats_t *stats)
+{
+    prop_scan_t s;
+
+    memset(stats, 0, sizeof(prop_parse_stats_t));
+    s.p = json;
+    s.end = json + len;
+
+    if (prop_expect(&s, '{') < 0) {
+        return -1;
+    }
+    prop_skip_ws(&s);
+    if (s.p < s.end && *s.p == '}') {
+        return 0;
+    }
+
+    while (1) {
+        prop_value_t value;
+        const char *key;
+        int key_len, res;
+        prop_id_t id;
+
+        prop_skip_ws(&s);
+        if (s.p >= s.end || *s.p != '"' || prop_scan_string(&s, &key, &key_len) < 0 || prop_expect(&s, ':') < 0) {
+            return -1;
+        }
+
+        id = prop_lookup(key, key_len);
+        if (id == PROP_MAX || setters[id] == NULL) {
+            if (prop_skip_value(&s) < 0) {
+                return -1;
+            }
+            stats->unknown++;
+        } else {
+            res = prop_scan_typed(&s, id, &value);
+            if (res < 0) {
+                return -1;
+            }
+            if (res == 0) {
+                stats->mismatched++;
+            } else if (setters[id](ctx, id, &value) == 0) {
+                stats->applied++;
+            }
+        }
+
+        prop_skip_ws(&s);
+        if (s.p < s.end && *s.p == ',') {
+            s.p++;
+            continue;
+        }
+        return prop_expect(&s, '}');
+    }
+}
+
+int prop_unescape(const prop_value_t *value, char *dst, int size)
+{
+    const char *p = value->str;
+    const char *end = value->str + value->str_len;
+    int len = 0;
+
+    while (p < end) {
+        char c = *p++;
+
+        if (c == '\\' && p < end) {
+            c = *p++;
+            switch (c) {
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                case 'r':
+                    c = '\r';
+                    break;
+                case 'b':
+                    c = '\b';
+                    break;
+                case 'f':
+                    c = '\f';
+                    break;
+                case 'u':
+                    /* only the ascii range is kept, everything else becomes '?' */
+                    if (end - p >= 4 && p[0] == '0' && p[1] == '0') {
+                        c = (char)(((p[2] <= '9' ? p[2] - '0' : (p[2] | 0x20) - 'a' + 10) << 4) |
+                                   (p[3] <= '9' ? p[3] - '0' : (p[3] | 0x20) - 'a' + 10));
+                    } else {
+                        c = '?';
+                    }
+                    p += (end - p >= 4) ? 4 : end - p;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (len + 1 >= size) {
+            return -1;
+        }
+        dst[len++] = c;
+    }
+
+    dst[len] = '\0';
+    return len;
+}
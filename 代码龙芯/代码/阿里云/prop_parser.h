@@ -0,0 +1,44 @@
+/*
+ * Streaming property request parser.
+ *
+ * Walks a flat JSON object from the cloud (property set params or service
+ * input) in one pass, without building a DOM and without allocating. Keys are
+ * resolved to APP_PROPERTY_SCHEMA ids through a perfect hash and the value is
+ * handed to the setter registered for that id, already typed.
+ */
+#ifndef _PROP_PARSER_H_
+#define _PROP_PARSER_H_
+
+#include <stdint.h>
+
+#include "prop_encoder.h"
+
+typedef struct _prop_value {
+    int64_t         i;              /* number truncated to an integer, bools are 0/1 */
+    double          d;              /* number as parsed, including the fraction */
+    const char     *str;            /* string contents inside the request, escapes not decoded */
+    int             str_len;
+} prop_value_t;
+
+typedef int (*prop_setter_t)(void *ctx, prop_id_t id, const prop_value_t *value);
+
+typedef struct _prop_parse_stats {
+    int             applied;        /* setters called */
+    int             unknown;        /* keys not in the schema or without a setter */
+    int             mismatched;     /* values of the wrong json type for the schema, or numbers too long to hold */
+} prop_parse_stats_t;
+
+/* build the perfect hash over the schema identifiers, call once at startup */
+int       prop_parser_init(void);
+
+/* PROP_MAX if the key is not in the schema */
+prop_id_t prop_lookup(const char *key, int len);
+
+/* returns 0, or -1 on malformed json; setters that already ran are not undone */
+int       prop_parse(const char *json, int len, const prop_setter_t setters[PROP_MAX], void *ctx,
+                     prop_parse_stats_t *stats);
+
+/* decode a string value into dst, returns its length or -1 if dst is too small */
+int       prop_unescape(const prop_value_t *value, char *dst, int size);
+
+#endif /* _PROP_PARSER_H_ */
@@ -0,0 +1,315 @@
+/*
+ * Local query endpoint for the latest node readings
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "query_server.h"
+
+/* answers are sent in chunks of this size, a LIST of every node takes a few */
+#define QUERY_SERVER_REPLY_MAX      4096
+
+/* one reading line, at most "255:65535 -3276.8 -3276.8 18446744073709551615 4294967295\n" */
+#define QUERY_SERVER_READING_MAX    64
+
+static void query_server_drop(query_server_t *server, query_server_client_t *client)
+{
+    close(client->fd);
+    client->fd = -1;
+    client->len = 0;
+}
+
+static int query_server_send(query_server_client_t *client, const char *buf, int len)
+{
+    while (len > 0) {
+        ssize_t n = send(client->fd, buf, len, MSG_NOSIGNAL);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            /* EAGAIN here is the send timeout: the client stopped reading */
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/* tenths as a decimal with one digit */
+static int query_server_deci(char *buf, int size, int16_t tenths)
+{
+    int value = (tenths < 0) ? -tenths : tenths;
+
+    return snprintf(buf, size, "%s%d.%d", (tenths < 0) ? "-" : "", value / 10, value % 10);
+}
+
+static int query_server_reading(char *buf, const node_snapshot_reading_t *reading)
+{
+    char node[16], t[16], h[16];
+
+    if (reading->link != 0) {
+        snprintf(node, sizeof(node), "%u:%u", reading->link, reading->node_id);
+    } else {
+        snprintf(node, sizeof(node), "%u", reading->node_id);
+    }
+    query_server_deci(t, sizeof(t), reading->temperature);
+    query_server_deci(h, sizeof(h), reading->humidity);
+    return snprintf(buf, QUERY_SERVER_READING_MAX, "%s %s %s %llu %u\n", node, t, h,
+                    (unsigned long long)reading->timestamp_ms, reading->updates);
+}
+
+static int query_server_list(query_server_t *server, query_server_client_t *client)
+{
+    char reply[QUERY_SERVER_REPLY_MAX];
+    node_snapshot_reading_t reading;
+    int count = node_snapshot_count(server->snap);
+    int i, len = 0;
+
+    for (i = 0; i < count; i++) {
+        if (len + QUERY_SERVER_READING_MAX > (int)sizeof(reply)) {
+            if (query_server_send(client, reply, len) < 0) {
+                return -1;
+            }
+            len = 0;
+        }
+        if (node_snapshot_read(server->snap, i, &reading) == 0) {
+            len += query_server_reading(reply + len, &reading);
+        }
+    }
+    reply[len++] = '\n';
+
+    return query_server_send(client, reply, len);
+}
+
+static int query_server_metrics(query_server_t *server, query_server_client_t *client)
+{
+    static char text[STAGE_METRICS_TEXT_MAX + 1];  /* query thread only */
+    int len = -1;
+
+    if (server->metrics != NULL) {
+        len = stage_metrics_render(server->metrics, text, STAGE_METRICS_TEXT_MAX);
+    }
+    if (len < 0) {
+        server->stats.errors++;
+        return query_server_send(client, "ERR no metrics\n", 15);
+    }
+    text[len++] = '\n';
+
+    return query_server_send(client, text, len);
+}
+
+/* answer one request line, -1 if the client has to go */
+static int query_server_request(query_server_t *server, query_server_client_t *client, char *line)
+{
+    char reply[QUERY_SERVER_READING_MAX];
+    node_snapshot_reading_t reading;
+    char *p, *end;
+    long link = 0, node_id;
+
+    server->stats.requests++;
+
+    if (strncmp(line, "GET ", 4) == 0) {
+        p = line + 4;
+        node_id = strtol(p, &end, 10);
+        if (end != p && *end == ':') {
+            link = node_id;
+            p = end + 1;
+            node_id = strtol(p, &end, 10);
+        }
+        if (end == p || *end != '\0' || link < 0 || link > 0xFF || node_id < 0 || node_id > 0xFFFF) {
+            server->stats.errors++;
+            return query_server_send(client, "ERR bad request\n", 16);
+        }
+        if (node_snapshot_get(server->snap, (uint8_t)link, (uint16_t)node_id, &reading) < 0) {
+            return query_server_send(client, "ERR no such node\n", 17);
+        }
+        return query_server_send(client, reply, query_server_reading(reply, &reading));
+    }
+
+    if (strcmp(line, "LIST") == 0) {
+        return query_server_list(server, client);
+    }
+
+    if (strcmp(line, "METRICS") == 0) {
+        return query_server_metrics(server, client);
+    }
+
+    if (strcmp(line, "GEN") == 0) {
+        int len = snprintf(reply, sizeof(reply), "%llu\n",
+                           (unsigned long long)__atomic_load_n(&server->snap->shm->generation, __ATOMIC_ACQUIRE));
+
+        return query_server_send(client, reply, len);
+    }
+
+    server->stats.errors++;
+    return query_server_send(client, "ERR bad request\n", 16);
+}
+
+/* read what the client sent and answer every complete line */
+static void query_server_serve(query_server_t *server, query_server_client_t *client)
+{
+    char buf[QUERY_SERVER_REPLY_MAX];
+    ssize_t n;
+    int i;
+
+    n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        query_server_drop(server, client);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (buf[i] == '\r') {
+            continue;
+        }
+        if (buf[i] != '\n') {
+            if (client->len == QUERY_SERVER_LINE_MAX - 1) {
+                server->stats.errors++;
+                query_server_drop(server, client);
+                return;
+            }
+            client->line[client->len++] = buf[i];
+            continue;
+        }
+
+        client->line[client->len] = '\0';
+        client->len = 0;
+        if (query_server_request(server, client, client->line) < 0) {
+            server->stats.errors++;
+            query_server_drop(server, client);
+            return;
+        }
+    }
+}
+
+static void query_server_accept(query_server_t *server)
+{
+    struct timeval tv;
+    int fd, i;
+
+    fd = accept(server->fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    for (i = 0; i < QUERY_SERVER_CLIENTS; i++) {
+        if (server->clients[i].fd < 0) {
+            break;
+        }
+    }
+    if (i == QUERY_SERVER_CLIENTS) {
+        server->stats.rejected++;
+        close(fd);
+        return;
+    }
+
+    tv.tv_sec = 0;
+    tv.tv_usec = QUERY_SERVER_SEND_TIMEOUT_MS * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    server->clients[i].fd = fd;
+    server->clients[i].len = 0;
+    server->stats.connections++;
+}
+
+int query_server_open(query_server_t *server, const char *path, const node_snapshot_t *snap)
+{
+    struct sockaddr_un addr;
+    int i;
+
+    memset(server, 0, sizeof(query_server_t));
+    server->snap = snap;
+    for (i = 0; i < QUERY_SERVER_CLIENTS; i++) {
+        server->clients[i].fd = -1;
+    }
+
+    if (path == NULL) {
+        path = QUERY_SERVER_PATH_DEFAULT;
+    }
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    snprintf(server->path, sizeof(server->path), "%s", path);
+
+    server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server->fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, server->path, strlen(server->path));
+
+    unlink(server->path);
+    if (bind(server->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->fd, QUERY_SERVER_CLIENTS) < 0) {
+        close(server->fd);
+        server->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void query_server_close(query_server_t *server)
+{
+    int i;
+
+    for (i = 0; i < QUERY_SERVER_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            query_server_drop(server, &server->clients[i]);
+        }
+    }
+    if (server->fd >= 0) {
+        close(server->fd);
+        server->fd = -1;
+        unlink(server->path);
+    }
+}
+
+int query_server_poll(query_server_t *server, int timeout_ms)
+{
+    struct pollfd pfd[QUERY_SERVER_CLIENTS + 1];
+    int map[QUERY_SERVER_CLIENTS + 1];
+    int i, n = 0, ready;
+
+    pfd[n].fd = server->fd;
+    pfd[n].events = POLLIN;
+    map[n++] = -1;
+    for (i = 0; i < QUERY_SERVER_CLIENTS; i++) {
+        if (server->clients[i].fd >= 0) {
+            pfd[n].fd = server->clients[i].fd;
+            pfd[n].events = POLLIN;
+            map[n++] = i;
+        }
+    }
+
+    ready = poll(pfd, n, timeout_ms);
+    if (ready < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (i = 1; i < n; i++) {
+        if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+            query_server_serve(server, &server->clients[map[i]]);
+        }
+    }
+    if (pfd[0].revents & POLLIN) {
+        query_server_accept(server);
+    }
+
+    return ready;
+}
@@ -0,0 +1,70 @@
+/*
+ * Local query endpoint on a Unix stream socket, answered from the node snapshot.
+ *
+ * Line protocol, one request per line, any number of requests per connection:
+ *
+ *   GET <node>      "<node> <temperature> <humidity> <time ms> <updates>\n",
+ *                   or "ERR no such node\n"
+ *   LIST            one such line per node, then an empty line
+ *   GEN             "<generation>\n", changes whenever any node does
+ *   METRICS         the pipeline metrics in Prometheus text format, then an
+ *                   empty line
+ *
+ * A node is "<link>:<node id>", or just "<node id>" for one on link 0.
+ * Temperature and humidity are decimals with one digit, time is the wall clock
+ * ms when the node took the sample. Anything else is answered "ERR bad request\n".
+ *
+ * One thread serves every client with poll(). Answers never touch the cloud
+ * connection or the ingestion thread, they are read from the snapshot.
+ */
+#ifndef _QUERY_SERVER_H_
+#define _QUERY_SERVER_H_
+
+#include <stdint.h>
+
+#include "node_snapshot.h"
+#include "stage_metrics.h"
+
+#ifndef QUERY_SERVER_PATH_DEFAULT
+#define QUERY_SERVER_PATH_DEFAULT       "/tmp/zigbee_gateway.sock"
+#endif
+
+/* connections served at once, more are accepted and closed right away */
+#define QUERY_SERVER_CLIENTS            16
+
+/* longest request line */
+#define QUERY_SERVER_LINE_MAX           64
+
+/* a client that doesn't take its answer within this long is dropped */
+#define QUERY_SERVER_SEND_TIMEOUT_MS    100
+
+typedef struct _query_server_client {
+    int             fd;                 /* -1 for a free entry */
+    int             len;
+    char            line[QUERY_SERVER_LINE_MAX];
+} query_server_client_t;
+
+typedef struct _query_server_stats {
+    uint64_t        connections;
+    uint64_t        rejected;           /* all client entries were busy */
+    uint64_t        requests;
+    uint64_t        errors;             /* bad requests and dropped clients */
+} query_server_stats_t;
+
+typedef struct _query_server {
+    int             fd;
+    char            path[108];
+    const node_snapshot_t *snap;
+    const stage_metrics_t *metrics;     /* set after open, NULL answers METRICS with an error */
+    query_server_client_t clients[QUERY_SERVER_CLIENTS];
+    query_server_stats_t stats;
+} query_server_t;
+
+/* bind and listen on path, NULL for the default; a stale socket file is replaced */
+int  query_server_open(query_server_t *server, const char *path, const node_snapshot_t *snap);
+void query_server_close(query_server_t *server);
+
+/* wait up to timeout_ms for connections and requests and answer them */
+int  query_server_poll(query_server_t *server, int timeout_ms);
+
+#endif /* _QUERY_SERVER_H_ */
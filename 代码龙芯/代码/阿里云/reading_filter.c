@@ -0,0 +1,101 @@
+/*
+ * Per node duplicate and staleness filter
+ */
+#include <string.h>
+
+#include "reading_filter.h"
+#include "node_hash.h"
+
+static int reading_filter_match(const reading_filter_t *filter, uint32_t pos, uint16_t node_id)
+{
+    const reading_filter_node_t *node = &filter->nodes[pos];
+
+    return !node->used || node->node_id == node_id;
+}
+
+/* slot of node_id or the free one it would go to, the table never fills */
+static reading_filter_node_t *reading_filter_slot(reading_filter_t *filter, uint16_t node_id)
+{
+    int slot = NODE_HASH_PROBE(READING_FILTER_SIZE, 0, node_id, pos, reading_filter_match(filter, pos, node_id));
+
+    return &filter->nodes[slot];
+}
+
+/* slot of node_id, claiming an empty one; NULL when the table is full */
+static reading_filter_node_t *reading_filter_lookup(reading_filter_t *filter, uint16_t node_id)
+{
+    reading_filter_node_t *node = reading_filter_slot(filter, node_id);
+
+    if (!node->used) {
+        if (filter->count >= READING_FILTER_SIZE - READING_FILTER_SIZE / 4) {
+            return NULL;
+        }
+        node->used = 1;
+        node->node_id = node_id;
+        node->seq = 0;
+        node->sample_ms = 0;
+        filter->count++;
+    }
+    return node;
+}
+
+void reading_filter_init(reading_filter_t *filter)
+{
+    memset(filter, 0, sizeof(reading_filter_t));
+}
+
+int reading_filter_check(reading_filter_t *filter, const uplink_reading_t *reading, uint64_t sample_ms)
+{
+    reading_filter_node_t *node;
+    int8_t ahead;
+
+    if (reading->flags & UPLINK_FLAG_INVALID) {
+        filter->stats.invalid++;
+        return -1;
+    }
+
+    /* older coordinators send no sequence numbers, nothing to judge by */
+    if (reading->flags & UPLINK_FLAG_NO_SEQ) {
+        filter->stats.accepted++;
+        return 0;
+    }
+
+    node = reading_filter_lookup(filter, reading->node_id);
+    if (node == NULL) {
+        filter->stats.untracked++;
+        return 0;
+    }
+
+    /* a fresh slot has sample_ms 0 and takes anything */
+    ahead = (int8_t)(reading->seq - node->seq);
+    if (node->sample_ms != 0 && ahead <= 0) {
+        if (sample_ms < node->sample_ms + READING_FILTER_RESTART_MS) {
+            if (ahead == 0) {
+                filter->stats.duplicates++;
+            } else {
+                filter->stats.stale++;
+            }
+            return -1;
+        }
+        filter->stats.restarts++;
+    }
+
+    node->seq = reading->seq;
+    node->temperature = reading->temperature;
+    node->humidity = reading->humidity;
+    node->sample_ms = sample_ms;
+    filter->stats.accepted++;
+    return 0;
+}
+
+int reading_filter_last(reading_filter_t *filter, uint16_t node_id, int16_t *temperature, int16_t *humidity)
+{
+    reading_filter_node_t *node = reading_filter_slot(filter, node_id);
+
+    if (!node->used || node->sample_ms == 0) {
+        return -1;
+    }
+    *temperature = node->temperature;
+    *humidity = node->humidity;
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Per node duplicate and staleness filter for readings from the coordinator.
+ *
+ * Nodes number their samples. A reading is dropped when the node already
+ * delivered that sequence number, when it is older than the last one reported
+ * for the node (arrived out of order), or when the node flagged the sensor
+ * read as failed. A node that restarts begins again from a low sequence
+ * number; that is told apart from a late reading by its sample time.
+ */
+#ifndef _READING_FILTER_H_
+#define _READING_FILTER_H_
+
+#include <stdint.h>
+
+#include "uplink.h"
+
+/* open addressed node table, power of two, holds any 16 bit node id population up to 3/4 of it */
+#define READING_FILTER_SIZE         4096
+
+/* a sequence number that repeats or goes back is taken as a node restart when the
+ * sample is at least this much newer than the last one reported */
+#ifndef READING_FILTER_RESTART_MS
+#define READING_FILTER_RESTART_MS   30000
+#endif
+
+typedef struct _reading_filter_stats {
+    uint64_t        accepted;
+    uint64_t        duplicates;
+    uint64_t        stale;
+    uint64_t        invalid;
+    uint64_t        restarts;
+    uint64_t        untracked;      /* table full, passed through unchecked */
+} reading_filter_stats_t;
+
+typedef struct _reading_filter_node {
+    uint16_t        node_id;
+    uint8_t         used;
+    uint8_t         seq;
+    int16_t         temperature;    /* last accepted reading */
+    int16_t         humidity;
+    uint64_t        sample_ms;
+} reading_filter_node_t;
+
+typedef struct _reading_filter {
+    reading_filter_node_t nodes[READING_FILTER_SIZE];
+    int                 count;
+    reading_filter_stats_t stats;
+} reading_filter_t;
+
+void reading_filter_init(reading_filter_t *filter);
+
+/* 0 if the reading should be reported, -1 if it is dropped; sample_ms is when the node took it */
+int  reading_filter_check(reading_filter_t *filter, const uplink_reading_t *reading, uint64_t sample_ms);
+
+/* last accepted reading of a node, in tenths; -1 if the node has not been seen */
+int  reading_filter_last(reading_filter_t *filter, uint16_t node_id, int16_t *temperature, int16_t *humidity);
+
+#endif /* _READING_FILTER_H_ */
@@ -0,0 +1,218 @@
+/*
+ * Coalescing report stage
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "iot_import.h"
+
+#include "report_batch.h"
+#include "prop_encoder.h"
+#include "node_hash.h"
+
+/* multi-property payload, Readings is an array of struct in the tsl */
+static void report_batch_item(report_batch_t *batch, prop_writer_t *w, const app_reading_t *reading)
+{
+    prop_begin_object(w);
+    prop_put_NODE_ID(w, reading->node_id);
+    if (reading->link != 0) {
+        prop_put_LINK(w, reading->link);
+    }
+    prop_put_TEMPERATURE(w, reading->temperature);
+    prop_put_HUMIDITY(w, reading->humidity);
+    if (batch->config.history || (reading->flags & APP_READING_HELD)) {
+        prop_put_TIME(w, reading->timestamp_ms);
+    }
+    prop_end_object(w);
+}
+
+static int report_batch_item_len(report_batch_t *batch, const app_reading_t *reading)
+{
+    prop_writer_t w;
+
+    prop_writer_init(&w, NULL, 0);
+    report_batch_item(batch, &w, reading);
+    return w.len;
+}
+
+/* size of {"Readings":[]} */
+static int report_batch_envelope_len(void)
+{
+    prop_writer_t w;
+
+    prop_writer_init(&w, NULL, 0);
+    prop_begin_object(&w);
+    prop_open_READINGS(&w);
+    prop_end_array(&w);
+    prop_end_object(&w);
+    return w.len;
+}
+
+static int report_batch_match(const report_batch_t *batch, uint32_t pos, uint16_t node_id)
+{
+    int slot = batch->index[pos];
+
+    return slot < 0 || batch->readings[slot].node_id == node_id;
+}
+
+/* returns the index slot of node_id, either holding it or empty */
+static int report_batch_lookup(report_batch_t *batch, uint16_t node_id)
+{
+    return NODE_HASH_PROBE(REPORT_BATCH_INDEX_SIZE, 0, node_id, pos, report_batch_match(batch, pos, node_id));
+}
+
+static void report_batch_reset(report_batch_t *batch)
+{
+    batch->count = 0;
+    batch->bytes = 0;
+    batch->mixed = 0;
+    memset(batch->index, 0xff, sizeof(batch->index));
+}
+
+void report_batch_init(report_batch_t *batch, const report_batch_config_t *config, report_batch_send_t send, void *ctx)
+{
+    memset(batch, 0, sizeof(report_batch_t));
+
+    batch->config.max_bytes = REPORT_BATCH_BYTES_DEFAULT;
+    batch->config.window_ms = REPORT_BATCH_WINDOW_DEFAULT;
+    if (config != NULL) {
+        batch->config = *config;
+    }
+    if (batch->config.max_bytes > REPORT_BATCH_PAYLOAD_MAX - 1) {
+        batch->config.max_bytes = REPORT_BATCH_PAYLOAD_MAX - 1;
+    }
+
+    batch->send = send;
+    batch->ctx = ctx;
+    batch->envelope = report_batch_envelope_len();
+    report_batch_reset(batch);
+}
+
+/* encode and post the readings of one dest */
+static int report_batch_send(report_batch_t *batch, int dest, const app_reading_t *readings, int count)
+{
+    prop_writer_t w;
+    int i, res, len;
+
+    STAGE_BEGIN(t);
+    prop_writer_init(&w, batch->payload, sizeof(batch->payload));
+    prop_begin_object(&w);
+    prop_open_READINGS(&w);
+    for (i = 0; i < count; i++) {
+        report_batch_item(batch, &w, &readings[i]);
+    }
+    prop_end_array(&w);
+    prop_end_object(&w);
+
+    len = prop_writer_finish(&w);
+    STAGE_END(batch->shard, STAGE_ENCODE, t, count);
+    res = (len < 0) ? FAIL_RETURN : batch->send(batch->ctx, dest, batch->payload, len, readings, count);
+    if (res == FAIL_RETURN) {
+        batch->stats.send_failures++;
+        batch->stats.unsent += count;
+    } else {
+        batch->stats.batches++;
+        batch->stats.readings += count;
+    }
+
+    return res;
+}
+
+int report_batch_flush(report_batch_t *batch)
+{
+    uint8_t sent[REPORT_BATCH_MAX_READINGS];
+    int i, j, n, res, last = 0;
+
+    if (batch->count == 0) {
+        return 0;
+    }
+    if (!batch->mixed) {
+        res = report_batch_send(batch, batch->dests[0], batch->readings, batch->count);
+        report_batch_reset(batch);
+        return res;
+    }
+
+    /* one payload per dest, in the order of their first readings */
+    memset(sent, 0, batch->count);
+    for (i = 0; i < batch->count; i++) {
+        if (sent[i]) {
+            continue;
+        }
+        for (j = i, n = 0; j < batch->count; j++) {
+            if (!sent[j] && batch->dests[j] == batch->dests[i]) {
+                batch->group[n++] = batch->readings[j];
+                sent[j] = 1;
+            }
+        }
+        res = report_batch_send(batch, batch->dests[i], batch->group, n);
+        if (last != FAIL_RETURN) {
+            last = res;
+        }
+    }
+
+    report_batch_reset(batch);
+    return last;
+}
+
+int report_batch_add(report_batch_t *batch, const app_reading_t *reading, int dest, uint64_t now_ms)
+{
+    int item_len = report_batch_item_len(batch, reading);
+    int keep = batch->config.history || (reading->flags & APP_READING_HELD);
+    int pos, slot;
+
+    /* history posts keep the order of the spool, one dest at a time */
+    if (batch->config.history && batch->count > 0 && dest != batch->dests[batch->count - 1]) {
+        report_batch_flush(batch);
+    }
+
+    pos = keep ? -1 : report_batch_lookup(batch, reading->node_id);
+    slot = (pos < 0) ? -1 : batch->index[pos];
+    if (slot >= 0) {
+        /* same node still pending, the newer reading wins, as the device it is for now */
+        batch->bytes += item_len - report_batch_item_len(batch, &batch->readings[slot]);
+        batch->readings[slot] = *reading;
+        batch->mixed |= (dest != batch->dests[slot] && batch->count > 1);
+        batch->dests[slot] = dest;
+        batch->stats.coalesced++;
+
+        if (batch->bytes > batch->config.max_bytes) {
+            batch->stats.size_flushes++;
+            report_batch_flush(batch);
+        }
+        return 0;
+    }
+
+    if (batch->count > 0 &&
+        (batch->bytes + 1 + item_len > batch->config.max_bytes || batch->count == REPORT_BATCH_MAX_READINGS)) {
+        batch->stats.size_flushes++;
+        report_batch_flush(batch);
+        pos = keep ? -1 : report_batch_lookup(batch, reading->node_id);
+    }
+
+    if (batch->count == 0) {
+        batch->bytes = batch->envelope;
+        batch->first_ms = now_ms;
+    } else {
+        batch->bytes++;
+    }
+
+    if (pos >= 0) {
+        batch->index[pos] = batch->count;
+    }
+    batch->dests[batch->count] = dest;
+    batch->mixed |= (dest != batch->dests[0]);
+    batch->readings[batch->count++] = *reading;
+    batch->bytes += item_len;
+
+    return 0;
+}
+
+int report_batch_poll(report_batch_t *batch, uint64_t now_ms)
+{
+    if (batch->count == 0 || now_ms - batch->first_ms < batch->config.window_ms) {
+        return 0;
+    }
+
+    batch->stats.deadline_flushes++;
+    return report_batch_flush(batch);
+}
@@ -0,0 +1,92 @@
+/*
+ * Coalescing report stage: readings from many zigbee nodes are collected and
+ * posted as one multi-property payload instead of one publish per reading.
+ * Every reading is added with the device it posts as; a flush sends one
+ * payload per device, in the order the devices first appear in the batch,
+ * so a node's older readings still go up before its newer ones when it
+ * moves from one device to another.
+ */
+#ifndef _REPORT_BATCH_H_
+#define _REPORT_BATCH_H_
+
+#include <stdint.h>
+
+#include "app_reading.h"
+#include "stage_metrics.h"
+
+/* max readings held in one batch. Live batches hold one per node, a newer reading
+ * replaces the pending one, history batches keep them all. Readings flagged
+ * APP_READING_HELD are never replaced and carry their Time in live batches too */
+#define REPORT_BATCH_MAX_READINGS   256
+
+/* size of the open addressed node id index, power of two and at least twice the readings */
+#define REPORT_BATCH_INDEX_SIZE     512
+
+/* room for the encoded payload, upper bound of the byte budget */
+#define REPORT_BATCH_PAYLOAD_MAX    4096
+
+/* default budget, leaves room for the alink envelope inside the sdk mqtt tx buffer */
+#ifndef REPORT_BATCH_BYTES_DEFAULT
+#define REPORT_BATCH_BYTES_DEFAULT  800
+#endif
+
+/* default deadline in ms, counted from the first pending reading */
+#ifndef REPORT_BATCH_WINDOW_DEFAULT
+#define REPORT_BATCH_WINDOW_DEFAULT 2000
+#endif
+
+/* returns the message id or FAIL_RETURN, like IOT_Linkkit_Report. dest is the device the
+ * readings were added for, readings are the ones encoded in payload, so a failed post can keep them */
+typedef int (*report_batch_send_t)(void *ctx, int dest, const char *payload, int len, const app_reading_t *readings,
+                                   int count);
+
+typedef struct _report_batch_config {
+    int             max_bytes;          /* flush when the payload would outgrow this */
+    uint32_t        window_ms;          /* flush when the oldest pending reading is this old */
+    int             history;            /* keep every reading in order and stamp it with its time,
+                                         * another dest flushes what is pending first */
+} report_batch_config_t;
+
+typedef struct _report_batch_stats {
+    uint64_t        batches;            /* payloads sent successfully */
+    uint64_t        readings;           /* readings carried by those payloads */
+    uint64_t        size_flushes;
+    uint64_t        deadline_flushes;
+    uint64_t        coalesced;          /* readings replaced by a newer one of the same node */
+    uint64_t        send_failures;
+    uint64_t        unsent;             /* readings handed back by failed posts */
+} report_batch_stats_t;
+
+typedef struct _report_batch {
+    report_batch_config_t config;
+    report_batch_send_t send;
+    void               *ctx;
+
+    app_reading_t       readings[REPORT_BATCH_MAX_READINGS];
+    int                 dests[REPORT_BATCH_MAX_READINGS];
+    int16_t             index[REPORT_BATCH_INDEX_SIZE];
+    int                 count;
+    int                 mixed;              /* not all readings have the same dest */
+    app_reading_t       group[REPORT_BATCH_MAX_READINGS];   /* readings of one dest while flushing */
+    int                 bytes;              /* encoded size of the pending batch */
+    int                 envelope;           /* encoded size of an empty batch */
+    uint64_t            first_ms;
+
+    char                payload[REPORT_BATCH_PAYLOAD_MAX];
+    report_batch_stats_t stats;
+    stage_shard_t      *shard;              /* encode times of the owning thread, NULL for none */
+} report_batch_t;
+
+void report_batch_init(report_batch_t *batch, const report_batch_config_t *config, report_batch_send_t send, void *ctx);
+
+/* queue one reading to post as dest, flushes when the byte budget would be exceeded */
+int  report_batch_add(report_batch_t *batch, const app_reading_t *reading, int dest, uint64_t now_ms);
+
+/* flush on deadline, call from the main loop */
+int  report_batch_poll(report_batch_t *batch, uint64_t now_ms);
+
+/* send whatever is pending, returns the last send result, FAIL_RETURN if any failed,
+ * or 0 if nothing was pending */
+int  report_batch_flush(report_batch_t *batch);
+
+#endif /* _REPORT_BATCH_H_ */
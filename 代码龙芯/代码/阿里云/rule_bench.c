@@ -0,0 +1,139 @@
+/*
+ * Micro benchmark: edge rules over a stream of readings.
+ * Reports evaluation cost per reading for a small rule set and checks every
+ * transition against the same rules written out in C. Builds without the sdk:
+ * make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "edge_rules.h"
+
+#define BENCH_READINGS          10000000
+#define BENCH_NODES             200
+
+static const char *bench_rules[] = {
+    "overheat: temperature > 35 clear temperature < 34.5",
+    "frost: temperature < 2 clear temperature > 3",
+    "damp: humidity > 85 && node != 7 clear humidity < 80",
+    "swing: (temperature > 30 || humidity > 90) && !(node == 3)",
+};
+
+/* each of these must be refused */
+static const char *bench_bad_rules[] = {
+    "overheat temperature > 35",
+    "x: temperature >",
+    "x: (temperature > 1",
+    "x: temperature > 1 clear",
+    "x: temperatures > 1",
+    /* every operand loads the stack, the VM's would overflow */
+    "deep: link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(link+(1)))))))))))))))))))))))) > 0",
+};
+
+#define BENCH_RULES             (int)(sizeof(bench_rules) / sizeof(bench_rules[0]))
+
+static app_reading_t bench_stream[BENCH_READINGS];
+static uint64_t bench_events, bench_check;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_handler(void *ctx, const edge_rule_t *rule, const app_reading_t *reading, int active)
+{
+    bench_events++;
+    bench_check = bench_check * 31 + reading->node_id * 4 + (rule - (const edge_rule_t *)ctx) * 2 + active;
+}
+
+/* the rule set above, by hand */
+static void bench_reference(uint64_t *events, uint64_t *check)
+{
+    static uint8_t active[BENCH_NODES + 1][BENCH_RULES];
+    int i, r;
+
+    for (i = 0; i < BENCH_READINGS; i++) {
+        const app_reading_t *x = &bench_stream[i];
+        int set[BENCH_RULES], clear[BENCH_RULES];
+
+        set[0] = x->temperature > 350;
+        clear[0] = x->temperature < 345;
+        set[1] = x->temperature < 20;
+        clear[1] = x->temperature > 30;
+        set[2] = x->humidity > 850 && x->node_id != 7;
+        clear[2] = x->humidity < 800;
+        set[3] = (x->temperature > 300 || x->humidity > 900) && x->node_id != 3;
+        clear[3] = !set[3];
+
+        for (r = 0; r < BENCH_RULES; r++) {
+            uint8_t *a = &active[x->node_id][r];
+
+            if (!*a ? set[r] : clear[r]) {
+                *a = !*a;
+                (*events)++;
+                *check = *check * 31 + x->node_id * 4 + r * 2 + *a;
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static edge_rules_t rules;
+    static int16_t temperature[BENCH_NODES], humidity[BENCH_NODES];
+    uint64_t events = 0, check = 0;
+    double start, elapsed;
+    char err[128];
+    int i, refused = 0, ok;
+
+    edge_rules_init(&rules, bench_handler, rules.rules);
+    for (i = 0; i < (int)(sizeof(bench_bad_rules) / sizeof(bench_bad_rules[0])); i++) {
+        refused += edge_rules_add(&rules, bench_bad_rules[i], err, sizeof(err)) < 0;
+    }
+    for (i = 0; i < BENCH_RULES; i++) {
+        if (edge_rules_add(&rules, bench_rules[i], err, sizeof(err)) < 0) {
+            printf("rule %d: %s\n", i, err);
+            return 1;
+        }
+    }
+
+    /* rooms wandering across every threshold */
+    srand(1);
+    for (i = 0; i < BENCH_NODES; i++) {
+        temperature[i] = rand() % 400;
+        humidity[i] = rand() % 1000;
+    }
+    for (i = 0; i < BENCH_READINGS; i++) {
+        int node = rand() % BENCH_NODES;
+
+        temperature[node] += rand() % 21 - 10;
+        humidity[node] += rand() % 41 - 20;
+        temperature[node] = (temperature[node] < -100) ? -100 : (temperature[node] > 500) ? 500 : temperature[node];
+        humidity[node] = (humidity[node] < 0) ? 0 : (humidity[node] > 1000) ? 1000 : humidity[node];
+        bench_stream[i].node_id = node + 1;
+        bench_stream[i].link = 0;
+        bench_stream[i].temperature = temperature[node];
+        bench_stream[i].humidity = humidity[node];
+        bench_stream[i].timestamp_ms = i;
+    }
+
+    start = bench_now();
+    for (i = 0; i < BENCH_READINGS; i++) {
+        edge_rules_eval(&rules, &bench_stream[i]);
+    }
+    elapsed = bench_now() - start;
+
+    bench_reference(&events, &check);
+    ok = events == bench_events && check == bench_check &&
+         refused == (int)(sizeof(bench_bad_rules) / sizeof(bench_bad_rules[0]));
+    printf("rules    %6.1f ns/reading for %d rules  %llu transitions  %d/%d bad rules refused  %s\n",
+           elapsed * 1e9 / BENCH_READINGS, BENCH_RULES, (unsigned long long)bench_events, refused,
+           (int)(sizeof(bench_bad_rules) / sizeof(bench_bad_rules[0])), ok ? "ok" : "MISMATCH");
+
+    return ok ? 0 : 1;
+}
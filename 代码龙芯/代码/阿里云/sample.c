@@ -5,11 +5,31 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "iot_import.h"
 #include "iot_export.h"
 #include "iot_export_linkkit.h"
 
+#include "app_reading.h"
+#include "serial_bridge.h"
+#include "serial_hub.h"
+#include "report_batch.h"
+#include "spsc_ring.h"
+#include "store_forward.h"
+#include "prop_encoder.h"
+#include "prop_parser.h"
+#include "reading_filter.h"
+#include "ts_store.h"
+#include "node_snapshot.h"
+#include "query_server.h"
+#include "edge_rules.h"
+#include "subdev_registry.h"
+#include "cloud_conn.h"
+#include "stage_metrics.h"
+#include "bin_log.h"
+
 
 /* Properties defined of the sample
 {
@@ -38,19 +58,128 @@
 
 #define PROPERTY_ID_DATA_VALUE          "Hello,World!"
 
-/* format of property post payload */
-#define PROPERTY_PAYLOAD_FORMAT         "{\"Data\": \"%s\", \"Status\": %d}"
+/* reusable buffer for the gateway's own property post, see APP_PROPERTY_SCHEMA */
+#define APP_PAYLOAD_MAX                 128
+
+/* readings buffered between the ingestion and cloud threads, covers a few seconds of a stalled yield */
+#define APP_READING_RING_SIZE           16384
+
+/* a reading sampled this long before the node sent it was held back, a power saving node sends
+ * several in one message. Each keeps its own item and Time in the live batch, see report_batch.h */
+#define APP_READING_HELD_MS             1000
+
+/* spooled readings replayed per cloud loop iteration, the spool rate limit applies on top */
+#define APP_REPLAY_MAX                  64
+
+/* event posted when an edge rule is raised or cleared for a node, and its payload buffer */
+#define APP_ALARM_EVENT_ID              "NodeAlarm"
+#define APP_EVENT_PAYLOAD_MAX           192
+
+/* rollup posts are cut once they reach the node batch budget, the buffer holds one more item */
+#define APP_ROLLUP_BYTES                REPORT_BATCH_BYTES_DEFAULT
+#define APP_ROLLUP_PAYLOAD_MAX          1024
+
+/* ingestion thread wakes up at least this often to check for exit */
+#define SERIAL_POLL_TIMEOUT_MS          100
+
+/* the coordinator is pinged this often, a few unanswered pings in a row are reported */
+#define SERIAL_PING_INTERVAL_MS         10000
+#define SERIAL_PING_LOST_MAX            3
 
+/* tty the zigbee coordinator is attached to, argv[1..] list one tty per coordinator instead */
+#define SERIAL_DEVICE_DEFAULT           "/dev/ttyS1"
+
+/* sub-device product every coordinator PAN is logged in as, "<DEVICE_NAME>_pan<link>".
+ * The secret is the product secret, the devices register themselves on first login.
+ * Left empty, every link reports through the gateway device itself */
+#ifndef SUBDEV_PRODUCT_KEY
+#define SUBDEV_PRODUCT_KEY              ""
+#endif
+#ifndef SUBDEV_PRODUCT_SECRET
+#define SUBDEV_PRODUCT_SECRET           ""
+#endif
+
+/* sub-device product of the zigbee nodes, "<DEVICE_NAME>_<link>_<node id>", registered the same way.
+ * A node's readings and alarms go up as its own device once it is logged in, until then and
+ * left empty through its link */
+#ifndef NODE_PRODUCT_KEY
+#define NODE_PRODUCT_KEY                ""
+#endif
+#ifndef NODE_PRODUCT_SECRET
+#define NODE_PRODUCT_SECRET             ""
+#endif
+
+/* the broker is probed before each connect, see cloud_conn.h. An empty host
+ * probes the one the sdk connects to, 0 connects without probing */
+#ifndef APP_CLOUD_PROBE
+#define APP_CLOUD_PROBE                 1
+#endif
+#ifndef APP_CLOUD_HOST
+#define APP_CLOUD_HOST                  ""
+#endif
+#ifndef APP_CLOUD_PORT
+#define APP_CLOUD_PORT                  1883
+#endif
+
+/* pipeline metrics are dumped here for a Prometheus textfile collector, empty for none.
+ * They are also served as METRICS on the query socket */
+#ifndef APP_METRICS_PATH
+#define APP_METRICS_PATH                "/tmp/zigbee_gateway.prom"
+#endif
+#define APP_METRICS_DUMP_S              10
+
+
+/* app trace is recorded into a binary log, formatted and printed by its own thread with a
+ * rate limit per call site, see bin_log.h. Every record also goes to APP_LOG_PATH, rotated
+ * through APP_LOG_FILES files of APP_LOG_FILE_MAX bytes, empty for none: decode with
+ * bin_log_decode. -DAPP_LOG_ASYNC=0 prints every trace on the calling thread instead */
+#ifndef APP_LOG_ASYNC
+#define APP_LOG_ASYNC                   1
+#endif
+#ifndef APP_LOG_PATH
+#define APP_LOG_PATH                    "/tmp/zigbee_gateway.log"
+#endif
+#define APP_LOG_FILE_MAX                (1024 * 1024)
+#define APP_LOG_FILES                   4
 
 /* define print for app trace */
+#if APP_LOG_ASYNC
+#define APP_TRACE(fmt, ...)             BIN_LOG(&app_log, fmt, ##__VA_ARGS__)
+#else
 #define APP_TRACE(fmt, ...)  \
     do { \
         HAL_Printf("%s|%03d :: ", __func__, __LINE__); \
         HAL_Printf(fmt, ##__VA_ARGS__); \
         HAL_Printf("%s", "\r\n"); \
     } while(0)
+#endif
+
+/* trace on the per-frame, per-reading and per-post paths, compiled in with
+ * -DAPP_TRACE_HOT_PATHS=1. The events are counted as stage metrics either way */
+#ifndef APP_TRACE_HOT_PATHS
+#define APP_TRACE_HOT_PATHS             0
+#endif
+#if APP_TRACE_HOT_PATHS
+#define APP_TRACE_HOT(fmt, ...)         APP_TRACE(fmt, ##__VA_ARGS__)
+#else
+#define APP_TRACE_HOT(fmt, ...)         do { if (0) APP_TRACE(fmt, ##__VA_ARGS__); } while (0)
+#endif
 
 
+/* one coordinator and the PAN behind it */
+typedef struct _app_link {
+    int             index;          /* link number, stamped on every reading */
+    reading_filter_t filter;        /* ingestion thread only */
+    uint64_t        radio_missed;   /* ingestion thread only, from the node summaries */
+    uint64_t        pings_sent;     /* ingestion thread only */
+    uint64_t        pings_answered;
+    uint64_t        ping_rtt_max_ms;
+    uint64_t        ping_answer_ms; /* when the last answer came in */
+    int             devid;          /* cloud thread only, the sub-device or the gateway device */
+    report_batch_t  batch;          /* cloud thread only */
+    uint32_t        rollup_cursor;  /* cloud thread only, first bucket not posted yet, 0 until the first close */
+} app_link_t;
+
 /* app context type define */
 typedef struct _app_context {
     int         device_id;
@@ -58,11 +187,261 @@ typedef struct _app_context {
     uint8_t     prop_status;
     uint8_t     cloud_connected;
     uint8_t     device_initialized;    
+    uint8_t     running;
+    serial_hub_t    hub;            /* polled by the ingestion thread, links are added before the others start */
+    app_link_t      links[SERIAL_HUB_LINKS];
+    node_snapshot_t snapshot;       /* written by the ingestion thread only, read by anyone */
+    uint8_t         snapshot_ready;
+    query_server_t  query;          /* query thread only */
+    spsc_ring_t     ring;           /* ingestion thread -> cloud thread */
+    report_batch_t  history;        /* cloud thread only, replays the spool */
+    store_forward_t spool;          /* cloud thread only */
+    uint8_t         spool_ready;
+    uint8_t         replay_failed;
+    uint64_t        spool_drops;
+    char            payload[APP_PAYLOAD_MAX];   /* cloud thread only */
+    ts_store_t      ts;             /* cloud thread only */
+    uint8_t         ts_ready;
+    uint32_t        granularity;    /* seconds per reported bucket, 0 posts raw readings */
+    uint64_t        rollups_posted;
+    char            rollup_payload[APP_ROLLUP_PAYLOAD_MAX];
+    edge_rules_t    rules;          /* cloud thread only */
+    uint64_t        alarms_unsent;
+    char            event_payload[APP_EVENT_PAYLOAD_MAX];
+    subdev_registry_t subdevs;      /* cloud thread only, sub-devices of the nodes */
+    uint8_t         subdevs_ready;
+    cloud_conn_t    conn;           /* cloud thread only */
+    stage_metrics_t metrics;        /* shards are added before the threads start */
+    stage_shard_t  *ingest_shard;
+    stage_shard_t  *cloud_shard;
+    uint8_t         metrics_dump_failed;
 } app_context_t;
 
 /* app context variable declare */
 static app_context_t app_context;
 
+/* app trace, see APP_TRACE */
+static bin_log_t app_log;
+
+/* downlink command collected while a cloud request is parsed */
+typedef struct _app_request {
+    int         link;           /* coordinator the command goes to, -1 for every one */
+    int         node_id;        /* 0 addresses every node */
+    int         group_id;       /* addresses a group instead, 0 if not requested */
+    int         interval;       /* sample interval in seconds, 0 if not requested */
+    int         deadband_t;     /* report dead-bands in tenths, -1 if not requested */
+    int         deadband_h;
+    int         heartbeat;      /* seconds between unchanged reports, 0 if not requested */
+    uint8_t     changed;        /* gateway properties were written */
+} app_request_t;
+
+static int app_post_all_property(void);
+
+static int app_set_data(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    char data[sizeof(app_context.prop_data)];
+
+    if (prop_unescape(value, data, sizeof(data)) < 0) {
+        return -1;
+    }
+
+    memcpy(app_context.prop_data, data, sizeof(data));
+    ((app_request_t *)ctx)->changed = 1;
+    return 0;
+}
+
+static int app_set_status(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    app_context.prop_status = (value->i != 0);
+    ((app_request_t *)ctx)->changed = 1;
+    return 0;
+}
+
+static int app_set_node_id(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i < 0 || value->i >= NODE_TARGET_GROUP) {
+        return -1;
+    }
+
+    ((app_request_t *)ctx)->node_id = (int)value->i;
+    return 0;
+}
+
+static int app_set_link(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i < 0 || value->i >= app_context.hub.count) {
+        return -1;
+    }
+
+    ((app_request_t *)ctx)->link = (int)value->i;
+    return 0;
+}
+
+static int app_set_group_id(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i <= 0 || value->i >= NODE_TARGET_GROUP) {
+        return -1;
+    }
+
+    ((app_request_t *)ctx)->group_id = (int)value->i;
+    return 0;
+}
+
+static int app_set_interval(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i <= 0 || value->i > 0xFFFF) {
+        return -1;
+    }
+
+    ((app_request_t *)ctx)->interval = (int)value->i;
+    return 0;
+}
+
+/* dead-bands arrive as tsl floats and go down as one byte of tenths, so 25.5 at most.
+ * 0 reports every change of that metric, batched rather than at once */
+static int app_set_deadband(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    int tenths = (int)(value->d * 10 + 0.5);
+
+    if (value->d < 0 || tenths > 0xFF) {
+        return -1;
+    }
+
+    if (id == PROP_TEMP_DEADBAND) {
+        ((app_request_t *)ctx)->deadband_t = tenths;
+    } else {
+        ((app_request_t *)ctx)->deadband_h = tenths;
+    }
+    return 0;
+}
+
+static int app_set_heartbeat(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i <= 0 || value->i > 0xFFFF) {
+        return -1;
+    }
+
+    ((app_request_t *)ctx)->heartbeat = (int)value->i;
+    return 0;
+}
+
+/* raw readings, or one bucket per node every minute or quarter hour */
+static int app_set_granularity(void *ctx, prop_id_t id, const prop_value_t *value)
+{
+    if (value->i != 0 && (!app_context.ts_ready || (value->i != ts_level_period[TS_LEVEL_1MIN] &&
+                                                    value->i != ts_level_period[TS_LEVEL_15MIN]))) {
+        return -1;
+    }
+
+    if (app_context.granularity != (uint32_t)value->i) {
+        int i;
+
+        app_context.granularity = (uint32_t)value->i;
+        for (i = 0; i < app_context.hub.count; i++) {
+            app_context.links[i].rollup_cursor = 0;
+        }
+    }
+    ((app_request_t *)ctx)->changed = 1;
+    return 0;
+}
+
+/* identifiers the cloud may write, everything else in a request is skipped */
+static const prop_setter_t app_request_setters[PROP_MAX] = {
+    [PROP_DATA]             = app_set_data,
+    [PROP_STATUS]           = app_set_status,
+    [PROP_NODE_ID]          = app_set_node_id,
+    [PROP_LINK]             = app_set_link,
+    [PROP_GROUP_ID]         = app_set_group_id,
+    [PROP_INTERVAL]         = app_set_interval,
+    [PROP_TEMP_DEADBAND]    = app_set_deadband,
+    [PROP_HUMI_DEADBAND]    = app_set_deadband,
+    [PROP_HEARTBEAT]        = app_set_heartbeat,
+    [PROP_GRANULARITY]      = app_set_granularity,
+};
+
+/* link a device id stands for, -1 for the gateway device */
+static int app_link_of(int devid)
+{
+    int i;
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        if (app_context.links[i].devid == devid && devid != app_context.device_id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* apply a property set or service request in one pass over the payload.
+ * A request to a PAN sub-device goes to its coordinator, one to the gateway to every
+ * coordinator unless it names a Link */
+static int app_apply_request(int devid, const char *request, const int request_len)
+{
+    app_request_t req;
+    prop_parse_stats_t stats;
+    uint8_t cmd[NODE_CONFIG_SIZE_MAX];
+    const subdev_entry_t *node;
+    int target, len, i;
+
+    memset(&req, 0, sizeof(app_request_t));
+    req.link = app_link_of(devid);
+    req.deadband_t = -1;
+    req.deadband_h = -1;
+    /* a node's own device addresses just that node */
+    if (app_context.subdevs_ready && (node = subdev_registry_find(&app_context.subdevs, devid)) != NULL) {
+        req.link = node->link;
+        req.node_id = node->node_id;
+    }
+    if (prop_parse(request, request_len, app_request_setters, &req, &stats) < 0) {
+        APP_TRACE("Malformed request ignored, %d values applied before the error", stats.applied);
+        return FAIL_RETURN;
+    }
+
+    /* everything the request changes on the nodes goes down as one command,
+     * the coordinator fans it out in a single broadcast or group-cast */
+    target = req.group_id ? (NODE_TARGET_GROUP | req.group_id) : req.node_id;
+    if (req.group_id) {
+        /* only routers and always-on nodes keep the receiver on for a group-cast */
+        APP_TRACE("Group %d command does not reach sleepy nodes, address them by NodeID", req.group_id);
+    }
+    cmd[0] = target & 0xFF;
+    cmd[1] = (target >> 8) & 0xFF;
+    cmd[2] = 0;
+    len = 3;
+    if (req.interval > 0) {
+        cmd[2] |= NODE_CONFIG_INTERVAL;
+        cmd[len++] = req.interval & 0xFF;
+        cmd[len++] = (req.interval >> 8) & 0xFF;
+    }
+    if (req.deadband_t >= 0) {
+        cmd[2] |= NODE_CONFIG_DEADBAND_T;
+        cmd[len++] = req.deadband_t;
+    }
+    if (req.deadband_h >= 0) {
+        cmd[2] |= NODE_CONFIG_DEADBAND_H;
+        cmd[len++] = req.deadband_h;
+    }
+    if (req.heartbeat > 0) {
+        cmd[2] |= NODE_CONFIG_HEARTBEAT;
+        cmd[len++] = req.heartbeat & 0xFF;
+        cmd[len++] = (req.heartbeat >> 8) & 0xFF;
+    }
+    for (i = 0; cmd[2] != 0 && i < app_context.hub.count; i++) {
+        if ((req.link < 0 || req.link == i) &&
+            serial_hub_send(&app_context.hub, i, FUN_CODE_NODE_CONFIG, cmd, len) < 0) {
+            APP_TRACE("Send node config 0x%02x to target 0x%04x on link %d fail", cmd[2], target, i);
+        }
+    }
+
+    /* echo the new gateway state back to the cloud */
+    if (req.changed) {
+        app_post_all_property();
+    }
+
+    return SUCCESS_RETURN;
+}
+
 /* 
  * Connect handle
  */
@@ -71,6 +450,7 @@ static int user_connected_event_handler(void)
     APP_TRACE("Cloud Connected");
 
     app_context.cloud_connected = 1;
+    cloud_conn_connected(&app_context.conn, HAL_UptimeMs());
     return 0;
 }
 
@@ -82,6 +462,10 @@ static int user_disconnected_event_handler(void)
     APP_TRACE("Cloud Disconnected");
 
     app_context.cloud_connected = 0;
+    if (app_context.subdevs_ready) {
+        subdev_registry_reset(&app_context.subdevs);
+    }
+    cloud_conn_disconnected(&app_context.conn, HAL_UptimeMs());
     return 0;
 }
 
@@ -93,10 +477,11 @@ static int user_service_request_event_handler(const int devid, const char *servi
         const char *request, const int request_len,
         char **response, int *response_len)
 {
-    APP_TRACE("Service Request Received, Devid: %d, Service ID: %.*s, Payload: %s", devid, serviceid_len, serviceid, request);
-    
-    /* view sdk example to get more detail */
-    return 0;
+    APP_TRACE("Service Request Received, Devid: %d, Service ID: %.*s, Payload: %.*s", devid, serviceid_len, serviceid,
+              request_len, request);
+
+    /* service input params carry the same identifiers as properties */
+    return app_apply_request(devid, request, request_len);
 }
 
 /**
@@ -104,10 +489,9 @@ static int user_service_request_event_handler(const int devid, const char *servi
  */
 static int user_property_set_event_handler(const int devid, const char *request, const int request_len)
 {
-    APP_TRACE("Property Set Received, Devid: %d, payload: %s\r\n", devid, request);
+    APP_TRACE("Property Set Received, Devid: %d, payload: %.*s\r\n", devid, request_len, request);
 
-    /* you should use cJSON to parse the request to get specific property value, see sdk exampel */
-    return 0;
+    return app_apply_request(devid, request, request_len);
 }
 
 /**
@@ -128,10 +512,24 @@ static int user_report_reply_event_handler(const int devid, const int msgid, con
     const char *reply_value = (reply == NULL) ? ("NULL") : (reply);
     const int reply_value_len = (reply_len == 0) ? (strlen("NULL")) : (reply_len);
 
+    STAGE_POINT(app_context.cloud_shard, (code == 200) ? STAGE_POINT_REPLY : STAGE_POINT_REPLY_ERROR);
+
     /* reply value many be meaningless if it's a property post reply */
-    APP_TRACE("Property Post Reply Received, Devid: %d, Message ID: %d, Code: %d, Reply: %.*s\r\n", devid, msgid, code,
+    APP_TRACE_HOT("Property Post Reply Received, Devid: %d, Message ID: %d, Code: %d, Reply: %.*s\r\n", devid, msgid, code,
                   reply_value_len,
                   reply_value);
+
+    /* the first acknowledged post after a (re)connect ends the outage */
+    if (code == 200 && !app_context.conn.published) {
+        cloud_conn_published(&app_context.conn, HAL_UptimeMs());
+        if (app_context.conn.published) {
+            APP_TRACE("Cloud publishing %llums after it went away: dns %ums, tcp %ums, connect %ums, subscribe %ums, "
+                      "first publish %ums", (unsigned long long)app_context.conn.stats.ttfp_last_ms,
+                      app_context.conn.stats.last.dns_ms, app_context.conn.stats.last.tcp_ms,
+                      app_context.conn.stats.last.connect_ms, app_context.conn.stats.last.subscribe_ms,
+                      app_context.conn.stats.last.publish_ms);
+        }
+    }
     return 0;
 }
 
@@ -155,33 +553,468 @@ static int user_trigger_event_reply_event_handler(const int devid, const int msg
  */
 static int user_initialized(const int devid)
 {
-    APP_TRACE("Device Initialized, Devid: %d", devid);
-
     if (app_context.device_id == devid) {
+        APP_TRACE("Device Initialized, Devid: %d", devid);
         app_context.device_initialized = 1;
+        cloud_conn_initialized(&app_context.conn, HAL_UptimeMs());
+        return 0;
+    }
+
+    APP_TRACE_HOT("Device Initialized, Devid: %d", devid);
+    STAGE_POINT(app_context.cloud_shard, STAGE_POINT_SUBDEV_ONLINE);
+    if (app_context.subdevs_ready) {
+        subdev_registry_online(&app_context.subdevs, devid, HAL_UptimeMs());
     }
 
     return 0;
 }
 
+/* every property post goes through here, timed as the publish stage */
+static int app_report(int devid, const char *payload, int len)
+{
+    int res;
+
+    STAGE_BEGIN(t);
+    res = IOT_Linkkit_Report(devid, ITM_MSG_POST_PROPERTY, (uint8_t *)payload, len);
+    STAGE_END(app_context.cloud_shard, STAGE_PUBLISH, t, 1);
+    if (res == FAIL_RETURN) {
+        STAGE_POINT(app_context.cloud_shard, STAGE_POINT_POST_FAIL);
+    }
+
+    return res;
+}
+
 /* app post all property ervery 5 second */
 static int app_post_all_property(void)
 {
     int res = 0;
-    char payload[60] = {0};
-    
-    HAL_Snprintf(payload, sizeof(payload), PROPERTY_PAYLOAD_FORMAT, app_context.prop_data, app_context.prop_status);
+    int len = 0;
+    prop_writer_t w;
 
-    res = IOT_Linkkit_Report(app_context.device_id, ITM_MSG_POST_PROPERTY, (uint8_t*)payload, strlen(payload));
+    prop_writer_init(&w, app_context.payload, sizeof(app_context.payload));
+    prop_begin_object(&w);
+    prop_put_DATA(&w, app_context.prop_data);
+    prop_put_STATUS(&w, app_context.prop_status);
+    prop_put_GRANULARITY(&w, app_context.granularity);
+    prop_end_object(&w);
+
+    len = prop_writer_finish(&w);
+    if (len < 0) {
+        APP_TRACE("App properties don't fit in %d bytes\r\n", APP_PAYLOAD_MAX);
+        return FAIL_RETURN;
+    }
+
+    res = app_report(app_context.device_id, app_context.payload, len);
     if (res == FAIL_RETURN) {
         APP_TRACE("App post properties every 5 seconds fail\r\n");
         return res;
     }
-    APP_TRACE("Property post successfully, Message ID: %d, payload: %s", res, payload);
+    APP_TRACE("Property post successfully, Message ID: %d, payload: %s", res, app_context.payload);
+
+    return res;
+}
+
+/* wall clock in ms, readings are stamped with it so replayed ones keep their time */
+static uint64_t app_time_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* keep a reading on disk until the cloud is back */
+static void app_spool_reading(const app_reading_t *reading)
+{
+    STAGE_POINT(app_context.cloud_shard, STAGE_POINT_SPOOLED);
+    if (!app_context.spool_ready || store_forward_append(&app_context.spool, reading) < 0) {
+        app_context.spool_drops++;
+    }
+}
+
+/* app post a batch of zigbee node readings as one multi-property payload of the link or a node device */
+static int app_post_node_batch(void *ctx, int devid, const char *payload, int len, const app_reading_t *readings,
+                               int count)
+{
+    int res = FAIL_RETURN;
+    int i;
+
+    if (app_context.cloud_connected) {
+        res = app_report(devid, payload, len);
+    }
+
+    if (res == FAIL_RETURN) {
+        APP_TRACE_HOT("App post batch of %d node readings fail, spooled", count);
+        for (i = 0; i < count; i++) {
+            app_spool_reading(&readings[i]);
+        }
+    }
+
+    return res;
+}
+
+/* app post a batch of spooled readings, the spool checkpoint only moves when the post went out */
+static int app_post_history_batch(void *ctx, int devid, const char *payload, int len, const app_reading_t *readings,
+                                  int count)
+{
+    int res = FAIL_RETURN;
+
+    /* once a post of this round failed, later ones must not move the checkpoint past it */
+    if (app_context.cloud_connected && !app_context.replay_failed) {
+        res = app_report(devid, payload, len);
+    }
+
+    if (res == FAIL_RETURN) {
+        app_context.replay_failed = 1;
+        return res;
+    }
 
+    store_forward_commit(&app_context.spool, count);
     return res;
 }
 
+/* device a spooled reading replays as, -1 while the node's login is still on its way */
+static int app_replay_devid(const app_reading_t *reading, uint64_t now_ms)
+{
+    int devid;
+
+    if (!app_context.subdevs_ready) {
+        return app_context.links[reading->link].devid;
+    }
+    devid = subdev_registry_lookup(&app_context.subdevs, reading->link, reading->node_id, now_ms);
+    if (devid < 0 && subdev_registry_pending(&app_context.subdevs, reading->link, reading->node_id)) {
+        return -1;
+    }
+
+    return (devid >= 0) ? devid : app_context.links[reading->link].devid;
+}
+
+/* replay the spool in order, rate limited so a reconnect doesn't flood the broker */
+static void app_replay_spool(uint64_t now_ms)
+{
+    app_reading_t readings[APP_REPLAY_MAX];
+    int count, devid, i;
+
+    count = store_forward_read(&app_context.spool, readings, APP_REPLAY_MAX, now_ms);
+    if (count == 0) {
+        return;
+    }
+
+    /* readings go up as the device they would have had live, a node whose login is
+     * still pending holds the replay up until its device is online or has failed */
+    app_context.replay_failed = 0;
+    for (i = 0; i < count; i++) {
+        if (readings[i].link >= app_context.hub.count) {
+            readings[i].link = 0;
+        }
+        devid = app_replay_devid(&readings[i], now_ms);
+        if (devid < 0) {
+            break;
+        }
+        report_batch_add(&app_context.history, &readings[i], devid, now_ms);
+    }
+    report_batch_flush(&app_context.history);
+
+    if (app_context.replay_failed || i < count) {
+        store_forward_rewind(&app_context.spool);
+    }
+}
+
+/* close the open Rollups payload and post it as the link's device */
+static int app_flush_rollups(app_link_t *link, prop_writer_t *w, int items)
+{
+    int res, len;
+
+    prop_end_array(w);
+    prop_end_object(w);
+    len = prop_writer_finish(w);
+    if (len < 0) {
+        APP_TRACE("Node rollups don't fit in %d bytes", APP_ROLLUP_PAYLOAD_MAX);
+        return FAIL_RETURN;
+    }
+
+    res = app_report(link->devid, app_context.rollup_payload, len);
+    if (res == FAIL_RETURN) {
+        APP_TRACE("App post %d node rollups fail, retried next second", items);
+        return res;
+    }
+
+    app_context.rollups_posted += items;
+    return res;
+}
+
+/* post every bucket of the reporting granularity that closed since the last post.
+ * The store keeps them, so a failed post is simply retried from the cursor while
+ * the bucket is still in the ring; a bucket split over several posts may be sent twice.
+ * Every link has its own cursor and posts as its own device */
+static void app_post_link_rollups(app_link_t *link, ts_level_t level, uint32_t closed)
+{
+    ts_store_t *ts = &app_context.ts;
+    uint32_t period = ts_level_period[level];
+    uint32_t start;
+    prop_writer_t w;
+    ts_agg_t agg;
+    int i, items = 0;
+
+    /* reporting starts with the first bucket closing after a switch */
+    if (link->rollup_cursor == 0) {
+        link->rollup_cursor = closed;
+        return;
+    }
+    /* the oldest slot is the next to be reused, skip what went by while offline */
+    if (closed - link->rollup_cursor > (TS_STORE_ROLLUP_SLOTS - 1) * period) {
+        link->rollup_cursor = closed - (TS_STORE_ROLLUP_SLOTS - 1) * period;
+    }
+    if (!app_context.cloud_connected) {
+        return;
+    }
+
+    for (start = link->rollup_cursor; start < closed; start += period) {
+        for (i = 0; i < ts->count; i++) {
+            if (ts->series[i].link != link->index || ts_store_bucket(ts, i, level, start, &agg) < 0) {
+                continue;
+            }
+            if (items == 0) {
+                prop_writer_init(&w, app_context.rollup_payload, sizeof(app_context.rollup_payload));
+                prop_begin_object(&w);
+                prop_open_ROLLUPS(&w);
+            }
+            ts_store_put_agg(&w, &ts->series[i], level, &agg);
+            items++;
+
+            if (w.len >= APP_ROLLUP_BYTES) {
+                if (app_flush_rollups(link, &w, items) == FAIL_RETURN) {
+                    return;
+                }
+                link->rollup_cursor = start;
+                items = 0;
+            }
+        }
+    }
+    if (items > 0 && app_flush_rollups(link, &w, items) == FAIL_RETURN) {
+        return;
+    }
+    link->rollup_cursor = closed;
+}
+
+static void app_post_rollups(uint64_t now_ms)
+{
+    ts_level_t level = (app_context.granularity == ts_level_period[TS_LEVEL_1MIN]) ? TS_LEVEL_1MIN : TS_LEVEL_15MIN;
+    int i;
+
+    if (!app_context.ts_ready) {
+        return;
+    }
+    ts_store_poll(&app_context.ts, now_ms);
+    if (app_context.granularity == 0) {
+        return;
+    }
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        app_post_link_rollups(&app_context.links[i], level, app_context.ts.closed[level]);
+    }
+}
+
+/* device a node's posts and events go up as: its own once logged in, else its link's */
+static int app_node_devid(const app_reading_t *reading, uint64_t now_ms)
+{
+    int devid = -1;
+
+    if (app_context.subdevs_ready) {
+        devid = subdev_registry_lookup(&app_context.subdevs, reading->link, reading->node_id, now_ms);
+    }
+
+    return (devid >= 0) ? devid : app_context.links[reading->link].devid;
+}
+
+/* an edge rule was raised or cleared for a node, only these transitions go up as events */
+static void app_rule_handler(void *ctx, const edge_rule_t *rule, const app_reading_t *reading, int active)
+{
+    prop_writer_t w;
+    int res, len;
+
+    prop_writer_init(&w, app_context.event_payload, sizeof(app_context.event_payload));
+    prop_begin_object(&w);
+    prop_put_NODE_ID(&w, reading->node_id);
+    if (reading->link != 0) {
+        prop_put_LINK(&w, reading->link);
+    }
+    prop_put_RULE(&w, rule->name);
+    prop_put_ACTIVE(&w, active);
+    prop_put_TEMPERATURE(&w, reading->temperature);
+    prop_put_HUMIDITY(&w, reading->humidity);
+    prop_put_TIME(&w, reading->timestamp_ms);
+    prop_end_object(&w);
+
+    len = prop_writer_finish(&w);
+    if (len < 0) {
+        APP_TRACE("Alarm doesn't fit in %d bytes", APP_EVENT_PAYLOAD_MAX);
+        return;
+    }
+
+    APP_TRACE("Rule %s %s for node %d:%d", rule->name, active ? "raised" : "cleared", reading->link,
+              reading->node_id);
+    res = FAIL_RETURN;
+    if (app_context.cloud_connected) {
+        res = IOT_Linkkit_TriggerEvent(app_node_devid(reading, HAL_UptimeMs()), APP_ALARM_EVENT_ID, strlen(APP_ALARM_EVENT_ID),
+                                       app_context.event_payload, len);
+    }
+    if (res < 0) {
+        app_context.alarms_unsent++;
+        APP_TRACE("Trigger event %s fail, payload: %s", APP_ALARM_EVENT_ID, app_context.event_payload);
+    }
+}
+
+/* readings handed over by the ingestion thread */
+static void app_dispatch_reading(const app_reading_t *reading, uint64_t now_ms)
+{
+    int devid;
+
+    /* every frame keeps the node's sub-device from going idle, the first one brings it up */
+    STAGE_BEGIN(t);
+    devid = app_node_devid(reading, now_ms);
+    edge_rules_eval(&app_context.rules, reading);
+
+    if (app_context.ts_ready) {
+        ts_store_add(&app_context.ts, reading);
+    }
+    STAGE_END(app_context.cloud_shard, STAGE_AGGREGATE, t, 1);
+
+    /* downsampled reporting posts the rollups instead, they outlive an outage on their own */
+    if (app_context.granularity != 0) {
+        return;
+    }
+
+    /* keep order: while anything is spooled, new readings queue up behind it */
+    if (!app_context.cloud_connected || (app_context.spool_ready && store_forward_pending(&app_context.spool))) {
+        app_spool_reading(reading);
+        return;
+    }
+
+    /* the link batch posts each device's readings as a payload of their own */
+    report_batch_add(&app_context.links[reading->link].batch, reading, devid, now_ms);
+}
+
+/* queue a node reading for the cloud thread unless it is a duplicate, stale or a failed read */
+static void app_ingest_reading(app_link_t *link, const uplink_reading_t *node_reading, uint64_t now_ms)
+{
+    app_reading_t reading;
+
+    /* the node says how long ago it sampled, the coordinator hold adds tens of ms at most */
+    reading.timestamp_ms = now_ms - (uint64_t)node_reading->age * UPLINK_AGE_UNIT_MS;
+    if (reading_filter_check(&link->filter, node_reading, reading.timestamp_ms) < 0) {
+        return;
+    }
+
+    reading.node_id = node_reading->node_id;
+    reading.link = link->index;
+    reading.flags = (node_reading->age >= APP_READING_HELD_MS / UPLINK_AGE_UNIT_MS) ? APP_READING_HELD : 0;
+    reading.temperature = node_reading->temperature;
+    reading.humidity = node_reading->humidity;
+    if (app_context.snapshot_ready) {
+        node_snapshot_update(&app_context.snapshot, &reading);
+    }
+    if (spsc_ring_push(&app_context.ring, &reading) == 0) {
+        STAGE_POINT(app_context.ingest_shard, STAGE_POINT_READING);
+    }
+}
+
+/* frames decoded from one coordinator uart, ctx is its link */
+static void app_serial_frame_handler(void *ctx, uint8_t fc, const uint8_t *data, int len)
+{
+    app_link_t *link = (app_link_t *)ctx;
+    uplink_reading_t node_reading;
+
+    memset(&node_reading, 0, sizeof(node_reading));
+    node_reading.flags = UPLINK_FLAG_NO_SEQ;
+
+    switch (fc) {
+        case FUN_CODE_UPDATA_DATA: {
+            /* id, temperature, humidity */
+            if (len < 3) {
+                return;
+            }
+            node_reading.node_id = data[0];
+            node_reading.temperature = data[1] * 10;
+            node_reading.humidity = data[2] * 10;
+            app_ingest_reading(link, &node_reading, app_time_ms());
+        }
+        break;
+        case UPLINK_FC_SAMPLES:
+        case UPLINK_FC_READINGS: {
+            uplink_reading_t readings[UPLINK_PAYLOAD_MAX];
+            int i, count = uplink_decode_readings(fc, data, len, readings, UPLINK_PAYLOAD_MAX);
+            uint64_t now_ms = app_time_ms();
+
+            for (i = 0; i < count; i++) {
+                app_ingest_reading(link, &readings[i], now_ms);
+            }
+        }
+        break;
+        case FUN_CODE_PING: {
+            /* the timestamp we sent, the coordinator only echoes it */
+            uint64_t sent_ms = 0, now_ms = app_time_ms();
+            int i;
+
+            if (len != sizeof(sent_ms)) {
+                return;
+            }
+            for (i = len - 1; i >= 0; i--) {
+                sent_ms = (sent_ms << 8) | data[i];
+            }
+            if (now_ms - sent_ms > link->ping_rtt_max_ms) {
+                link->ping_rtt_max_ms = now_ms - sent_ms;
+            }
+            link->pings_answered++;
+            link->ping_answer_ms = now_ms;
+        }
+        break;
+        case FUN_CODE_NODE_SUMMARY:
+        case FUN_CODE_NODE_SUMMARY_V2: {
+            /* the coordinator only forwards changes, the summary refreshes nodes whose steady
+             * readings it held back, dated when the newest of them was taken */
+            int size = SUMMARY_RECORD_SIZE, skip = 0;
+            const uint8_t *rec;
+
+            if (fc == FUN_CODE_NODE_SUMMARY_V2) {
+                /* min/max/mean of older coordinators, ts_store has them from the readings */
+                size = (len % SUMMARY_RECORD_SIZE_V2 == 0) ? SUMMARY_RECORD_SIZE_V2 : SUMMARY_RECORD_SIZE_V1;
+                skip = SUMMARY_AGGREGATE_SIZE;
+            }
+            for (rec = data; rec + size <= data + len; rec += size) {
+                uint8_t missed = rec[6 + skip];
+                uint16_t held;
+                int16_t t, h;
+
+                if (missed > 0) {
+                    link->radio_missed += missed;
+                    STAGE_POINT(app_context.ingest_shard, STAGE_POINT_RADIO_LOSS);
+                    APP_TRACE_HOT("Node %d:%d: %d radio messages lost", link->index, rec[0], missed);
+                }
+                held = (size != SUMMARY_RECORD_SIZE_V1) ? (uint16_t)(rec[7 + skip] | rec[8 + skip] << 8)
+                                                        : SUMMARY_HELD_NONE;
+                if (held == SUMMARY_HELD_NONE) {
+                    continue;
+                }
+                /* records are in whole units, keep the tenths of the last reading when it still agrees */
+                node_reading.node_id = rec[0];
+                node_reading.temperature = (int8_t)rec[3] * 10;
+                node_reading.humidity = rec[4] * 10;
+                if (reading_filter_last(&link->filter, rec[0], &t, &h) == 0 &&
+                    (t + (t < 0 ? -5 : 5)) / 10 == (int8_t)rec[3] && (h + 5) / 10 == rec[4]) {
+                    node_reading.temperature = t;
+                    node_reading.humidity = h;
+                }
+                node_reading.age = held;
+                app_ingest_reading(link, &node_reading, app_time_ms());
+            }
+        }
+        break;
+        default:
+            break;
+    }
+}
+
 /* update system time */
 static unsigned long long app_uptime_sec(void)
 {
@@ -194,12 +1027,291 @@ static unsigned long long app_uptime_sec(void)
     return (HAL_UptimeMs() - start_time) / 1000;
 }
 
-/* Linkkit sample main routine */
-static int app_linkkit_sample(void) 
+/* stop flag shared by the ingestion and cloud threads */
+static int app_running(void)
+{
+    return __atomic_load_n(&app_context.running, __ATOMIC_ACQUIRE);
+}
+
+static void app_stop(void)
+{
+    __atomic_store_n(&app_context.running, 0, __ATOMIC_RELEASE);
+}
+
+/* log every coordinator PAN in as a sub-device of the gateway, a link whose
+ * sub-device can't be brought up keeps reporting through the gateway device */
+static void app_open_subdevices(void)
+{
+    iotx_linkkit_dev_meta_info_t meta;
+    int i, devid;
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        app_context.links[i].devid = app_context.device_id;
+    }
+    if (strlen(SUBDEV_PRODUCT_KEY) == 0) {
+        return;
+    }
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        memset(&meta, 0, sizeof(iotx_linkkit_dev_meta_info_t));
+        memcpy(meta.product_key, SUBDEV_PRODUCT_KEY, strlen(SUBDEV_PRODUCT_KEY));
+        memcpy(meta.product_secret, SUBDEV_PRODUCT_SECRET, strlen(SUBDEV_PRODUCT_SECRET));
+        snprintf(meta.device_name, sizeof(meta.device_name), "%s_pan%d", DEVICE_NAME, i);
+
+        devid = IOT_Linkkit_Open(IOTX_LINKKIT_DEV_TYPE_SLAVE, &meta);
+        if (devid < 0) {
+            APP_TRACE("Open sub-device %s Failed, link %d reports as the gateway", meta.device_name, i);
+            continue;
+        }
+        if (IOT_Linkkit_Connect(devid) < 0 || IOT_Linkkit_Report(devid, ITM_MSG_LOGIN, NULL, 0) < 0) {
+            APP_TRACE("Login sub-device %s Failed, link %d reports as the gateway", meta.device_name, i);
+            IOT_Linkkit_Close(devid);
+            continue;
+        }
+        app_context.links[i].devid = devid;
+        APP_TRACE("Sub-device %s logged in for link %d, Devid: %d", meta.device_name, i, devid);
+    }
+}
+
+static void app_close_subdevices(void)
+{
+    int i;
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        if (app_context.links[i].devid >= 0 && app_context.links[i].devid != app_context.device_id) {
+            IOT_Linkkit_Report(app_context.links[i].devid, ITM_MSG_LOGOUT, NULL, 0);
+            IOT_Linkkit_Close(app_context.links[i].devid);
+        }
+        app_context.links[i].devid = -1;
+    }
+}
+
+/* sub-device registry calls, all made from the cloud thread */
+static int app_subdev_open(void *ctx, uint8_t link, uint16_t node_id)
+{
+    iotx_linkkit_dev_meta_info_t meta;
+
+    memset(&meta, 0, sizeof(iotx_linkkit_dev_meta_info_t));
+    memcpy(meta.product_key, NODE_PRODUCT_KEY, strlen(NODE_PRODUCT_KEY));
+    memcpy(meta.product_secret, NODE_PRODUCT_SECRET, strlen(NODE_PRODUCT_SECRET));
+    snprintf(meta.device_name, sizeof(meta.device_name), "%s_%u_%u", DEVICE_NAME, link, node_id);
+
+    return IOT_Linkkit_Open(IOTX_LINKKIT_DEV_TYPE_SLAVE, &meta);
+}
+
+/* adds the device to the gateway topology and logs it in, initialized follows */
+static int app_subdev_login(void *ctx, int devid)
+{
+    if (IOT_Linkkit_Connect(devid) < 0 || IOT_Linkkit_Report(devid, ITM_MSG_LOGIN, NULL, 0) < 0) {
+        APP_TRACE("Login node sub-device %d Failed", devid);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void app_subdev_logout(void *ctx, int devid)
+{
+    IOT_Linkkit_Report(devid, ITM_MSG_LOGOUT, NULL, 0);
+}
+
+static void app_subdev_close(void *ctx, int devid)
+{
+    IOT_Linkkit_Close(devid);
+}
+
+static const subdev_ops_t app_subdev_ops = {
+    app_subdev_open, app_subdev_login, app_subdev_logout, app_subdev_close
+};
+
+/* connection manager calls, made from the cloud thread. The gateway device
+ * is opened and connected, then its PAN sub-devices; node sub-devices follow
+ * through the registry once the connection is reported up */
+static int app_cloud_connect(void *ctx)
+{
+    iotx_linkkit_dev_meta_info_t *device_meta_info = (iotx_linkkit_dev_meta_info_t *)ctx;
+
+    app_context.device_id = IOT_Linkkit_Open(IOTX_LINKKIT_DEV_TYPE_MASTER, device_meta_info);
+    if (app_context.device_id < 0) {
+        APP_TRACE("IOT_Linkkit_Open Failed");
+        return -1;
+    }
+
+    if (IOT_Linkkit_Connect(app_context.device_id) < 0) {
+        APP_TRACE("IOT_Linkkit_Connect Failed, retrying");
+        return -1;
+    }
+    APP_TRACE("IOT_Linkkit_Connect successfully");
+
+    app_open_subdevices();
+    return 0;
+}
+
+/* everything goes, the next connect opens it all again */
+static void app_cloud_close(void *ctx)
+{
+    if (app_context.device_id < 0) {
+        return;
+    }
+    if (app_context.conn.state == CLOUD_CONN_LOST) {
+        APP_TRACE("Cloud not back within %dms, reconnecting", CLOUD_CONN_GRACE_MS);
+    }
+    if (app_context.subdevs_ready) {
+        subdev_registry_close(&app_context.subdevs);
+    }
+    app_close_subdevices();
+    IOT_Linkkit_Close(app_context.device_id);
+    app_context.device_id = -1;
+    app_context.cloud_connected = 0;
+    app_context.device_initialized = 0;
+}
+
+static const cloud_conn_ops_t app_cloud_ops = {
+    app_cloud_connect, app_cloud_close
+};
+
+/* the broker to probe before each connect */
+static const char *app_cloud_host(char *buf, int size)
+{
+    if (!APP_CLOUD_PROBE) {
+        return NULL;
+    }
+    if (strlen(APP_CLOUD_HOST) > 0) {
+        return APP_CLOUD_HOST;
+    }
+    if (0 != memcmp(ENDPOINT, "NULL", 4)) {
+        return ENDPOINT;
+    }
+    snprintf(buf, size, "%s.%s", PRODUCT_KEY, MQTT_DOMAIN);
+    return buf;
+}
+
+/* Cloud thread: owns the linkkit connection, every sdk call is made from here */
+static void *app_cloud_thread(void *arg)
 {
-    int res;
     uint64_t now = 0;
     uint64_t prev_sec = 0;
+    uint64_t now_ms = 0;
+    app_reading_t reading;
+    char host[CLOUD_CONN_HOST_MAX];
+    int i;
+
+    /* the first connect is made by the first poll, a gateway that starts offline keeps trying */
+    app_context.device_id = -1;
+    cloud_conn_init(&app_context.conn, app_cloud_host(host, sizeof(host)), APP_CLOUD_PORT, &app_cloud_ops, arg,
+                    HAL_UptimeMs());
+
+    APP_TRACE("Linkkit enter loop");
+    while (app_running()) {
+        cloud_conn_poll(&app_context.conn, HAL_UptimeMs());
+        if (app_context.device_id >= 0) {
+            IOT_Linkkit_Yield(USER_EXAMPLE_YIELD_TIMEOUT_MS);
+        } else {
+            HAL_SleepMs(USER_EXAMPLE_YIELD_TIMEOUT_MS);
+        }
+
+        /* readings queued by the ingestion thread while we were yielding */
+        now_ms = HAL_UptimeMs();
+        while (spsc_ring_pop(&app_context.ring, &reading) == 0) {
+            app_dispatch_reading(&reading, now_ms);
+        }
+        for (i = 0; i < app_context.hub.count; i++) {
+            report_batch_poll(&app_context.links[i].batch, now_ms);
+        }
+        if (app_context.cloud_connected && app_context.subdevs_ready) {
+            subdev_registry_poll(&app_context.subdevs, now_ms);
+        }
+
+        if (app_context.cloud_connected && app_context.spool_ready && store_forward_pending(&app_context.spool)) {
+            app_replay_spool(now_ms);
+        }
+
+        now = app_uptime_sec();
+        if (prev_sec == now) {
+            continue;
+        }
+
+        if (app_context.spool_ready) {
+            store_forward_sync(&app_context.spool);
+        }
+
+        if (strlen(APP_METRICS_PATH) > 0 && now % APP_METRICS_DUMP_S == 0 &&
+            stage_metrics_dump(&app_context.metrics, APP_METRICS_PATH) < 0 && !app_context.metrics_dump_failed) {
+            APP_TRACE("Dump metrics to %s Failed", APP_METRICS_PATH);
+            app_context.metrics_dump_failed = 1;
+        }
+
+        app_post_rollups(app_time_ms());
+
+        /* post all properties every 5 second */
+        if (now % 5 == 0 && app_context.cloud_connected) {
+            app_post_all_property();
+        }
+
+        prev_sec = now;
+    }
+
+    while (spsc_ring_pop(&app_context.ring, &reading) == 0) {
+        app_dispatch_reading(&reading, HAL_UptimeMs());
+    }
+    for (i = 0; i < app_context.hub.count; i++) {
+        report_batch_flush(&app_context.links[i].batch);
+    }
+
+    /* close linkkit service */
+    cloud_conn_close(&app_context.conn);
+
+    return NULL;
+}
+
+/* Query thread: answers local clients from the node snapshot, apart from both other threads */
+static void *app_query_thread(void *arg)
+{
+    while (app_running()) {
+        if (query_server_poll(&app_context.query, SERIAL_POLL_TIMEOUT_MS) < 0) {
+            APP_TRACE("Query server poll fail");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* send a ping to every link that is up, the answer carries the time back */
+static void app_ping_links(uint64_t now_ms)
+{
+    uint8_t token[sizeof(now_ms)];
+    int i;
+
+    for (i = 0; i < (int)sizeof(token); i++) {
+        token[i] = (now_ms >> (8 * i)) & 0xFF;
+    }
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        app_link_t *link = &app_context.links[i];
+
+        if (now_ms - link->ping_answer_ms >= SERIAL_PING_INTERVAL_MS * SERIAL_PING_LOST_MAX &&
+            now_ms - link->ping_answer_ms < SERIAL_PING_INTERVAL_MS * (SERIAL_PING_LOST_MAX + 1)) {
+            APP_TRACE("Coordinator on link %d did not answer the last %d pings", i, SERIAL_PING_LOST_MAX);
+        }
+        if (serial_hub_send(&app_context.hub, i, FUN_CODE_PING, token, sizeof(token)) == 0) {
+            link->pings_sent++;
+        }
+    }
+}
+
+/* Linkkit sample main routine, the calling thread becomes the ingestion thread.
+ * One coordinator per tty in serial_devices, readings carry its position as their link */
+static int app_linkkit_sample(int device_count, char **serial_devices)
+{
+    uint64_t full_drops = 0;
+    uint64_t ping_ms;
+    int i;
+    pthread_t cloud_thread;
+    pthread_t query_thread;
+    int query_running = 0;
+    char err[128];
+    report_batch_config_t history_config;
     iotx_linkkit_dev_meta_info_t device_meta_info;
 
     /* init app data */
@@ -228,58 +1340,319 @@ static int app_linkkit_sample(void)
     int post_event_reply = 1;
     IOT_Ioctl(IOTX_IOCTL_RECV_EVENT_REPLY, (void *)&post_event_reply);
 
+    /* property post replies time the first publish after a reconnect */
+    int post_property_reply = 1;
+    IOT_Ioctl(IOTX_IOCTL_RECV_PROP_REPLY, (void *)&post_property_reply);
+
     /* Init device metadata, the device infomation is defined in makefile */
     memset(&device_meta_info, 0, sizeof(iotx_linkkit_dev_meta_info_t));    
     memcpy(device_meta_info.product_key, PRODUCT_KEY, strlen(PRODUCT_KEY));
     memcpy(device_meta_info.device_name, DEVICE_NAME, strlen(DEVICE_NAME));
     memcpy(device_meta_info.device_secret, DEVICE_SECRET, strlen(DEVICE_SECRET));
 
-    /* Create master device resource */
-    app_context.device_id = IOT_Linkkit_Open(IOTX_LINKKIT_DEV_TYPE_MASTER, &device_meta_info);
-    if (app_context.device_id < 0) {
-        APP_TRACE("IOT_Linkkit_Open Failed");
+    /* every thread that records has a shard of its own, the query thread only reads them */
+    stage_metrics_init(&app_context.metrics);
+    app_context.ingest_shard = stage_metrics_shard(&app_context.metrics, "ingest");
+    app_context.cloud_shard = stage_metrics_shard(&app_context.metrics, "cloud");
+
+    /* cloud requests are resolved through a perfect hash over the property schema */
+    if (prop_parser_init() < 0) {
+        APP_TRACE("Property parser init Failed");
         return -1;
     }
-    APP_TRACE("IOT_Linkkit_Open successfully");
 
-    /* Start Connect AliCloud Server */
-    res = IOT_Linkkit_Connect(app_context.device_id);
-    if (res < 0) {
-        APP_TRACE("IOT_Linkkit_Connect Failed");
+    /* node readings are coalesced per link and posted on size or deadline */
+    for (i = 0; i < SERIAL_HUB_LINKS; i++) {
+        app_context.links[i].index = i;
+        report_batch_init(&app_context.links[i].batch, NULL, app_post_node_batch, &app_context.links[i]);
+        app_context.links[i].batch.shard = app_context.cloud_shard;
+    }
+
+    /* readings produced while the cloud is unreachable wait on disk, a missing spool only loses them */
+    if (store_forward_open(&app_context.spool, NULL) < 0) {
+        APP_TRACE("Open spool %s Failed, readings are dropped while offline", STORE_FORWARD_DIR_DEFAULT);
+    } else {
+        app_context.spool_ready = 1;
+        if (app_context.spool.stats.discarded > 0) {
+            APP_TRACE("Spool: %llu segments of another version discarded",
+                      (unsigned long long)app_context.spool.stats.discarded);
+        }
+    }
+    history_config.max_bytes = REPORT_BATCH_BYTES_DEFAULT;
+    history_config.window_ms = 0;
+    history_config.history = 1;
+    report_batch_init(&app_context.history, &history_config, app_post_history_batch, NULL);
+    app_context.history.shard = app_context.cloud_shard;
+
+    /* alarms are decided here rather than in the cloud, a missing rules file just means none */
+    edge_rules_init(&app_context.rules, app_rule_handler, NULL);
+    if (edge_rules_load(&app_context.rules, NULL, err, sizeof(err)) < 0) {
+        APP_TRACE("No edge rules loaded, %s", err);
+    } else {
+        APP_TRACE("%d edge rules loaded from %s", app_context.rules.count, EDGE_RULES_PATH_DEFAULT);
+    }
+
+    /* nodes come online as sub-devices of their own as they are heard from */
+    if (strlen(NODE_PRODUCT_KEY) > 0) {
+        subdev_registry_init(&app_context.subdevs, &app_subdev_ops, NULL);
+        app_context.subdevs_ready = 1;
+    }
+
+    /* recent history of every node, rolled up for downsampled reporting */
+    if (ts_store_init(&app_context.ts) < 0) {
+        APP_TRACE("Time series store init Failed, only raw readings are reported");
+    } else {
+        app_context.ts_ready = 1;
+    }
+
+    /* readings cross from the ingestion thread to the cloud thread here */
+    if (spsc_ring_init(&app_context.ring, APP_READING_RING_SIZE, sizeof(app_reading_t)) < 0) {
+        APP_TRACE("Reading ring init Failed");
         return -1;
     }
-    APP_TRACE("IOT_Linkkit_Connect successfully");
 
-    APP_TRACE("Linkkit enter loop");
-    while (1) {
-        IOT_Linkkit_Yield(USER_EXAMPLE_YIELD_TIMEOUT_MS);
+    /* latest reading of every node for local readers, the gateway runs without it if shm is unavailable */
+    if (node_snapshot_create(&app_context.snapshot, NULL) < 0) {
+        APP_TRACE("Create node snapshot %s Failed, no local queries", NODE_SNAPSHOT_NAME_DEFAULT);
+    } else {
+        app_context.snapshot_ready = 1;
+    }
 
-        now = app_uptime_sec();
-        if (prev_sec == now) {
-            continue;
+    /* Open the coordinator uarts, frames of all of them are decoded on this thread.
+     * A tty that isn't there yet is retried, only a hub without links is fatal */
+    if (serial_hub_init(&app_context.hub) < 0) {
+        APP_TRACE("Serial hub init Failed");
+        device_count = 0;
+    }
+    app_context.hub.shard = app_context.ingest_shard;
+    for (i = 0; i < device_count && i < SERIAL_HUB_LINKS; i++) {
+        app_link_t *link = &app_context.links[i];
+
+        /* duplicates and stale samples are dropped before they reach the ring */
+        reading_filter_init(&link->filter);
+        serial_hub_add(&app_context.hub, serial_devices[i], SERIAL_BRIDGE_BAUD, app_serial_frame_handler, link,
+                       app_time_ms());
+        APP_TRACE("Open serial device %s as link %d %s", serial_devices[i], i,
+                  app_context.hub.links[i].up ? "successfully" : "Failed, retrying");
+    }
+    if (app_context.hub.count == 0) {
+        APP_TRACE("No coordinator link");
+        serial_hub_close(&app_context.hub);
+        if (app_context.spool_ready) {
+            store_forward_close(&app_context.spool);
         }
+        spsc_ring_deinit(&app_context.ring);
+        ts_store_deinit(&app_context.ts);
+        node_snapshot_close(&app_context.snapshot);
+        return -1;
+    }
 
-        /* post all properties every 5 second */
-        if (now % 5 == 0) {
-            app_post_all_property();
+    app_uptime_sec();
+    app_context.running = 1;
+    if (pthread_create(&cloud_thread, NULL, app_cloud_thread, &device_meta_info) != 0) {
+        APP_TRACE("Cloud thread create Failed");
+        if (app_context.spool_ready) {
+            store_forward_close(&app_context.spool);
+        }
+        serial_hub_close(&app_context.hub);
+        spsc_ring_deinit(&app_context.ring);
+        ts_store_deinit(&app_context.ts);
+        node_snapshot_close(&app_context.snapshot);
+        return -1;
+    }
+
+    if (app_context.snapshot_ready) {
+        if (query_server_open(&app_context.query, NULL, &app_context.snapshot) < 0) {
+            APP_TRACE("Open query socket %s Failed", QUERY_SERVER_PATH_DEFAULT);
+        } else {
+            app_context.query.metrics = &app_context.metrics;
+            if (pthread_create(&query_thread, NULL, app_query_thread, NULL) != 0) {
+                APP_TRACE("Query thread create Failed");
+                query_server_close(&app_context.query);
+            } else {
+                query_running = 1;
+            }
+        }
+    }
+
+    ping_ms = app_time_ms();
+    for (i = 0; i < app_context.hub.count; i++) {
+        app_context.links[i].ping_answer_ms = ping_ms;
+    }
+
+    APP_TRACE("Ingestion enter loop");
+    while (app_running()) {
+        uint64_t now_ms;
+
+        /* drain the coordinator uarts, every complete frame is queued to the cloud thread */
+        if (serial_hub_poll(&app_context.hub, SERIAL_POLL_TIMEOUT_MS, app_time_ms()) < 0) {
+            APP_TRACE("Serial hub poll fail");
+        }
+
+        /* don't wait for a coordinator's next summary period to learn its nodes, also after it came back */
+        for (i = 0; i < app_context.hub.count; i++) {
+            if (app_context.hub.links[i].opened) {
+                app_context.hub.links[i].opened = 0;
+                if (serial_hub_send(&app_context.hub, i, FUN_CODE_QUERY_NODES, NULL, 0) < 0) {
+                    APP_TRACE("Query node table of link %d fail", i);
+                }
+            }
+        }
+
+        /* the coordinator only talks when nodes do, ping it to tell a quiet network from a dead link */
+        now_ms = app_time_ms();
+        if (now_ms - ping_ms >= SERIAL_PING_INTERVAL_MS) {
+            app_ping_links(now_ms);
+            ping_ms = now_ms;
+        }
+
+        /* report backpressure when the cloud thread can't keep up */
+        if (app_context.ring.full_drops != full_drops) {
+            APP_TRACE("Reading ring full, %llu readings dropped so far",
+                      (unsigned long long)app_context.ring.full_drops);
+            full_drops = app_context.ring.full_drops;
         }
 
         /* after all, this is an sample, give a chance to return... */
         /* modify this value for this sample executaion time period */
-        if (now > 60 * SAMPLE_EXECUTION_TIME) {
+        if (app_uptime_sec() > 60 * SAMPLE_EXECUTION_TIME) {
             APP_TRACE("sample run timeout, break form loop");
             break;
         }
-        
-        prev_sec = now;
     }
-    
-    /* close linkkit service */
-    IOT_Linkkit_Close(app_context.device_id);
+
+    app_stop();
+    pthread_join(cloud_thread, NULL);
+    if (query_running) {
+        pthread_join(query_thread, NULL);
+    }
+
+    for (i = 0; i < app_context.hub.count; i++) {
+        app_link_t *link = &app_context.links[i];
+        serial_link_t *serial = &app_context.hub.links[i];
+
+        APP_TRACE("Link %d %s: opened %llu times, dropped %llu times", i, serial->path,
+                  (unsigned long long)serial->opens, (unsigned long long)serial->drops);
+        APP_TRACE("Link %d serial frames: %llu, checksum errors: %llu, crc errors: %llu, framing errors: %llu", i,
+                  (unsigned long long)serial->bridge.decoder.frames,
+                  (unsigned long long)serial->bridge.decoder.checksum_errors,
+                  (unsigned long long)serial->bridge.decoder.crc_errors,
+                  (unsigned long long)serial->bridge.decoder.framing_errors);
+        APP_TRACE("Link %d readings accepted: %llu, duplicates: %llu, stale: %llu, invalid: %llu, node restarts: %llu",
+                  i, (unsigned long long)link->filter.stats.accepted,
+                  (unsigned long long)link->filter.stats.duplicates,
+                  (unsigned long long)link->filter.stats.stale,
+                  (unsigned long long)link->filter.stats.invalid,
+                  (unsigned long long)link->filter.stats.restarts);
+        APP_TRACE("Link %d radio messages lost: %llu", i, (unsigned long long)link->radio_missed);
+        APP_TRACE("Link %d coordinator pings sent: %llu, answered: %llu, max round trip: %llums", i,
+                  (unsigned long long)link->pings_sent, (unsigned long long)link->pings_answered,
+                  (unsigned long long)link->ping_rtt_max_ms);
+        APP_TRACE("Link %d node batches: %llu, readings: %llu, coalesced: %llu, unsent: %llu", i,
+                  (unsigned long long)link->batch.stats.batches,
+                  (unsigned long long)link->batch.stats.readings,
+                  (unsigned long long)link->batch.stats.coalesced,
+                  (unsigned long long)link->batch.stats.unsent);
+    }
+    APP_TRACE("Reading ring pushed: %llu, full drops: %llu, high watermark: %u",
+              (unsigned long long)app_context.ring.pushed,
+              (unsigned long long)app_context.ring.full_drops,
+              app_context.ring.high_watermark);
+    APP_TRACE("Spool appended: %llu, replayed: %llu, evicted: %llu, dropped: %llu",
+              (unsigned long long)app_context.spool.stats.appended,
+              (unsigned long long)app_context.spool.stats.replayed,
+              (unsigned long long)app_context.spool.stats.evicted,
+              (unsigned long long)app_context.spool_drops);
+    APP_TRACE("Query connections: %llu, rejected: %llu, requests: %llu, errors: %llu, untracked nodes: %llu",
+              (unsigned long long)app_context.query.stats.connections,
+              (unsigned long long)app_context.query.stats.rejected,
+              (unsigned long long)app_context.query.stats.requests,
+              (unsigned long long)app_context.query.stats.errors,
+              (unsigned long long)app_context.snapshot.untracked);
+    APP_TRACE("Edge rules: %d, readings evaluated: %llu, raised: %llu, cleared: %llu, alarms unsent: %llu",
+              app_context.rules.count,
+              (unsigned long long)app_context.rules.stats.evaluated,
+              (unsigned long long)app_context.rules.stats.raised,
+              (unsigned long long)app_context.rules.stats.cleared,
+              (unsigned long long)app_context.alarms_unsent);
+    APP_TRACE("Node sub-devices: %d, logins: %llu, answered: %llu, failures: %llu, idle logouts: %llu, "
+              "slowest login: %llums, untracked: %llu",
+              app_context.subdevs.count,
+              (unsigned long long)app_context.subdevs.stats.logins,
+              (unsigned long long)app_context.subdevs.stats.online,
+              (unsigned long long)app_context.subdevs.stats.failures,
+              (unsigned long long)app_context.subdevs.stats.logouts,
+              (unsigned long long)app_context.subdevs.stats.login_ms_max,
+              (unsigned long long)app_context.subdevs.stats.untracked);
+    APP_TRACE("Cloud attempts: %llu, unreachable: %llu, dns failures: %llu, connect failures: %llu, drops: %llu, "
+              "sdk reconnects: %llu, taken over: %llu",
+              (unsigned long long)app_context.conn.stats.attempts,
+              (unsigned long long)app_context.conn.stats.probe_failures,
+              (unsigned long long)app_context.conn.stats.dns_failures,
+              (unsigned long long)app_context.conn.stats.connect_failures,
+              (unsigned long long)app_context.conn.stats.drops,
+              (unsigned long long)app_context.conn.stats.sdk_recoveries,
+              (unsigned long long)app_context.conn.stats.takeovers);
+    APP_TRACE("Cloud time to first publish: %llu times, last: %llums, average: %llums, max: %llums",
+              (unsigned long long)app_context.conn.stats.ttfp_count,
+              (unsigned long long)app_context.conn.stats.ttfp_last_ms,
+              (unsigned long long)(app_context.conn.stats.ttfp_count ?
+                                   app_context.conn.stats.ttfp_total_ms / app_context.conn.stats.ttfp_count : 0),
+              (unsigned long long)app_context.conn.stats.ttfp_max_ms);
+    APP_TRACE("Time series added: %llu, late: %llu, expired: %llu, untracked: %llu, folds: %llu, rollups posted: %llu",
+              (unsigned long long)app_context.ts.stats.added,
+              (unsigned long long)app_context.ts.stats.late,
+              (unsigned long long)app_context.ts.stats.expired,
+              (unsigned long long)app_context.ts.stats.untracked,
+              (unsigned long long)app_context.ts.stats.folds,
+              (unsigned long long)app_context.rollups_posted);
+
+    if (app_context.spool_ready) {
+        store_forward_close(&app_context.spool);
+    }
+    serial_hub_close(&app_context.hub);
+    spsc_ring_deinit(&app_context.ring);
+    ts_store_deinit(&app_context.ts);
+    if (query_running) {
+        query_server_close(&app_context.query);
+    }
+    node_snapshot_close(&app_context.snapshot);
 
     return 0;
 }
 
+static void app_log_out(const char *line, int len, void *ctx)
+{
+    HAL_Printf("%.*s\r\n", len, line);
+}
+
+static void app_log_open(void)
+{
+    bin_log_init(&app_log, app_log_out, NULL);
+#if APP_LOG_ASYNC
+    if (bin_log_start(&app_log, APP_LOG_PATH, APP_LOG_FILE_MAX, APP_LOG_FILES) < 0) {
+        APP_TRACE("Log writer start Failed, tracing synchronously");
+    }
+#endif
+}
+
+/* the stats are the writer's, read once it is stopped */
+static void app_log_close(void)
+{
+#if APP_LOG_ASYNC
+    bin_log_stop(&app_log);
+    APP_TRACE("Log records: %llu, dropped: %llu, printed: %llu, suppressed: %llu, file bytes: %llu, "
+              "rotations: %llu, file errors: %llu",
+              (unsigned long long)app_log.stats.records,
+              (unsigned long long)app_log.stats.dropped,
+              (unsigned long long)app_log.stats.lines,
+              (unsigned long long)app_log.stats.suppressed,
+              (unsigned long long)app_log.stats.bytes,
+              (unsigned long long)app_log.stats.rotations,
+              (unsigned long long)app_log.stats.file_errors);
+#endif
+}
+
 static void app_print_banner(void)
 {
     HAL_Printf("\n");
@@ -290,13 +1663,21 @@ static void app_print_banner(void)
 int main(int argc, char **argv)
 {
     app_print_banner();
+    app_log_open();
     IOT_SetLogLevel(IOT_LOG_ERROR);
     APP_TRACE("sample start!\n");
 
-    app_linkkit_sample();
+    if (argc > 1) {
+        app_linkkit_sample(argc - 1, argv + 1);
+    } else {
+        char *serial_device = SERIAL_DEVICE_DEFAULT;
+
+        app_linkkit_sample(1, &serial_device);
+    }
     IOT_SetLogLevel(IOT_LOG_NONE);
 
     APP_TRACE("sample end!\n");
+    app_log_close();
 
     return 0;
 }
@@ -0,0 +1,276 @@
+/*
+ * Coordinator UART bridge
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "serial_bridge.h"
+
+static uint8_t frame_checksum(const uint8_t *data, int len)
+{
+    uint8_t sum = 0;
+
+    while (len-- > 0) {
+        sum += *data++;
+    }
+
+    return sum;
+}
+
+/* drop one byte and look for the next plausible frame start */
+static void frame_decoder_resync(frame_decoder_t *dec)
+{
+    dec->head++;
+    dec->skipped_bytes++;
+}
+
+static void frame_decoder_run(frame_decoder_t *dec)
+{
+    while (dec->tail - dec->head >= FRAME_HEAD_SIZE + FRAME_TAIL_SIZE) {
+        const uint8_t *p = dec->buf + dec->head;
+        int len = p[0];
+
+        /* no legacy frame is long enough to start with the sync byte */
+        if (p[0] == UPLINK_SYNC) {
+            uplink_frame_t frame;
+            int size = uplink_frame_parse(p, dec->tail - dec->head, &frame);
+
+            if (size == 0) {
+                break;
+            }
+            if (size < 0) {
+                if (size == UPLINK_ERR_CRC) {
+                    dec->crc_errors++;
+                } else {
+                    dec->framing_errors++;
+                }
+                frame_decoder_resync(dec);
+                continue;
+            }
+
+            dec->frames++;
+            dec->head += size;
+            if (dec->handler != NULL) {
+                dec->handler(dec->ctx, frame.fc, frame.payload, frame.len);
+            }
+            continue;
+        }
+
+        if (len < FRAME_HEAD_SIZE || len > FRAME_HEAD_SIZE + FRAME_DATA_MAX) {
+            dec->framing_errors++;
+            frame_decoder_resync(dec);
+            continue;
+        }
+
+        if (dec->tail - dec->head < len + FRAME_TAIL_SIZE) {
+            break;
+        }
+
+        if (p[len] != FRAME_TAIL_0 || p[len + 1] != FRAME_TAIL_1) {
+            dec->framing_errors++;
+            frame_decoder_resync(dec);
+            continue;
+        }
+
+        if (frame_checksum(p + 2, len - 2) != p[1]) {
+            dec->checksum_errors++;
+            frame_decoder_resync(dec);
+            continue;
+        }
+
+        dec->frames++;
+        dec->head += len + FRAME_TAIL_SIZE;
+        if (dec->handler != NULL) {
+            dec->handler(dec->ctx, p[2], p + FRAME_HEAD_SIZE, len - FRAME_HEAD_SIZE);
+        }
+    }
+
+    if (dec->head == dec->tail) {
+        dec->head = dec->tail = 0;
+    }
+}
+
+/* move the undecoded bytes to the front so reads always have room */
+static void frame_decoder_compact(frame_decoder_t *dec)
+{
+    if (dec->head == 0) {
+        return;
+    }
+
+    memmove(dec->buf, dec->buf + dec->head, dec->tail - dec->head);
+    dec->tail -= dec->head;
+    dec->head = 0;
+}
+
+void frame_decoder_init(frame_decoder_t *dec, frame_handler_t handler, void *ctx)
+{
+    memset(dec, 0, sizeof(frame_decoder_t));
+    dec->handler = handler;
+    dec->ctx = ctx;
+}
+
+void frame_decoder_feed(frame_decoder_t *dec, const uint8_t *data, int len)
+{
+    while (len > 0) {
+        int n;
+
+        frame_decoder_compact(dec);
+        n = sizeof(dec->buf) - dec->tail;
+        if (n > len) {
+            n = len;
+        }
+
+        memcpy(dec->buf + dec->tail, data, n);
+        dec->tail += n;
+        dec->bytes += n;
+        data += n;
+        len -= n;
+
+        frame_decoder_run(dec);
+    }
+}
+
+static speed_t serial_baud_to_speed(int baud)
+{
+    switch (baud) {
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 230400:
+            return B230400;
+        case 115200:
+        default:
+            return B115200;
+    }
+}
+
+int serial_bridge_open(serial_bridge_t *bridge, const char *path, int baud, frame_handler_t handler, void *ctx)
+{
+    frame_decoder_init(&bridge->decoder, handler, ctx);
+    bridge->fd = -1;
+
+    return serial_bridge_reopen(bridge, path, baud);
+}
+
+int serial_bridge_reopen(serial_bridge_t *bridge, const char *path, int baud)
+{
+    struct termios tio;
+
+    serial_bridge_close(bridge);
+
+    /* a partial frame from the old tty would only resync against the new one */
+    bridge->decoder.head = 0;
+    bridge->decoder.tail = 0;
+
+    bridge->fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (bridge->fd < 0) {
+        return -1;
+    }
+
+    if (tcgetattr(bridge->fd, &tio) < 0) {
+        close(bridge->fd);
+        bridge->fd = -1;
+        return -1;
+    }
+
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, serial_baud_to_speed(baud));
+    cfsetospeed(&tio, serial_baud_to_speed(baud));
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+
+    if (tcsetattr(bridge->fd, TCSANOW, &tio) < 0) {
+        close(bridge->fd);
+        bridge->fd = -1;
+        return -1;
+    }
+
+    tcflush(bridge->fd, TCIFLUSH);
+    return 0;
+}
+
+int serial_bridge_poll(serial_bridge_t *bridge)
+{
+    frame_decoder_t *dec = &bridge->decoder;
+    int total = 0;
+
+    while (1) {
+        ssize_t n;
+
+        frame_decoder_compact(dec);
+        n = read(bridge->fd, dec->buf + dec->tail, sizeof(dec->buf) - dec->tail);
+        if (n > 0) {
+            dec->tail += n;
+            dec->bytes += n;
+            total += n;
+            frame_decoder_run(dec);
+            continue;
+        }
+
+        if (n == 0 || errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        return -1;
+    }
+
+    return total;
+}
+
+int serial_bridge_send(serial_bridge_t *bridge, uint8_t fc, const uint8_t *data, int len)
+{
+    uint8_t frame[FRAME_SIZE_MAX];
+    int size = FRAME_HEAD_SIZE + len + FRAME_TAIL_SIZE;
+    int sent = 0;
+
+    if (len < 0 || len > FRAME_DATA_MAX) {
+        bridge->tx_errors++;
+        return -1;
+    }
+
+    frame[0] = FRAME_HEAD_SIZE + len;
+    frame[2] = fc;
+    if (len > 0) {
+        memcpy(frame + FRAME_HEAD_SIZE, data, len);
+    }
+    frame[1] = frame_checksum(frame + 2, len + 1);
+    frame[FRAME_HEAD_SIZE + len] = FRAME_TAIL_0;
+    frame[FRAME_HEAD_SIZE + len + 1] = FRAME_TAIL_1;
+
+    /* frames are tiny, a full tty buffer means the coordinator is gone */
+    while (sent < size) {
+        ssize_t n = write(bridge->fd, frame + sent, size - sent);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            bridge->tx_errors++;
+            return -1;
+        }
+        sent += n;
+    }
+
+    bridge->tx_frames++;
+    return 0;
+}
+
+void serial_bridge_close(serial_bridge_t *bridge)
+{
+    if (bridge->fd >= 0) {
+        close(bridge->fd);
+        bridge->fd = -1;
+    }
+}
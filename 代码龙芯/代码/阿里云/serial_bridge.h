@@ -0,0 +1,131 @@
+/*
+ * Coordinator UART bridge: streaming decoder for the frames packed by
+ * packDataAndSend() in cc2530.c, plus a nonblocking tty reader feeding it.
+ * Both the legacy frame below and the crc protected uplink frame of
+ * ../uplink.h are accepted on the same stream.
+ */
+#ifndef _SERIAL_BRIDGE_H_
+#define _SERIAL_BRIDGE_H_
+
+#include <stdint.h>
+
+#include "uplink.h"
+
+/* frame layout: len, checksum, fc, data..., '$', '@'
+ * len counts len/checksum/fc plus data, checksum is the 8 bit sum of fc and data */
+#define FRAME_HEAD_SIZE             3
+#define FRAME_TAIL_SIZE             2
+#define FRAME_TAIL_0                '$'
+#define FRAME_TAIL_1                '@'
+
+/* SAMPLE_APP_TX_MAX on the coordinator */
+#define FRAME_DATA_MAX              80
+#define FRAME_SIZE_MAX              (FRAME_HEAD_SIZE + FRAME_DATA_MAX + FRAME_TAIL_SIZE)
+
+/* function codes, keep in sync with SampleApp.h on the coordinator */
+#define FUN_CODE_UPDATA_DATA        0x01
+
+/* periodic node table summary, SUMMARY_RECORD_SIZE byte records:
+ * id, short address (16 bit le), temperature, humidity, readings in the
+ * window (0 if the node was silent), radio messages the coordinator missed
+ * from the node in the window after retransmissions, age of the newest
+ * reading it held back unchanged in the window (16 bit le,
+ * UPLINK_AGE_UNIT_MS, SUMMARY_HELD_NONE if none). Whole units rounded half
+ * away from zero, the temperature is signed. Older coordinators send
+ * FUN_CODE_NODE_SUMMARY_V2 with SUMMARY_AGGREGATE_SIZE bytes of min/max/mean
+ * after the humidity, in records of SUMMARY_RECORD_SIZE_V2, or of
+ * SUMMARY_RECORD_SIZE_V1 without the age. The gateway rolls those up itself */
+#define FUN_CODE_NODE_SUMMARY       0x05
+#define FUN_CODE_NODE_SUMMARY_V2    0x02
+#define SUMMARY_RECORD_SIZE         9
+#define SUMMARY_RECORD_SIZE_V2      17
+#define SUMMARY_RECORD_SIZE_V1      15
+#define SUMMARY_AGGREGATE_SIZE      8
+#define SUMMARY_HELD_NONE           0xFFFF
+
+/* packed readings, UPLINK_FC_SAMPLES and the older UPLINK_FC_READINGS, only sent in uplink frames */
+
+/* node commands start with a 16 bit le target: 0 for all nodes (broadcast),
+ * NODE_TARGET_GROUP | group for a group (group-cast), otherwise a node id
+ * (unicast if the coordinator knows the node) */
+#define NODE_TARGET_GROUP           0x8000
+
+/* gateway -> coordinator: target, interval in seconds (16 bit le) */
+#define FUN_CODE_SET_INTERVAL       0x10
+
+/* gateway -> coordinator: target, temperature and humidity dead-band in tenths
+ * (0xFF keeps the node's value), heartbeat in seconds (16 bit le, 0 keeps it) */
+#define FUN_CODE_SET_REPORT         0x11
+#define REPORT_DEADBAND_KEEP        0xFF
+
+/* gateway -> coordinator: target, NODE_CONFIG_* mask, then only the fields in
+ * the mask, in bit order: interval in seconds (16 bit le), temperature and
+ * humidity dead-band in tenths, heartbeat in seconds (16 bit le). Replaces the
+ * two commands above, one radio message per request whatever it changes */
+#define FUN_CODE_NODE_CONFIG        0x12
+#define NODE_CONFIG_INTERVAL        0x01
+#define NODE_CONFIG_DEADBAND_T      0x02
+#define NODE_CONFIG_DEADBAND_H      0x04
+#define NODE_CONFIG_HEARTBEAT       0x08
+#define NODE_CONFIG_SIZE_MAX        9
+
+/* gateway -> coordinator, no data: send the node summary now rather than at
+ * the end of the coordinator's period */
+#define FUN_CODE_QUERY_NODES        0x13
+
+/* gateway -> coordinator and back: up to PING_DATA_MAX bytes of data the
+ * coordinator echoes in a frame with the same function code */
+#define FUN_CODE_PING               0x14
+#define PING_DATA_MAX               9
+
+/* coordinator UART speed, 115200 for coordinators built without SAMPLE_APP_UART_230400 */
+#ifndef SERIAL_BRIDGE_BAUD
+#define SERIAL_BRIDGE_BAUD          230400
+#endif
+
+/* bytes buffered between tty reads, must hold at least one max size frame */
+#define SERIAL_BRIDGE_BUF_SIZE      4096
+
+typedef void (*frame_handler_t)(void *ctx, uint8_t fc, const uint8_t *data, int len);
+
+typedef struct _frame_decoder {
+    uint8_t         buf[SERIAL_BRIDGE_BUF_SIZE];
+    int             head;               /* first byte not decoded yet */
+    int             tail;               /* one past the last buffered byte */
+    frame_handler_t handler;
+    void           *ctx;
+
+    uint64_t        bytes;
+    uint64_t        frames;
+    uint64_t        checksum_errors;
+    uint64_t        crc_errors;
+    uint64_t        framing_errors;
+    uint64_t        skipped_bytes;      /* bytes dropped while resyncing */
+} frame_decoder_t;
+
+typedef struct _serial_bridge {
+    int             fd;
+    frame_decoder_t decoder;            /* reader side */
+    uint64_t        tx_frames;          /* writer side */
+    uint64_t        tx_errors;
+} serial_bridge_t;
+
+void frame_decoder_init(frame_decoder_t *dec, frame_handler_t handler, void *ctx);
+void frame_decoder_feed(frame_decoder_t *dec, const uint8_t *data, int len);
+
+/* open the coordinator tty (or a pty slave) raw and nonblocking */
+int  serial_bridge_open(serial_bridge_t *bridge, const char *path, int baud, frame_handler_t handler, void *ctx);
+
+/* open the tty again after it went away, the decoder and its counters are kept */
+int  serial_bridge_reopen(serial_bridge_t *bridge, const char *path, int baud);
+
+/* drain everything the tty has buffered, returns bytes read or -1 on error */
+int  serial_bridge_poll(serial_bridge_t *bridge);
+
+/* frame and write one downlink command, -1 if the tty didn't take all of it.
+ * Reads and writes may come from different threads. */
+int  serial_bridge_send(serial_bridge_t *bridge, uint8_t fc, const uint8_t *data, int len);
+
+void serial_bridge_close(serial_bridge_t *bridge);
+
+#endif /* _SERIAL_BRIDGE_H_ */
@@ -0,0 +1,153 @@
+/*
+ * Several coordinator links served from one epoll loop
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "serial_hub.h"
+
+static int serial_hub_open_link(serial_hub_t *hub, int i, uint64_t now_ms)
+{
+    serial_link_t *link = &hub->links[i];
+    struct epoll_event ev;
+
+    pthread_mutex_lock(&hub->lock);
+    if (serial_bridge_reopen(&link->bridge, link->path, link->baud) < 0) {
+        pthread_mutex_unlock(&hub->lock);
+        link->down_ms = now_ms;
+        return -1;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u32 = i;
+    if (epoll_ctl(hub->epfd, EPOLL_CTL_ADD, link->bridge.fd, &ev) < 0) {
+        serial_bridge_close(&link->bridge);
+        pthread_mutex_unlock(&hub->lock);
+        link->down_ms = now_ms;
+        return -1;
+    }
+
+    link->up = 1;
+    pthread_mutex_unlock(&hub->lock);
+    link->opened = 1;
+    link->opens++;
+    return 0;
+}
+
+static void serial_hub_drop_link(serial_hub_t *hub, int i, uint64_t now_ms)
+{
+    serial_link_t *link = &hub->links[i];
+
+    pthread_mutex_lock(&hub->lock);
+    epoll_ctl(hub->epfd, EPOLL_CTL_DEL, link->bridge.fd, NULL);
+    serial_bridge_close(&link->bridge);
+    link->up = 0;
+    pthread_mutex_unlock(&hub->lock);
+    link->down_ms = now_ms;
+    link->drops++;
+}
+
+int serial_hub_init(serial_hub_t *hub)
+{
+    memset(hub, 0, sizeof(serial_hub_t));
+    pthread_mutex_init(&hub->lock, NULL);
+
+    hub->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return (hub->epfd < 0) ? -1 : 0;
+}
+
+void serial_hub_close(serial_hub_t *hub)
+{
+    int i;
+
+    pthread_mutex_lock(&hub->lock);
+    for (i = 0; i < hub->count; i++) {
+        serial_bridge_close(&hub->links[i].bridge);
+        hub->links[i].up = 0;
+    }
+    pthread_mutex_unlock(&hub->lock);
+    if (hub->epfd >= 0) {
+        close(hub->epfd);
+        hub->epfd = -1;
+    }
+    pthread_mutex_destroy(&hub->lock);
+}
+
+int serial_hub_add(serial_hub_t *hub, const char *path, int baud, frame_handler_t handler, void *ctx,
+                   uint64_t now_ms)
+{
+    serial_link_t *link;
+    int i = hub->count;
+
+    if (i == SERIAL_HUB_LINKS || strlen(path) >= SERIAL_HUB_PATH_MAX) {
+        return -1;
+    }
+    link = &hub->links[i];
+
+    memset(link, 0, sizeof(serial_link_t));
+    frame_decoder_init(&link->bridge.decoder, handler, ctx);
+    link->bridge.fd = -1;
+    memcpy(link->path, path, strlen(path) + 1);
+    link->baud = baud;
+    hub->count++;
+
+    serial_hub_open_link(hub, i, now_ms);
+    return i;
+}
+
+int serial_hub_poll(serial_hub_t *hub, int timeout_ms, uint64_t now_ms)
+{
+    struct epoll_event events[SERIAL_HUB_LINKS];
+    int i, n;
+
+    n = epoll_wait(hub->epfd, events, SERIAL_HUB_LINKS, timeout_ms);
+    if (n < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        int k = events[i].data.u32;
+        uint64_t frames = hub->links[k].bridge.decoder.frames;
+        int res;
+
+        STAGE_BEGIN(t);
+        res = serial_bridge_poll(&hub->links[k].bridge);
+        STAGE_END(hub->shard, STAGE_DECODE, t, (uint32_t)(hub->links[k].bridge.decoder.frames - frames));
+
+        /* a hangup still gets its buffered bytes read first, the read then fails */
+        if (res < 0 || (events[i].events & (EPOLLHUP | EPOLLERR))) {
+            serial_hub_drop_link(hub, k, now_ms);
+        }
+    }
+
+    for (i = 0; i < hub->count; i++) {
+        serial_link_t *link = &hub->links[i];
+
+        if (!link->up && now_ms - link->down_ms >= SERIAL_HUB_REOPEN_MS) {
+            serial_hub_open_link(hub, i, now_ms);
+        }
+    }
+
+    return n;
+}
+
+int serial_hub_send(serial_hub_t *hub, int link, uint8_t fc, const uint8_t *data, int len)
+{
+    int ret = -1;
+
+    if (link < 0 || link >= hub->count) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&hub->lock);
+    if (hub->links[link].up) {
+        ret = serial_bridge_send(&hub->links[link].bridge, fc, data, len);
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    return ret;
+}
@@ -0,0 +1,65 @@
+/*
+ * Several coordinator links served from one epoll loop.
+ *
+ * Every link is a serial_bridge with its own frame decoder, so frames of
+ * different PANs never mix however their bytes interleave. The loop only
+ * touches links that have input. A link whose tty goes away (a coordinator
+ * unplugged, a simulator restarted) is taken out of the loop and reopened
+ * every SERIAL_HUB_REOPEN_MS without holding up the others.
+ *
+ * Only the thread running serial_hub_poll opens and drops links; sends may
+ * come from any thread, the hub lock keeps them off a tty being swapped.
+ */
+#ifndef _SERIAL_HUB_H_
+#define _SERIAL_HUB_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "serial_bridge.h"
+#include "stage_metrics.h"
+
+/* coordinators one gateway fronts */
+#ifndef SERIAL_HUB_LINKS
+#define SERIAL_HUB_LINKS            8
+#endif
+
+#define SERIAL_HUB_REOPEN_MS        5000
+
+#define SERIAL_HUB_PATH_MAX         128
+
+typedef struct _serial_link {
+    serial_bridge_t bridge;
+    char            path[SERIAL_HUB_PATH_MAX];
+    int             baud;
+    uint8_t         up;
+    uint8_t         opened;             /* set on every successful open, cleared by the owner */
+    uint64_t        down_ms;            /* when the link last went down or failed to open */
+    uint64_t        opens;
+    uint64_t        drops;              /* times the tty went away */
+} serial_link_t;
+
+typedef struct _serial_hub {
+    int             epfd;
+    pthread_mutex_t lock;               /* held while a link fd is opened, closed or written */
+    serial_link_t   links[SERIAL_HUB_LINKS];
+    int             count;
+    stage_shard_t  *shard;              /* decode times of the polling thread, NULL for none */
+} serial_hub_t;
+
+int  serial_hub_init(serial_hub_t *hub);
+void serial_hub_close(serial_hub_t *hub);
+
+/* add a coordinator tty, frames go to handler with ctx. The link number, or -1
+ * if the hub is full. A tty that doesn't open yet is retried from the poll */
+int  serial_hub_add(serial_hub_t *hub, const char *path, int baud, frame_handler_t handler, void *ctx,
+                    uint64_t now_ms);
+
+/* wait up to timeout_ms for input on any link and decode it, then reopen links that are due.
+ * Number of links that had input, or -1 if epoll itself failed */
+int  serial_hub_poll(serial_hub_t *hub, int timeout_ms, uint64_t now_ms);
+
+/* downlink command to one link, -1 if it is down or the tty didn't take the frame */
+int  serial_hub_send(serial_hub_t *hub, int link, uint8_t fc, const uint8_t *data, int len);
+
+#endif /* _SERIAL_HUB_H_ */
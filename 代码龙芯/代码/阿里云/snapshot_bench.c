@@ -0,0 +1,197 @@
+/*
+ * Micro benchmark: node snapshot readers against a writer that never stops.
+ * Reports lookups/s through a second mapping of the segment, as another
+ * process would see it, checks that no read is torn, and measures GET round
+ * trips through the query socket. Builds without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "node_snapshot.h"
+#include "query_server.h"
+
+#define BENCH_NODES             1000
+#define BENCH_SECONDS           1.0
+#define BENCH_SHM               "/zigbee_nodes_bench"
+#define BENCH_SOCKET            "/tmp/zigbee_nodes_bench.sock"
+
+static node_snapshot_t bench_writer;
+static query_server_t bench_server;
+static volatile int bench_running = 1;
+static uint64_t bench_updates;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* every update keeps humidity and time tied to temperature, a torn read breaks that */
+static void *bench_write_thread(void *arg)
+{
+    app_reading_t reading;
+    uint32_t i = 0;
+
+    while (bench_running) {
+        reading.node_id = i % BENCH_NODES + 1;
+        reading.link = 0;
+        reading.temperature = (int16_t)(i & 0x7FFF);
+        reading.humidity = reading.temperature ^ 0x5555;
+        reading.timestamp_ms = (uint64_t)reading.temperature * 3;
+        node_snapshot_update(&bench_writer, &reading);
+        i++;
+    }
+    bench_updates = i;
+
+    return NULL;
+}
+
+static void *bench_query_thread(void *arg)
+{
+    while (bench_running) {
+        query_server_poll(&bench_server, 10);
+    }
+
+    return NULL;
+}
+
+static int bench_torn(const node_snapshot_reading_t *reading)
+{
+    return reading->humidity != (reading->temperature ^ 0x5555) ||
+           reading->timestamp_ms != (uint64_t)reading->temperature * 3;
+}
+
+/* 1 if no copy was torn */
+static int bench_lookups(void)
+{
+    node_snapshot_t reader;
+    node_snapshot_reading_t reading;
+    uint64_t reads = 0, torn = 0, missing = 0;
+    double start = bench_now(), elapsed;
+
+    if (node_snapshot_attach(&reader, BENCH_SHM) < 0) {
+        printf("attach failed\n");
+        return 0;
+    }
+
+    do {
+        int i;
+
+        for (i = 0; i < 1000; i++) {
+            if (node_snapshot_get(&reader, 0, (uint16_t)(rand() % BENCH_NODES + 1), &reading) < 0) {
+                missing++;
+            } else {
+                torn += bench_torn(&reading);
+            }
+        }
+        reads += 1000;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    printf("get      %10.0f lookups/s  %llu missing  %llu torn  %s\n", reads / elapsed,
+           (unsigned long long)missing, (unsigned long long)torn, (torn == 0) ? "ok" : "MISMATCH");
+    node_snapshot_close(&reader);
+    return torn == 0;
+}
+
+/* one request line, the answer is read up to its last line */
+static int bench_ask(int fd, const char *request, char *answer, int size, int lines)
+{
+    int len = 0;
+
+    if (write(fd, request, strlen(request)) < 0) {
+        return -1;
+    }
+    while (lines > 0 && len < size) {
+        ssize_t n = read(fd, answer + len, size - len);
+        int i;
+
+        if (n <= 0) {
+            return -1;
+        }
+        for (i = len; i < len + n; i++) {
+            lines -= (answer[i] == '\n');
+        }
+        len += n;
+    }
+
+    return len;
+}
+
+/* 1 if every request was answered */
+static int bench_socket(void)
+{
+    static char answer[128 * 1024];
+    struct sockaddr_un addr;
+    uint64_t asked = 0, errors = 0;
+    double start, elapsed;
+    int fd, len, ok;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, BENCH_SOCKET);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("connect failed\n");
+        return 0;
+    }
+
+    start = bench_now();
+    do {
+        char request[32];
+
+        snprintf(request, sizeof(request), "GET %d\n", rand() % BENCH_NODES + 1);
+        len = bench_ask(fd, request, answer, sizeof(answer), 1);
+        errors += (len < 0 || strncmp(answer, "ERR", 3) == 0);
+        asked++;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_SECONDS);
+
+    /* every node and the empty line that ends the list */
+    len = bench_ask(fd, "LIST\n", answer, sizeof(answer), BENCH_NODES + 1);
+    ok = errors == 0 && len > 0;
+    printf("socket   %10.0f GETs/s  %llu errors, LIST %d bytes  %s\n", asked / elapsed,
+           (unsigned long long)errors, len, ok ? "ok" : "MISMATCH");
+    close(fd);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t writer, query;
+    double start;
+    int ok = 1;
+
+    if (node_snapshot_create(&bench_writer, BENCH_SHM) < 0 ||
+        query_server_open(&bench_server, BENCH_SOCKET, &bench_writer) < 0) {
+        printf("snapshot or socket setup failed\n");
+        return 1;
+    }
+
+    start = bench_now();
+    pthread_create(&writer, NULL, bench_write_thread, NULL);
+    pthread_create(&query, NULL, bench_query_thread, NULL);
+    while (node_snapshot_count(&bench_writer) < BENCH_NODES) {
+        usleep(1000);
+    }
+
+    ok &= bench_lookups();
+    ok &= bench_socket();
+
+    bench_running = 0;
+    pthread_join(writer, NULL);
+    pthread_join(query, NULL);
+    printf("update   %10.0f updates/s while being read\n", bench_updates / (bench_now() - start));
+
+    query_server_close(&bench_server);
+    node_snapshot_close(&bench_writer);
+    return ok ? 0 : 1;
+}
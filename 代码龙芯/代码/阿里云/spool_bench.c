@@ -0,0 +1,229 @@
+/*
+ * Micro benchmark: the store and forward spool across restarts.
+ * Small segments in a scratch directory. Appends, tears the last record the
+ * way a crash in the middle of a write leaves it, reopens, and checks that
+ * the replay comes back in order from the checkpoint, that the oldest
+ * segment is evicted with the right count when the checkpoint is in it, and
+ * that a segment of another layout is discarded. Reports what an append and
+ * a replayed reading cost. Builds without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "store_forward.h"
+
+#define BENCH_DIR               "/tmp/spool_bench"
+#define BENCH_CAPACITY          100     /* records per segment of the checks */
+#define BENCH_SEGMENTS          4
+#define BENCH_READINGS          200000
+
+/* size of a segment header and of a record, see store_forward.c */
+#define BENCH_HEADER_SIZE       16
+#define BENCH_RECORD_SIZE       (8 + (int)sizeof(app_reading_t))
+
+static uint64_t bench_clock;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_clear(void)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    struct dirent *entry;
+    DIR *dir = opendir(BENCH_DIR);
+
+    if (dir == NULL) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", BENCH_DIR, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dir);
+    rmdir(BENCH_DIR);
+}
+
+static int bench_open(store_forward_t *sf, uint32_t segment_size, uint32_t segments)
+{
+    store_forward_config_t config;
+
+    config.dir = BENCH_DIR;
+    config.segment_size = segment_size;
+    config.max_segments = segments;
+    config.replay_rate = 1000000000;
+    config.replay_burst = 1000;
+    return store_forward_open(sf, &config);
+}
+
+static int bench_open_small(store_forward_t *sf)
+{
+    return bench_open(sf, BENCH_HEADER_SIZE + BENCH_CAPACITY * BENCH_RECORD_SIZE, BENCH_SEGMENTS);
+}
+
+/* readings carry their sequence number in the timestamp */
+static void bench_append(store_forward_t *sf, uint64_t from, uint64_t to)
+{
+    app_reading_t reading;
+
+    memset(&reading, 0, sizeof(reading));
+    for (; from < to; from++) {
+        reading.node_id = (uint16_t)(from % 500 + 1);
+        reading.temperature = (int16_t)(from % 400 - 100);
+        reading.timestamp_ms = from;
+        store_forward_append(sf, &reading);
+    }
+}
+
+/* read up to max and commit count of them, 1 if they are the sequence numbers from first on */
+static int bench_replay(store_forward_t *sf, uint64_t first, int max, int count)
+{
+    static app_reading_t readings[1000];
+    int got = 0, ok = 1;
+
+    while (got < max) {
+        int i, n = store_forward_read(sf, readings, (max - got < 1000) ? max - got : 1000, bench_clock += 1000);
+
+        if (n == 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            ok = ok && readings[i].timestamp_ms == first + got + i;
+        }
+        got += n;
+    }
+    store_forward_commit(sf, count);
+
+    return ok && got == max;
+}
+
+/* the last record of the newest segment, written up to its magic but not the rest */
+static void bench_tear(uint32_t segment, uint32_t index)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    uint8_t byte = 0xA5;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/seg-%08u.log", BENCH_DIR, segment);
+    fd = open(path, O_WRONLY);
+    if (fd >= 0) {
+        if (pwrite(fd, &byte, 1, BENCH_HEADER_SIZE + index * BENCH_RECORD_SIZE + 8 + 2) != 1) {
+            perror("bench tear");
+        }
+        close(fd);
+    }
+}
+
+/* a segment an older build left behind */
+static void bench_foreign(uint32_t segment)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    uint32_t header[4] = { 0x47535053, 2, 24, 0 };
+    int fd;
+
+    header[3] = segment;
+    snprintf(path, sizeof(path), "%s/seg-%08u.log", BENCH_DIR, segment);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        if (write(fd, header, sizeof(header)) != sizeof(header)) {
+            perror("bench foreign");
+        }
+        close(fd);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    store_forward_t sf;
+    store_forward_cursor_t torn;
+    double t_append, t_replay;
+    uint64_t evicted;
+    uint32_t first;
+    int ok, failed = 0;
+
+    bench_clock = 1000;
+
+    /* a crash tears the last of 250 records, the next appends go where it was */
+    bench_clear();
+    if (bench_open_small(&sf) < 0) {
+        printf("spool open failed\n");
+        return 1;
+    }
+    bench_append(&sf, 0, 250);
+    store_forward_close(&sf);
+    bench_tear(2, 49);
+    bench_open_small(&sf);
+    torn = sf.write;
+    bench_append(&sf, 249, 260);
+    ok = torn.segment == 2 && torn.index == 49 && bench_replay(&sf, 0, 260, 0);
+    store_forward_close(&sf);
+    printf("torn     appends resume at record %u of segment %u, 260 readings back in order  %s\n",
+           torn.index, torn.segment, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* 120 handed out and 100 acknowledged before a restart, the other 20 come again */
+    bench_open_small(&sf);
+    ok = bench_replay(&sf, 0, 120, 100);
+    store_forward_close(&sf);
+    bench_open_small(&sf);
+    first = sf.first_segment;
+    ok = ok && first == 1 && bench_replay(&sf, 100, 160, 0);
+    store_forward_close(&sf);
+    printf("resume   replay picks up at the checkpoint after a restart, acknowledged segments gone up to %u  %s\n",
+           first, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* the disk budget runs out while the checkpoint is in the oldest segment */
+    bench_clear();
+    bench_open_small(&sf);
+    bench_append(&sf, 0, 100);
+    ok = bench_replay(&sf, 0, 30, 30);
+    bench_append(&sf, 100, 450);
+    evicted = sf.stats.evicted;
+    ok = ok && evicted == 70 && sf.first_segment == 1;
+    store_forward_close(&sf);
+    bench_open_small(&sf);
+    ok = ok && bench_replay(&sf, 100, 350, 0);
+    store_forward_close(&sf);
+    printf("evict    %llu unsent readings of the oldest segment dropped, the rest in order after a restart  %s\n",
+           (unsigned long long)evicted, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* an older build's segment is deleted, the others are kept */
+    bench_foreign(0);
+    bench_open_small(&sf);
+    ok = sf.stats.discarded == 1 && sf.first_segment == 1 && access(BENCH_DIR "/seg-00000000.log", F_OK) < 0 &&
+         bench_replay(&sf, 100, 350, 0);
+    store_forward_close(&sf);
+    printf("version  %llu segment of another layout discarded  %s\n", (unsigned long long)sf.stats.discarded,
+           ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    /* default segments */
+    bench_clear();
+    bench_open(&sf, STORE_FORWARD_SEGMENT_DEFAULT, STORE_FORWARD_SEGMENTS_DEFAULT);
+    t_append = bench_now();
+    bench_append(&sf, 0, BENCH_READINGS);
+    t_append = bench_now() - t_append;
+    t_replay = bench_now();
+    ok = bench_replay(&sf, 0, BENCH_READINGS, BENCH_READINGS) && !store_forward_pending(&sf);
+    t_replay = bench_now() - t_replay;
+    store_forward_close(&sf);
+    bench_clear();
+    printf("spool    %6.1f ns/append  %6.1f ns/replayed reading  %s\n", t_append * 1e9 / BENCH_READINGS,
+           t_replay * 1e9 / BENCH_READINGS, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    return failed ? 1 : 0;
+}
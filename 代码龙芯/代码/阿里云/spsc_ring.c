@@ -0,0 +1,72 @@
+/*
+ * Lock-free single producer / single consumer ring
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+int spsc_ring_init(spsc_ring_t *ring, uint32_t size, uint32_t elem_size)
+{
+    uint32_t capacity = 1;
+
+    while (capacity < size) {
+        capacity <<= 1;
+    }
+
+    memset(ring, 0, sizeof(spsc_ring_t));
+    ring->slots = malloc((size_t)capacity * elem_size);
+    if (ring->slots == NULL) {
+        return -1;
+    }
+
+    ring->mask = capacity - 1;
+    ring->elem_size = elem_size;
+    return 0;
+}
+
+void spsc_ring_deinit(spsc_ring_t *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int spsc_ring_push(spsc_ring_t *ring, const void *elem)
+{
+    uint32_t tail = ring->tail;
+    uint32_t used = tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (used > ring->mask) {
+        ring->full_drops++;
+        return -1;
+    }
+
+    memcpy(ring->slots + (size_t)(tail & ring->mask) * ring->elem_size, elem, ring->elem_size);
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+    ring->pushed++;
+    if (used + 1 > ring->high_watermark) {
+        ring->high_watermark = used + 1;
+    }
+    return 0;
+}
+
+int spsc_ring_pop(spsc_ring_t *ring, void *elem)
+{
+    uint32_t head = ring->head;
+
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    memcpy(elem, ring->slots + (size_t)(head & ring->mask) * ring->elem_size, ring->elem_size);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    ring->popped++;
+    return 0;
+}
+
+uint32_t spsc_ring_count(spsc_ring_t *ring)
+{
+    return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,42 @@
+/*
+ * Lock-free single producer / single consumer ring of fixed size elements.
+ * The ingestion thread pushes, the cloud thread pops, no locks on either side.
+ */
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stdint.h>
+
+#define SPSC_RING_CACHE_LINE    64
+
+typedef struct _spsc_ring {
+    /* read only after init */
+    uint8_t            *slots;
+    uint32_t            mask;
+    uint32_t            elem_size;
+
+    /* consumer side */
+    uint32_t            head __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+    uint64_t            popped;
+
+    /* producer side, the backpressure counters live here too */
+    uint32_t            tail __attribute__((aligned(SPSC_RING_CACHE_LINE)));
+    uint64_t            pushed;
+    uint64_t            full_drops;         /* elements rejected because the ring was full */
+    uint32_t            high_watermark;     /* max fill level seen by the producer */
+} spsc_ring_t;
+
+/* size is rounded up to a power of two */
+int      spsc_ring_init(spsc_ring_t *ring, uint32_t size, uint32_t elem_size);
+void     spsc_ring_deinit(spsc_ring_t *ring);
+
+/* producer only, returns -1 and counts a drop when full */
+int      spsc_ring_push(spsc_ring_t *ring, const void *elem);
+
+/* consumer only, returns -1 when empty */
+int      spsc_ring_pop(spsc_ring_t *ring, void *elem);
+
+/* approximate when called from a third thread */
+uint32_t spsc_ring_count(spsc_ring_t *ring);
+
+#endif /* _SPSC_RING_H_ */
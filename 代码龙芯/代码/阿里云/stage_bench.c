@@ -0,0 +1,151 @@
+/*
+ * Micro benchmark: pipeline metrics. Measures what a timed stage and a trace
+ * point cost on the recording thread next to the three-printf APP_TRACE they
+ * replace on the hot paths, two threads recording into their own shards
+ * against both adding into one shared set of counters, and rendering the
+ * Prometheus text. Builds without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "stage_metrics.h"
+
+#define BENCH_RECORDS           10000000
+#define BENCH_TRACES            1000000
+#define BENCH_THREADS           2
+#define BENCH_RENDERS           1000
+
+static stage_metrics_t bench_metrics;
+static stage_hist_t bench_shared;       /* the unsharded alternative */
+static FILE *bench_null;
+
+static double bench_now(void)
+{
+    return stage_clock_ns() / 1e9;
+}
+
+/* what APP_TRACE does per message */
+static void bench_trace(int node_id)
+{
+    fprintf(bench_null, "%s|%03d :: ", __func__, __LINE__);
+    fprintf(bench_null, "App post reading of node %d:%d fail, spooled", 0, node_id);
+    fprintf(bench_null, "%s", "\r\n");
+    fflush(bench_null);
+}
+
+static void *bench_sharded(void *arg)
+{
+    stage_shard_t *shard = (stage_shard_t *)arg;
+    int i;
+
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        stage_record(shard, STAGE_AGGREGATE, 300 + (i & 1023), 1);
+    }
+
+    return NULL;
+}
+
+static void *bench_unsharded(void *arg)
+{
+    int i;
+
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        uint64_t ns = 300 + (i & 1023);
+
+        __atomic_fetch_add(&bench_shared.buckets[64 - __builtin_clzll(ns) - STAGE_METRICS_BUCKET_SHIFT], 1,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(&bench_shared.count, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&bench_shared.items, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&bench_shared.sum_ns, ns, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static double bench_threads(void *(*fn)(void *), stage_shard_t **shards)
+{
+    pthread_t threads[BENCH_THREADS];
+    double t = bench_now();
+    int i;
+
+    for (i = 0; i < BENCH_THREADS; i++) {
+        pthread_create(&threads[i], NULL, fn, shards[i]);
+    }
+    for (i = 0; i < BENCH_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    return bench_now() - t;
+}
+
+int main(int argc, char **argv)
+{
+    static char text[STAGE_METRICS_TEXT_MAX];
+    stage_shard_t *shards[BENCH_THREADS];
+    stage_shard_t *shard;
+    double t, t_stage, t_point, t_trace, t_sharded, t_shared;
+    uint64_t sink = 0;
+    int i, len = 0, ok, failed = 0;
+
+    bench_null = fopen("/dev/null", "w");
+    if (bench_null == NULL) {
+        return 1;
+    }
+    stage_metrics_init(&bench_metrics);
+    shard = stage_metrics_shard(&bench_metrics, "bench");
+
+    /* a timed stage around a trivial body, the cost is the two clock reads and the record */
+    t = bench_now();
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        STAGE_BEGIN(s);
+        sink += i;
+        STAGE_END(shard, STAGE_DECODE, s, 1);
+    }
+    t_stage = bench_now() - t;
+
+    t = bench_now();
+    for (i = 0; i < BENCH_RECORDS; i++) {
+        STAGE_POINT(shard, STAGE_POINT_SPOOLED);
+    }
+    t_point = bench_now() - t;
+
+    t = bench_now();
+    for (i = 0; i < BENCH_TRACES; i++) {
+        bench_trace(i);
+    }
+    t_trace = bench_now() - t;
+
+    ok = shard->stages[STAGE_DECODE].count == BENCH_RECORDS && shard->points[STAGE_POINT_SPOOLED] == BENCH_RECORDS;
+    printf("stage    %6.1f ns timed stage, %5.1f ns trace point, %6.1f ns APP_TRACE to /dev/null  %s\n",
+           t_stage * 1e9 / BENCH_RECORDS, t_point * 1e9 / BENCH_RECORDS, t_trace * 1e9 / BENCH_TRACES,
+           ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    for (i = 0; i < BENCH_THREADS; i++) {
+        shards[i] = stage_metrics_shard(&bench_metrics, (i == 0) ? "t0" : "t1");
+    }
+    t_sharded = bench_threads(bench_sharded, shards);
+    t_shared = bench_threads(bench_unsharded, shards);
+    ok = shards[0]->stages[STAGE_AGGREGATE].count + shards[1]->stages[STAGE_AGGREGATE].count ==
+         (uint64_t)BENCH_THREADS * BENCH_RECORDS && bench_shared.count == (uint64_t)BENCH_THREADS * BENCH_RECORDS;
+    printf("shards   %d threads %5.1f ns/record in own shards, %5.1f ns/record into one shared set  %s\n",
+           BENCH_THREADS, t_sharded * 1e9 / BENCH_RECORDS, t_shared * 1e9 / BENCH_RECORDS, ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    t = bench_now();
+    for (i = 0; i < BENCH_RENDERS; i++) {
+        len = stage_metrics_render(&bench_metrics, text, sizeof(text));
+    }
+    t = bench_now() - t;
+    ok = len > 0 && strstr(text, "gateway_stage_seconds_count{stage=\"decode\",thread=\"bench\"} 10000000\n") != NULL
+         && strstr(text, "gateway_stage_seconds_bucket{stage=\"decode\",thread=\"bench\",le=\"+Inf\"} 10000000\n") != NULL
+         && strstr(text, "gateway_events_total{event=\"spooled\"} 10000000\n") != NULL;
+    printf("render   %6.1f us for %d bytes of Prometheus text  %s\n", t * 1e6 / BENCH_RENDERS, len,
+           ok ? "ok" : "MISMATCH");
+    failed += !ok;
+
+    fclose(bench_null);
+    return failed ? 1 : (int)(sink & 0);
+}
@@ -0,0 +1,166 @@
+/*
+ * Counters and latency histograms of the gateway pipeline
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stage_metrics.h"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "decode", "aggregate", "encode", "publish"
+};
+
+static const char *stage_point_names[STAGE_POINT_COUNT] = {
+    "reading", "radio_loss", "post_fail", "spooled", "reply", "reply_error", "subdev_online"
+};
+
+void stage_metrics_init(stage_metrics_t *m)
+{
+    memset(m, 0, sizeof(stage_metrics_t));
+}
+
+stage_shard_t *stage_metrics_shard(stage_metrics_t *m, const char *thread)
+{
+    stage_shard_t *shard;
+
+    if (m->count == STAGE_METRICS_SHARDS) {
+        return NULL;
+    }
+    shard = &m->shards[m->count++];
+    shard->thread = thread;
+
+    return shard;
+}
+
+static uint64_t stage_load(const uint64_t *v)
+{
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+/* appends to buf at *len, -1 once it doesn't fit */
+static int stage_printf(char *buf, int size, int *len, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
+
+static int stage_printf(char *buf, int size, int *len, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (*len < 0) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || n >= size - *len) {
+        *len = -1;
+        return -1;
+    }
+    *len += n;
+
+    return 0;
+}
+
+static void stage_render_hist(const stage_shard_t *shard, int s, char *buf, int size, int *len)
+{
+    const stage_hist_t *h = &shard->stages[s];
+    uint64_t cumulative = 0;
+    int b;
+
+    for (b = 0; b < STAGE_METRICS_BUCKETS; b++) {
+        cumulative += stage_load(&h->buckets[b]);
+        stage_printf(buf, size, len, "gateway_stage_seconds_bucket{stage=\"%s\",thread=\"%s\",le=\"%.9g\"} %llu\n",
+                     stage_names[s], shard->thread, (double)(1ull << (b + STAGE_METRICS_BUCKET_SHIFT)) / 1e9,
+                     (unsigned long long)cumulative);
+    }
+    cumulative += stage_load(&h->buckets[STAGE_METRICS_BUCKETS]);
+    stage_printf(buf, size, len, "gateway_stage_seconds_bucket{stage=\"%s\",thread=\"%s\",le=\"+Inf\"} %llu\n",
+                 stage_names[s], shard->thread, (unsigned long long)cumulative);
+    stage_printf(buf, size, len, "gateway_stage_seconds_sum{stage=\"%s\",thread=\"%s\"} %.9f\n",
+                 stage_names[s], shard->thread, stage_load(&h->sum_ns) / 1e9);
+    stage_printf(buf, size, len, "gateway_stage_seconds_count{stage=\"%s\",thread=\"%s\"} %llu\n",
+                 stage_names[s], shard->thread, (unsigned long long)cumulative);
+}
+
+int stage_metrics_render(const stage_metrics_t *m, char *buf, int size)
+{
+    int i, s, len = 0;
+
+    /* stages a thread never ran are left out */
+    stage_printf(buf, size, &len, "# HELP gateway_stage_seconds Time spent in a pipeline stage per call.\n"
+                 "# TYPE gateway_stage_seconds histogram\n");
+    for (i = 0; i < m->count; i++) {
+        for (s = 0; s < STAGE_COUNT; s++) {
+            if (stage_load(&m->shards[i].stages[s].count) > 0) {
+                stage_render_hist(&m->shards[i], s, buf, size, &len);
+            }
+        }
+    }
+
+    stage_printf(buf, size, &len, "# HELP gateway_stage_items_total Frames, readings or payloads a stage handled.\n"
+                 "# TYPE gateway_stage_items_total counter\n");
+    for (i = 0; i < m->count; i++) {
+        for (s = 0; s < STAGE_COUNT; s++) {
+            if (stage_load(&m->shards[i].stages[s].count) > 0) {
+                stage_printf(buf, size, &len, "gateway_stage_items_total{stage=\"%s\",thread=\"%s\"} %llu\n",
+                             stage_names[s], m->shards[i].thread,
+                             (unsigned long long)stage_load(&m->shards[i].stages[s].items));
+            }
+        }
+    }
+
+    stage_printf(buf, size, &len, "# HELP gateway_stage_max_seconds Longest call of a pipeline stage.\n"
+                 "# TYPE gateway_stage_max_seconds gauge\n");
+    for (i = 0; i < m->count; i++) {
+        for (s = 0; s < STAGE_COUNT; s++) {
+            if (stage_load(&m->shards[i].stages[s].count) > 0) {
+                stage_printf(buf, size, &len, "gateway_stage_max_seconds{stage=\"%s\",thread=\"%s\"} %.9f\n",
+                             stage_names[s], m->shards[i].thread, stage_load(&m->shards[i].stages[s].max_ns) / 1e9);
+            }
+        }
+    }
+
+    stage_printf(buf, size, &len, "# HELP gateway_events_total Trace points passed.\n"
+                 "# TYPE gateway_events_total counter\n");
+    for (s = 0; s < STAGE_POINT_COUNT; s++) {
+        uint64_t total = 0;
+
+        for (i = 0; i < m->count; i++) {
+            total += stage_load(&m->shards[i].points[s]);
+        }
+        stage_printf(buf, size, &len, "gateway_events_total{event=\"%s\"} %llu\n", stage_point_names[s],
+                     (unsigned long long)total);
+    }
+
+    return len;
+}
+
+int stage_metrics_dump(const stage_metrics_t *m, const char *path)
+{
+    static char text[STAGE_METRICS_TEXT_MAX];   /* one thread dumps */
+    char tmp[256];
+    FILE *fp;
+    int len;
+
+    len = stage_metrics_render(m, text, sizeof(text));
+    if (len < 0 || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        return -1;
+    }
+    if (fwrite(text, 1, len, fp) != (size_t)len) {
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+}
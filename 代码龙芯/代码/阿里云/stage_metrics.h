@@ -0,0 +1,140 @@
+/*
+ * Counters and latency histograms of the gateway pipeline.
+ *
+ * A reading goes through four stages: its uart frame is decoded on the
+ * ingestion thread, the cloud thread aggregates it (sub-device lookup, rules,
+ * time series), encodes the payload it ends up in and publishes that through
+ * the sdk. Each stage records how long it took into a histogram with power
+ * of two buckets from 256 ns up, next to the items it handled. Trace points
+ * are plain event counters.
+ *
+ * Every thread records into a shard of its own, registered before the
+ * threads start, so recording is a few relaxed stores to memory no other
+ * writer touches. Exporting reads all shards with relaxed loads from any
+ * thread; a histogram read while it is being written may be off by the one
+ * sample in flight.
+ *
+ * Building with -DSTAGE_METRICS=0 removes every STAGE_ macro from the code
+ * paths, rendering then shows zeros.
+ */
+#ifndef _STAGE_METRICS_H_
+#define _STAGE_METRICS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#ifndef STAGE_METRICS
+#define STAGE_METRICS                   1
+#endif
+
+/* threads that record */
+#define STAGE_METRICS_SHARDS            4
+
+/* bucket i counts samples below 2^(i + 8) ns, 256 ns to 2.1 s; one more for anything longer */
+#define STAGE_METRICS_BUCKETS           24
+#define STAGE_METRICS_BUCKET_SHIFT      8
+
+/* rendering all shards takes less than this */
+#define STAGE_METRICS_TEXT_MAX          32768
+
+typedef enum {
+    STAGE_DECODE,                       /* uart bytes read and decoded, frames handled */
+    STAGE_AGGREGATE,                    /* reading dispatched on the cloud thread */
+    STAGE_ENCODE,                       /* payload encoded */
+    STAGE_PUBLISH,                      /* payload handed to the sdk */
+    STAGE_COUNT
+} stage_t;
+
+typedef enum {
+    STAGE_POINT_READING,                /* reading queued to the cloud thread */
+    STAGE_POINT_RADIO_LOSS,             /* coordinator reported lost radio messages of a node */
+    STAGE_POINT_POST_FAIL,              /* the sdk refused a post */
+    STAGE_POINT_SPOOLED,                /* reading spooled instead of posted */
+    STAGE_POINT_REPLY,                  /* post acknowledged */
+    STAGE_POINT_REPLY_ERROR,            /* post answered with an error */
+    STAGE_POINT_SUBDEV_ONLINE,          /* sub-device reported initialized */
+    STAGE_POINT_COUNT
+} stage_point_t;
+
+typedef struct _stage_hist {
+    uint64_t        count;
+    uint64_t        items;
+    uint64_t        sum_ns;
+    uint64_t        max_ns;
+    uint64_t        buckets[STAGE_METRICS_BUCKETS + 1];
+} stage_hist_t;
+
+/* written by its thread only, starts on a cache line of its own */
+typedef struct _stage_shard {
+    const char     *thread;             /* label of the thread */
+    stage_hist_t    stages[STAGE_COUNT];
+    uint64_t        points[STAGE_POINT_COUNT];
+} __attribute__((aligned(64))) stage_shard_t;
+
+typedef struct _stage_metrics {
+    stage_shard_t   shards[STAGE_METRICS_SHARDS];
+    int             count;
+} stage_metrics_t;
+
+void stage_metrics_init(stage_metrics_t *m);
+
+/* shard of a thread, NULL when all are taken. Call before the threads start */
+stage_shard_t *stage_metrics_shard(stage_metrics_t *m, const char *thread);
+
+/* Prometheus text exposition of all shards, the length or -1 if size is too small */
+int  stage_metrics_render(const stage_metrics_t *m, char *buf, int size);
+
+/* render into path, through a temporary file and a rename so readers never see half of it */
+int  stage_metrics_dump(const stage_metrics_t *m, const char *path);
+
+static inline uint64_t stage_clock_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* the owning thread is the only writer, a load and a store are enough */
+#define STAGE_ADD(field, n) \
+    __atomic_store_n(&(field), __atomic_load_n(&(field), __ATOMIC_RELAXED) + (n), __ATOMIC_RELAXED)
+
+/* shard may be NULL, nothing is recorded then */
+static inline void stage_record(stage_shard_t *shard, stage_t stage, uint64_t ns, uint32_t items)
+{
+    stage_hist_t *h;
+    int b;
+
+    if (shard == NULL) {
+        return;
+    }
+    h = &shard->stages[stage];
+    b = 64 - __builtin_clzll(ns | 1) - STAGE_METRICS_BUCKET_SHIFT;
+    b = (b < 0) ? 0 : (b > STAGE_METRICS_BUCKETS) ? STAGE_METRICS_BUCKETS : b;
+    STAGE_ADD(h->buckets[b], 1);
+    STAGE_ADD(h->count, 1);
+    STAGE_ADD(h->items, items);
+    STAGE_ADD(h->sum_ns, ns);
+    if (ns > h->max_ns) {
+        __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void stage_point(stage_shard_t *shard, stage_point_t point)
+{
+    if (shard != NULL) {
+        STAGE_ADD(shard->points[point], 1);
+    }
+}
+
+#if STAGE_METRICS
+#define STAGE_BEGIN(t)                      uint64_t t = stage_clock_ns()
+#define STAGE_END(shard, stage, t, items)   stage_record((shard), (stage), stage_clock_ns() - (t), (items))
+#define STAGE_POINT(shard, point)           stage_point((shard), (point))
+#else
+#define STAGE_BEGIN(t)                      do { } while (0)
+#define STAGE_END(shard, stage, t, items)   do { (void)(items); } while (0)
+#define STAGE_POINT(shard, point)           do { } while (0)
+#endif
+
+#endif /* _STAGE_METRICS_H_ */
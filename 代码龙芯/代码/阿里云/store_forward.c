@@ -0,0 +1,437 @@
+/*
+ * Store and forward queue
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store_forward.h"
+
+#define STORE_FORWARD_SEGMENT_MAGIC     0x47535053      /* "SPSG" */
+#define STORE_FORWARD_RECORD_MAGIC      0x43525053      /* "SPRC" */
+#define STORE_FORWARD_VERSION           3       /* 2: readings in tenths, 3: coordinator link */
+#define STORE_FORWARD_CHECKPOINT        "checkpoint"
+
+typedef struct _store_forward_header {
+    uint32_t        magic;
+    uint32_t        version;
+    uint32_t        record_size;
+    uint32_t        id;
+} store_forward_header_t;
+
+typedef struct _store_forward_record {
+    uint32_t        magic;
+    uint32_t        check;
+    app_reading_t   reading;
+} store_forward_record_t;
+
+/* fnv-1a, enough to tell a torn record from a complete one */
+static uint32_t store_forward_check(const app_reading_t *reading)
+{
+    const uint8_t *p = (const uint8_t *)reading;
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < sizeof(app_reading_t); i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static void store_forward_path(store_forward_t *sf, uint32_t id, char *path, int size)
+{
+    snprintf(path, size, "%s/seg-%08u.log", sf->dir, id);
+}
+
+static void store_forward_unmap(store_forward_t *sf, store_forward_segment_t *seg)
+{
+    if (seg->base != NULL) {
+        munmap(seg->base, sf->config.segment_size);
+        seg->base = NULL;
+    }
+}
+
+/* map segment id into seg, creating the file if asked to */
+static int store_forward_map(store_forward_t *sf, store_forward_segment_t *seg, uint32_t id, int create)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    store_forward_header_t *header;
+    struct stat st;
+    int fd;
+
+    if (seg->base != NULL && seg->id == id) {
+        return 0;
+    }
+    store_forward_unmap(sf, seg);
+
+    store_forward_path(sf, id, path, sizeof(path));
+    fd = open(path, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) < 0 || (st.st_size < sf->config.segment_size &&
+                               ftruncate(fd, sf->config.segment_size) < 0)) {
+        close(fd);
+        return -1;
+    }
+
+    seg->base = mmap(NULL, sf->config.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg->base == MAP_FAILED) {
+        seg->base = NULL;
+        return -1;
+    }
+    seg->id = id;
+
+    header = (store_forward_header_t *)seg->base;
+    if (header->magic == 0 && create) {
+        header->version = STORE_FORWARD_VERSION;
+        header->record_size = sizeof(store_forward_record_t);
+        header->id = id;
+        header->magic = STORE_FORWARD_SEGMENT_MAGIC;
+    }
+
+    if (header->magic != STORE_FORWARD_SEGMENT_MAGIC || header->version != STORE_FORWARD_VERSION ||
+        header->record_size != sizeof(store_forward_record_t) || header->id != id) {
+        store_forward_unmap(sf, seg);
+        return -1;
+    }
+
+    return 0;
+}
+
+static store_forward_record_t *store_forward_record(store_forward_segment_t *seg, uint32_t index)
+{
+    return (store_forward_record_t *)(seg->base + sizeof(store_forward_header_t)) + index;
+}
+
+static int store_forward_valid(const store_forward_record_t *record)
+{
+    return record->magic == STORE_FORWARD_RECORD_MAGIC && record->check == store_forward_check(&record->reading);
+}
+
+static int store_forward_cursor_before(const store_forward_cursor_t *a, const store_forward_cursor_t *b)
+{
+    return a->segment < b->segment || (a->segment == b->segment && a->index < b->index);
+}
+
+/*
+ * Move cursor past the next valid record and copy it out if reading is given.
+ * Segments that are evicted, missing or damaged are skipped as a whole.
+ */
+static int store_forward_next(store_forward_t *sf, store_forward_segment_t *seg, store_forward_cursor_t *cursor,
+                              app_reading_t *reading)
+{
+    while (store_forward_cursor_before(cursor, &sf->write)) {
+        store_forward_record_t *record;
+
+        if (cursor->segment < sf->first_segment) {
+            cursor->segment = sf->first_segment;
+            cursor->index = 0;
+            continue;
+        }
+        if (cursor->index >= sf->capacity || store_forward_map(sf, seg, cursor->segment, 0) < 0) {
+            cursor->segment++;
+            cursor->index = 0;
+            continue;
+        }
+
+        record = store_forward_record(seg, cursor->index++);
+        if (store_forward_valid(record)) {
+            if (reading != NULL) {
+                *reading = record->reading;
+            }
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* drop segments that are fully acknowledged */
+static void store_forward_trim(store_forward_t *sf)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+
+    while (sf->first_segment < sf->checkpoint->segment && sf->first_segment < sf->write.segment) {
+        store_forward_path(sf, sf->first_segment, path, sizeof(path));
+        unlink(path);
+        sf->first_segment++;
+    }
+}
+
+/* disk budget reached: throw away the oldest segment, acknowledged or not */
+static void store_forward_evict(store_forward_t *sf)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    uint32_t oldest = sf->first_segment;
+
+    if (sf->checkpoint->segment == oldest) {
+        sf->stats.evicted += sf->capacity - sf->checkpoint->index;
+        sf->checkpoint->segment = oldest + 1;
+        sf->checkpoint->index = 0;
+    }
+    if (sf->read.segment <= oldest) {
+        sf->read = *sf->checkpoint;
+    }
+
+    store_forward_path(sf, oldest, path, sizeof(path));
+    unlink(path);
+    sf->first_segment++;
+}
+
+/* a segment written with another layout, by an older or newer build. A missing or
+ * blank header is not, the segment was created and never written to */
+static int store_forward_foreign(store_forward_t *sf, uint32_t id)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    store_forward_header_t header;
+    ssize_t len;
+    int fd;
+
+    store_forward_path(sf, id, path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    len = read(fd, &header, sizeof(header));
+    close(fd);
+
+    return len == sizeof(header) && header.magic != 0 &&
+           (header.magic != STORE_FORWARD_SEGMENT_MAGIC || header.version != STORE_FORWARD_VERSION ||
+            header.record_size != sizeof(store_forward_record_t) || header.id != id);
+}
+
+/* find the segments on disk, the ones this build can't read are deleted */
+static int store_forward_scan(store_forward_t *sf, uint32_t *first, uint32_t *last)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    struct dirent *entry;
+    DIR *dir;
+    int found = 0;
+
+    dir = opendir(sf->dir);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned int id;
+
+        if (sscanf(entry->d_name, "seg-%08u.log", &id) != 1) {
+            continue;
+        }
+        if (store_forward_foreign(sf, id)) {
+            store_forward_path(sf, id, path, sizeof(path));
+            if (unlink(path) == 0) {
+                sf->stats.discarded++;
+            }
+            continue;
+        }
+        if (!found || id < *first) {
+            *first = id;
+        }
+        if (!found || id > *last) {
+            *last = id;
+        }
+        found = 1;
+    }
+
+    closedir(dir);
+    return found;
+}
+
+static int store_forward_open_checkpoint(store_forward_t *sf)
+{
+    char path[STORE_FORWARD_PATH_MAX + 32];
+    void *base;
+
+    snprintf(path, sizeof(path), "%s/%s", sf->dir, STORE_FORWARD_CHECKPOINT);
+    sf->checkpoint_fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (sf->checkpoint_fd < 0) {
+        return -1;
+    }
+
+    if (ftruncate(sf->checkpoint_fd, sizeof(store_forward_cursor_t)) < 0) {
+        close(sf->checkpoint_fd);
+        return -1;
+    }
+
+    base = mmap(NULL, sizeof(store_forward_cursor_t), PROT_READ | PROT_WRITE, MAP_SHARED, sf->checkpoint_fd, 0);
+    if (base == MAP_FAILED) {
+        close(sf->checkpoint_fd);
+        return -1;
+    }
+
+    sf->checkpoint = (store_forward_cursor_t *)base;
+    return 0;
+}
+
+int store_forward_open(store_forward_t *sf, const store_forward_config_t *config)
+{
+    uint32_t first = 0, last = 0;
+    int found;
+
+    memset(sf, 0, sizeof(store_forward_t));
+    sf->config.dir = STORE_FORWARD_DIR_DEFAULT;
+    sf->config.segment_size = STORE_FORWARD_SEGMENT_DEFAULT;
+    sf->config.max_segments = STORE_FORWARD_SEGMENTS_DEFAULT;
+    sf->config.replay_rate = STORE_FORWARD_RATE_DEFAULT;
+    sf->config.replay_burst = STORE_FORWARD_BURST_DEFAULT;
+    if (config != NULL) {
+        sf->config = *config;
+    }
+    if (sf->config.max_segments < 2) {
+        sf->config.max_segments = 2;
+    }
+
+    snprintf(sf->dir, sizeof(sf->dir), "%s", sf->config.dir);
+    sf->capacity = (sf->config.segment_size - sizeof(store_forward_header_t)) / sizeof(store_forward_record_t);
+    if (sf->capacity == 0) {
+        return -1;
+    }
+
+    if (mkdir(sf->dir, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+
+    found = store_forward_scan(sf, &first, &last);
+    if (found < 0) {
+        return -1;
+    }
+
+    /* the newest segment takes appends, recover its end by scanning for the first hole */
+    sf->first_segment = first;
+    if (store_forward_map(sf, &sf->write_seg, last, 1) < 0) {
+        return -1;
+    }
+    sf->write.segment = last;
+    while (sf->write.index < sf->capacity &&
+           store_forward_valid(store_forward_record(&sf->write_seg, sf->write.index))) {
+        sf->write.index++;
+    }
+
+    if (store_forward_open_checkpoint(sf) < 0) {
+        store_forward_unmap(sf, &sf->write_seg);
+        return -1;
+    }
+    if (store_forward_cursor_before(sf->checkpoint, &(store_forward_cursor_t) { first, 0 }) ||
+        store_forward_cursor_before(&sf->write, sf->checkpoint)) {
+        sf->checkpoint->segment = first;
+        sf->checkpoint->index = 0;
+    }
+    sf->read = *sf->checkpoint;
+
+    sf->tokens = sf->config.replay_burst;
+    return 0;
+}
+
+void store_forward_close(store_forward_t *sf)
+{
+    store_forward_sync(sf);
+    store_forward_unmap(sf, &sf->write_seg);
+    store_forward_unmap(sf, &sf->read_seg);
+
+    if (sf->checkpoint != NULL) {
+        munmap(sf->checkpoint, sizeof(store_forward_cursor_t));
+        close(sf->checkpoint_fd);
+        sf->checkpoint = NULL;
+    }
+}
+
+int store_forward_append(store_forward_t *sf, const app_reading_t *reading)
+{
+    store_forward_record_t *record;
+
+    if (sf->write.index >= sf->capacity) {
+        if (sf->write.segment + 1 - sf->first_segment >= sf->config.max_segments) {
+            store_forward_evict(sf);
+        }
+        if (store_forward_map(sf, &sf->write_seg, sf->write.segment + 1, 1) < 0) {
+            sf->stats.append_failures++;
+            return -1;
+        }
+        sf->write.segment++;
+        sf->write.index = 0;
+    }
+
+    record = store_forward_record(&sf->write_seg, sf->write.index++);
+    record->reading = *reading;
+    record->check = store_forward_check(reading);
+    record->magic = STORE_FORWARD_RECORD_MAGIC;
+
+    sf->stats.appended++;
+    return 0;
+}
+
+int store_forward_pending(store_forward_t *sf)
+{
+    return store_forward_cursor_before(sf->checkpoint, &sf->write);
+}
+
+int store_forward_read(store_forward_t *sf, app_reading_t *readings, int max, uint64_t now_ms)
+{
+    int count = 0;
+
+    /* refill the replay bucket */
+    if (sf->refill_ms != 0) {
+        sf->tokens += (double)(now_ms - sf->refill_ms) * sf->config.replay_rate / 1000;
+        if (sf->tokens > sf->config.replay_burst) {
+            sf->tokens = sf->config.replay_burst;
+        }
+    }
+    sf->refill_ms = now_ms;
+
+    if (max > (int)sf->tokens) {
+        max = (int)sf->tokens;
+    }
+
+    while (count < max && store_forward_next(sf, &sf->read_seg, &sf->read, &readings[count]) == 0) {
+        count++;
+    }
+
+    sf->tokens -= count;
+    return count;
+}
+
+void store_forward_commit(store_forward_t *sf, int count)
+{
+    store_forward_segment_t seg = { 0, NULL };
+    store_forward_cursor_t cursor = *sf->checkpoint;
+
+    while (count-- > 0 && store_forward_next(sf, &seg, &cursor, NULL) == 0) {
+        sf->stats.replayed++;
+    }
+    store_forward_unmap(sf, &seg);
+
+    /* at the end of a segment the next record is in the one after, so the full one can go */
+    if (cursor.index >= sf->capacity && cursor.segment < sf->write.segment) {
+        cursor.segment++;
+        cursor.index = 0;
+    }
+    *sf->checkpoint = cursor;
+    store_forward_trim(sf);
+}
+
+void store_forward_rewind(store_forward_t *sf)
+{
+    sf->read = *sf->checkpoint;
+    sf->stats.rewinds++;
+}
+
+void store_forward_sync(store_forward_t *sf)
+{
+    if (sf->write_seg.base != NULL) {
+        msync(sf->write_seg.base, sf->config.segment_size, MS_ASYNC);
+    }
+    if (sf->checkpoint != NULL) {
+        msync(sf->checkpoint, sizeof(store_forward_cursor_t), MS_ASYNC);
+    }
+}
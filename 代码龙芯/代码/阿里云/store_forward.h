@@ -0,0 +1,92 @@
+/*
+ * Store and forward queue: readings produced while the cloud is unreachable
+ * are appended to memory mapped segment files and replayed in order later.
+ */
+#ifndef _STORE_FORWARD_H_
+#define _STORE_FORWARD_H_
+
+#include <stdint.h>
+
+#include "app_reading.h"
+
+#ifndef STORE_FORWARD_DIR_DEFAULT
+#define STORE_FORWARD_DIR_DEFAULT       "./spool"
+#endif
+
+#define STORE_FORWARD_SEGMENT_DEFAULT   (1024 * 1024)
+#define STORE_FORWARD_SEGMENTS_DEFAULT  16
+
+/* replay token bucket, readings per second and max burst */
+#define STORE_FORWARD_RATE_DEFAULT      500
+#define STORE_FORWARD_BURST_DEFAULT     100
+
+#define STORE_FORWARD_PATH_MAX          256
+
+typedef struct _store_forward_config {
+    const char     *dir;
+    uint32_t        segment_size;       /* bytes per segment file */
+    uint32_t        max_segments;       /* disk budget, oldest segment is evicted beyond it */
+    uint32_t        replay_rate;
+    uint32_t        replay_burst;
+} store_forward_config_t;
+
+/* position of a record: segment id and record index inside it */
+typedef struct _store_forward_cursor {
+    uint32_t        segment;
+    uint32_t        index;
+} store_forward_cursor_t;
+
+typedef struct _store_forward_segment {
+    uint32_t        id;
+    uint8_t        *base;               /* mapping of the whole segment, NULL if unmapped */
+} store_forward_segment_t;
+
+typedef struct _store_forward_stats {
+    uint64_t        appended;
+    uint64_t        replayed;           /* committed after a successful post */
+    uint64_t        evicted;            /* dropped unsent because the disk budget was hit */
+    uint64_t        discarded;          /* segments of another layout deleted on open */
+    uint64_t        rewinds;            /* replayed batches that failed and will be sent again */
+    uint64_t        append_failures;
+} store_forward_stats_t;
+
+typedef struct _store_forward {
+    store_forward_config_t config;
+    char            dir[STORE_FORWARD_PATH_MAX];
+    uint32_t        capacity;           /* records per segment */
+
+    uint32_t        first_segment;      /* oldest segment on disk */
+    store_forward_segment_t write_seg;
+    store_forward_segment_t read_seg;
+    store_forward_cursor_t  write;      /* next record to append */
+    store_forward_cursor_t  read;       /* next record to replay, may run ahead of the checkpoint */
+    store_forward_cursor_t *checkpoint; /* next record not yet acknowledged, mapped from disk */
+    int             checkpoint_fd;
+
+    double          tokens;
+    uint64_t        refill_ms;
+
+    store_forward_stats_t stats;
+} store_forward_t;
+
+int  store_forward_open(store_forward_t *sf, const store_forward_config_t *config);
+void store_forward_close(store_forward_t *sf);
+
+int  store_forward_append(store_forward_t *sf, const app_reading_t *reading);
+
+/* readings stored and not yet acknowledged */
+int  store_forward_pending(store_forward_t *sf);
+
+/* read up to max readings in order, limited by the replay rate */
+int  store_forward_read(store_forward_t *sf, app_reading_t *readings, int max, uint64_t now_ms);
+
+/* acknowledge the oldest count readings handed out by store_forward_read */
+void store_forward_commit(store_forward_t *sf, int count);
+
+/* hand out everything after the checkpoint again, after a failed post */
+void store_forward_rewind(store_forward_t *sf);
+
+/* schedule dirty pages for writeback */
+void store_forward_sync(store_forward_t *sf);
+
+#endif /* _STORE_FORWARD_H_ */
@@ -0,0 +1,141 @@
+/*
+ * Micro benchmark: sub-device registry against a simulated cloud.
+ * Every login is answered after BENCH_RTT_MS of simulated time. Reports how
+ * long the nodes of a freshly started gateway take to come online through
+ * the pipelined logins, checks that idle nodes are logged out and busy ones
+ * are not, and measures the lookup on the reading path. Builds without the
+ * sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "subdev_registry.h"
+
+#define BENCH_NODES             500
+#define BENCH_LINKS             2
+#define BENCH_RTT_MS            150
+#define BENCH_LOOP_MS           200     /* one pass of the cloud loop, the yield timeout */
+#define BENCH_LOOKUPS           10000000
+
+static subdev_registry_t bench_reg;
+static int bench_devids;
+static uint64_t bench_due[BENCH_NODES];    /* answer time of each devid's login, 0 if none pending */
+static uint64_t bench_logouts;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t bench_clock;
+
+static int bench_open(void *ctx, uint8_t link, uint16_t node_id)
+{
+    return (bench_devids < BENCH_NODES) ? bench_devids++ : -1;
+}
+
+static int bench_login(void *ctx, int devid)
+{
+    bench_due[devid] = bench_clock + BENCH_RTT_MS;
+    return 0;
+}
+
+static void bench_logout(void *ctx, int devid)
+{
+    bench_logouts++;
+}
+
+static void bench_close(void *ctx, int devid)
+{
+}
+
+static const subdev_ops_t bench_ops = {
+    bench_open, bench_login, bench_logout, bench_close
+};
+
+/* one loop pass: answers arrive during the yield, then the registry is polled */
+static void bench_step(void)
+{
+    int d;
+
+    bench_clock += BENCH_LOOP_MS;
+    for (d = 0; d < bench_devids; d++) {
+        if (bench_due[d] != 0 && bench_due[d] <= bench_clock) {
+            bench_due[d] = 0;
+            subdev_registry_online(&bench_reg, d, bench_clock);
+        }
+    }
+    subdev_registry_poll(&bench_reg, bench_clock);
+}
+
+/* every node sends a frame now and then, like a node on its report interval */
+static void bench_frames(int first, int last)
+{
+    int i;
+
+    for (i = first; i < last; i++) {
+        subdev_registry_lookup(&bench_reg, i % BENCH_LINKS, i / BENCH_LINKS + 1, bench_clock);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t start, online_ms, logouts, sum = 0;
+    double t;
+    int i, ok, all;
+
+    subdev_registry_init(&bench_reg, &bench_ops, NULL);
+    bench_clock = 1000;
+
+    /* a gateway starting up hears from every node within its first report interval */
+    start = bench_clock;
+    bench_frames(0, BENCH_NODES);
+    while (bench_reg.online < BENCH_NODES && bench_clock - start < 600000) {
+        bench_step();
+    }
+    online_ms = bench_clock - start;
+    all = bench_reg.online == BENCH_NODES && bench_reg.stats.failures == 0;
+    printf("login    %d nodes online in %.1f s, one at a time %.1f s, slowest answer %llu ms  %s\n",
+           BENCH_NODES, online_ms / 1000.0, (double)BENCH_NODES * BENCH_RTT_MS / 1000,
+           (unsigned long long)bench_reg.stats.login_ms_max, all ? "ok" : "MISMATCH");
+
+    /* half of the nodes keep reporting, the other half goes quiet */
+    start = bench_clock;
+    while (bench_clock - start < SUBDEV_REGISTRY_IDLE_MS + 60000) {
+        if ((bench_clock - start) % 60000 == 0) {
+            bench_frames(0, BENCH_NODES / 2);
+        }
+        bench_step();
+    }
+    logouts = bench_logouts;
+    ok = (logouts == BENCH_NODES - BENCH_NODES / 2 && bench_reg.online == BENCH_NODES / 2);
+
+    /* a quiet node that talks again only logs in again, its devid is kept */
+    start = bench_clock;
+    bench_frames(BENCH_NODES / 2, BENCH_NODES);
+    while (bench_reg.online < BENCH_NODES && bench_clock - start < 600000) {
+        bench_step();
+    }
+    ok = ok && bench_reg.online == BENCH_NODES && bench_reg.stats.opened == BENCH_NODES;
+    printf("idle     %llu quiet nodes logged out, back online in %.1f s without reopening  %s\n",
+           (unsigned long long)logouts, (bench_clock - start) / 1000.0, ok ? "ok" : "MISMATCH");
+    all = all && ok;
+
+    t = bench_now();
+    for (i = 0; i < BENCH_LOOKUPS; i++) {
+        int n = (int)(((uint32_t)i * 7919u) % BENCH_NODES);
+
+        sum += subdev_registry_lookup(&bench_reg, n % BENCH_LINKS, n / BENCH_LINKS + 1, bench_clock);
+    }
+    t = bench_now() - t;
+    printf("lookup   %6.1f ns/reading  %s\n", t * 1e9 / BENCH_LOOKUPS, (sum > 0) ? "ok" : "MISMATCH");
+    all = all && sum > 0;
+
+    subdev_registry_close(&bench_reg);
+    return all ? 0 : 1;
+}
@@ -0,0 +1,236 @@
+/*
+ * Registry of the Linkkit sub-devices standing for zigbee nodes
+ */
+#include <string.h>
+
+#include "subdev_registry.h"
+#include "node_hash.h"
+
+void subdev_registry_init(subdev_registry_t *reg, const subdev_ops_t *ops, void *ctx)
+{
+    memset(reg, 0, sizeof(subdev_registry_t));
+    memset(reg->index, 0xff, sizeof(reg->index));
+    reg->ops = *ops;
+    reg->ctx = ctx;
+}
+
+void subdev_registry_close(subdev_registry_t *reg)
+{
+    int i;
+
+    for (i = 0; i < reg->count; i++) {
+        subdev_entry_t *e = &reg->entries[i];
+
+        if (e->state == SUBDEV_ONLINE) {
+            reg->ops.logout(reg->ctx, e->devid);
+        }
+        if (e->devid >= 0) {
+            reg->ops.close(reg->ctx, e->devid);
+        }
+        e->state = SUBDEV_OFFLINE;
+        e->devid = -1;
+    }
+    reg->queue_len = 0;
+    reg->inflight_len = 0;
+    reg->online = 0;
+}
+
+static void subdev_registry_enqueue(subdev_registry_t *reg, int i)
+{
+    reg->entries[i].state = SUBDEV_QUEUED;
+    reg->queue[(reg->queue_head + reg->queue_len) % SUBDEV_REGISTRY_NODES] = i;
+    reg->queue_len++;
+}
+
+static int subdev_registry_match(const subdev_registry_t *reg, uint32_t pos, uint8_t link, uint16_t node_id)
+{
+    int i = reg->index[pos];
+
+    return i < 0 || (reg->entries[i].node_id == node_id && reg->entries[i].link == link);
+}
+
+/* returns the index slot of the node, either holding it or empty */
+static int subdev_registry_slot(const subdev_registry_t *reg, uint8_t link, uint16_t node_id)
+{
+    return NODE_HASH_PROBE(SUBDEV_REGISTRY_INDEX_SIZE, link, node_id, pos,
+                           subdev_registry_match(reg, pos, link, node_id));
+}
+
+int subdev_registry_lookup(subdev_registry_t *reg, uint8_t link, uint16_t node_id, uint64_t now_ms)
+{
+    int pos = subdev_registry_slot(reg, link, node_id);
+    subdev_entry_t *e;
+    int i = reg->index[pos];
+
+    if (i < 0) {
+        if (reg->count == SUBDEV_REGISTRY_NODES) {
+            reg->stats.untracked++;
+            return -1;
+        }
+        i = reg->count++;
+        e = &reg->entries[i];
+        e->node_id = node_id;
+        e->link = link;
+        e->devid = -1;
+        e->seen_ms = now_ms;
+        reg->index[pos] = i;
+        subdev_registry_enqueue(reg, i);
+        return -1;
+    }
+
+    e = &reg->entries[i];
+    e->seen_ms = now_ms;
+    if (e->state == SUBDEV_ONLINE) {
+        return e->devid;
+    }
+    /* logged out for idleness, or failed and due for another try */
+    if (e->state == SUBDEV_OFFLINE && now_ms >= e->since_ms) {
+        subdev_registry_enqueue(reg, i);
+    }
+
+    return -1;
+}
+
+int subdev_registry_pending(const subdev_registry_t *reg, uint8_t link, uint16_t node_id)
+{
+    int i = reg->index[subdev_registry_slot(reg, link, node_id)];
+
+    return i >= 0 && (reg->entries[i].state == SUBDEV_QUEUED || reg->entries[i].state == SUBDEV_LOGIN);
+}
+
+const subdev_entry_t *subdev_registry_find(const subdev_registry_t *reg, int devid)
+{
+    int i;
+
+    for (i = 0; i < reg->count; i++) {
+        if (reg->entries[i].devid == devid && devid >= 0) {
+            return &reg->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void subdev_registry_fail(subdev_registry_t *reg, subdev_entry_t *e, uint64_t now_ms)
+{
+    e->state = SUBDEV_OFFLINE;
+    e->since_ms = now_ms + SUBDEV_REGISTRY_RETRY_MS;
+    reg->stats.failures++;
+}
+
+/* inflight is unordered, the last one takes the free place */
+static void subdev_registry_land(subdev_registry_t *reg, int k)
+{
+    reg->inflight[k] = reg->inflight[--reg->inflight_len];
+}
+
+int subdev_registry_online(subdev_registry_t *reg, int devid, uint64_t now_ms)
+{
+    int k;
+
+    for (k = 0; k < reg->inflight_len; k++) {
+        subdev_entry_t *e = &reg->entries[reg->inflight[k]];
+
+        if (e->devid != devid) {
+            continue;
+        }
+        subdev_registry_land(reg, k);
+        e->state = SUBDEV_ONLINE;
+        reg->online++;
+        reg->stats.online++;
+        if (now_ms - e->since_ms > reg->stats.login_ms_max) {
+            reg->stats.login_ms_max = now_ms - e->since_ms;
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+/* open the device if it has none yet and send its login */
+static void subdev_registry_login(subdev_registry_t *reg, int i, uint64_t now_ms)
+{
+    subdev_entry_t *e = &reg->entries[i];
+    int k;
+
+    if (e->devid < 0) {
+        e->devid = reg->ops.open(reg->ctx, e->link, e->node_id);
+        if (e->devid < 0) {
+            subdev_registry_fail(reg, e, now_ms);
+            return;
+        }
+        reg->stats.opened++;
+    }
+
+    /* in flight before the call, the answer may come in while it is being made */
+    e->state = SUBDEV_LOGIN;
+    e->since_ms = now_ms;
+    reg->inflight[reg->inflight_len++] = i;
+    reg->stats.logins++;
+    if (reg->ops.login(reg->ctx, e->devid) == 0 || e->state != SUBDEV_LOGIN) {
+        return;
+    }
+
+    for (k = 0; k < reg->inflight_len; k++) {
+        if (reg->inflight[k] == i) {
+            subdev_registry_land(reg, k);
+            break;
+        }
+    }
+    subdev_registry_fail(reg, e, now_ms);
+}
+
+void subdev_registry_poll(subdev_registry_t *reg, uint64_t now_ms)
+{
+    int k, started = 0, logouts = 0;
+
+    for (k = reg->inflight_len - 1; k >= 0; k--) {
+        subdev_entry_t *e = &reg->entries[reg->inflight[k]];
+
+        if (now_ms - e->since_ms >= SUBDEV_REGISTRY_LOGIN_TIMEOUT_MS) {
+            subdev_registry_land(reg, k);
+            subdev_registry_fail(reg, e, now_ms);
+        }
+    }
+
+    while (reg->queue_len > 0 && reg->inflight_len < SUBDEV_REGISTRY_INFLIGHT && started < SUBDEV_REGISTRY_BATCH) {
+        int i = reg->queue[reg->queue_head];
+
+        reg->queue_head = (reg->queue_head + 1) % SUBDEV_REGISTRY_NODES;
+        reg->queue_len--;
+        subdev_registry_login(reg, i, now_ms);
+        started++;
+    }
+
+    /* a slice of the table per poll, idle devices are found within a few seconds either way */
+    for (k = 0; k < SUBDEV_REGISTRY_SCAN && k < reg->count && logouts < SUBDEV_REGISTRY_BATCH; k++) {
+        subdev_entry_t *e;
+
+        reg->scan = (reg->scan + 1 < reg->count) ? reg->scan + 1 : 0;
+        e = &reg->entries[reg->scan];
+        if (e->state == SUBDEV_ONLINE && now_ms - e->seen_ms >= SUBDEV_REGISTRY_IDLE_MS) {
+            reg->ops.logout(reg->ctx, e->devid);
+            e->state = SUBDEV_OFFLINE;
+            e->since_ms = now_ms;
+            reg->online--;
+            reg->stats.logouts++;
+            logouts++;
+        }
+    }
+}
+
+void subdev_registry_reset(subdev_registry_t *reg)
+{
+    int i;
+
+    for (i = 0; i < reg->count; i++) {
+        subdev_entry_t *e = &reg->entries[i];
+
+        if (e->state == SUBDEV_ONLINE || e->state == SUBDEV_LOGIN) {
+            e->state = SUBDEV_OFFLINE;
+            e->since_ms = 0;
+        }
+    }
+    reg->inflight_len = 0;
+    reg->online = 0;
+}
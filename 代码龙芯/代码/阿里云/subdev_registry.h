@@ -0,0 +1,129 @@
+/*
+ * Registry of the Linkkit sub-devices standing for zigbee nodes.
+ *
+ * A node gets its sub-device the first time one of its frames comes in: the
+ * lookup only queues it, the device is opened and logged in from the poll.
+ * Logins are pipelined, up to SUBDEV_REGISTRY_INFLIGHT of them wait for
+ * their answer at once and every poll starts at most SUBDEV_REGISTRY_BATCH
+ * more, so a few hundred nodes come online within seconds of the gateway
+ * starting without any single poll stalling the cloud loop. A login is done
+ * when the sdk reports the device initialized; one that doesn't answer within
+ * SUBDEV_REGISTRY_LOGIN_TIMEOUT_MS is retried later.
+ *
+ * A node that has sent nothing for SUBDEV_REGISTRY_IDLE_MS is logged out and
+ * keeps its devid, its next frame only logs it in again. Readings of a node
+ * whose device isn't online yet are the caller's to route elsewhere.
+ *
+ * The registry makes no sdk calls itself, they go through subdev_ops_t. It
+ * belongs to the cloud thread.
+ */
+#ifndef _SUBDEV_REGISTRY_H_
+#define _SUBDEV_REGISTRY_H_
+
+#include <stdint.h>
+
+/* nodes with a sub-device, later nodes are counted and stay with their link */
+#ifndef SUBDEV_REGISTRY_NODES
+#define SUBDEV_REGISTRY_NODES           1024
+#endif
+
+/* open addressed (link, node id) index, power of two and at least twice the nodes */
+#define SUBDEV_REGISTRY_INDEX_SIZE      2048
+
+/* logins waiting for their answer at once */
+#ifndef SUBDEV_REGISTRY_INFLIGHT
+#define SUBDEV_REGISTRY_INFLIGHT        32
+#endif
+
+/* logins started and idle devices logged out per poll */
+#ifndef SUBDEV_REGISTRY_BATCH
+#define SUBDEV_REGISTRY_BATCH           16
+#endif
+
+/* nodes looked at for idleness per poll */
+#define SUBDEV_REGISTRY_SCAN            64
+
+#define SUBDEV_REGISTRY_LOGIN_TIMEOUT_MS    10000
+#define SUBDEV_REGISTRY_RETRY_MS            30000
+
+/* a few missed heartbeats of a node at the longest interval */
+#ifndef SUBDEV_REGISTRY_IDLE_MS
+#define SUBDEV_REGISTRY_IDLE_MS         (30 * 60 * 1000)
+#endif
+
+typedef enum {
+    SUBDEV_QUEUED,                      /* seen, waiting for a login slot */
+    SUBDEV_LOGIN,                       /* login sent, waiting for the answer */
+    SUBDEV_ONLINE,
+    SUBDEV_OFFLINE,                     /* logged out or failed, devid kept if it was opened */
+} subdev_state_t;
+
+/* the sdk calls, all made from the poll. open returns the devid or -1,
+ * login returns 0 once the login is sent; its answer comes in through subdev_registry_online */
+typedef struct _subdev_ops {
+    int  (*open)(void *ctx, uint8_t link, uint16_t node_id);
+    int  (*login)(void *ctx, int devid);
+    void (*logout)(void *ctx, int devid);
+    void (*close)(void *ctx, int devid);
+} subdev_ops_t;
+
+typedef struct _subdev_entry {
+    uint16_t        node_id;
+    uint8_t         link;
+    uint8_t         state;              /* subdev_state_t */
+    int             devid;              /* -1 until opened */
+    uint64_t        seen_ms;            /* last frame of the node */
+    uint64_t        since_ms;           /* login sent, or when a failed one may be retried */
+} subdev_entry_t;
+
+typedef struct _subdev_registry_stats {
+    uint64_t        opened;
+    uint64_t        logins;             /* sent */
+    uint64_t        online;             /* answered */
+    uint64_t        failures;           /* open or login refused, or no answer in time */
+    uint64_t        logouts;            /* idle devices logged out */
+    uint64_t        untracked;          /* lookups of nodes beyond SUBDEV_REGISTRY_NODES */
+    uint64_t        login_ms_max;       /* slowest answer */
+} subdev_registry_stats_t;
+
+typedef struct _subdev_registry {
+    subdev_ops_t    ops;
+    void           *ctx;
+    subdev_entry_t  entries[SUBDEV_REGISTRY_NODES];
+    int16_t         index[SUBDEV_REGISTRY_INDEX_SIZE];
+    int             count;
+    int16_t         queue[SUBDEV_REGISTRY_NODES];   /* entries waiting for a login, in order */
+    int             queue_head;
+    int             queue_len;
+    int16_t         inflight[SUBDEV_REGISTRY_INFLIGHT];
+    int             inflight_len;
+    int             online;             /* entries online now */
+    int             scan;               /* next entry of the idle scan */
+    subdev_registry_stats_t stats;
+} subdev_registry_t;
+
+void subdev_registry_init(subdev_registry_t *reg, const subdev_ops_t *ops, void *ctx);
+
+/* log out and close every device */
+void subdev_registry_close(subdev_registry_t *reg);
+
+/* a frame of the node came in: its devid when online, else -1. Queues a login the first time
+ * and after the device went idle */
+int  subdev_registry_lookup(subdev_registry_t *reg, uint8_t link, uint16_t node_id, uint64_t now_ms);
+
+/* the node's login is queued or waiting for its answer */
+int  subdev_registry_pending(const subdev_registry_t *reg, uint8_t link, uint16_t node_id);
+
+/* the entry devid was opened for, NULL if it isn't a node's */
+const subdev_entry_t *subdev_registry_find(const subdev_registry_t *reg, int devid);
+
+/* the sdk reported devid initialized, 0 if it was one of ours */
+int  subdev_registry_online(subdev_registry_t *reg, int devid, uint64_t now_ms);
+
+/* start queued logins, time out unanswered ones and log out idle devices. Call from the loop */
+void subdev_registry_poll(subdev_registry_t *reg, uint64_t now_ms);
+
+/* the connection is gone and took every login with it, devices log in again on their next frame */
+void subdev_registry_reset(subdev_registry_t *reg);
+
+#endif /* _SUBDEV_REGISTRY_H_ */
@@ -0,0 +1,141 @@
+/*
+ * Micro benchmark: a day of readings through the time series store.
+ * Reports host cost of adding a reading and of closing periods, and the
+ * payload bytes a day of raw, 1 minute and 15 minute reporting takes.
+ * Builds without the sdk: make bench
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ts_store.h"
+
+#define BENCH_NODES             200
+#define BENCH_INTERVAL_S        5
+#define BENCH_SECONDS           (24 * 3600)
+#define BENCH_START_S           1760000400u     /* on a quarter hour */
+
+static ts_store_t bench_store;
+static uint64_t bench_bytes[TS_LEVEL_MAX];
+static uint64_t bench_items[TS_LEVEL_MAX];
+static uint32_t bench_cursor[TS_LEVEL_MAX];
+static int bench_bad;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the item a raw reading is posted as, see report_batch.c */
+static int bench_raw_bytes(const app_reading_t *reading)
+{
+    prop_writer_t w;
+
+    prop_writer_init(&w, NULL, 0);
+    prop_begin_object(&w);
+    prop_put_NODE_ID(&w, reading->node_id);
+    prop_put_TEMPERATURE(&w, reading->temperature);
+    prop_put_HUMIDITY(&w, reading->humidity);
+    prop_put_TIME(&w, reading->timestamp_ms);
+    prop_end_object(&w);
+    return w.len + 1;
+}
+
+/* measure every bucket that closed since the last call, as the gateway would post it */
+static void bench_collect(ts_level_t level)
+{
+    uint32_t period = ts_level_period[level];
+    uint32_t closed = bench_store.closed[level];
+    uint32_t start;
+    ts_agg_t agg;
+    int i;
+
+    if (bench_cursor[level] == 0) {
+        bench_cursor[level] = closed;
+        return;
+    }
+
+    for (start = bench_cursor[level]; start < closed; start += period) {
+        for (i = 0; i < bench_store.count; i++) {
+            prop_writer_t w;
+
+            if (ts_store_bucket(&bench_store, i, level, start, &agg) < 0 ||
+                agg.count != period / BENCH_INTERVAL_S) {
+                bench_bad++;
+                continue;
+            }
+            prop_writer_init(&w, NULL, 0);
+            ts_store_put_agg(&w, &bench_store.series[i], level, &agg);
+            bench_bytes[level] += w.len + 1;
+            bench_items[level]++;
+        }
+    }
+    bench_cursor[level] = closed;
+}
+
+int main(int argc, char **argv)
+{
+    static int16_t temperature[BENCH_NODES], humidity[BENCH_NODES];
+    double add_time = 0, poll_time = 0, start;
+    uint64_t raw_bytes = 0, readings = 0;
+    uint32_t t;
+    int node;
+
+    if (ts_store_init(&bench_store) < 0) {
+        return 1;
+    }
+
+    srand(1);
+    for (node = 0; node < BENCH_NODES; node++) {
+        temperature[node] = 180 + rand() % 100;
+        humidity[node] = (40 + rand() % 30) * 10;
+    }
+
+    for (t = BENCH_START_S; t < BENCH_START_S + BENCH_SECONDS; t += BENCH_INTERVAL_S) {
+        app_reading_t batch[BENCH_NODES];
+
+        for (node = 0; node < BENCH_NODES; node++) {
+            temperature[node] += rand() % 3 - 1;
+            humidity[node] += (rand() % 3 - 1) * 10;
+            batch[node].node_id = node + 1;
+            batch[node].temperature = temperature[node];
+            batch[node].humidity = humidity[node];
+            batch[node].link = 0;
+            batch[node].timestamp_ms = (uint64_t)t * 1000;
+            raw_bytes += bench_raw_bytes(&batch[node]);
+        }
+
+        start = bench_now();
+        for (node = 0; node < BENCH_NODES; node++) {
+            ts_store_add(&bench_store, &batch[node]);
+        }
+        add_time += bench_now() - start;
+        readings += BENCH_NODES;
+
+        /* the gateway polls every second, nothing closes in between */
+        start = bench_now();
+        ts_store_poll(&bench_store, (uint64_t)(t + BENCH_INTERVAL_S) * 1000 + TS_STORE_GRACE_MS);
+        poll_time += bench_now() - start;
+
+        bench_collect(TS_LEVEL_1MIN);
+        bench_collect(TS_LEVEL_15MIN);
+    }
+
+    printf("add      %6.1f ns/reading\n", add_time * 1e9 / readings);
+    printf("fold     %6.1f us/quarter for %d nodes\n", poll_time * 1e6 / bench_store.stats.folds, BENCH_NODES);
+    printf("raw      %10llu bytes/day  %8llu items\n", (unsigned long long)raw_bytes,
+           (unsigned long long)readings);
+    printf("1min     %10llu bytes/day  %8llu items  %5.1fx smaller\n",
+           (unsigned long long)bench_bytes[TS_LEVEL_1MIN], (unsigned long long)bench_items[TS_LEVEL_1MIN],
+           (double)raw_bytes / bench_bytes[TS_LEVEL_1MIN]);
+    printf("15min    %10llu bytes/day  %8llu items  %5.1fx smaller  %s\n",
+           (unsigned long long)bench_bytes[TS_LEVEL_15MIN], (unsigned long long)bench_items[TS_LEVEL_15MIN],
+           (double)raw_bytes / bench_bytes[TS_LEVEL_15MIN], bench_bad ? "MISMATCH" : "ok");
+
+    ts_store_deinit(&bench_store);
+    return bench_bad ? 1 : 0;
+}
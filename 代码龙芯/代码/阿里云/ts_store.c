@@ -0,0 +1,253 @@
+/*
+ * In-memory time series of node readings
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "ts_store.h"
+#include "node_hash.h"
+
+const uint32_t ts_level_period[TS_LEVEL_MAX] = { 60, 900 };
+
+static int ts_store_match(const ts_store_t *store, uint32_t pos, uint8_t link, uint16_t node_id)
+{
+    int i = store->index[pos];
+
+    return i < 0 || (store->series[i].node_id == node_id && store->series[i].link == link);
+}
+
+/* index slot of the node, either holding it or empty */
+static int ts_store_lookup(const ts_store_t *store, uint8_t link, uint16_t node_id)
+{
+    return NODE_HASH_PROBE(TS_STORE_INDEX_SIZE, link, node_id, pos, ts_store_match(store, pos, link, node_id));
+}
+
+int ts_store_init(ts_store_t *store)
+{
+    memset(store, 0, sizeof(ts_store_t));
+    memset(store->index, 0xff, sizeof(store->index));
+
+    store->series = calloc(TS_STORE_NODES, sizeof(ts_series_t));
+    return (store->series == NULL) ? -1 : 0;
+}
+
+void ts_store_deinit(ts_store_t *store)
+{
+    free(store->series);
+    store->series = NULL;
+    store->count = 0;
+}
+
+int ts_store_find(const ts_store_t *store, uint8_t link, uint16_t node_id)
+{
+    return store->index[ts_store_lookup(store, link, node_id)];
+}
+
+static int16_t ts_avg(int32_t sum, uint32_t count)
+{
+    return (int16_t)((sum >= 0 ? sum + (int32_t)(count / 2) : sum - (int32_t)(count / 2)) / (int32_t)count);
+}
+
+static void ts_rollup_put(ts_rollup_t *r, int slot, int16_t t, int16_t h)
+{
+    if (t < r->t_min[slot]) {
+        r->t_min[slot] = t;
+    }
+    if (t > r->t_max[slot]) {
+        r->t_max[slot] = t;
+    }
+    if (h < r->h_min[slot]) {
+        r->h_min[slot] = h;
+    }
+    if (h > r->h_max[slot]) {
+        r->h_max[slot] = h;
+    }
+    r->t_sum[slot] += t;
+    r->h_sum[slot] += h;
+    r->count[slot]++;
+}
+
+void ts_store_add(ts_store_t *store, const app_reading_t *reading)
+{
+    uint32_t sec = (uint32_t)(reading->timestamp_ms / 1000);
+    uint32_t start = sec - sec % ts_level_period[TS_LEVEL_1MIN];
+    int pos = ts_store_lookup(store, reading->link, reading->node_id);
+    int i = store->index[pos];
+    ts_series_t *s;
+    ts_rollup_t *r;
+    int slot;
+
+    if (i < 0) {
+        /* keep the index at most half full so probes stay short */
+        if (store->count >= TS_STORE_NODES) {
+            store->stats.untracked++;
+            return;
+        }
+        i = store->count++;
+        store->index[pos] = i;
+        store->series[i].node_id = reading->node_id;
+        store->series[i].link = reading->link;
+    }
+    s = &store->series[i];
+
+    slot = s->raw_next++ & (TS_STORE_RAW_SLOTS - 1);
+    s->raw_time[slot] = reading->timestamp_ms;
+    s->raw_t[slot] = reading->temperature;
+    s->raw_h[slot] = reading->humidity;
+    store->stats.added++;
+
+    r = &s->level[TS_LEVEL_1MIN];
+    slot = (start / ts_level_period[TS_LEVEL_1MIN]) & (TS_STORE_ROLLUP_SLOTS - 1);
+    if (r->count[slot] != 0 && r->start[slot] > start) {
+        /* the slot has moved on to a newer minute */
+        store->stats.expired++;
+        return;
+    }
+    if (start < store->closed[TS_LEVEL_1MIN]) {
+        store->stats.late++;
+    }
+
+    if (r->count[slot] == 0 || r->start[slot] != start) {
+        r->start[slot] = start;
+        r->count[slot] = 0;
+        r->t_min[slot] = r->t_max[slot] = reading->temperature;
+        r->h_min[slot] = r->h_max[slot] = reading->humidity;
+        r->t_sum[slot] = r->h_sum[slot] = 0;
+    }
+    ts_rollup_put(r, slot, reading->temperature, reading->humidity);
+}
+
+/* fold the buckets of src starting in [from, to) into dst's bucket at start.
+ * Every slot is visited and selected arithmetically, no branch per slot */
+static void ts_fold(const ts_rollup_t *src, uint32_t from, uint32_t to, ts_rollup_t *dst, uint32_t start,
+                    uint32_t period)
+{
+    int32_t t_min = INT16_MAX, t_max = INT16_MIN, h_min = INT16_MAX, h_max = INT16_MIN;
+    int32_t t_sum = 0, h_sum = 0;
+    uint32_t count = 0;
+    int i, slot;
+
+    for (i = 0; i < TS_STORE_ROLLUP_SLOTS; i++) {
+        int in = (src->start[i] - from < to - from) & (src->count[i] != 0);
+
+        t_min = (in && src->t_min[i] < t_min) ? src->t_min[i] : t_min;
+        t_max = (in && src->t_max[i] > t_max) ? src->t_max[i] : t_max;
+        h_min = (in && src->h_min[i] < h_min) ? src->h_min[i] : h_min;
+        h_max = (in && src->h_max[i] > h_max) ? src->h_max[i] : h_max;
+        t_sum += in ? src->t_sum[i] : 0;
+        h_sum += in ? src->h_sum[i] : 0;
+        count += in ? src->count[i] : 0;
+    }
+
+    slot = (start / period) & (TS_STORE_ROLLUP_SLOTS - 1);
+    dst->start[slot] = start;
+    dst->count[slot] = count;
+    dst->t_min[slot] = t_min;
+    dst->t_max[slot] = t_max;
+    dst->t_sum[slot] = t_sum;
+    dst->h_min[slot] = h_min;
+    dst->h_max[slot] = h_max;
+    dst->h_sum[slot] = h_sum;
+}
+
+void ts_store_poll(ts_store_t *store, uint64_t now_ms)
+{
+    uint32_t now = (now_ms > TS_STORE_GRACE_MS) ? (uint32_t)((now_ms - TS_STORE_GRACE_MS) / 1000) : 0;
+    uint32_t minute = ts_level_period[TS_LEVEL_1MIN];
+    uint32_t quarter = ts_level_period[TS_LEVEL_15MIN];
+    uint32_t closed, start;
+    int i;
+
+    store->closed[TS_LEVEL_1MIN] = now - now % minute;
+
+    /* a quarter can only be folded while all of its minutes are still in the ring */
+    closed = now - now % quarter;
+    start = store->closed[TS_LEVEL_15MIN];
+    if (start == 0 || closed - start > (TS_STORE_ROLLUP_SLOTS * minute) / quarter * quarter) {
+        start = closed;
+    }
+    for (; start < closed; start += quarter) {
+        for (i = 0; i < store->count; i++) {
+            ts_series_t *s = &store->series[i];
+
+            ts_fold(&s->level[TS_LEVEL_1MIN], start, start + quarter, &s->level[TS_LEVEL_15MIN], start, quarter);
+        }
+        store->stats.folds++;
+    }
+    store->closed[TS_LEVEL_15MIN] = closed;
+}
+
+int ts_store_bucket(const ts_store_t *store, int series, ts_level_t level, uint32_t start, ts_agg_t *agg)
+{
+    const ts_rollup_t *r = &store->series[series].level[level];
+    int slot = (start / ts_level_period[level]) & (TS_STORE_ROLLUP_SLOTS - 1);
+
+    if (r->count[slot] == 0 || r->start[slot] != start) {
+        return -1;
+    }
+
+    agg->start = start;
+    agg->count = r->count[slot];
+    agg->t_min = r->t_min[slot];
+    agg->t_max = r->t_max[slot];
+    agg->t_avg = ts_avg(r->t_sum[slot], r->count[slot]);
+    agg->h_min = r->h_min[slot];
+    agg->h_max = r->h_max[slot];
+    agg->h_avg = ts_avg(r->h_sum[slot], r->count[slot]);
+    return 0;
+}
+
+int ts_store_raw(const ts_store_t *store, int series, uint64_t from_ms, ts_agg_t *agg)
+{
+    const ts_series_t *s = &store->series[series];
+    int32_t t_min = INT16_MAX, t_max = INT16_MIN, h_min = INT16_MAX, h_max = INT16_MIN;
+    int32_t t_sum = 0, h_sum = 0;
+    uint32_t count = 0;
+    int i;
+
+    /* empty slots have time 0, which no window starts at */
+    for (i = 0; i < TS_STORE_RAW_SLOTS; i++) {
+        int in = s->raw_time[i] >= from_ms && s->raw_time[i] != 0;
+
+        t_min = (in && s->raw_t[i] < t_min) ? s->raw_t[i] : t_min;
+        t_max = (in && s->raw_t[i] > t_max) ? s->raw_t[i] : t_max;
+        h_min = (in && s->raw_h[i] < h_min) ? s->raw_h[i] : h_min;
+        h_max = (in && s->raw_h[i] > h_max) ? s->raw_h[i] : h_max;
+        t_sum += in ? s->raw_t[i] : 0;
+        h_sum += in ? s->raw_h[i] : 0;
+        count += in;
+    }
+
+    if (count == 0) {
+        return -1;
+    }
+
+    agg->start = (uint32_t)(from_ms / 1000);
+    agg->count = count;
+    agg->t_min = t_min;
+    agg->t_max = t_max;
+    agg->t_avg = ts_avg(t_sum, count);
+    agg->h_min = h_min;
+    agg->h_max = h_max;
+    agg->h_avg = ts_avg(h_sum, count);
+    return 0;
+}
+
+void ts_store_put_agg(prop_writer_t *w, const ts_series_t *series, ts_level_t level, const ts_agg_t *agg)
+{
+    prop_begin_object(w);
+    prop_put_NODE_ID(w, series->node_id);
+    if (series->link != 0) {
+        prop_put_LINK(w, series->link);
+    }
+    prop_put_TIME(w, (uint64_t)agg->start * 1000);
+    prop_put_PERIOD(w, ts_level_period[level]);
+    prop_put_TEMPERATURE(w, agg->t_avg);
+    prop_put_HUMIDITY(w, agg->h_avg);
+    prop_put_TEMP_MIN(w, agg->t_min);
+    prop_put_TEMP_MAX(w, agg->t_max);
+    prop_put_HUMI_MIN(w, agg->h_min);
+    prop_put_HUMI_MAX(w, agg->h_max);
+    prop_put_COUNT(w, agg->count);
+    prop_end_object(w);
+}
@@ -0,0 +1,124 @@
+/*
+ * In-memory time series of node readings, for downsampled reporting.
+ *
+ * Each node has a series: its last TS_STORE_RAW_SLOTS raw readings and two
+ * rollup levels of 1 minute and 15 minute buckets, each holding min, max, sum
+ * and count of both metrics. Buckets are aligned to wall clock periods and sit
+ * in direct mapped rings indexed by bucket number, so a level always holds the
+ * last TS_STORE_ROLLUP_SLOTS periods and nothing has to be expired.
+ *
+ * Storage is columnar, one array per field. The 1 minute level is updated as
+ * readings arrive; the 15 minute level is folded from it once a quarter hour
+ * has closed. Folds run over whole columns without branches so the compiler
+ * can vectorize them.
+ *
+ * The store belongs to the cloud thread.
+ */
+#ifndef _TS_STORE_H_
+#define _TS_STORE_H_
+
+#include <stdint.h>
+
+#include "app_reading.h"
+#include "prop_encoder.h"
+
+/* nodes with a series, later nodes are counted and not stored */
+#ifndef TS_STORE_NODES
+#define TS_STORE_NODES              256
+#endif
+
+/* open addressed node id index, power of two and at least twice the nodes */
+#define TS_STORE_INDEX_SIZE         512
+
+/* raw readings kept per node, power of two */
+#define TS_STORE_RAW_SLOTS          64
+
+/* buckets kept per level, power of two: a bit over an hour of minutes, 16 hours of quarters */
+#define TS_STORE_ROLLUP_SLOTS       64
+
+/* a period counts as closed this long after it ended. Covers readings that
+ * sleepy end devices hold back for up to SAMPLE_APP_BATCH_HOLD (300 s) */
+#ifndef TS_STORE_GRACE_MS
+#define TS_STORE_GRACE_MS           330000
+#endif
+
+typedef enum {
+    TS_LEVEL_1MIN,
+    TS_LEVEL_15MIN,
+    TS_LEVEL_MAX
+} ts_level_t;
+
+/* bucket length of each level in seconds */
+extern const uint32_t ts_level_period[TS_LEVEL_MAX];
+
+/* one node's readings over a bucket or a raw window, in tenths */
+typedef struct _ts_agg {
+    uint32_t        start;              /* seconds since the epoch */
+    uint32_t        count;
+    int16_t         t_min;
+    int16_t         t_max;
+    int16_t         t_avg;
+    int16_t         h_min;
+    int16_t         h_max;
+    int16_t         h_avg;
+} ts_agg_t;
+
+typedef struct _ts_rollup {
+    uint32_t        start[TS_STORE_ROLLUP_SLOTS];   /* bucket start in seconds */
+    uint32_t        count[TS_STORE_ROLLUP_SLOTS];   /* 0 for an empty slot */
+    int16_t         t_min[TS_STORE_ROLLUP_SLOTS];
+    int16_t         t_max[TS_STORE_ROLLUP_SLOTS];
+    int32_t         t_sum[TS_STORE_ROLLUP_SLOTS];
+    int16_t         h_min[TS_STORE_ROLLUP_SLOTS];
+    int16_t         h_max[TS_STORE_ROLLUP_SLOTS];
+    int32_t         h_sum[TS_STORE_ROLLUP_SLOTS];
+} ts_rollup_t;
+
+typedef struct _ts_series {
+    uint16_t        node_id;
+    uint8_t         link;
+    uint32_t        raw_next;                       /* counts up, slot is raw_next % TS_STORE_RAW_SLOTS */
+    uint64_t        raw_time[TS_STORE_RAW_SLOTS];   /* sample time in ms, 0 for an empty slot */
+    int16_t         raw_t[TS_STORE_RAW_SLOTS];
+    int16_t         raw_h[TS_STORE_RAW_SLOTS];
+    ts_rollup_t     level[TS_LEVEL_MAX];
+} ts_series_t;
+
+typedef struct _ts_store_stats {
+    uint64_t        added;
+    uint64_t        late;               /* arrived for a minute that was already closed */
+    uint64_t        expired;            /* older than the 1 minute ring, raw only */
+    uint64_t        untracked;          /* node table full */
+    uint64_t        folds;              /* 15 minute buckets folded */
+} ts_store_stats_t;
+
+typedef struct _ts_store {
+    ts_series_t    *series;             /* TS_STORE_NODES, count in use */
+    int             count;
+    int16_t         index[TS_STORE_INDEX_SIZE];
+    uint32_t        closed[TS_LEVEL_MAX];   /* every bucket starting before this is closed */
+    ts_store_stats_t stats;
+} ts_store_t;
+
+int  ts_store_init(ts_store_t *store);
+void ts_store_deinit(ts_store_t *store);
+
+void ts_store_add(ts_store_t *store, const app_reading_t *reading);
+
+/* close the periods that ended TS_STORE_GRACE_MS before now_ms and fold
+ * the quarter hours among them, call about once a second */
+void ts_store_poll(ts_store_t *store, uint64_t now_ms);
+
+/* series index of a node, -1 if it has none */
+int  ts_store_find(const ts_store_t *store, uint8_t link, uint16_t node_id);
+
+/* bucket of series starting at start (seconds), -1 if the node had no readings in it */
+int  ts_store_bucket(const ts_store_t *store, int series, ts_level_t level, uint32_t start, ts_agg_t *agg);
+
+/* raw readings of series sampled at or after from_ms, -1 if there are none */
+int  ts_store_raw(const ts_store_t *store, int series, uint64_t from_ms, ts_agg_t *agg);
+
+/* one Rollups item: node, bucket start, period, averages, min/max and count */
+void ts_store_put_agg(prop_writer_t *w, const ts_series_t *series, ts_level_t level, const ts_agg_t *agg);
+
+#endif /* _TS_STORE_H_ */